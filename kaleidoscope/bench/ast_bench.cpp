@@ -0,0 +1,261 @@
+// AST allocation: the original unique_ptr tree against ASTContext arena nodes.
+// Both trees are built with the same shape as the parsed corpus and then torn
+// down, so the comparison isolates allocation and destruction cost.
+#include "corpus.h"
+
+#include <frontend.h>
+#include <sourcebuffer.h>
+
+#include <benchmark/benchmark.h>
+
+#include <malloc.h>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    // The baseline node classes: one heap object per node, owned through
+    // unique_ptr and destroyed through a virtual destructor.
+    struct LegacyExprAST
+    {
+        virtual ~LegacyExprAST() = default;
+    };
+
+    struct LegacyNumberExprAST : LegacyExprAST
+    {
+        double Val;
+        LegacyNumberExprAST(double Val) : Val(Val) {}
+    };
+
+    struct LegacyVariableExprAST : LegacyExprAST
+    {
+        Symbol Name;
+        LegacyVariableExprAST(Symbol Name) : Name(Name) {}
+    };
+
+    struct LegacyBinaryExprAST : LegacyExprAST
+    {
+        char Op;
+        std::unique_ptr<LegacyExprAST> LHS, RHS;
+        LegacyBinaryExprAST(char Op, std::unique_ptr<LegacyExprAST> LHS,
+                            std::unique_ptr<LegacyExprAST> RHS)
+            : Op(Op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+    };
+
+    struct LegacyCallExprAST : LegacyExprAST
+    {
+        Symbol Callee;
+        std::vector<std::unique_ptr<LegacyExprAST>> Args;
+        LegacyCallExprAST(Symbol Callee, std::vector<std::unique_ptr<LegacyExprAST>> Args)
+            : Callee(Callee), Args(std::move(Args)) {}
+    };
+
+    struct LegacyIfExprAST : LegacyExprAST
+    {
+        std::unique_ptr<LegacyExprAST> Cond, Then, Else;
+        LegacyIfExprAST(std::unique_ptr<LegacyExprAST> Cond, std::unique_ptr<LegacyExprAST> Then,
+                        std::unique_ptr<LegacyExprAST> Else)
+            : Cond(std::move(Cond)), Then(std::move(Then)), Else(std::move(Else)) {}
+    };
+
+    std::unique_ptr<LegacyExprAST> buildLegacy(const ExprAST *E)
+    {
+        switch (E->getKind())
+        {
+        case ExprAST::Number:
+            return std::make_unique<LegacyNumberExprAST>(static_cast<const NumberExprAST *>(E)->get_val());
+        case ExprAST::Variable:
+            return std::make_unique<LegacyVariableExprAST>(static_cast<const VariableExprAST *>(E)->get_val());
+        case ExprAST::Binary:
+        {
+            auto *B = static_cast<const BinaryExprAST *>(E);
+            return std::make_unique<LegacyBinaryExprAST>(B->getOp(), buildLegacy(B->getLHS()),
+                                                         buildLegacy(B->getRHS()));
+        }
+        case ExprAST::Call:
+        {
+            auto *C = static_cast<const CallExprAST *>(E);
+            std::vector<std::unique_ptr<LegacyExprAST>> Args;
+            for (ExprAST *A : C->getArgs())
+            {
+                Args.push_back(buildLegacy(A));
+            }
+            return std::make_unique<LegacyCallExprAST>(C->getCallee(), std::move(Args));
+        }
+        case ExprAST::If:
+        {
+            auto *I = static_cast<const IfExprAST *>(E);
+            return std::make_unique<LegacyIfExprAST>(buildLegacy(I->getCond()), buildLegacy(I->getThen()),
+                                                     buildLegacy(I->getElse()));
+        }
+        }
+        return nullptr;
+    }
+
+    ExprAST *buildArena(ASTContext &Ctx, const ExprAST *E, std::vector<ExprAST *> &Scratch)
+    {
+        switch (E->getKind())
+        {
+        case ExprAST::Number:
+            return Ctx.create<NumberExprAST>(static_cast<const NumberExprAST *>(E)->get_val());
+        case ExprAST::Variable:
+            return Ctx.create<VariableExprAST>(static_cast<const VariableExprAST *>(E)->get_val());
+        case ExprAST::Binary:
+        {
+            auto *B = static_cast<const BinaryExprAST *>(E);
+            ExprAST *LHS = buildArena(Ctx, B->getLHS(), Scratch);
+            ExprAST *RHS = buildArena(Ctx, B->getRHS(), Scratch);
+            return Ctx.create<BinaryExprAST>(B->getOp(), LHS, RHS);
+        }
+        case ExprAST::Call:
+        {
+            auto *C = static_cast<const CallExprAST *>(E);
+            size_t Base = Scratch.size();
+            for (ExprAST *A : C->getArgs())
+            {
+                ExprAST *Arg = buildArena(Ctx, A, Scratch);
+                Scratch.push_back(Arg);
+            }
+            ASTArray<ExprAST *> Args = Ctx.copyArray(Scratch, Base);
+            Scratch.resize(Base);
+            return Ctx.create<CallExprAST>(C->getCallee(), Args);
+        }
+        case ExprAST::If:
+        {
+            auto *I = static_cast<const IfExprAST *>(E);
+            ExprAST *Cond = buildArena(Ctx, I->getCond(), Scratch);
+            ExprAST *Then = buildArena(Ctx, I->getThen(), Scratch);
+            ExprAST *Else = buildArena(Ctx, I->getElse(), Scratch);
+            return Ctx.create<IfExprAST>(Cond, Then, Else);
+        }
+        }
+        return nullptr;
+    }
+
+    size_t countNodes(const ExprAST *E)
+    {
+        switch (E->getKind())
+        {
+        case ExprAST::Binary:
+        {
+            auto *B = static_cast<const BinaryExprAST *>(E);
+            return 1 + countNodes(B->getLHS()) + countNodes(B->getRHS());
+        }
+        case ExprAST::Call:
+        {
+            size_t N = 1;
+            for (ExprAST *A : static_cast<const CallExprAST *>(E)->getArgs())
+            {
+                N += countNodes(A);
+            }
+            return N;
+        }
+        case ExprAST::If:
+        {
+            auto *I = static_cast<const IfExprAST *>(E);
+            return 1 + countNodes(I->getCond()) + countNodes(I->getThen()) + countNodes(I->getElse());
+        }
+        default:
+            return 1;
+        }
+    }
+
+    // heapInUse - Bytes currently allocated from malloc, including the large
+    // blocks malloc serves with mmap.
+    size_t heapInUse()
+    {
+        struct mallinfo2 MI = mallinfo2();
+        return MI.uordblks + MI.hblkhd;
+    }
+
+    // The parsed corpus every benchmark builds its trees from.
+    struct ParsedCorpus
+    {
+        std::unique_ptr<SourceBuffer> Buf;
+        SymbolTable Symbols;
+        ASTContext Ctx;
+        ModuleAST M;
+        size_t Nodes = 0;
+
+        ParsedCorpus() : Buf(SourceBuffer::getFile(corpusPath().c_str()))
+        {
+            Lexer Lex(*Buf, Symbols);
+            M = Parser(Lex).parseModule(Ctx);
+            for (FunctionAST *F : M.Functions)
+            {
+                Nodes += countNodes(F->getBody());
+            }
+        }
+    };
+
+    ParsedCorpus &parsedCorpus()
+    {
+        static ParsedCorpus P;
+        return P;
+    }
+}
+
+static void BM_ParseArena(benchmark::State &State)
+{
+    auto Buf = SourceBuffer::getFile(corpusPath().c_str());
+    size_t Nodes = 0;
+    for (auto _ : State)
+    {
+        SymbolTable Symbols;
+        ASTContext Ctx;
+        Lexer Lex(*Buf, Symbols);
+        ModuleAST M = Parser(Lex).parseModule(Ctx);
+        Nodes += Ctx.getNumNodes();
+        benchmark::DoNotOptimize(M.Functions.data());
+    }
+    State.counters["nodes"] = benchmark::Counter(static_cast<double>(Nodes), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_ParseArena)->Unit(benchmark::kMillisecond);
+
+static void BM_BuildUniquePtrTree(benchmark::State &State)
+{
+    ParsedCorpus &P = parsedCorpus();
+    size_t PeakBytes = 0;
+    for (auto _ : State)
+    {
+        size_t Before = heapInUse();
+        std::vector<std::unique_ptr<LegacyExprAST>> Bodies;
+        Bodies.reserve(P.M.Functions.size());
+        for (FunctionAST *F : P.M.Functions)
+        {
+            Bodies.push_back(buildLegacy(F->getBody()));
+        }
+        PeakBytes = heapInUse() - Before;
+        // Bodies is torn down here, one delete per node.
+    }
+    State.counters["nodes"] = benchmark::Counter(static_cast<double>(P.Nodes * State.iterations()),
+                                                 benchmark::Counter::kIsRate);
+    State.counters["peak_heap_MB"] = static_cast<double>(PeakBytes) / (1024 * 1024);
+    State.counters["bytes_per_node"] = static_cast<double>(PeakBytes) / P.Nodes;
+}
+BENCHMARK(BM_BuildUniquePtrTree)->Unit(benchmark::kMillisecond);
+
+static void BM_BuildArenaTree(benchmark::State &State)
+{
+    ParsedCorpus &P = parsedCorpus();
+    size_t PeakBytes = 0;
+    std::vector<ExprAST *> Scratch;
+    for (auto _ : State)
+    {
+        size_t Before = heapInUse();
+        ASTContext Ctx;
+        std::vector<ExprAST *> Bodies;
+        Bodies.reserve(P.M.Functions.size());
+        for (FunctionAST *F : P.M.Functions)
+        {
+            Bodies.push_back(buildArena(Ctx, F->getBody(), Scratch));
+        }
+        PeakBytes = heapInUse() - Before;
+        // Ctx is torn down here, one delete per slab.
+    }
+    State.counters["nodes"] = benchmark::Counter(static_cast<double>(P.Nodes * State.iterations()),
+                                                 benchmark::Counter::kIsRate);
+    State.counters["peak_heap_MB"] = static_cast<double>(PeakBytes) / (1024 * 1024);
+    State.counters["bytes_per_node"] = static_cast<double>(PeakBytes) / P.Nodes;
+}
+BENCHMARK(BM_BuildArenaTree)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,199 @@
+#ifndef KALEIDOSCOPE_BENCH_CORPUS_H
+#define KALEIDOSCOPE_BENCH_CORPUS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// makeCorpus - A few MB of fib-like definitions, comments and indentation.
+inline std::string makeCorpus(size_t TargetSize)
+{
+    std::string Out;
+    Out.reserve(TargetSize + 256);
+    for (unsigned I = 0; Out.size() < TargetSize; ++I)
+    {
+        std::string N = std::to_string(I);
+        Out += "# helper number " + N + "\n";
+        Out += "def f" + N + "(x y)\n";
+        Out += "    (x*" + N + ".25 + y) * (f0(x-1) - 3.5) < y\n";
+        Out += "extern g" + N + "(a b c)\n";
+    }
+    return Out;
+}
+
+// makeIndentedCorpus - Machine-generated style: deep indentation, banner
+// comments and long trailing comments around small expressions.
+inline std::string makeIndentedCorpus(size_t TargetSize)
+{
+    std::string Out;
+    Out.reserve(TargetSize + 512);
+    const std::string Banner(72, '#');
+    for (unsigned I = 0; Out.size() < TargetSize; ++I)
+    {
+        std::string N = std::to_string(I);
+        Out += Banner + "\n# generated helper " + N + ", do not edit by hand\n" + Banner + "\n";
+        Out += "def h" + N + "(x y)\n";
+        Out += "                        x *" + N + "      # scale by the table entry for this helper\n";
+        Out += "                            + y        # then add the offset\n";
+        Out += "\t\t\t\t\t\t\t\t- 1\n\n\n";
+    }
+    return Out;
+}
+
+// CorpusMix - The shape of a synthetic corpus. The weights are relative: at
+// each node of an expression the generator picks a variable, a literal, a
+// binary operator, an if or a call with these odds, and only a leaf once
+// MaxDepth is reached.
+struct CorpusMix
+{
+    unsigned Identifiers = 4; // a, b or c
+    unsigned Numbers = 2;     // an integer or a decimal literal
+    unsigned Operators = 6;   // one of + - * <, parenthesized
+    unsigned Ifs = 1;         // if (e < e) then e else e
+    unsigned Calls = 1;       // a call to an earlier definition
+    unsigned MaxDepth = 6;
+    uint64_t Seed = 1;
+};
+
+// CorpusRandom - splitmix64: the same sequence for a seed on every platform
+// and standard library, unlike the <random> distributions.
+struct CorpusRandom
+{
+    uint64_t State;
+
+    uint64_t next()
+    {
+        uint64_t Z = (State += 0x9e3779b97f4a7c15ULL);
+        Z = (Z ^ (Z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        Z = (Z ^ (Z >> 27)) * 0x94d049bb133111ebULL;
+        return Z ^ (Z >> 31);
+    }
+    unsigned below(unsigned N) { return static_cast<unsigned>(next() % N); }
+};
+
+// makeSyntheticCorpus - At least TargetSize bytes of definitions
+// "def s<N>(a b c)" whose bodies are random expressions drawn from Mix.
+// Calls only go to earlier definitions, so the corpus is a valid module.
+// The output depends only on TargetSize and Mix.
+inline std::string makeSyntheticCorpus(size_t TargetSize, const CorpusMix &Mix)
+{
+    enum Choice
+    {
+        Identifier,
+        Number,
+        Operator,
+        If,
+        Call,
+    };
+    CorpusRandom Rand{Mix.Seed};
+
+    // Pending output, popped from the back: a fixed string, or an expression
+    // still to be generated at a depth.
+    struct Item
+    {
+        const char *Text;
+        unsigned Depth;
+    };
+    std::vector<Item> Work;
+
+    std::string Out;
+    Out.reserve(TargetSize + 4096);
+    for (unsigned N = 0; Out.size() < TargetSize; ++N)
+    {
+        Out += "def s" + std::to_string(N) + "(a b c)\n    ";
+        Work.push_back({nullptr, 0});
+        while (!Work.empty())
+        {
+            Item I = Work.back();
+            Work.pop_back();
+            if (I.Text)
+            {
+                Out += I.Text;
+                continue;
+            }
+            // Past MaxDepth only leaves; the first definition has nothing to call.
+            const bool Inner = I.Depth < Mix.MaxDepth;
+            const unsigned Weights[] = {Mix.Identifiers, Mix.Numbers, Inner ? Mix.Operators : 0, Inner ? Mix.Ifs : 0,
+                                        Inner && N > 0 ? Mix.Calls : 0};
+            unsigned Total = 0;
+            for (unsigned W : Weights)
+            {
+                Total += W;
+            }
+            Choice C = Number;
+            if (Total != 0)
+            {
+                unsigned Pick = Rand.below(Total);
+                unsigned K = 0;
+                while (Pick >= Weights[K])
+                {
+                    Pick -= Weights[K++];
+                }
+                C = static_cast<Choice>(K);
+            }
+            const unsigned D = I.Depth + 1;
+            switch (C)
+            {
+            case Identifier:
+                Out += static_cast<char>('a' + Rand.below(3));
+                break;
+            case Number:
+                Out += std::to_string(Rand.below(1000));
+                if (Rand.below(2))
+                {
+                    Out += "." + std::to_string(Rand.below(100));
+                }
+                break;
+            case Operator:
+            {
+                static const char *const Ops[] = {" + ", " - ", " * ", " < "};
+                Out += '(';
+                Work.insert(Work.end(), {{")", 0}, {nullptr, D}, {Ops[Rand.below(4)], 0}, {nullptr, D}});
+                break;
+            }
+            case If:
+                Out += "(if ";
+                Work.insert(Work.end(), {{")", 0}, {nullptr, D}, {" else ", 0}, {nullptr, D}, {" then ", 0},
+                                         {nullptr, D}, {" < ", 0}, {nullptr, D}});
+                break;
+            case Call:
+                Out += "s" + std::to_string(Rand.below(N)) + "(";
+                Work.insert(Work.end(), {{")", 0}, {nullptr, D}, {", ", 0}, {nullptr, D}, {", ", 0}, {nullptr, D}});
+                break;
+            }
+        }
+        Out += "\n";
+    }
+    return Out;
+}
+
+enum CorpusKind
+{
+    MixedCorpus,
+    IndentedCorpus,
+};
+
+// corpusPath - Write a generated corpus to a file once and return its path.
+inline const std::string &corpusPath(CorpusKind Kind = MixedCorpus)
+{
+    static std::string Paths[2];
+    std::string &P = Paths[Kind];
+    if (P.empty())
+    {
+        P = Kind == MixedCorpus ? "kaleidoscope_bench_corpus.ks" : "kaleidoscope_bench_indented.ks";
+        FILE *F = fopen(P.c_str(), "wb");
+        if (!F)
+        {
+            std::abort();
+        }
+        size_t Size = 8 * 1024 * 1024;
+        std::string Text = Kind == MixedCorpus ? makeCorpus(Size) : makeIndentedCorpus(Size);
+        fwrite(Text.data(), 1, Text.size(), F);
+        fclose(F);
+    }
+    return P;
+}
+
+#endif // KALEIDOSCOPE_BENCH_CORPUS_H
@@ -0,0 +1,82 @@
+// kaleidoscope_corpus - Write a synthetic corpus (corpus.h) to stdout, the
+// same bytes the benchmarks generate for the same options, so a benchmark
+// input can be reproduced, inspected or fed to the driver.
+#include "corpus.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void printUsage(const char *Argv0)
+{
+    fprintf(stderr, "Usage: %s [-size=MB] [-seed=N] [-depth=N] [-mix=IDENTS,NUMBERS,OPS,IFS,CALLS]\n", Argv0);
+}
+
+// parseNumber - Parse a decimal no larger than Max; false if it is not one.
+static bool parseNumber(const char *Str, unsigned long long Max, unsigned long long &Out)
+{
+    char *End;
+    unsigned long long N = strtoull(Str, &End, 10);
+    if (!isdigit(static_cast<unsigned char>(*Str)) || *End != '\0' || N > Max)
+    {
+        return false;
+    }
+    Out = N;
+    return true;
+}
+
+// parseMix - Parse the five comma-separated weights of -mix=.
+static bool parseMix(const char *Str, CorpusMix &Mix)
+{
+    unsigned *Weights[] = {&Mix.Identifiers, &Mix.Numbers, &Mix.Operators, &Mix.Ifs, &Mix.Calls};
+    for (unsigned K = 0; K < 5; ++K)
+    {
+        char *End;
+        unsigned long N = strtoul(Str, &End, 10);
+        if (!isdigit(static_cast<unsigned char>(*Str)) || N > 1000 || *End != (K == 4 ? '\0' : ','))
+        {
+            return false;
+        }
+        *Weights[K] = static_cast<unsigned>(N);
+        Str = End + 1;
+    }
+    return Mix.Identifiers + Mix.Numbers != 0;
+}
+
+int main(int argc, char *argv[])
+{
+    CorpusMix Mix;
+    unsigned long long SizeMB = 1;
+    for (int I = 1; I < argc; ++I)
+    {
+        const char *Arg = argv[I];
+        unsigned long long N;
+        if (strncmp(Arg, "-size=", 6) == 0 && parseNumber(Arg + 6, 4096, N))
+        {
+            SizeMB = N;
+        }
+        else if (strncmp(Arg, "-seed=", 6) == 0 && parseNumber(Arg + 6, ~0ULL, N))
+        {
+            Mix.Seed = N;
+        }
+        else if (strncmp(Arg, "-depth=", 7) == 0 && parseNumber(Arg + 7, 64, N))
+        {
+            Mix.MaxDepth = static_cast<unsigned>(N);
+        }
+        else if (strncmp(Arg, "-mix=", 5) != 0 || !parseMix(Arg + 5, Mix))
+        {
+            fprintf(stderr, "Error: bad argument '%s'\n", Arg);
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::string Text = makeSyntheticCorpus(SizeMB * 1024 * 1024, Mix);
+    if (fwrite(Text.data(), 1, Text.size(), stdout) != Text.size() || fflush(stdout) != 0)
+    {
+        fprintf(stderr, "Error: can't write the corpus\n");
+        return 1;
+    }
+    return 0;
+}
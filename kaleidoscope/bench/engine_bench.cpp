@@ -0,0 +1,51 @@
+// Embedding: a formula compiled once by an Engine and then called through
+// its CompiledFunction handle from many threads at once. Calls take no
+// locks, so the rate should grow with the thread count up to the number of
+// cores. BM_Compile is the round trip of one compile() on the compile
+// thread.
+#include <engine.h>
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <string>
+
+namespace
+{
+    const char *Formula = "def f(x y) if x < y then x * x - y else (x - y) * (x + y) + 1\n";
+
+    Engine &engine()
+    {
+        static std::unique_ptr<Engine> E = Engine::create();
+        return *E;
+    }
+
+    void BM_CompiledCall(benchmark::State &State)
+    {
+        static CompiledFunction F = engine().compile(Formula).get().get("f");
+        double X = State.thread_index(), Sum = 0;
+        for (auto _ : State)
+        {
+            Sum += F(X, 2.0);
+            X += 1;
+            benchmark::DoNotOptimize(Sum);
+        }
+        State.SetItemsProcessed(State.iterations());
+    }
+
+    void BM_Compile(benchmark::State &State)
+    {
+        for (auto _ : State)
+        {
+            CompiledUnit U = engine().compile(Formula).get();
+            if (U.NumErrors)
+            {
+                State.SkipWithError("compile failed");
+                return;
+            }
+        }
+    }
+}
+
+BENCHMARK(BM_CompiledCall)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_Compile)->Unit(benchmark::kMicrosecond);
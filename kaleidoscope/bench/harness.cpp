@@ -0,0 +1,47 @@
+#include "harness.h"
+
+#include <fold.h>
+#include <frontend.h>
+#include <inline.h>
+#include <sourcebuffer.h>
+
+std::unique_ptr<CompiledScript> compileModule(const std::string &Source, llvm::StringRef Name,
+                                              const CompileOptions &Opts)
+{
+    auto S = std::make_unique<CompiledScript>();
+    auto Buffer = SourceBuffer::getMemBuffer(Source, Name.str());
+    Lexer Lex(*Buffer, S->Symbols);
+    Parser P(Lex);
+    S->M = P.parseModule(S->Ctx);
+    if (Opts.Fold)
+    {
+        foldModule(S->M, S->Ctx);
+    }
+    if (Opts.Inline)
+    {
+        inlineModule(S->M, S->Symbols, S->Ctx);
+    }
+
+    S->CG = std::make_unique<CodeGen>(S->Symbols, Name);
+    if (Opts.Optimizer)
+    {
+        S->CG->setOptimizer(Opts.Optimizer);
+    }
+    S->CG->setTailCalls(Opts.TailCalls);
+    if (Opts.Memoize)
+    {
+        S->CG->memoize(S->Symbols.lookup(Opts.Memoize), Opts.MemoCacheBits);
+    }
+    S->CG->codegenModule(S->M);
+
+    if (!S->CG->getTopLevelExprs().empty())
+    {
+        S->Entry = S->CG->getTopLevelExprs().front();
+        if (Opts.ExportEntry)
+        {
+            S->Entry->setName("entry");
+            S->Entry->setLinkage(llvm::Function::ExternalLinkage);
+        }
+    }
+    return S;
+}
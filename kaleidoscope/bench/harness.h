@@ -0,0 +1,46 @@
+#ifndef KALEIDOSCOPE_BENCH_HARNESS_H
+#define KALEIDOSCOPE_BENCH_HARNESS_H
+
+#include <ast.h>
+#include <codegen.h>
+#include <symboltable.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// CompileOptions - How compileModule() lowers a script.
+struct CompileOptions
+{
+    bool ExportEntry = true; // rename Entry "entry" and export it, for lookupExpr()
+    const char *Memoize = nullptr; // memoize the function of this name ...
+    unsigned MemoCacheBits = 0;    // ... with 2^MemoCacheBits entries
+    CodeGen::TailCallMode TailCalls = CodeGen::TailCalls;
+    bool Fold = false;                      // foldModule() before lowering
+    bool Inline = false;                    // inlineModule() after folding
+    FunctionOptimizer *Optimizer = nullptr; // optimize each function as it is lowered
+};
+
+// CompiledScript - A script parsed into symbols and nodes of its own and
+// lowered by CG, whose module is still there to take.
+struct CompiledScript
+{
+    SymbolTable Symbols;
+    ASTContext Ctx;
+    ModuleAST M;
+    std::unique_ptr<CodeGen> CG;     // made once the tree is final; it sizes its tables by Symbols
+    llvm::Function *Entry = nullptr; // the first top-level expression, if any
+};
+
+// compileModule - Lex, parse and lower Source, naming both the buffer and the
+// module Name: the fixture each JIT benchmark starts from, so that what it
+// does with the module is all the benchmark holds.
+std::unique_ptr<CompiledScript> compileModule(const std::string &Source, llvm::StringRef Name,
+                                              const CompileOptions &Opts = CompileOptions());
+
+// allocationCount - The number of operator new calls in the process so far.
+// The benchmark binary replaces the global operator new (bench/main.cpp) to
+// count them; take the difference around the code being measured.
+uint64_t allocationCount();
+
+#endif // KALEIDOSCOPE_BENCH_HARNESS_H
@@ -0,0 +1,50 @@
+// Calls to one-line helpers: a tail-recursive loop whose body goes through
+// small functions, compiled at -O2 and called with and without AST inlining.
+// LLVM optimizes each function on its own, so without inlineModule() every
+// helper is a real native call per iteration; with it the loop body is
+// straight-line arithmetic, lerp(x, 0, 1) folded down to x.
+#include "harness.h"
+
+#include <jit.h>
+#include <optimizer.h>
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+namespace
+{
+    const char *const Defs = "def sq(x) x * x\n"
+                             "def lerp(t a b) a + (b - a) * t\n"
+                             "def clamp(x lo hi) if x < lo then lo else if hi < x then hi else x\n"
+                             "def step(x) clamp(lerp(x, 0, 1) * 0.5 + sq(x) * 0.25, 0, 4)\n"
+                             "def loop(n x) if n < 1 then x else loop(n - 1, step(x) + 0.001)\n";
+
+    void BM_Helpers(benchmark::State &State)
+    {
+        auto Optimizer = FunctionOptimizer::create(2, nullptr);
+        if (!Optimizer)
+        {
+            State.SkipWithError("no optimizer");
+            return;
+        }
+        CompileOptions Opts;
+        Opts.Fold = true;
+        Opts.Inline = State.range(1) != 0;
+        Opts.Optimizer = Optimizer.get();
+        std::unique_ptr<CompiledScript> Compiled =
+            compileModule(std::string(Defs) + "loop(" + std::to_string(State.range(0)) + ", 0.5);\n", "script", Opts);
+
+        auto JIT = llvm::cantFail(KaleidoscopeJIT::create(KaleidoscopeJIT::Eager));
+        llvm::cantFail(JIT->addModule(Compiled->CG->takeModule()));
+        double (*Fn)() = llvm::cantFail(JIT->lookupExpr("entry"));
+        for (auto _ : State)
+        {
+            benchmark::DoNotOptimize(Fn());
+        }
+        State.counters["iters/s"] =
+            benchmark::Counter(static_cast<double>(State.range(0)), benchmark::Counter::kIsIterationInvariantRate);
+    }
+}
+
+BENCHMARK(BM_Helpers)->ArgNames({"n", "inline"})->Args({1000000, 0})->Args({1000000, 1})->Unit(benchmark::kMillisecond);
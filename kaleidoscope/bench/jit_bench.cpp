@@ -0,0 +1,81 @@
+// JIT startup latency: time from source text to the first top-level result
+// for a script that defines many functions but calls only two of them, with
+// the eager JIT (the whole module is compiled on first lookup) against the
+// lazy one (only the functions that are actually called get compiled) and
+// tiered execution (nothing is compiled; the bytecode interpreter runs it).
+#include "harness.h"
+
+#include <jit.h>
+#include <tiered.h>
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+namespace
+{
+    // makeScript - NumDefs functions with non-trivial bodies, each calling
+    // its predecessor, and one top-level expression that calls two of them.
+    std::string makeScript(unsigned NumDefs)
+    {
+        std::string S;
+        for (unsigned I = 0; I < NumDefs; ++I)
+        {
+            std::string N = std::to_string(I);
+            std::string Callee = I == 0 ? "x" : "f" + std::to_string(I - 1) + "(x - 1, y * 0.5)";
+            S += "def f" + N + "(x y)\n";
+            S += "    if x < 1 then y * " + N + ".5 + x * x - y\n";
+            S += "    else if y < x then " + Callee + " + (x - y) * (x + y) * 0.25\n";
+            S += "    else " + Callee + " - x * y + " + N + "\n";
+        }
+        S += "f1(3, 2) + f2(4, 5);\n";
+        return S;
+    }
+
+    void BM_JITStartup(benchmark::State &State, KaleidoscopeJIT::JITMode Mode)
+    {
+        const std::string Script = makeScript(static_cast<unsigned>(State.range(0)));
+        for (auto _ : State)
+        {
+            std::unique_ptr<CompiledScript> Compiled = compileModule(Script, "script");
+            auto JIT = llvm::cantFail(KaleidoscopeJIT::create(Mode));
+            llvm::cantFail(JIT->addModule(Compiled->CG->takeModule()));
+            double Result = llvm::cantFail(JIT->lookupExpr("entry"))();
+            benchmark::DoNotOptimize(Result);
+        }
+        State.counters["defs"] = static_cast<double>(State.range(0));
+    }
+
+    void BM_TieredStartup(benchmark::State &State)
+    {
+        const std::string Script = makeScript(static_cast<unsigned>(State.range(0)));
+        CompileOptions Opts;
+        Opts.ExportEntry = false; // the engine runs the expressions itself
+        for (auto _ : State)
+        {
+            std::unique_ptr<CompiledScript> Compiled = compileModule(Script, "script", Opts);
+            auto Engine = llvm::cantFail(TieredEngine::create(1000));
+            Engine->addUnit(Compiled->M, Compiled->Symbols, "script", Compiled->CG->takeModule());
+            double Result = 0;
+            Engine->run(Engine->getTopLevelExprs().front(), Result);
+            benchmark::DoNotOptimize(Result);
+        }
+        State.counters["defs"] = static_cast<double>(State.range(0));
+    }
+}
+
+BENCHMARK_CAPTURE(BM_JITStartup, eager, KaleidoscopeJIT::Eager)
+    ->Arg(100)
+    ->Arg(500)
+    ->Arg(2000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_JITStartup, lazy, KaleidoscopeJIT::Lazy)
+    ->Arg(100)
+    ->Arg(500)
+    ->Arg(2000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_TieredStartup)
+    ->Arg(100)
+    ->Arg(500)
+    ->Arg(2000)
+    ->Unit(benchmark::kMillisecond);
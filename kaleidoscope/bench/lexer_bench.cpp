@@ -0,0 +1,133 @@
+// Lexer throughput: the original getchar()-per-character lexer against the
+// SourceBuffer cursor lexer, both over the same generated source file. The
+// argument picks the corpus: 0 is mixed code, 1 is heavily indented and
+// commented code, where the vectorized skipping matters most.
+#include "corpus.h"
+
+#include <frontend.h>
+#include <sourcebuffer.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+    // The baseline lexer, unchanged apart from reading a FILE* instead of stdin.
+    enum LegacyToken
+    {
+        legacy_eof = -1,
+        legacy_def = -2,
+        legacy_extern = -3,
+        legacy_identifier = -4,
+        legacy_number = -5,
+    };
+
+    struct LegacyLexer
+    {
+        FILE *In;
+        int LastChar = ' ';
+        std::string IdentifierStr;
+        double NumVal = 0;
+
+        int gettok()
+        {
+            while (isspace(LastChar))
+            {
+                LastChar = getc(In);
+            }
+            if (isalpha(LastChar))
+            {
+                IdentifierStr = LastChar;
+                while (isalnum((LastChar = getc(In))))
+                {
+                    IdentifierStr += LastChar;
+                }
+                if (IdentifierStr == "def")
+                {
+                    return legacy_def;
+                }
+                if (IdentifierStr == "extern")
+                {
+                    return legacy_extern;
+                }
+                return legacy_identifier;
+            }
+            if (isdigit(LastChar) || LastChar == '.')
+            {
+                std::string NumStr;
+                do
+                {
+                    NumStr += LastChar;
+                    LastChar = getc(In);
+                } while (isdigit(LastChar) || LastChar == '.');
+                NumVal = strtod(NumStr.c_str(), nullptr);
+                return legacy_number;
+            }
+            if (LastChar == '#')
+            {
+                do
+                {
+                    LastChar = getc(In);
+                } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+                if (LastChar != EOF)
+                {
+                    return gettok();
+                }
+            }
+            if (LastChar == EOF)
+            {
+                return legacy_eof;
+            }
+            int ThisChar = LastChar;
+            LastChar = getc(In);
+            return ThisChar;
+        }
+    };
+}
+
+static void BM_LexStdio(benchmark::State &State)
+{
+    const std::string &Path = corpusPath(static_cast<CorpusKind>(State.range(0)));
+    size_t Bytes = 0;
+    for (auto _ : State)
+    {
+        FILE *F = fopen(Path.c_str(), "rb");
+        LegacyLexer Lex{F};
+        size_t Tokens = 0;
+        while (Lex.gettok() != legacy_eof)
+        {
+            ++Tokens;
+        }
+        Bytes += static_cast<size_t>(ftell(F));
+        fclose(F);
+        benchmark::DoNotOptimize(Tokens);
+    }
+    State.SetBytesProcessed(static_cast<int64_t>(Bytes));
+}
+BENCHMARK(BM_LexStdio)->Arg(MixedCorpus)->Arg(IndentedCorpus)->Unit(benchmark::kMillisecond);
+
+static void BM_LexSourceBuffer(benchmark::State &State)
+{
+    const std::string &Path = corpusPath(static_cast<CorpusKind>(State.range(0)));
+    size_t Bytes = 0;
+    for (auto _ : State)
+    {
+        // Include the open/map cost, as the stdio variant pays for fopen.
+        auto Buf = SourceBuffer::getFile(Path.c_str());
+        SymbolTable Symbols;
+        Lexer Lex(*Buf, Symbols);
+        size_t Tokens = 0;
+        while (Lex.lex().Kind != tok_eof)
+        {
+            ++Tokens;
+        }
+        Bytes += Buf->size();
+        benchmark::DoNotOptimize(Tokens);
+    }
+    State.SetBytesProcessed(static_cast<int64_t>(Bytes));
+}
+BENCHMARK(BM_LexSourceBuffer)->Arg(MixedCorpus)->Arg(IndentedCorpus)->Unit(benchmark::kMillisecond);
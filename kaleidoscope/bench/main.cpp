@@ -0,0 +1,51 @@
+// The benchmark binary's entry point: benchmark_main plus what a result file
+// needs to be compared with one from another release, and the allocation
+// counter behind allocationCount().
+#include "harness.h"
+
+#include "llvm/Config/llvm-config.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<uint64_t> NumAllocations{0};
+}
+
+uint64_t allocationCount() { return NumAllocations.load(std::memory_order_relaxed); }
+
+// The array and nothrow forms of libstdc++ call this one, so it counts them
+// too. Over-aligned allocations go elsewhere and aren't counted.
+void *operator new(size_t Size)
+{
+    NumAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *P = malloc(Size ? Size : 1))
+    {
+        return P;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *P) noexcept { free(P); }
+void operator delete(void *P, size_t) noexcept { free(P); }
+
+int main(int argc, char **argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+    // Shown in the console header and stored in the "context" of
+    // --benchmark_out files.
+    benchmark::AddCustomContext("kaleidoscope_version", KALEIDOSCOPE_VERSION);
+    benchmark::AddCustomContext("llvm_version", LLVM_VERSION_STRING);
+    benchmark::AddCustomContext("build_type", KALEIDOSCOPE_BUILD_TYPE);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
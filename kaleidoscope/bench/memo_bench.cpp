@@ -0,0 +1,83 @@
+// Memoization: naive recursive fib(n) compiled plain and with result caches
+// of different sizes. The cache and its counters are cleared before every
+// iteration, so each one measures a cold cache; the counters report how
+// often the body was skipped. A cache smaller than the set of live arguments
+// keeps evicting entries that are still needed and falls back towards the
+// plain exponential run.
+#include "harness.h"
+
+#include <jit.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <string>
+
+namespace
+{
+    const char *const Fib = "def fib(x)\n"
+                            "    if x < 3 then 1 else fib(x - 1) + fib(x - 2)\n";
+
+    // BM_Fib - fib(range(0)) with a cache of 2^range(1) entries, or none for 0.
+    void BM_Fib(benchmark::State &State)
+    {
+        const double N = static_cast<double>(State.range(0));
+        const unsigned CacheBits = static_cast<unsigned>(State.range(1));
+
+        CompileOptions Opts;
+        Opts.Memoize = CacheBits != 0 ? "fib" : nullptr;
+        Opts.MemoCacheBits = CacheBits;
+        std::unique_ptr<CompiledScript> Compiled = compileModule(Fib, "fib", Opts);
+        uint64_t CacheSize = 0;
+        if (llvm::GlobalVariable *Cache = Compiled->CG->getModule().getNamedGlobal("fib.memo"))
+        {
+            CacheSize = Compiled->CG->getModule().getDataLayout().getTypeAllocSize(Cache->getValueType());
+        }
+
+        auto JIT = llvm::cantFail(KaleidoscopeJIT::create(KaleidoscopeJIT::Eager));
+        llvm::cantFail(JIT->addModule(Compiled->CG->takeModule()));
+        auto *Fn = llvm::jitTargetAddressToFunction<double (*)(double)>(
+            llvm::cantFail(JIT->getLLJIT().lookup("fib")).getAddress());
+        void *Cache = nullptr;
+        uint64_t *Counts = nullptr;
+        if (CacheBits != 0)
+        {
+            Cache = llvm::jitTargetAddressToPointer<void *>(
+                llvm::cantFail(JIT->getLLJIT().lookup("fib.memo")).getAddress());
+            Counts = llvm::jitTargetAddressToPointer<uint64_t *>(
+                llvm::cantFail(JIT->getLLJIT().lookup("fib.memo.stats")).getAddress());
+        }
+
+        uint64_t Hits = 0, Misses = 0;
+        for (auto _ : State)
+        {
+            if (Cache)
+            {
+                State.PauseTiming();
+                memset(Cache, 0, CacheSize);
+                Counts[0] = Counts[1] = 0;
+                State.ResumeTiming();
+            }
+            benchmark::DoNotOptimize(Fn(N));
+            if (Counts)
+            {
+                Hits += Counts[0];
+                Misses += Counts[1];
+            }
+        }
+        State.counters["hits"] = benchmark::Counter(static_cast<double>(Hits), benchmark::Counter::kAvgIterations);
+        State.counters["misses"] =
+            benchmark::Counter(static_cast<double>(Misses), benchmark::Counter::kAvgIterations);
+        State.counters["hit_rate"] =
+            Hits + Misses ? static_cast<double>(Hits) / static_cast<double>(Hits + Misses) : 0.0;
+    }
+}
+
+BENCHMARK(BM_Fib)
+    ->ArgNames({"n", "cache_bits"})
+    ->Args({25, 0})
+    ->Args({25, 2})
+    ->Args({25, 4})
+    ->Args({25, 12})
+    ->Args({40, 12})
+    ->Unit(benchmark::kMicrosecond);
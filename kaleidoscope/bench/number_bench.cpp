@@ -0,0 +1,96 @@
+// Numeric literal conversion: the original std::string + strtod path against
+// scanNumber, over a constant table of short integers, decimals and
+// long-mantissa literals that need the correctly rounded fallback.
+#include <numberscan.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct LiteralTable
+    {
+        std::string Text;                 // literals separated by ' ', '\0' terminated
+        std::vector<size_t> Starts;
+    };
+
+    const LiteralTable &literalTable()
+    {
+        static LiteralTable T = []
+        {
+            LiteralTable T;
+            std::mt19937_64 Rng(42);
+            for (unsigned I = 0; I < 200000; ++I)
+            {
+                T.Starts.push_back(T.Text.size());
+                switch (I % 4)
+                {
+                case 0: // small integers
+                    T.Text += std::to_string(Rng() % 1000);
+                    break;
+                case 1: // unit-conversion style decimals
+                    T.Text += std::to_string(Rng() % 100000) + "." + std::to_string(Rng() % 10000);
+                    break;
+                case 2: // fractions below one
+                    T.Text += "0." + std::to_string(Rng() % 1000000);
+                    break;
+                default: // long mantissas, beyond the fast path
+                    T.Text += std::to_string(Rng()) + "." + std::to_string(Rng());
+                    break;
+                }
+                T.Text += ' ';
+            }
+            return T;
+        }();
+        return T;
+    }
+
+    bool isNumChar(char C)
+    {
+        return (C >= '0' && C <= '9') || C == '.';
+    }
+}
+
+static void BM_NumberStrtod(benchmark::State &State)
+{
+    const LiteralTable &T = literalTable();
+    for (auto _ : State)
+    {
+        double Sum = 0;
+        for (size_t Start : T.Starts)
+        {
+            // What gettok() used to do: copy the run, then strtod.
+            std::string NumStr;
+            for (const char *P = T.Text.c_str() + Start; isNumChar(*P); ++P)
+            {
+                NumStr += *P;
+            }
+            Sum += strtod(NumStr.c_str(), nullptr);
+        }
+        benchmark::DoNotOptimize(Sum);
+    }
+    State.SetItemsProcessed(static_cast<int64_t>(State.iterations() * T.Starts.size()));
+    State.SetBytesProcessed(static_cast<int64_t>(State.iterations() * T.Text.size()));
+}
+BENCHMARK(BM_NumberStrtod);
+
+static void BM_NumberScan(benchmark::State &State)
+{
+    const LiteralTable &T = literalTable();
+    for (auto _ : State)
+    {
+        double Sum = 0;
+        for (size_t Start : T.Starts)
+        {
+            Sum += scanNumber(T.Text.c_str() + Start).Value;
+        }
+        benchmark::DoNotOptimize(Sum);
+    }
+    State.SetItemsProcessed(static_cast<int64_t>(State.iterations() * T.Starts.size()));
+    State.SetBytesProcessed(static_cast<int64_t>(State.iterations() * T.Text.size()));
+}
+BENCHMARK(BM_NumberScan);
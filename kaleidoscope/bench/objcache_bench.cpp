@@ -0,0 +1,101 @@
+// Object cache: time from source text to the first result for a library
+// whose entry point reaches every function, on the eager JIT with a cache
+// directory that starts out empty (cold: every group is compiled and
+// written) or was filled by an earlier run (warm: every group is loaded).
+#include "harness.h"
+
+#include <jit.h>
+#include <objcache.h>
+
+#include <benchmark/benchmark.h>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+
+#include <string>
+
+namespace
+{
+    // makeLibrary - NumDefs functions, each calling its predecessor, and a
+    // top-level expression that calls the last one.
+    std::string makeLibrary(unsigned NumDefs)
+    {
+        std::string S;
+        for (unsigned I = 0; I < NumDefs; ++I)
+        {
+            std::string N = std::to_string(I);
+            std::string Callee = I == 0 ? "x" : "f" + std::to_string(I - 1) + "(x - 1, y * 0.5)";
+            S += "def f" + N + "(x y)\n";
+            S += "    if x < 1 then y * " + N + ".5 + x * x - y\n";
+            S += "    else if y < x then " + Callee + " + (x - y) * (x + y) * 0.25\n";
+            S += "    else " + Callee + " - x * y + " + N + "\n";
+        }
+        S += "f" + std::to_string(NumDefs - 1) + "(3, 2);\n";
+        return S;
+    }
+
+    double runCached(const std::string &Script, DiskObjectCache &Cache)
+    {
+        std::unique_ptr<CompiledScript> Compiled = compileModule(Script, "library");
+        std::vector<std::pair<llvm::Function *, std::string>> Keys;
+        for (const FunctionAST *F : Compiled->M.Functions)
+        {
+            std::string_view Name = Compiled->Symbols.getName(F->getProto()->getName());
+            llvm::Function *Fn =
+                isTopLevelExpr(F->getProto(), Compiled->Symbols)
+                    ? Compiled->Entry
+                    : Compiled->CG->getModule().getFunction(llvm::StringRef(Name.data(), Name.size()));
+            Keys.emplace_back(Fn, functionKey(*F, Compiled->Symbols, Fn->getName(), Cache.getTargetID()));
+        }
+
+        auto JIT = llvm::cantFail(KaleidoscopeJIT::create(KaleidoscopeJIT::Eager, /*Concurrent=*/false, &Cache));
+        for (llvm::orc::ThreadSafeModule &TSM : partitionForCache(Compiled->CG->takeModule(), Keys))
+        {
+            llvm::cantFail(JIT->addModule(std::move(TSM)));
+        }
+        return llvm::cantFail(JIT->lookupExpr("entry"))();
+    }
+
+    void BM_CachedStartup(benchmark::State &State, bool Warm)
+    {
+        const std::string Script = makeLibrary(static_cast<unsigned>(State.range(0)));
+        llvm::SmallString<128> Dir;
+        if (llvm::sys::fs::createUniqueDirectory("kaleidoscope-objcache", Dir))
+        {
+            State.SkipWithError("cannot create a cache directory");
+            return;
+        }
+        auto Cache = DiskObjectCache::create(Dir);
+        if (Warm)
+        {
+            runCached(Script, *Cache);
+        }
+        for (auto _ : State)
+        {
+            if (!Warm)
+            {
+                State.PauseTiming();
+                llvm::sys::fs::remove_directories(Dir);
+                Cache = DiskObjectCache::create(Dir);
+                State.ResumeTiming();
+            }
+            benchmark::DoNotOptimize(runCached(Script, *Cache));
+        }
+        State.counters["defs"] = static_cast<double>(State.range(0));
+        // Objects loaded or compiled by one run.
+        State.counters["objects"] = Warm ? static_cast<double>(Cache->getNumHits()) / State.iterations()
+                                         : static_cast<double>(Cache->getNumMisses());
+        llvm::sys::fs::remove_directories(Dir);
+    }
+}
+
+BENCHMARK_CAPTURE(BM_CachedStartup, cold, false)
+    ->Arg(100)
+    ->Arg(500)
+    ->Arg(2000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_CachedStartup, warm, true)
+    ->Arg(100)
+    ->Arg(500)
+    ->Arg(2000)
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,217 @@
+// The compiler stage by stage over synthetic corpora (corpus.h): lexing,
+// parsing, IR generation at -O0 and -O2, the latency from source text to a
+// first JIT'd result, and the runtime of fib(n). The corpus is generated in
+// memory from a fixed seed, so every run and every release measures the same
+// input; kaleidoscope_corpus writes it out with the same options. Run with
+// --benchmark_out=FILE --benchmark_out_format=json (or build bench_json) to
+// keep the numbers.
+#include "corpus.h"
+#include "harness.h"
+
+#include <codegen.h>
+#include <frontend.h>
+#include <jit.h>
+#include <optimizer.h>
+#include <sourcebuffer.h>
+
+#include <benchmark/benchmark.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace
+{
+    // The corpora: the default mix, one of mostly literals and operators
+    // (short tokens, wide trees) and one of deep ifs and calls.
+    enum MixKind
+    {
+        DefaultMix,
+        ArithmeticMix,
+        DeepMix,
+    };
+
+    CorpusMix makeMix(MixKind Kind)
+    {
+        CorpusMix Mix;
+        if (Kind == ArithmeticMix)
+        {
+            Mix.Identifiers = 2;
+            Mix.Numbers = 6;
+            Mix.Ifs = 0;
+            Mix.Calls = 0;
+        }
+        else if (Kind == DeepMix)
+        {
+            Mix.Ifs = 3;
+            Mix.Calls = 3;
+            Mix.MaxDepth = 12;
+        }
+        return Mix;
+    }
+
+    // syntheticCorpus - KB kilobytes of the Kind mix, generated once per run.
+    const std::string &syntheticCorpus(MixKind Kind, size_t KB)
+    {
+        static std::map<std::pair<MixKind, size_t>, std::string> Cache;
+        std::string &S = Cache[{Kind, KB}];
+        if (S.empty())
+        {
+            S = makeSyntheticCorpus(KB * 1024, makeMix(Kind));
+        }
+        return S;
+    }
+
+    MixKind mixArg(const benchmark::State &State) { return static_cast<MixKind>(State.range(0)); }
+
+    void BM_Lex(benchmark::State &State)
+    {
+        auto Buf = SourceBuffer::getMemBuffer(syntheticCorpus(mixArg(State), 4096), "corpus");
+        uint64_t Tokens = 0;
+        for (auto _ : State)
+        {
+            SymbolTable Symbols;
+            Lexer Lex(*Buf, Symbols);
+            while (Lex.lex().Kind != tok_eof)
+            {
+                ++Tokens;
+            }
+        }
+        State.SetBytesProcessed(static_cast<int64_t>(Buf->size() * State.iterations()));
+        State.counters["tokens/s"] = benchmark::Counter(static_cast<double>(Tokens), benchmark::Counter::kIsRate);
+    }
+
+    void BM_Parse(benchmark::State &State)
+    {
+        auto Buf = SourceBuffer::getMemBuffer(syntheticCorpus(mixArg(State), 4096), "corpus");
+        uint64_t Nodes = 0, Allocations = 0;
+        for (auto _ : State)
+        {
+            uint64_t Before = allocationCount();
+            SymbolTable Symbols;
+            ASTContext Ctx;
+            Lexer Lex(*Buf, Symbols);
+            ModuleAST M = Parser(Lex).parseModule(Ctx);
+            Allocations += allocationCount() - Before;
+            Nodes += Ctx.getNumNodes();
+            benchmark::DoNotOptimize(M.Functions.data());
+        }
+        State.SetBytesProcessed(static_cast<int64_t>(Buf->size() * State.iterations()));
+        State.counters["nodes/s"] = benchmark::Counter(static_cast<double>(Nodes), benchmark::Counter::kIsRate);
+        State.counters["allocs/node"] = Nodes ? static_cast<double>(Allocations) / static_cast<double>(Nodes) : 0.0;
+    }
+
+    // BM_Codegen - IR for a 256 KB corpus at -O range(1), parsed once; the
+    // time includes the optimizer, which runs as each function is lowered.
+    void BM_Codegen(benchmark::State &State)
+    {
+        const unsigned OptLevel = static_cast<unsigned>(State.range(1));
+        auto Buf = SourceBuffer::getMemBuffer(syntheticCorpus(mixArg(State), 256), "corpus");
+        SymbolTable Symbols;
+        ASTContext Ctx;
+        Lexer Lex(*Buf, Symbols);
+        ModuleAST M = Parser(Lex).parseModule(Ctx);
+
+        std::unique_ptr<FunctionOptimizer> Optimizer;
+        if (OptLevel > 0 && !(Optimizer = FunctionOptimizer::create(OptLevel, nullptr)))
+        {
+            State.SkipWithError("no optimizer");
+            return;
+        }
+        uint64_t Functions = 0;
+        for (auto _ : State)
+        {
+            CodeGen CG(Symbols, "corpus");
+            CG.setOptimizer(Optimizer.get());
+            if (CG.codegenModule(M) != 0)
+            {
+                State.SkipWithError("codegen failed");
+                return;
+            }
+            Functions += M.Functions.size();
+        }
+        State.counters["functions/s"] =
+            benchmark::Counter(static_cast<double>(Functions), benchmark::Counter::kIsRate);
+        State.counters["nodes/s"] = benchmark::Counter(static_cast<double>(Ctx.getNumNodes() * State.iterations()),
+                                                       benchmark::Counter::kIsRate);
+    }
+
+    const char *const Fib = "def fib(x)\n"
+                            "    if x < 3 then 1 else fib(x - 1) + fib(x - 2)\n";
+
+    // compileFib - The JIT'd fib of Fib followed by Expr as "entry", at -O
+    // OptLevel.
+    std::unique_ptr<KaleidoscopeJIT> compileFib(const std::string &Expr, unsigned OptLevel,
+                                                KaleidoscopeJIT::JITMode Mode)
+    {
+        std::unique_ptr<FunctionOptimizer> Optimizer;
+        if (OptLevel > 0 && !(Optimizer = FunctionOptimizer::create(OptLevel, nullptr)))
+        {
+            return nullptr;
+        }
+        CompileOptions Opts;
+        Opts.Optimizer = Optimizer.get();
+        std::unique_ptr<CompiledScript> Compiled = compileModule(std::string(Fib) + Expr + ";\n", "fib", Opts);
+
+        auto JIT = llvm::cantFail(KaleidoscopeJIT::create(Mode));
+        llvm::cantFail(JIT->addModule(Compiled->CG->takeModule()));
+        return JIT;
+    }
+
+    // BM_FirstResult - From source text to the value of fib(10): parse,
+    // codegen, JIT setup, compilation and the call, at -O range(0).
+    void BM_FirstResult(benchmark::State &State, KaleidoscopeJIT::JITMode Mode)
+    {
+        const unsigned OptLevel = static_cast<unsigned>(State.range(0));
+        for (auto _ : State)
+        {
+            auto JIT = compileFib("fib(10)", OptLevel, Mode);
+            if (!JIT)
+            {
+                State.SkipWithError("no optimizer");
+                return;
+            }
+            benchmark::DoNotOptimize(llvm::cantFail(JIT->lookupExpr("entry"))());
+        }
+    }
+
+    // BM_FibRuntime - fib(range(0)) compiled once at -O range(1).
+    void BM_FibRuntime(benchmark::State &State)
+    {
+        auto JIT = compileFib("0", static_cast<unsigned>(State.range(1)), KaleidoscopeJIT::Eager);
+        if (!JIT)
+        {
+            State.SkipWithError("no optimizer");
+            return;
+        }
+        auto *Fn = llvm::jitTargetAddressToFunction<double (*)(double)>(
+            llvm::cantFail(JIT->getLLJIT().lookup("fib")).getAddress());
+        const double N = static_cast<double>(State.range(0));
+        for (auto _ : State)
+        {
+            benchmark::DoNotOptimize(Fn(N));
+        }
+    }
+}
+
+BENCHMARK(BM_Lex)->ArgName("mix")->DenseRange(DefaultMix, DeepMix)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Parse)->ArgName("mix")->DenseRange(DefaultMix, DeepMix)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Codegen)
+    ->ArgNames({"mix", "O"})
+    ->ArgsProduct({{DefaultMix, DeepMix}, {0, 2}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_FirstResult, eager, KaleidoscopeJIT::Eager)
+    ->ArgName("O")
+    ->Arg(0)
+    ->Arg(2)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_FirstResult, lazy, KaleidoscopeJIT::Lazy)
+    ->ArgName("O")
+    ->Arg(0)
+    ->Arg(2)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_FibRuntime)
+    ->ArgNames({"n", "O"})
+    ->ArgsProduct({{20, 25, 30}, {0, 2}})
+    ->Unit(benchmark::kMicrosecond);
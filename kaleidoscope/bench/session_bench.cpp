@@ -0,0 +1,63 @@
+// Sessions: time to redefine one function of a session that already holds
+// NumDefs, each calling its predecessor. Only the new body is compiled, so
+// the time should not grow with NumDefs.
+#include <session.h>
+
+#include <benchmark/benchmark.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    std::string makeDefinition(unsigned I, unsigned Constant)
+    {
+        std::string N = std::to_string(I);
+        std::string Callee = I == 0 ? "x" : "f" + std::to_string(I - 1) + "(x - 1, y * 0.5)";
+        return "def f" + N + "(x y)\n"
+               "    if x < 1 then y * " + std::to_string(Constant) + ".5 + x * x - y\n"
+               "    else if y < x then " + Callee + " + (x - y) * (x + y) * 0.25\n"
+               "    else " + Callee + " - x * y + " + N + "\n";
+    }
+
+    // sessionWith - A session holding NumDefs functions, built once per size:
+    // filling the large ones takes seconds.
+    Session &sessionWith(unsigned NumDefs)
+    {
+        static std::map<unsigned, std::unique_ptr<Session>> Sessions;
+        std::unique_ptr<Session> &S = Sessions[NumDefs];
+        if (!S)
+        {
+            S = Session::create(/*OptLevel=*/0, /*Fold=*/true);
+            std::string Library;
+            for (unsigned I = 0; I < NumDefs; ++I)
+            {
+                Library += makeDefinition(I, I);
+            }
+            std::vector<double> Results;
+            S->add(Library, Results);
+        }
+        return *S;
+    }
+
+    void BM_Redefine(benchmark::State &State)
+    {
+        unsigned NumDefs = static_cast<unsigned>(State.range(0));
+        Session &S = sessionWith(NumDefs);
+        unsigned Middle = NumDefs / 2, Constant = 0;
+        std::vector<double> Results;
+        for (auto _ : State)
+        {
+            if (S.add(makeDefinition(Middle, Constant++), Results))
+            {
+                State.SkipWithError("redefinition failed");
+                return;
+            }
+        }
+        State.counters["defs"] = static_cast<double>(S.getNumFunctions());
+    }
+}
+
+BENCHMARK(BM_Redefine)->Arg(100)->Arg(1000)->Arg(5000)->Unit(benchmark::kMillisecond);
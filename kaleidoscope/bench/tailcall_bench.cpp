@@ -0,0 +1,122 @@
+// Deep recursion: scripts that iterate by recursing Depth times, compiled
+// once and then called. With tail calls (the default) self tail calls are
+// loops and even/odd's mutual calls are jumps, so any depth runs; without
+// them, each level is a native frame and 10^7 levels overflow an 8 MB stack
+// and crash, so the plain variants only go to 10^4. sum needs the
+// accumulator loops of -fassociative-math. count_tail_memo gives count a
+// result cache, cleared before every iteration, which must keep the loop.
+// The interpreter reuses its frame for every tail call.
+#include "harness.h"
+
+#include <jit.h>
+#include <tiered.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace
+{
+    struct Script
+    {
+        const char *Defs;
+        const char *Callee; // called with Depth, then Rest
+        const char *Rest;
+    };
+
+    const Script Count = {"def count(n acc) if n < 1 then acc else count(n - 1, acc + 1)\n", "count", ", 0"};
+    const Script EvenOdd = {"def even(n) if n < 1 then 1 else odd(n - 1)\n"
+                            "def odd(n) if n < 1 then 0 else even(n - 1)\n",
+                            "even", ""};
+    const Script Sum = {"def sum(n) if n < 1 then 0 else n + sum(n - 1)\n", "sum", ""};
+
+    std::string makeSource(const Script &S, int64_t Depth)
+    {
+        return std::string(S.Defs) + S.Callee + "(" + std::to_string(Depth) + S.Rest + ");\n";
+    }
+
+    // BM_Recursion - S to range(0) levels, memoizing S.Callee with a cache of
+    // 2^MemoBits entries unless MemoBits is 0.
+    void BM_Recursion(benchmark::State &State, Script S, CodeGen::TailCallMode Mode, unsigned MemoBits = 0)
+    {
+        CompileOptions Opts;
+        Opts.TailCalls = Mode;
+        Opts.Memoize = MemoBits != 0 ? S.Callee : nullptr;
+        Opts.MemoCacheBits = MemoBits;
+        std::unique_ptr<CompiledScript> Compiled = compileModule(makeSource(S, State.range(0)), "script", Opts);
+        const std::string CacheName = std::string(S.Callee) + ".memo";
+        uint64_t CacheSize = 0;
+        if (llvm::GlobalVariable *Cache = Compiled->CG->getModule().getNamedGlobal(CacheName))
+        {
+            CacheSize = Compiled->CG->getModule().getDataLayout().getTypeAllocSize(Cache->getValueType());
+        }
+
+        auto JIT = llvm::cantFail(KaleidoscopeJIT::create(KaleidoscopeJIT::Eager));
+        llvm::cantFail(JIT->addModule(Compiled->CG->takeModule()));
+        double (*Fn)() = llvm::cantFail(JIT->lookupExpr("entry"));
+        void *Cache = nullptr;
+        if (CacheSize != 0)
+        {
+            Cache = llvm::jitTargetAddressToPointer<void *>(
+                llvm::cantFail(JIT->getLLJIT().lookup(CacheName)).getAddress());
+        }
+        for (auto _ : State)
+        {
+            if (Cache)
+            {
+                State.PauseTiming();
+                memset(Cache, 0, CacheSize);
+                State.ResumeTiming();
+            }
+            benchmark::DoNotOptimize(Fn());
+        }
+        State.counters["calls/s"] =
+            benchmark::Counter(static_cast<double>(State.range(0)), benchmark::Counter::kIsIterationInvariantRate);
+    }
+
+    void BM_InterpretedRecursion(benchmark::State &State, Script S)
+    {
+        CompileOptions Opts;
+        Opts.ExportEntry = false; // the engine runs the expression itself
+        std::unique_ptr<CompiledScript> Compiled = compileModule(makeSource(S, State.range(0)), "script", Opts);
+        auto Engine = llvm::cantFail(TieredEngine::create(/*Threshold=*/0));
+        Engine->addUnit(Compiled->M, Compiled->Symbols, "script", Compiled->CG->takeModule());
+        for (auto _ : State)
+        {
+            double Result = 0;
+            if (!Engine->run(Engine->getTopLevelExprs().front(), Result))
+            {
+                State.SkipWithError("interpreter failed");
+                return;
+            }
+            benchmark::DoNotOptimize(Result);
+        }
+        State.counters["calls/s"] =
+            benchmark::Counter(static_cast<double>(State.range(0)), benchmark::Counter::kIsIterationInvariantRate);
+    }
+}
+
+BENCHMARK_CAPTURE(BM_Recursion, count_plain, Count, CodeGen::NoTailCalls)->Arg(10000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Recursion, count_tail, Count, CodeGen::TailCalls)
+    ->Arg(10000)
+    ->Arg(10000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Recursion, count_tail_memo, Count, CodeGen::TailCalls, 10)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Recursion, evenodd_plain, EvenOdd, CodeGen::NoTailCalls)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Recursion, evenodd_tail, EvenOdd, CodeGen::TailCalls)
+    ->Arg(10000)
+    ->Arg(10000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Recursion, sum_plain, Sum, CodeGen::TailCalls)->Arg(10000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Recursion, sum_accumulator, Sum, CodeGen::AccumulatorTailCalls)
+    ->Arg(10000)
+    ->Arg(10000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_InterpretedRecursion, count, Count)->Arg(10000)->Arg(10000000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_InterpretedRecursion, evenodd, EvenOdd)->Arg(10000)->Arg(10000000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,138 @@
+#include "aot.h"
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetOptions.h"
+
+#include <cctype>
+#include <cstdio>
+#include <mutex>
+
+namespace
+{
+    // initializeAllTargets - Register every target LLVM was built with, for
+    // -mtriple; the JIT only registers the host.
+    void initializeAllTargets()
+    {
+        static std::once_flag Once;
+        std::call_once(Once,
+                       []
+                       {
+                           llvm::InitializeAllTargetInfos();
+                           llvm::InitializeAllTargets();
+                           llvm::InitializeAllTargetMCs();
+                           llvm::InitializeAllAsmPrinters();
+                       });
+    }
+}
+
+std::unique_ptr<llvm::TargetMachine> createAOTTargetMachine(const AOTTarget &T, unsigned OptLevel)
+{
+    initializeAllTargets();
+    std::string HostTriple = llvm::sys::getProcessTriple();
+    std::string TripleName = T.Triple.empty() ? HostTriple : llvm::Triple::normalize(T.Triple);
+    std::string Problem;
+    const llvm::Target *Target = llvm::TargetRegistry::lookupTarget(TripleName, Problem);
+    if (!Target)
+    {
+        fprintf(stderr, "Error: %s\n", Problem.c_str());
+        return nullptr;
+    }
+
+    std::string CPU = T.CPU;
+    llvm::SubtargetFeatures Features;
+    if (T.CPU == "native")
+    {
+        if (llvm::Triple(TripleName).getArch() != llvm::Triple(HostTriple).getArch())
+        {
+            fprintf(stderr, "Error: -mcpu=native needs the host's architecture, not '%s'\n", TripleName.c_str());
+            return nullptr;
+        }
+        CPU = llvm::sys::getHostCPUName().str();
+        llvm::StringMap<bool> HostFeatures;
+        if (llvm::sys::getHostCPUFeatures(HostFeatures))
+        {
+            for (const auto &KV : HostFeatures)
+            {
+                Features.AddFeature(KV.getKey(), KV.getValue());
+            }
+        }
+    }
+    llvm::SubtargetFeatures Attrs(T.Attrs);
+    for (llvm::StringRef Attr : Attrs.getFeatures())
+    {
+        Features.AddFeature(Attr);
+    }
+
+    llvm::CodeGenOpt::Level Level = OptLevel == 0   ? llvm::CodeGenOpt::None
+                                    : OptLevel == 1 ? llvm::CodeGenOpt::Less
+                                    : OptLevel == 2 ? llvm::CodeGenOpt::Default
+                                                    : llvm::CodeGenOpt::Aggressive;
+    std::unique_ptr<llvm::TargetMachine> TM(Target->createTargetMachine(
+        TripleName, CPU, Features.getString(), llvm::TargetOptions(), llvm::Reloc::PIC_, llvm::None, Level));
+    if (!TM)
+    {
+        fprintf(stderr, "Error: no target machine for '%s'\n", TripleName.c_str());
+        return nullptr;
+    }
+    return TM;
+}
+
+bool emitMachineCode(llvm::Module &M, llvm::TargetMachine &TM, bool Assembly, llvm::raw_pwrite_stream &OS)
+{
+    llvm::legacy::PassManager PM;
+    if (TM.addPassesToEmitFile(PM, OS, nullptr, Assembly ? llvm::CGFT_AssemblyFile : llvm::CGFT_ObjectFile))
+    {
+        fprintf(stderr, "Error: %s can't emit %s files\n", TM.getTargetTriple().str().c_str(),
+                Assembly ? "assembly" : "object");
+        return false;
+    }
+    PM.run(M);
+    OS.flush();
+    return true;
+}
+
+std::string generateCHeader(const ModuleAST &M, const SymbolTable &Symbols, llvm::StringRef Source)
+{
+    std::string Guard;
+    for (char C : Source)
+    {
+        Guard += isalnum(static_cast<unsigned char>(C)) ? static_cast<char>(toupper(static_cast<unsigned char>(C)))
+                                                         : '_';
+    }
+    if (Guard.empty() || isdigit(static_cast<unsigned char>(Guard[0])))
+    {
+        Guard.insert(0, "KS_");
+    }
+    Guard += "_H";
+
+    std::string H = "/* Functions of " + Source.str() + ", generated by kaleidoscope. */\n";
+    H += "#ifndef " + Guard + "\n#define " + Guard + "\n\n";
+    H += "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n";
+    for (const FunctionAST *F : M.Functions)
+    {
+        const PrototypeAST *P = F->getProto();
+        // Specializations ("f.spec0") are only called from within.
+        std::string_view Name = Symbols.getName(P->getName());
+        if (isTopLevelExpr(P, Symbols) || Name.find('.') != std::string_view::npos)
+        {
+            continue;
+        }
+        H += "double ";
+        H += Symbols.getName(P->getName());
+        // Parameters go unnamed: Kaleidoscope allows names like "int" or
+        // "return" that a C compiler would choke on.
+        H += "(";
+        for (uint32_t I = 0, E = P->getArgs().size(); I != E; ++I)
+        {
+            H += I ? ", double" : "double";
+        }
+        H += P->getArgs().empty() ? "void);\n" : ");\n";
+    }
+    H += "\n#ifdef __cplusplus\n}\n#endif\n\n#endif /* " + Guard + " */\n";
+    return H;
+}
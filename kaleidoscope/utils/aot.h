@@ -0,0 +1,47 @@
+#ifndef KALEIDOSCOPE_UTILS_AOT_H
+#define KALEIDOSCOPE_UTILS_AOT_H
+
+#include "ast.h"
+#include "symboltable.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <memory>
+#include <string>
+
+//===-------------------------------------------------------------===//
+// Ahead-of-time compilation
+//===-------------------------------------------------------------===//
+// -emit-obj and -emit-asm compile each unit through a TargetMachine instead
+// of the JIT, so the functions can be linked into a program that never
+// starts LLVM. Every def is an external double(double, ...) symbol under its
+// own name, and generateCHeader() declares them for C and C++ callers.
+// Top-level expressions stay internal and are never called.
+
+// AOTTarget - The machine to compile for.
+struct AOTTarget
+{
+    std::string Triple; // -mtriple=T; empty for the host
+    std::string CPU;    // -mcpu=NAME; empty for the target's default, "native" for the host's CPU and features
+    std::string Attrs;  // -mattr=+a,-b: features to add to or remove from the CPU's
+};
+
+// createAOTTargetMachine - A TargetMachine for T generating position
+// independent code at OptLevel (0 to 3), or null after printing why not.
+// Safe to call from any thread.
+std::unique_ptr<llvm::TargetMachine> createAOTTargetMachine(const AOTTarget &T, unsigned OptLevel);
+
+// emitMachineCode - Compile M, whose triple and data layout are TM's, to an
+// object file, or to assembly with Assembly, on OS. Returns false after
+// printing an error.
+bool emitMachineCode(llvm::Module &M, llvm::TargetMachine &TM, bool Assembly, llvm::raw_pwrite_stream &OS);
+
+// generateCHeader - A C header declaring each function M defines, with
+// unnamed parameters, inside extern "C" for C++; Source names the input in a
+// comment and gives the include guard.
+std::string generateCHeader(const ModuleAST &M, const SymbolTable &Symbols, llvm::StringRef Source);
+
+#endif // KALEIDOSCOPE_UTILS_AOT_H
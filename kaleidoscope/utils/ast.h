@@ -0,0 +1,239 @@
+#ifndef KALEIDOSCOPE_UTILS_AST_H
+#define KALEIDOSCOPE_UTILS_AST_H
+
+#include "bumpallocator.h"
+#include "symboltable.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//===-------------------------------------------------------------===//
+// AST
+//===-------------------------------------------------------------===//
+// Every node of a module is allocated in one ASTContext and referenced through
+// plain non-owning pointers. Nodes are never destroyed one by one, so they
+// must be trivially destructible: child lists are ASTArrays in the same arena
+// rather than std::vectors, and there is no virtual destructor (or any other
+// virtual function). Instead each ExprAST records its kind, and passes switch
+// over getKind().
+
+// ASTArray - A fixed-size array whose elements live in an ASTContext.
+template <typename T>
+class ASTArray
+{
+private:
+    T *Data = nullptr;
+    uint32_t Size = 0;
+
+public:
+    ASTArray() = default;
+    ASTArray(T *Data, uint32_t Size) : Data(Data), Size(Size) {}
+
+    T *begin() const { return Data; }
+    T *end() const { return Data + Size; }
+    uint32_t size() const { return Size; }
+    bool empty() const { return Size == 0; }
+    T &operator[](uint32_t I) const { return Data[I]; }
+};
+
+// ExprAST - Base class for all expression nodes.
+class ExprAST
+{
+public:
+    enum ExprKind : uint8_t
+    {
+        Number,
+        Variable,
+        Binary,
+        Call,
+        If,
+    };
+
+private:
+    ExprKind Kind;
+
+protected:
+    ExprAST(ExprKind Kind) : Kind(Kind) {}
+
+public:
+    ExprKind getKind() const { return Kind; }
+};
+
+// Numrical literals class
+class NumberExprAST : public ExprAST
+{
+private:
+    double Val;
+
+public:
+    NumberExprAST(double Val) : ExprAST(Number), Val(Val) {}
+    double get_val() const { return Val; }
+};
+
+// VariableExprAST - Expression class for referencing a variable, like "a".
+class VariableExprAST : public ExprAST
+{
+private:
+    Symbol Name;
+
+public:
+    VariableExprAST(Symbol Name) : ExprAST(Variable), Name(Name) {}
+    Symbol get_val() const { return Name; }
+    void setName(Symbol S) { Name = S; }
+};
+
+// BinaryExprAST - Expression class for a binary operator.
+class BinaryExprAST : public ExprAST
+{
+private:
+    char Op;
+    ExprAST *LHS, *RHS;
+
+public:
+    BinaryExprAST(char Op, ExprAST *LHS, ExprAST *RHS) : ExprAST(Binary), Op(Op), LHS(LHS), RHS(RHS) {}
+
+    char getOp() const { return Op; }
+    ExprAST *getLHS() const { return LHS; }
+    ExprAST *getRHS() const { return RHS; }
+    void setLHS(ExprAST *E) { LHS = E; }
+    void setRHS(ExprAST *E) { RHS = E; }
+};
+
+// CallExprAST - Expression class for function calls.
+class CallExprAST : public ExprAST
+{
+private:
+    Symbol Callee;
+    ASTArray<ExprAST *> Args;
+
+public:
+    CallExprAST(Symbol Callee, ASTArray<ExprAST *> Args) : ExprAST(Call), Callee(Callee), Args(Args) {}
+
+    Symbol getCallee() const { return Callee; }
+    void setCallee(Symbol S) { Callee = S; }
+    ASTArray<ExprAST *> getArgs() const { return Args; }
+};
+
+// IfExprAST - Expression class for if/then/else.
+class IfExprAST : public ExprAST
+{
+private:
+    ExprAST *Cond, *Then, *Else;
+
+public:
+    IfExprAST(ExprAST *Cond, ExprAST *Then, ExprAST *Else) : ExprAST(If), Cond(Cond), Then(Then), Else(Else) {}
+
+    ExprAST *getCond() const { return Cond; }
+    ExprAST *getThen() const { return Then; }
+    ExprAST *getElse() const { return Else; }
+    void setCond(ExprAST *E) { Cond = E; }
+    void setThen(ExprAST *E) { Then = E; }
+    void setElse(ExprAST *E) { Else = E; }
+};
+
+// PrototypeAST - This class represents the "prototype" for a function,
+// which captures its name, and its argument names (thus implicitly the number
+// of arguments the function takes).
+class PrototypeAST
+{
+private:
+    Symbol Name;
+    ASTArray<Symbol> Args;
+
+public:
+    PrototypeAST(Symbol Name, ASTArray<Symbol> Args) : Name(Name), Args(Args) {}
+
+    Symbol getName() const { return Name; }
+    void setName(Symbol S) { Name = S; }
+    ASTArray<Symbol> getArgs() const { return Args; }
+};
+
+// isTopLevelExpr - Whether P is the prototype the parser wraps a top-level
+// expression in: no parameters and the name "__anon_expr" in Symbols.
+inline bool isTopLevelExpr(const PrototypeAST *P, const SymbolTable &Symbols)
+{
+    return P->getArgs().empty() && Symbols.getName(P->getName()) == "__anon_expr";
+}
+
+// FunctionAST - This class represents a function definition itself.
+class FunctionAST
+{
+private:
+    PrototypeAST *Proto;
+    ExprAST *Body;
+
+public:
+    FunctionAST(PrototypeAST *Proto, ExprAST *Body) : Proto(Proto), Body(Body) {}
+
+    PrototypeAST *getProto() const { return Proto; }
+    ExprAST *getBody() const { return Body; }
+    void setBody(ExprAST *E) { Body = E; }
+};
+
+// ASTContext - Owns every node of one module. Allocation bumps a pointer and
+// the whole tree is released in one shot when the context goes away.
+class ASTContext
+{
+private:
+    BumpAllocator Allocator;
+    size_t NumNodes = 0;
+
+public:
+    ASTContext() = default;
+    ASTContext(const ASTContext &) = delete;
+    ASTContext &operator=(const ASTContext &) = delete;
+
+    // create - Construct a node in the arena.
+    template <typename T, typename... ArgTys>
+    T *create(ArgTys &&...Args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "AST nodes are never destroyed individually");
+        ++NumNodes;
+        return new (Allocator.allocate(sizeof(T), alignof(T))) T(std::forward<ArgTys>(Args)...);
+    }
+
+    // copyArray - Copy Elts[Begin, end) into the arena.
+    template <typename T>
+    ASTArray<T> copyArray(const std::vector<T> &Elts, size_t Begin = 0)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "ASTArray elements are copied bytewise");
+        size_t N = Elts.size() - Begin;
+        if (N == 0)
+        {
+            return ASTArray<T>();
+        }
+        T *Data = static_cast<T *>(Allocator.allocate(N * sizeof(T), alignof(T)));
+        memcpy(static_cast<void *>(Data), Elts.data() + Begin, N * sizeof(T));
+        return ASTArray<T>(Data, static_cast<uint32_t>(N));
+    }
+
+    // absorb - Take ownership of every node allocated in Other, e.g. to merge
+    // modules that were parsed separately. Other is left empty.
+    void absorb(ASTContext &&Other)
+    {
+        Allocator.absorb(std::move(Other.Allocator));
+        NumNodes += Other.NumNodes;
+        Other.NumNodes = 0;
+    }
+
+    size_t getNumNodes() const { return NumNodes; }
+    size_t getBytesAllocated() const { return Allocator.getBytesAllocated(); }
+    size_t getTotalMemory() const { return Allocator.getTotalMemory(); }
+};
+
+// ModuleAST - The top-level items of one parsed source, in source order.
+// Top-level expressions are wrapped in anonymous FunctionASTs, as the JIT will
+// run them like zero-argument functions.
+struct ModuleAST
+{
+    std::vector<FunctionAST *> Functions;
+    std::vector<PrototypeAST *> Externs;
+};
+
+#endif // KALEIDOSCOPE_UTILS_AST_H
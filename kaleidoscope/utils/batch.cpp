@@ -0,0 +1,122 @@
+#include "batch.h"
+
+#include "codegen.h"
+#include "fold.h"
+#include "frontend.h"
+#include "optimizer.h"
+#include "sema.h"
+#include "sourcebuffer.h"
+#include "symboltable.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Host.h"
+
+#include <cstdio>
+#include <string>
+
+unsigned hostVectorWidth()
+{
+    llvm::StringMap<bool> Features;
+    if (!llvm::sys::getHostCPUFeatures(Features))
+    {
+        return 2;
+    }
+    if (Features.lookup("avx512f"))
+    {
+        return 8;
+    }
+    return Features.lookup("avx") ? 4 : 2;
+}
+
+std::unique_ptr<BatchFunction> BatchFunction::compile(std::string_view Source, std::string_view Name,
+                                                      unsigned OptLevel, unsigned Width)
+{
+    auto Buffer = SourceBuffer::getMemBuffer(std::string(Source), "<batch>");
+    SymbolTable Symbols;
+    ASTContext Ctx;
+    Lexer Lex(*Buffer, Symbols);
+    Parser P(Lex);
+    ModuleAST M = P.parseModule(Ctx);
+    if (P.getNumErrors())
+    {
+        return nullptr;
+    }
+    ModuleInterface Interface;
+    Interface.FileName = "<batch>";
+    if (checkModule(M, Symbols, Interface))
+    {
+        return nullptr;
+    }
+    for (const FunctionSignature &Import : Interface.Imports)
+    {
+        fprintf(stderr, "Error: <batch>: unknown function '%s'\n", Import.Name.c_str());
+    }
+    if (!Interface.Imports.empty())
+    {
+        return nullptr;
+    }
+    foldModule(M, Ctx);
+
+    Symbol S = Symbols.lookup(Name);
+    const FunctionAST *Def = nullptr;
+    for (const FunctionAST *F : M.Functions)
+    {
+        if (F->getProto()->getName() == S && Name != "__anon_expr")
+        {
+            Def = F;
+        }
+    }
+    if (!Def)
+    {
+        fprintf(stderr, "Error: <batch>: no function '%.*s' to batch\n", static_cast<int>(Name.size()), Name.data());
+        return nullptr;
+    }
+
+    std::unique_ptr<FunctionOptimizer> Optimizer;
+    if (OptLevel > 0)
+    {
+        Optimizer = FunctionOptimizer::create(OptLevel, nullptr);
+        if (!Optimizer)
+        {
+            return nullptr;
+        }
+    }
+    CodeGen CG(Symbols, "<batch>");
+    CG.setOptimizer(Optimizer.get());
+    if (CG.codegenModule(M))
+    {
+        return nullptr;
+    }
+    if (Width == 0)
+    {
+        Width = hostVectorWidth();
+    }
+    llvm::Function *K = CG.codegenBatch(M, S, Width);
+    if (!K)
+    {
+        return nullptr;
+    }
+    std::string KernelName = K->getName().str();
+
+    auto JIT = KaleidoscopeJIT::create(KaleidoscopeJIT::Eager);
+    if (!JIT)
+    {
+        fprintf(stderr, "Error: %s\n", llvm::toString(JIT.takeError()).c_str());
+        return nullptr;
+    }
+    if (auto Err = (*JIT)->addModule(CG.takeModule()))
+    {
+        fprintf(stderr, "Error: %s\n", llvm::toString(std::move(Err)).c_str());
+        return nullptr;
+    }
+    auto Sym = (*JIT)->getLLJIT().lookup(KernelName);
+    if (!Sym)
+    {
+        fprintf(stderr, "Error: %s\n", llvm::toString(Sym.takeError()).c_str());
+        return nullptr;
+    }
+    auto Kernel = llvm::jitTargetAddressToFunction<BatchKernel>(Sym->getAddress());
+    return std::unique_ptr<BatchFunction>(
+        new BatchFunction(std::move(*JIT), Kernel, Def->getProto()->getArgs().size(), Width));
+}
@@ -0,0 +1,57 @@
+#ifndef KALEIDOSCOPE_UTILS_BATCH_H
+#define KALEIDOSCOPE_UTILS_BATCH_H
+
+#include "jit.h"
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+//===-------------------------------------------------------------===//
+// Batch evaluation
+//===-------------------------------------------------------------===//
+// BatchKernel - Out[i] = f(Columns[0][i], ..., Columns[N-1][i]) for every
+// row i below NumRows; Out may not overlap the columns.
+using BatchKernel = void (*)(const double *const *Columns, double *Out, uint64_t NumRows);
+
+// BatchFunction - A function of a script compiled for whole columns of
+// arguments at once, for embedders that evaluate one formula over many rows
+// (see CodeGen::codegenBatch). The kernel only reads the compiled code, so
+// run() may be called from several threads at once.
+class BatchFunction
+{
+private:
+    std::unique_ptr<KaleidoscopeJIT> JIT;
+    BatchKernel Kernel;
+    unsigned Arity;
+    unsigned Width;
+
+    BatchFunction(std::unique_ptr<KaleidoscopeJIT> JIT, BatchKernel Kernel, unsigned Arity, unsigned Width)
+        : JIT(std::move(JIT)), Kernel(Kernel), Arity(Arity), Width(Width)
+    {
+    }
+
+public:
+    // compile - Compile the script Source, which must define Name, and a
+    // kernel for Name that computes Width rows at a time; Width is a power
+    // of two, or 0 for the host's vector width for doubles. Top-level expressions of Source are
+    // compiled but never run. Reports its own errors and returns null.
+    static std::unique_ptr<BatchFunction> compile(std::string_view Source, std::string_view Name,
+                                                  unsigned OptLevel = 2, unsigned Width = 0);
+
+    // run - Evaluate the function on NumRows rows: Columns holds getArity()
+    // arrays of NumRows arguments each, Out gets the results.
+    void run(const double *const *Columns, double *Out, uint64_t NumRows) const { Kernel(Columns, Out, NumRows); }
+
+    BatchKernel getKernel() const { return Kernel; }
+    unsigned getArity() const { return Arity; }
+    // getWidth - The rows the kernel computes at once; 1 if it calls the
+    // function row by row, e.g. because the function recurses.
+    unsigned getWidth() const { return Width; }
+};
+
+// hostVectorWidth - The number of doubles in the host's widest vector
+// registers: 8 with AVX-512, 4 with AVX, otherwise 2.
+unsigned hostVectorWidth();
+
+#endif // KALEIDOSCOPE_UTILS_BATCH_H
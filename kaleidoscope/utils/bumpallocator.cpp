@@ -0,0 +1,53 @@
+#include "bumpallocator.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Slabs start at 64 KiB and double every 16 slabs, capped at 64 MiB, so
+    // small modules stay small and huge ones need few slabs.
+    const size_t InitialSlabSize = 64 * 1024;
+    const size_t SlabGrowthInterval = 16;
+    const size_t MaxSlabShift = 10;
+
+    size_t slabSizeFor(size_t NumSlabs)
+    {
+        return InitialSlabSize << std::min(NumSlabs / SlabGrowthInterval, MaxSlabShift);
+    }
+}
+
+void *BumpAllocator::allocateSlow(size_t Size, size_t Align)
+{
+    size_t Padded = Size + Align - 1;
+    size_t SlabSize = slabSizeFor(Slabs.size());
+
+    // Oversized requests get a slab of their own so the current slab keeps its
+    // free space.
+    if (Padded > SlabSize / 2)
+    {
+        Slabs.emplace_back(new char[Padded]);
+        TotalMemory += Padded;
+        uintptr_t P = (reinterpret_cast<uintptr_t>(Slabs.back().get()) + Align - 1) &
+                      ~(uintptr_t(Align) - 1);
+        BytesAllocated += Size;
+        return reinterpret_cast<void *>(P);
+    }
+
+    Slabs.emplace_back(new char[SlabSize]);
+    TotalMemory += SlabSize;
+    CurPtr = Slabs.back().get();
+    End = CurPtr + SlabSize;
+    return allocate(Size, Align);
+}
+
+void BumpAllocator::absorb(BumpAllocator &&Other)
+{
+    // CurPtr stays in our own slab; the adopted ones are only kept alive.
+    Slabs.insert(Slabs.end(), std::make_move_iterator(Other.Slabs.begin()),
+                 std::make_move_iterator(Other.Slabs.end()));
+    BytesAllocated += Other.BytesAllocated;
+    TotalMemory += Other.TotalMemory;
+    Other.Slabs.clear();
+    Other.CurPtr = Other.End = nullptr;
+    Other.BytesAllocated = Other.TotalMemory = 0;
+}
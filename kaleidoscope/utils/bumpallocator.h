@@ -0,0 +1,52 @@
+#ifndef KALEIDOSCOPE_UTILS_BUMPALLOCATOR_H
+#define KALEIDOSCOPE_UTILS_BUMPALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// BumpAllocator - Hands out memory by bumping a pointer through large slabs.
+// Nothing is freed individually; all slabs are released together when the
+// allocator is destroyed, so allocation is a few instructions and teardown is
+// one free() per slab instead of one per object.
+class BumpAllocator
+{
+private:
+    std::vector<std::unique_ptr<char[]>> Slabs;
+    char *CurPtr = nullptr;
+    char *End = nullptr;
+    size_t BytesAllocated = 0; // bytes handed out, excluding padding
+    size_t TotalMemory = 0;    // bytes held in slabs
+
+    void *allocateSlow(size_t Size, size_t Align);
+
+public:
+    BumpAllocator() = default;
+    BumpAllocator(const BumpAllocator &) = delete;
+    BumpAllocator &operator=(const BumpAllocator &) = delete;
+    BumpAllocator(BumpAllocator &&) = default;
+    BumpAllocator &operator=(BumpAllocator &&) = default;
+
+    // allocate - Return Size bytes aligned to Align, which must be a power of 2.
+    void *allocate(size_t Size, size_t Align)
+    {
+        uintptr_t P = (reinterpret_cast<uintptr_t>(CurPtr) + Align - 1) & ~(uintptr_t(Align) - 1);
+        if (CurPtr && P + Size <= reinterpret_cast<uintptr_t>(End))
+        {
+            CurPtr = reinterpret_cast<char *>(P + Size);
+            BytesAllocated += Size;
+            return reinterpret_cast<void *>(P);
+        }
+        return allocateSlow(Size, Align);
+    }
+
+    // absorb - Take over the slabs of Other, so memory it handed out lives as
+    // long as this allocator. Other is left empty.
+    void absorb(BumpAllocator &&Other);
+
+    size_t getBytesAllocated() const { return BytesAllocated; }
+    size_t getTotalMemory() const { return TotalMemory; }
+};
+
+#endif // KALEIDOSCOPE_UTILS_BUMPALLOCATOR_H
@@ -0,0 +1,421 @@
+#include "bytecode.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    const uint32_t MaxRegisters = UINT16_MAX;
+}
+
+// Compiler - Emits the bytecode of one unit. Like codegen, the expression
+// walk keeps its own stack so long operator chains cannot overflow the
+// native stack; a node is visited once per Stage.
+class BytecodeModule::Compiler
+{
+private:
+    BytecodeModule &BC;
+    const SymbolTable &Symbols;
+    const std::string &FileName;
+    unsigned NumErrors = 0;
+
+    // ParamReg[S] - The register of parameter S in the current function, or
+    // -1 for anything that isn't a parameter of it.
+    std::vector<int32_t> ParamReg;
+
+    uint32_t Top = 0; // next free register
+    uint32_t Max = 0; // frame size so far
+    const char *CurName = nullptr;
+
+    struct Frame
+    {
+        const ExprAST *E;
+        uint32_t Stage;
+        uint32_t Save;  // Top when the node was entered
+        uint32_t Patch; // the jump of an if whose target is still open
+        bool Tail;      // the function returns the node's value
+    };
+    std::vector<Frame> Frames;
+    std::vector<uint32_t> Results;
+
+    void logError(const char *Fmt, const std::string &Name)
+    {
+        char Msg[512];
+        snprintf(Msg, sizeof(Msg), Fmt, Name.c_str());
+        fprintf(stderr, "Error: %s: %s\n", FileName.c_str(), Msg);
+        ++NumErrors;
+    }
+
+    std::string name(Symbol S) const { return std::string(Symbols.getName(S)); }
+
+    // alloc - The next free register, growing the frame if needed.
+    bool alloc(uint32_t &Reg)
+    {
+        if (Top >= MaxRegisters)
+        {
+            logError("function '%s' needs too many registers for the interpreter", CurName);
+            return false;
+        }
+        Reg = Top++;
+        Max = Top > Max ? Top : Max;
+        return true;
+    }
+
+    void emit(bc::Opcode Op, uint32_t Dst, uint32_t A, uint32_t B)
+    {
+        BC.Code.push_back({Op, static_cast<uint16_t>(Dst), static_cast<uint16_t>(A), B});
+    }
+
+    // place - Make Reg's value live in register Dst, which becomes the top.
+    void place(uint32_t Reg, uint32_t Dst)
+    {
+        if (Reg != Dst)
+        {
+            emit(bc::Move, Dst, Reg, 0);
+        }
+        Top = Dst + 1;
+        Max = Top > Max ? Top : Max;
+    }
+
+    bool expr(const ExprAST *Root, bool Tail, uint32_t &Out);
+    bool call(uint32_t Callee, uint32_t NumArgs, const std::string &Name, uint32_t Save, bool Tail, uint32_t &Out);
+
+public:
+    Compiler(BytecodeModule &BC, const SymbolTable &Symbols, const std::string &FileName)
+        : BC(BC), Symbols(Symbols), FileName(FileName), ParamReg(Symbols.size(), -1)
+    {
+    }
+
+    void function(const FunctionAST *Fn, uint32_t Index);
+    unsigned getNumErrors() const { return NumErrors; }
+};
+
+// call - Emit a call to Callee whose arguments are in the registers from
+// Save on; the result replaces them. A tail call doesn't come back, so Out
+// is only a placeholder.
+bool BytecodeModule::Compiler::call(uint32_t Callee, uint32_t NumArgs, const std::string &Name, uint32_t Save,
+                                    bool Tail, uint32_t &Out)
+{
+    const bc::Function &F = *BC.Functions[Callee];
+    if (F.NumParams != NumArgs)
+    {
+        logError("incorrect number of arguments passed to '%s'", Name);
+        return false;
+    }
+    emit(Tail ? bc::TailCall : bc::Call, Save, Save, Callee);
+    place(Save, Save);
+    Out = Save;
+    return true;
+}
+
+// expr - Emit Root into a register, Out. With Tail, Root is the function's
+// value: its calls in tail position become tail calls, and the arms of its
+// ifs return instead of meeting at the end.
+bool BytecodeModule::Compiler::expr(const ExprAST *Root, bool Tail, uint32_t &Out)
+{
+    size_t FrameBase = Frames.size(), ResultBase = Results.size();
+    auto Fail = [&]
+    {
+        Frames.resize(FrameBase);
+        Results.resize(ResultBase);
+        return false;
+    };
+    auto PopResult = [&]
+    {
+        uint32_t R = Results.back();
+        Results.pop_back();
+        return R;
+    };
+
+    Frames.push_back({Root, 0, Top, 0, Tail});
+    while (Frames.size() > FrameBase)
+    {
+        Frame F = Frames.back();
+        Frames.pop_back();
+        switch (F.E->getKind())
+        {
+        case ExprAST::Number:
+        {
+            uint32_t R;
+            if (!alloc(R))
+            {
+                return Fail();
+            }
+            emit(bc::LoadK, R, 0, BC.constant(static_cast<const NumberExprAST *>(F.E)->get_val()));
+            Results.push_back(R);
+            break;
+        }
+        case ExprAST::Variable:
+        {
+            Symbol Name = static_cast<const VariableExprAST *>(F.E)->get_val();
+            int32_t R = ParamReg[Name.getID()];
+            if (R < 0)
+            {
+                logError("unknown variable name '%s'", name(Name));
+                return Fail();
+            }
+            Results.push_back(static_cast<uint32_t>(R));
+            break;
+        }
+        case ExprAST::Binary:
+        {
+            auto *B = static_cast<const BinaryExprAST *>(F.E);
+            if (F.Stage == 0)
+            {
+                Frames.push_back({F.E, 1, Top, 0, false});
+                Frames.push_back({B->getRHS(), 0, 0, 0, false});
+                Frames.push_back({B->getLHS(), 0, 0, 0, false});
+                break;
+            }
+            uint32_t R = PopResult();
+            uint32_t L = PopResult();
+            bc::Opcode Op;
+            switch (B->getOp())
+            {
+            case '+':
+                Op = bc::Add;
+                break;
+            case '-':
+                Op = bc::Sub;
+                break;
+            case '*':
+                Op = bc::Mul;
+                break;
+            case '<':
+                Op = bc::Lt;
+                break;
+            default:
+            {
+                // A user-defined operator calls "binary<op>", as in codegen.
+                std::string FnName = std::string("binary") + B->getOp();
+                auto It = BC.ByName.find(FnName);
+                if (It == BC.ByName.end() || BC.Functions[It->second]->NumParams != 2)
+                {
+                    logError("invalid binary operator '%s'", std::string(1, B->getOp()));
+                    return Fail();
+                }
+                // R may live in F.Save, where L has to go.
+                uint32_t Tmp = R;
+                if (R == F.Save)
+                {
+                    Top = F.Save + 2 > Top ? F.Save + 2 : Top;
+                    Max = Top > Max ? Top : Max;
+                    Tmp = F.Save + 1;
+                    emit(bc::Move, Tmp, R, 0);
+                }
+                place(L, F.Save);
+                place(Tmp, F.Save + 1);
+                uint32_t D;
+                if (!call(It->second, 2, FnName, F.Save, false, D))
+                {
+                    return Fail();
+                }
+                Results.push_back(D);
+                continue;
+            }
+            }
+            Top = F.Save;
+            uint32_t D;
+            if (!alloc(D))
+            {
+                return Fail();
+            }
+            emit(Op, D, L, R);
+            Results.push_back(D);
+            break;
+        }
+        case ExprAST::Call:
+        {
+            // Stage N means the first N arguments are in place.
+            auto *C = static_cast<const CallExprAST *>(F.E);
+            ASTArray<ExprAST *> Args = C->getArgs();
+            if (F.Stage == 0)
+            {
+                F.Save = Top;
+            }
+            else
+            {
+                place(PopResult(), F.Save + F.Stage - 1);
+            }
+            if (F.Stage < Args.size())
+            {
+                Frames.push_back({F.E, F.Stage + 1, F.Save, 0, F.Tail});
+                Frames.push_back({Args[F.Stage], 0, 0, 0, false});
+                break;
+            }
+            std::string Name = name(C->getCallee());
+            uint32_t D;
+            if (!call(BC.getOrCreate(Name, Args.size()), Args.size(), Name, F.Save, F.Tail, D))
+            {
+                return Fail();
+            }
+            Results.push_back(D);
+            break;
+        }
+        case ExprAST::If:
+        {
+            auto *If = static_cast<const IfExprAST *>(F.E);
+            switch (F.Stage)
+            {
+            case 0:
+                Frames.push_back({F.E, 1, Top, 0, F.Tail});
+                Frames.push_back({If->getCond(), 0, 0, 0, false});
+                break;
+            case 1:
+            {
+                uint32_t Cond = PopResult();
+                Top = F.Save;
+                uint32_t Patch = static_cast<uint32_t>(BC.Code.size());
+                emit(bc::JumpIfFalse, 0, Cond, 0);
+                Frames.push_back({F.E, 2, F.Save, Patch, F.Tail});
+                Frames.push_back({If->getThen(), 0, 0, 0, F.Tail});
+                break;
+            }
+            case 2:
+            {
+                // Both arms leave their value in F.Save, or return it.
+                uint32_t Patch = 0;
+                if (F.Tail)
+                {
+                    emit(bc::Ret, 0, PopResult(), 0);
+                }
+                else
+                {
+                    place(PopResult(), F.Save);
+                    Patch = static_cast<uint32_t>(BC.Code.size());
+                    emit(bc::Jump, 0, 0, 0);
+                }
+                BC.Code[F.Patch].B = static_cast<uint32_t>(BC.Code.size());
+                Top = F.Save;
+                Frames.push_back({F.E, 3, F.Save, Patch, F.Tail});
+                Frames.push_back({If->getElse(), 0, 0, 0, F.Tail});
+                break;
+            }
+            default:
+                if (F.Tail)
+                {
+                    break; // the else arm's value is the if's
+                }
+                place(PopResult(), F.Save);
+                BC.Code[F.Patch].B = static_cast<uint32_t>(BC.Code.size());
+                Results.push_back(F.Save);
+                break;
+            }
+            break;
+        }
+        }
+    }
+
+    Out = PopResult();
+    return true;
+}
+
+void BytecodeModule::Compiler::function(const FunctionAST *Fn, uint32_t Index)
+{
+    const PrototypeAST *P = Fn->getProto();
+    bc::Function &F = *BC.Functions[Index];
+    CurName = F.Name.c_str();
+
+    uint32_t NumParams = P->getArgs().size();
+    for (uint32_t I = 0; I < NumParams; ++I)
+    {
+        ParamReg[P->getArgs()[I].getID()] = static_cast<int32_t>(I);
+    }
+    Top = Max = NumParams;
+
+    size_t CodeBase = BC.Code.size();
+    uint32_t Result;
+    bool OK = expr(Fn->getBody(), /*Tail=*/true, Result);
+    if (OK)
+    {
+        emit(bc::Ret, 0, Result, 0);
+        F.Entry = static_cast<uint32_t>(CodeBase);
+        F.NumRegs = Max;
+        F.Defined = true;
+    }
+    else
+    {
+        BC.Code.resize(CodeBase);
+    }
+
+    for (Symbol Param : P->getArgs())
+    {
+        ParamReg[Param.getID()] = -1;
+    }
+}
+
+uint32_t BytecodeModule::getOrCreate(const std::string &Name, uint32_t NumParams)
+{
+    auto It = ByName.try_emplace(Name, static_cast<uint32_t>(Functions.size()));
+    if (It.second)
+    {
+        Functions.push_back(std::make_unique<bc::Function>());
+        Functions.back()->Name = Name;
+        Functions.back()->NumParams = NumParams;
+    }
+    return It.first->second;
+}
+
+uint32_t BytecodeModule::constant(double Val)
+{
+    uint64_t Bits;
+    memcpy(&Bits, &Val, sizeof(Bits));
+    auto It = ConstantIndex.try_emplace(Bits, static_cast<uint32_t>(Constants.size()));
+    if (It.second)
+    {
+        Constants.push_back(Val);
+    }
+    return It.first->second;
+}
+
+unsigned BytecodeModule::addUnit(const ModuleAST &M, const SymbolTable &Symbols, const std::string &FileName)
+{
+    Compiler C(*this, Symbols, FileName);
+    uint32_t Unit = NumUnits++;
+
+    // Declare everything first, so calls to later definitions in this unit
+    // get their arity checked.
+    for (const PrototypeAST *P : M.Externs)
+    {
+        getOrCreate(std::string(Symbols.getName(P->getName())), P->getArgs().size());
+    }
+    for (const FunctionAST *Fn : M.Functions)
+    {
+        if (!isTopLevelExpr(Fn->getProto(), Symbols))
+        {
+            getOrCreate(std::string(Symbols.getName(Fn->getProto()->getName())), Fn->getProto()->getArgs().size());
+        }
+    }
+
+    unsigned NumExprs = 0;
+    for (const FunctionAST *Fn : M.Functions)
+    {
+        uint32_t Index;
+        bool IsTopLevel = isTopLevelExpr(Fn->getProto(), Symbols);
+        if (IsTopLevel)
+        {
+            // Top-level expressions are not callable by name, so they stay
+            // out of ByName.
+            Index = static_cast<uint32_t>(Functions.size());
+            Functions.push_back(std::make_unique<bc::Function>());
+            Functions.back()->Name = "__anon_expr." + std::to_string(Unit) + "." + std::to_string(NumExprs++);
+        }
+        else
+        {
+            Index = ByName.find(std::string(Symbols.getName(Fn->getProto()->getName())))->second;
+        }
+        Functions[Index]->Unit = Unit;
+        C.function(Fn, Index);
+        if (IsTopLevel && Functions[Index]->Defined)
+        {
+            TopLevelExprs.push_back(Index);
+        }
+    }
+    return C.getNumErrors();
+}
+
+int64_t BytecodeModule::lookup(const std::string &Name) const
+{
+    auto It = ByName.find(Name);
+    return It == ByName.end() ? -1 : It->second;
+}
@@ -0,0 +1,121 @@
+#ifndef KALEIDOSCOPE_UTILS_BYTECODE_H
+#define KALEIDOSCOPE_UTILS_BYTECODE_H
+
+#include "ast.h"
+#include "symboltable.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//===-------------------------------------------------------------===//
+// Bytecode
+//===-------------------------------------------------------------===//
+// A compact register bytecode for the tier-0 interpreter. Every function has
+// a frame of NumRegs doubles: its parameters in registers [0, NumParams),
+// then the temporaries, which are allocated like a stack as the body is
+// emitted. A variable is the register of its parameter, so it costs no
+// instruction.
+//
+// The arguments of a call are evaluated into consecutive registers at the
+// top of the caller's live temporaries, and the callee's frame starts right
+// there, so a call copies nothing: the arguments already are the callee's
+// parameters. The result lands in the first of those registers. A call whose
+// value the function returns is a TailCall: it moves the arguments down to
+// the bottom of the frame and runs the callee there, so tail recursion, self
+// or mutual, runs in constant space.
+namespace bc
+{
+    enum Opcode : uint8_t
+    {
+        LoadK,       // Dst = K[B]
+        Move,        // Dst = A
+        Add,         // Dst = A + B
+        Sub,         // Dst = A - B
+        Mul,         // Dst = A * B
+        Lt,          // Dst = A < B (unordered counts as less), 1.0 or 0.0
+        Jump,        // pc = B
+        JumpIfFalse, // if A is 0.0 or NaN: pc = B
+        Call,        // Dst = function B with its frame at A
+        CallNative,  // a Call whose callee was compiled: Dst = Native(&A)
+        TailCall,    // return function B with its frame at A, in this frame
+        TailNative,  // a TailCall whose callee was compiled: return Native(&A)
+        Ret,         // return A
+    };
+
+    // Instr - 12 bytes. Registers are 16 bits; B holds a third register, a
+    // constant, a jump target or a function index.
+    struct Instr
+    {
+        Opcode Op;
+        uint16_t Dst;
+        uint16_t A;
+        uint32_t B;
+    };
+
+    // NativeEntry - Compiled code for a function, called with a pointer to
+    // its arguments so that one signature fits every arity.
+    using NativeEntry = double (*)(const double *Args);
+
+    // Function - One named function, extern or top-level expression. Calls
+    // is only touched by the interpreter's thread; Native is published by
+    // whoever compiles the function.
+    struct Function
+    {
+        std::string Name;
+        uint32_t NumParams = 0;
+        uint32_t NumRegs = 0;
+        uint32_t Entry = 0; // index of the first instruction in Code
+        uint32_t Unit = 0;  // the addUnit() call that defined it
+        bool Defined = false;
+        uint32_t Calls = 0;
+        std::atomic<NativeEntry> Native{nullptr};
+    };
+}
+
+// BytecodeModule - The bytecode of every unit of a program. Functions are
+// numbered across units and calls are resolved by name, like the JIT links
+// the units' IR modules.
+class BytecodeModule
+{
+private:
+    std::vector<std::unique_ptr<bc::Function>> Functions;
+    std::unordered_map<std::string, uint32_t> ByName;
+    std::vector<uint32_t> TopLevelExprs;
+    std::vector<bc::Instr> Code;
+    std::vector<double> Constants;
+    std::unordered_map<uint64_t, uint32_t> ConstantIndex; // by bit pattern
+    unsigned NumUnits = 0;
+
+    class Compiler;
+
+    uint32_t getOrCreate(const std::string &Name, uint32_t NumParams);
+    uint32_t constant(double Val);
+
+public:
+    // addUnit - Compile the functions of M (whose names are in Symbols) and
+    // declare its externs. Calls to functions no unit has defined yet are
+    // left pointing at a declaration that a later unit can fill in. Returns
+    // the number of errors printed; FileName prefixes them.
+    unsigned addUnit(const ModuleAST &M, const SymbolTable &Symbols, const std::string &FileName);
+
+    // lookup - The index of the function called Name, or -1.
+    int64_t lookup(const std::string &Name) const;
+
+    size_t getNumFunctions() const { return Functions.size(); }
+    bc::Function &getFunction(uint32_t I) { return *Functions[I]; }
+    const bc::Function &getFunction(uint32_t I) const { return *Functions[I]; }
+
+    // getTopLevelExprs - The anonymous top-level expressions of every unit,
+    // in unit then source order.
+    const std::vector<uint32_t> &getTopLevelExprs() const { return TopLevelExprs; }
+
+    std::vector<bc::Instr> &getCode() { return Code; }
+    const std::vector<bc::Instr> &getCode() const { return Code; }
+    const std::vector<double> &getConstants() const { return Constants; }
+};
+
+#endif // KALEIDOSCOPE_UTILS_BYTECODE_H
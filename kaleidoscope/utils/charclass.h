@@ -0,0 +1,213 @@
+#ifndef KALEIDOSCOPE_UTILS_CHARCLASS_H
+#define KALEIDOSCOPE_UTILS_CHARCLASS_H
+
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+//===-------------------------------------------------------------===//
+// Character classes
+//===-------------------------------------------------------------===//
+// A 256-entry table replaces the locale-aware <cctype> calls in the lexer.
+// The classes match the "C" locale: space is ' ' and '\t'..'\r', letters and
+// digits are ASCII only.
+namespace charclass
+{
+    enum : uint8_t
+    {
+        Space = 1 << 0,
+        Digit = 1 << 1,
+        Alpha = 1 << 2,
+        Dot = 1 << 3,
+    };
+
+    struct Table
+    {
+        uint8_t Flags[256];
+
+        constexpr Table() : Flags()
+        {
+            Flags[static_cast<unsigned char>(' ')] = Space;
+            for (int C = '\t'; C <= '\r'; ++C)
+            {
+                Flags[C] = Space;
+            }
+            for (int C = '0'; C <= '9'; ++C)
+            {
+                Flags[C] = Digit;
+            }
+            for (int C = 'a'; C <= 'z'; ++C)
+            {
+                Flags[C] = Alpha;
+                Flags[C - 'a' + 'A'] = Alpha;
+            }
+            Flags[static_cast<unsigned char>('.')] = Dot;
+        }
+    };
+
+    constexpr Table Classes;
+
+    inline bool is(char C, uint8_t Mask)
+    {
+        return (Classes.Flags[static_cast<unsigned char>(C)] & Mask) != 0;
+    }
+}
+
+inline bool isSpaceChar(char C) { return charclass::is(C, charclass::Space); }
+inline bool isDigitChar(char C) { return charclass::is(C, charclass::Digit); }
+inline bool isIdentStart(char C) { return charclass::is(C, charclass::Alpha); }
+inline bool isIdentChar(char C) { return charclass::is(C, charclass::Alpha | charclass::Digit); }
+inline bool isNumberStart(char C) { return charclass::is(C, charclass::Digit | charclass::Dot); }
+
+//===-------------------------------------------------------------===//
+// Vectorized skipping
+//===-------------------------------------------------------------===//
+// Both scanners look at 32 (AVX2) or 16 (SSE2, NEON) bytes per step while a
+// whole vector fits before End, then finish with the table. Nothing past End
+// is loaded, so they are safe on a mapped file whose last byte ends a page;
+// the scalar tail stops on the source buffer's '\0' sentinel. The instruction
+// set is picked at compile time; configure with KALEIDOSCOPE_NATIVE=ON to get
+// the AVX2 path on machines that have it.
+namespace charclass
+{
+    inline unsigned countTrailingZeros(uint64_t Mask)
+    {
+        return static_cast<unsigned>(__builtin_ctzll(Mask));
+    }
+
+#if defined(__ARM_NEON) && !defined(__SSE2__)
+    // neonMask - Compress a 0x00/0xFF byte mask to 4 bits per byte.
+    inline uint64_t neonMask(uint8x16_t Eq)
+    {
+        uint8x8_t Narrow = vshrn_n_u16(vreinterpretq_u16_u8(Eq), 4);
+        return vget_lane_u64(vreinterpret_u64_u8(Narrow), 0);
+    }
+#endif
+}
+
+// skipWhitespace - Return the first non-space character at or after P.
+inline const char *skipWhitespace(const char *P, const char *End)
+{
+    // Most runs between tokens are a single space; don't pay for a vector.
+    if (!isSpaceChar(*P) || !isSpaceChar(P[1]))
+    {
+        return isSpaceChar(*P) ? P + 1 : P;
+    }
+
+#if defined(__AVX2__)
+    const __m256i Blank = _mm256_set1_epi8(' ');
+    const __m256i Tab = _mm256_set1_epi8('\t');
+    const __m256i CtrlRange = _mm256_set1_epi8('\r' - '\t');
+    while (End - P >= 32)
+    {
+        __m256i V = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(P));
+        __m256i Off = _mm256_sub_epi8(V, Tab); // '\t'..'\r' -> 0..4
+        __m256i Ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(Off, CtrlRange), Off);
+        __m256i Sp = _mm256_or_si256(Ctrl, _mm256_cmpeq_epi8(V, Blank));
+        uint32_t NotSpace = ~static_cast<uint32_t>(_mm256_movemask_epi8(Sp));
+        if (NotSpace)
+        {
+            return P + charclass::countTrailingZeros(NotSpace);
+        }
+        P += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i Blank = _mm_set1_epi8(' ');
+    const __m128i Tab = _mm_set1_epi8('\t');
+    const __m128i CtrlRange = _mm_set1_epi8('\r' - '\t');
+    while (End - P >= 16)
+    {
+        __m128i V = _mm_loadu_si128(reinterpret_cast<const __m128i *>(P));
+        __m128i Off = _mm_sub_epi8(V, Tab); // '\t'..'\r' -> 0..4
+        __m128i Ctrl = _mm_cmpeq_epi8(_mm_min_epu8(Off, CtrlRange), Off);
+        __m128i Sp = _mm_or_si128(Ctrl, _mm_cmpeq_epi8(V, Blank));
+        uint32_t NotSpace = ~static_cast<uint32_t>(_mm_movemask_epi8(Sp)) & 0xFFFF;
+        if (NotSpace)
+        {
+            return P + charclass::countTrailingZeros(NotSpace);
+        }
+        P += 16;
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t Blank = vdupq_n_u8(' ');
+    const uint8x16_t Tab = vdupq_n_u8('\t');
+    const uint8x16_t CtrlRange = vdupq_n_u8('\r' - '\t');
+    while (End - P >= 16)
+    {
+        uint8x16_t V = vld1q_u8(reinterpret_cast<const uint8_t *>(P));
+        uint8x16_t Ctrl = vcleq_u8(vsubq_u8(V, Tab), CtrlRange);
+        uint8x16_t Sp = vorrq_u8(Ctrl, vceqq_u8(V, Blank));
+        uint64_t NotSpace = ~charclass::neonMask(Sp);
+        if (NotSpace)
+        {
+            return P + charclass::countTrailingZeros(NotSpace) / 4;
+        }
+        P += 16;
+    }
+#endif
+
+    while (isSpaceChar(*P))
+    {
+        ++P;
+    }
+    return P;
+}
+
+// skipToLineEnd - Return the first '\n' or '\r' at or after P, or End.
+inline const char *skipToLineEnd(const char *P, const char *End)
+{
+#if defined(__AVX2__)
+    const __m256i NL = _mm256_set1_epi8('\n');
+    const __m256i CR = _mm256_set1_epi8('\r');
+    while (End - P >= 32)
+    {
+        __m256i V = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(P));
+        __m256i Eol = _mm256_or_si256(_mm256_cmpeq_epi8(V, NL), _mm256_cmpeq_epi8(V, CR));
+        uint32_t Mask = static_cast<uint32_t>(_mm256_movemask_epi8(Eol));
+        if (Mask)
+        {
+            return P + charclass::countTrailingZeros(Mask);
+        }
+        P += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i NL = _mm_set1_epi8('\n');
+    const __m128i CR = _mm_set1_epi8('\r');
+    while (End - P >= 16)
+    {
+        __m128i V = _mm_loadu_si128(reinterpret_cast<const __m128i *>(P));
+        __m128i Eol = _mm_or_si128(_mm_cmpeq_epi8(V, NL), _mm_cmpeq_epi8(V, CR));
+        uint32_t Mask = static_cast<uint32_t>(_mm_movemask_epi8(Eol));
+        if (Mask)
+        {
+            return P + charclass::countTrailingZeros(Mask);
+        }
+        P += 16;
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t NL = vdupq_n_u8('\n');
+    const uint8x16_t CR = vdupq_n_u8('\r');
+    while (End - P >= 16)
+    {
+        uint8x16_t V = vld1q_u8(reinterpret_cast<const uint8_t *>(P));
+        uint64_t Mask = charclass::neonMask(vorrq_u8(vceqq_u8(V, NL), vceqq_u8(V, CR)));
+        if (Mask)
+        {
+            return P + charclass::countTrailingZeros(Mask) / 4;
+        }
+        P += 16;
+    }
+#endif
+
+    while (P != End && *P != '\n' && *P != '\r')
+    {
+        ++P;
+    }
+    return P;
+}
+
+#endif // KALEIDOSCOPE_UTILS_CHARCLASS_H
@@ -0,0 +1,213 @@
+#include "chunkparse.h"
+
+#include "charclass.h"
+#include "frontend.h"
+#include "sourcebuffer.h"
+
+#include <cstdio>
+#include <string_view>
+
+namespace
+{
+    // findItemStart - Return the first `def` or `extern` token that starts at
+    // or after Target, or End. This is a cut-down lexer: it only needs to know
+    // where identifiers, numbers and comments begin and end, so it never
+    // mistakes "undef" or "# def" for a keyword.
+    const char *findItemStart(const char *Start, const char *Target, const char *End)
+    {
+        // There are no multi-line tokens, so a line start is a token boundary.
+        const char *P = Target;
+        while (P != Start && P[-1] != '\n' && P[-1] != '\r')
+        {
+            --P;
+        }
+
+        while (P < End)
+        {
+            char C = *P;
+            if (isIdentStart(C))
+            {
+                const char *IdStart = P;
+                do
+                {
+                    ++P;
+                } while (P < End && isIdentChar(*P));
+                if (IdStart >= Target)
+                {
+                    std::string_view Id(IdStart, static_cast<size_t>(P - IdStart));
+                    if (Id == "def" || Id == "extern")
+                    {
+                        return IdStart;
+                    }
+                }
+                continue;
+            }
+            if (isNumberStart(C))
+            {
+                do
+                {
+                    ++P;
+                } while (P < End && isNumberStart(*P));
+                continue;
+            }
+            if (C == '#')
+            {
+                P = skipToLineEnd(P, End);
+                continue;
+            }
+            ++P;
+        }
+        return End;
+    }
+
+    // remapExpr - Rewrite the symbols under Root. The walk uses an explicit
+    // stack, since a long operator chain is one deep spine of binary nodes.
+    void remapExpr(ExprAST *Root, const std::vector<Symbol> &Remap, std::vector<ExprAST *> &Worklist)
+    {
+        Worklist.push_back(Root);
+        while (!Worklist.empty())
+        {
+            ExprAST *E = Worklist.back();
+            Worklist.pop_back();
+            switch (E->getKind())
+            {
+            case ExprAST::Number:
+                break;
+            case ExprAST::Variable:
+            {
+                auto *V = static_cast<VariableExprAST *>(E);
+                V->setName(Remap[V->get_val().getID()]);
+                break;
+            }
+            case ExprAST::Binary:
+            {
+                auto *B = static_cast<BinaryExprAST *>(E);
+                Worklist.push_back(B->getRHS());
+                Worklist.push_back(B->getLHS());
+                break;
+            }
+            case ExprAST::Call:
+            {
+                auto *C = static_cast<CallExprAST *>(E);
+                C->setCallee(Remap[C->getCallee().getID()]);
+                for (ExprAST *Arg : C->getArgs())
+                {
+                    Worklist.push_back(Arg);
+                }
+                break;
+            }
+            case ExprAST::If:
+            {
+                auto *If = static_cast<IfExprAST *>(E);
+                Worklist.push_back(If->getCond());
+                Worklist.push_back(If->getThen());
+                Worklist.push_back(If->getElse());
+                break;
+            }
+            }
+        }
+    }
+
+    void remapProto(PrototypeAST *P, const std::vector<Symbol> &Remap)
+    {
+        P->setName(Remap[P->getName().getID()]);
+        for (Symbol &Arg : P->getArgs())
+        {
+            Arg = Remap[Arg.getID()];
+        }
+    }
+}
+
+std::vector<SourceChunk> splitTopLevel(const SourceBuffer &Buf, unsigned MaxChunks)
+{
+    const char *Start = Buf.begin();
+    const char *End = Buf.end();
+    size_t Size = Buf.size();
+
+    std::vector<SourceChunk> Chunks;
+    uint32_t Begin = 0;
+    for (unsigned I = 1; I < MaxChunks; ++I)
+    {
+        size_t Ideal = Size / MaxChunks * I;
+        if (Ideal <= Begin)
+        {
+            continue;
+        }
+        uint32_t Cut = static_cast<uint32_t>(findItemStart(Start, Start + Ideal, End) - Start);
+        if (Cut == Size)
+        {
+            break;
+        }
+        Chunks.push_back({Begin, Cut});
+        Begin = Cut;
+    }
+    Chunks.push_back({Begin, static_cast<uint32_t>(Size)});
+    return Chunks;
+}
+
+ChunkedParse::ChunkedParse(const SourceBuffer &Buf, const std::vector<SourceChunk> &Ranges) : Buf(Buf)
+{
+    for (const SourceChunk &R : Ranges)
+    {
+        Chunks.push_back(std::make_unique<Chunk>());
+        Chunks.back()->Range = R;
+    }
+}
+
+void ChunkedParse::parseChunk(unsigned I)
+{
+    Chunk &C = *Chunks[I];
+    Lexer Lex(Buf, C.Range.Begin, C.Range.End, C.Symbols);
+    Parser P(Lex);
+    P.setDiagnostics(&C.Diagnostics);
+    C.Module = P.parseModule(C.Ctx);
+    C.NumErrors = P.getNumErrors();
+}
+
+void ChunkedParse::mapSymbols(SymbolTable &Symbols)
+{
+    // Interning in chunk order keeps symbol IDs independent of scheduling.
+    for (auto &C : Chunks)
+    {
+        C->Remap.resize(C->Symbols.size());
+        for (uint32_t ID = 0; ID < C->Symbols.size(); ++ID)
+        {
+            C->Remap[ID] = Symbols.intern(C->Symbols.getName(Symbol(ID)));
+        }
+    }
+}
+
+void remapModule(ModuleAST &M, const std::vector<Symbol> &Remap)
+{
+    std::vector<ExprAST *> Worklist;
+    for (FunctionAST *F : M.Functions)
+    {
+        remapProto(F->getProto(), Remap);
+        remapExpr(F->getBody(), Remap, Worklist);
+    }
+    for (PrototypeAST *P : M.Externs)
+    {
+        remapProto(P, Remap);
+    }
+}
+
+void ChunkedParse::remapChunk(unsigned I)
+{
+    Chunk &C = *Chunks[I];
+    remapModule(C.Module, C.Remap);
+}
+
+unsigned ChunkedParse::merge(ASTContext &Ctx, ModuleAST &M)
+{
+    unsigned NumErrors = 0;
+    for (auto &C : Chunks)
+    {
+        M.Functions.insert(M.Functions.end(), C->Module.Functions.begin(), C->Module.Functions.end());
+        M.Externs.insert(M.Externs.end(), C->Module.Externs.begin(), C->Module.Externs.end());
+        Ctx.absorb(std::move(C->Ctx));
+        NumErrors += C->NumErrors;
+        fputs(C->Diagnostics.c_str(), stderr);
+    }
+    Chunks.clear();
+    return NumErrors;
+}
@@ -0,0 +1,73 @@
+#ifndef KALEIDOSCOPE_UTILS_CHUNKPARSE_H
+#define KALEIDOSCOPE_UTILS_CHUNKPARSE_H
+
+#include "ast.h"
+#include "symboltable.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class SourceBuffer;
+
+// SourceChunk - The byte range [Begin, End) of a source buffer.
+struct SourceChunk
+{
+    uint32_t Begin;
+    uint32_t End;
+};
+
+// splitTopLevel - Cut Buf into at most MaxChunks ranges of roughly equal size
+// that each start at a `def` or `extern` keyword (the first starts at the
+// beginning of the buffer). Top-level items never span two ranges, so the
+// ranges can be parsed independently. Only the bytes around each cut point
+// are scanned: from the start of the line containing the ideal cut, forward
+// to the next keyword outside a comment.
+std::vector<SourceChunk> splitTopLevel(const SourceBuffer &Buf, unsigned MaxChunks);
+
+// remapModule - Rewrite every symbol of M, which was parsed with another
+// SymbolTable, through Remap (that table's symbol ID -> the new symbol).
+void remapModule(ModuleAST &M, const std::vector<Symbol> &Remap);
+
+// ChunkedParse - Parses the chunks of one buffer independently, each into its
+// own ASTContext and SymbolTable, and merges the results into one module.
+//
+// parseChunk() may run for different chunks on different threads at once.
+// Once every chunk is parsed, mapSymbols() interns their identifiers into the
+// module's SymbolTable, remapChunk() rewrites each chunk's symbols (again one
+// thread per chunk if wanted), and merge() concatenates the items in source
+// order and hands the arenas to the module's ASTContext.
+class ChunkedParse
+{
+private:
+    struct Chunk
+    {
+        SourceChunk Range;
+        ASTContext Ctx;
+        SymbolTable Symbols;
+        ModuleAST Module;
+        unsigned NumErrors = 0;
+        std::string Diagnostics; // printed by merge(), in chunk order
+        std::vector<Symbol> Remap; // chunk symbol ID -> module symbol
+    };
+
+    const SourceBuffer &Buf;
+    std::vector<std::unique_ptr<Chunk>> Chunks;
+
+public:
+    ChunkedParse(const SourceBuffer &Buf, const std::vector<SourceChunk> &Ranges);
+
+    unsigned getNumChunks() const { return static_cast<unsigned>(Chunks.size()); }
+
+    void parseChunk(unsigned I);
+    void mapSymbols(SymbolTable &Symbols);
+    void remapChunk(unsigned I);
+
+    // merge - Append every chunk's items to M, move their nodes into Ctx, and
+    // return the number of top-level items that failed to parse. Their errors
+    // are printed here, in source order, rather than as the chunks parse.
+    unsigned merge(ASTContext &Ctx, ModuleAST &M);
+};
+
+#endif // KALEIDOSCOPE_UTILS_CHUNKPARSE_H
@@ -0,0 +1,1247 @@
+#include "codegen.h"
+
+#include "optimizer.h"
+#include "purity.h"
+#include "trace.h"
+
+#include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Type.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // isCallFree - Whether evaluating E calls nothing, so it may be moved
+    // across calls without reordering their effects.
+    bool isCallFree(const ExprAST *E)
+    {
+        std::vector<const ExprAST *> Worklist{E};
+        while (!Worklist.empty())
+        {
+            E = Worklist.back();
+            Worklist.pop_back();
+            switch (E->getKind())
+            {
+            case ExprAST::Number:
+            case ExprAST::Variable:
+                break;
+            case ExprAST::Binary:
+            {
+                auto *B = static_cast<const BinaryExprAST *>(E);
+                if (B->getOp() != '+' && B->getOp() != '-' && B->getOp() != '*' && B->getOp() != '<')
+                {
+                    return false; // a call to binary<op>
+                }
+                Worklist.push_back(B->getLHS());
+                Worklist.push_back(B->getRHS());
+                break;
+            }
+            case ExprAST::Call:
+                return false;
+            case ExprAST::If:
+            {
+                auto *If = static_cast<const IfExprAST *>(E);
+                Worklist.push_back(If->getCond());
+                Worklist.push_back(If->getThen());
+                Worklist.push_back(If->getElse());
+                break;
+            }
+            }
+        }
+        return true;
+    }
+
+    // A batch kernel inlines everything its function calls, so it only gets
+    // a vector body while that stays below this many expression nodes.
+    const uint64_t MaxBatchNodes = 4096;
+
+    // vectorIntrinsic - The intrinsic that computes the pure extern Name on
+    // vectors, or not_intrinsic.
+    llvm::Intrinsic::ID vectorIntrinsic(llvm::StringRef Name, unsigned NumArgs)
+    {
+        if (NumArgs == 1)
+        {
+            return llvm::StringSwitch<llvm::Intrinsic::ID>(Name)
+                .Case("sqrt", llvm::Intrinsic::sqrt)
+                .Case("sin", llvm::Intrinsic::sin)
+                .Case("cos", llvm::Intrinsic::cos)
+                .Case("exp", llvm::Intrinsic::exp)
+                .Case("exp2", llvm::Intrinsic::exp2)
+                .Case("log", llvm::Intrinsic::log)
+                .Case("log2", llvm::Intrinsic::log2)
+                .Case("log10", llvm::Intrinsic::log10)
+                .Case("fabs", llvm::Intrinsic::fabs)
+                .Case("floor", llvm::Intrinsic::floor)
+                .Case("ceil", llvm::Intrinsic::ceil)
+                .Case("trunc", llvm::Intrinsic::trunc)
+                .Case("round", llvm::Intrinsic::round)
+                .Default(llvm::Intrinsic::not_intrinsic);
+        }
+        if (NumArgs == 2)
+        {
+            return llvm::StringSwitch<llvm::Intrinsic::ID>(Name)
+                .Case("pow", llvm::Intrinsic::pow)
+                .Case("fmin", llvm::Intrinsic::minnum)
+                .Case("fmax", llvm::Intrinsic::maxnum)
+                .Default(llvm::Intrinsic::not_intrinsic);
+        }
+        return llvm::Intrinsic::not_intrinsic;
+    }
+}
+
+CodeGen::CodeGen(const SymbolTable &Symbols, llvm::StringRef ModuleName)
+    : Context(std::make_unique<llvm::LLVMContext>()),
+      TheModule(std::make_unique<llvm::Module>(ModuleName, *Context)), Builder(*Context), Symbols(Symbols),
+      NamedValues(Symbols.size(), nullptr), MemoBits(Symbols.size(), 0)
+{
+}
+
+void CodeGen::setOptimizer(FunctionOptimizer *O)
+{
+    Optimizer = O;
+    if (O)
+    {
+        O->prepare(*TheModule);
+    }
+}
+
+void CodeGen::memoize(Symbol Name, unsigned CacheBits)
+{
+    MemoBits[Name.getID()] = static_cast<uint8_t>(CacheBits);
+}
+
+// logError - Report a codegen error about Name and return null, like the
+// parser's LogError.
+llvm::Value *CodeGen::logError(const char *Fmt, llvm::StringRef Name)
+{
+    std::string Msg;
+    llvm::raw_string_ostream OS(Msg);
+    OS << "Error: " << TheModule->getModuleIdentifier() << ": ";
+    char Buf[256];
+    snprintf(Buf, sizeof(Buf), Fmt, Name.str().c_str());
+    OS << Buf << "\n";
+    fputs(OS.str().c_str(), stderr);
+    ++NumErrors;
+    return nullptr;
+}
+
+llvm::StringRef CodeGen::name(Symbol S) const
+{
+    std::string_view N = Symbols.getName(S);
+    return llvm::StringRef(N.data(), N.size());
+}
+
+// getFunction - The function called Name in this module, or a new external
+// declaration taking NumArgs doubles if the unit hasn't seen it yet.
+llvm::Function *CodeGen::getFunction(Symbol Name, unsigned NumArgs)
+{
+    llvm::StringRef FnName = name(Name);
+    if (llvm::Function *F = TheModule->getFunction(FnName))
+    {
+        return F;
+    }
+    std::vector<llvm::Type *> Doubles(NumArgs, llvm::Type::getDoubleTy(*Context));
+    llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*Context), Doubles, false);
+    return llvm::Function::Create(FT, llvm::Function::ExternalLinkage, FnName, TheModule.get());
+}
+
+llvm::Value *CodeGen::emitBinary(char Op, llvm::Value *L, llvm::Value *R)
+{
+    switch (Op)
+    {
+    case '+':
+        return Builder.CreateFAdd(L, R, "addtmp");
+    case '-':
+        return Builder.CreateFSub(L, R, "subtmp");
+    case '*':
+        return Builder.CreateFMul(L, R, "multmp");
+    case '<':
+        L = Builder.CreateFCmpULT(L, R, "cmptmp");
+        // Convert bool 0/1 to double 0.0 or 1.0
+        return Builder.CreateUIToFP(L, llvm::Type::getDoubleTy(*Context), "booltmp");
+    default:
+        break;
+    }
+
+    // Any other operator was registered at runtime; it is lowered as a call
+    // to the function "binary<op>", as in the tutorial's later chapters.
+    std::string FnName = std::string("binary") + Op;
+    llvm::Function *F = TheModule->getFunction(FnName);
+    if (!F || F->arg_size() != 2)
+    {
+        return logError("invalid binary operator '%s'", llvm::StringRef(&Op, 1));
+    }
+    return Builder.CreateCall(F, {L, R}, "binop");
+}
+
+// emitMemoLookup - At the top of F, find the cache entry for F's arguments
+// and return from F if it holds their result. Leaves the builder in the block
+// that computes it.
+CodeGen::MemoSlot CodeGen::emitMemoLookup(llvm::Function *F, unsigned CacheBits)
+{
+    llvm::Type *I64 = Builder.getInt64Ty();
+    MemoSlot Slot;
+    // { double Value, i64 Valid, [N x i64] Keys }
+    Slot.EntryTy =
+        llvm::StructType::get(*Context, {Builder.getDoubleTy(), I64, llvm::ArrayType::get(I64, F->arg_size())});
+    llvm::ArrayType *CacheTy = llvm::ArrayType::get(Slot.EntryTy, uint64_t(1) << CacheBits);
+    llvm::ArrayType *StatsTy = llvm::ArrayType::get(I64, 2);
+    Slot.Cache = new llvm::GlobalVariable(*TheModule, CacheTy, false, llvm::GlobalValue::ExternalLinkage,
+                                          llvm::ConstantAggregateZero::get(CacheTy), F->getName() + ".memo");
+    Slot.Stats = new llvm::GlobalVariable(*TheModule, StatsTy, false, llvm::GlobalValue::ExternalLinkage,
+                                          llvm::ConstantAggregateZero::get(StatsTy), F->getName() + ".memo.stats");
+
+    // Mix the argument bits one at a time and take the top bits as the index.
+    llvm::Value *Hash = Builder.getInt64(0x9E3779B97F4A7C15ULL);
+    for (llvm::Argument &Arg : F->args())
+    {
+        llvm::Value *Key = Builder.CreateBitCast(&Arg, I64, "memo.key");
+        Slot.Keys.push_back(Key);
+        Hash = Builder.CreateMul(Builder.CreateXor(Hash, Key), Builder.getInt64(0xff51afd7ed558ccdULL));
+        Hash = Builder.CreateXor(Hash, Builder.CreateLShr(Hash, 32));
+    }
+    llvm::Value *Idx = Builder.CreateLShr(Hash, 64 - CacheBits, "memo.idx");
+    Slot.Entry = Builder.CreateInBoundsGEP(CacheTy, Slot.Cache, {Builder.getInt64(0), Idx}, "memo.entry");
+
+    llvm::Value *Valid = Builder.CreateLoad(I64, Builder.CreateStructGEP(Slot.EntryTy, Slot.Entry, 1));
+    llvm::Value *Hit = Builder.CreateICmpNE(Valid, Builder.getInt64(0), "memo.hit");
+    for (unsigned I = 0; I != Slot.Keys.size(); ++I)
+    {
+        llvm::Value *KeyPtr = Builder.CreateInBoundsGEP(
+            Slot.EntryTy, Slot.Entry, {Builder.getInt32(0), Builder.getInt32(2), Builder.getInt32(I)});
+        Hit = Builder.CreateAnd(Hit, Builder.CreateICmpEQ(Builder.CreateLoad(I64, KeyPtr), Slot.Keys[I]), "memo.hit");
+    }
+
+    llvm::BasicBlock *HitBB = llvm::BasicBlock::Create(*Context, "memo.hit", F);
+    llvm::BasicBlock *MissBB = llvm::BasicBlock::Create(*Context, "memo.miss", F);
+    Builder.CreateCondBr(Hit, HitBB, MissBB);
+
+    Builder.SetInsertPoint(HitBB);
+    emitMemoCount(Slot, 0);
+    Builder.CreateRet(
+        Builder.CreateLoad(Builder.getDoubleTy(), Builder.CreateStructGEP(Slot.EntryTy, Slot.Entry, 0), "memo.val"));
+
+    Builder.SetInsertPoint(MissBB);
+    emitMemoCount(Slot, 1);
+    return Slot;
+}
+
+// emitMemoCount - Count a hit (0) or a miss (1).
+void CodeGen::emitMemoCount(const MemoSlot &Slot, unsigned Counter)
+{
+    llvm::Type *I64 = Builder.getInt64Ty();
+    llvm::Value *Ptr = Builder.CreateInBoundsGEP(Slot.Stats->getValueType(), Slot.Stats,
+                                                 {Builder.getInt64(0), Builder.getInt64(Counter)});
+    Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(I64, Ptr), Builder.getInt64(1)), Ptr);
+}
+
+// emitMemoStore - Replace whatever the entry held with this call's Result.
+// Nothing is written on the miss: recursive calls in the body may have
+// claimed the entry since.
+void CodeGen::emitMemoStore(const MemoSlot &Slot, llvm::Value *Result)
+{
+    for (unsigned I = 0; I != Slot.Keys.size(); ++I)
+    {
+        Builder.CreateStore(Slot.Keys[I], Builder.CreateInBoundsGEP(Slot.EntryTy, Slot.Entry,
+                                                                    {Builder.getInt32(0), Builder.getInt32(2),
+                                                                     Builder.getInt32(I)}));
+    }
+    Builder.CreateStore(Result, Builder.CreateStructGEP(Slot.EntryTy, Slot.Entry, 0));
+    Builder.CreateStore(Builder.getInt64(1), Builder.CreateStructGEP(Slot.EntryTy, Slot.Entry, 1));
+}
+
+// emitProfileEntry - At the top of F, count the call, read the cycle counter
+// and start the count of cycles spent in callees from zero.
+CodeGen::ProfileSlot CodeGen::emitProfileEntry(llvm::Function *F)
+{
+    llvm::Type *I64 = Builder.getInt64Ty();
+    llvm::ArrayType *CountersTy = llvm::ArrayType::get(I64, 2);
+    ProfileSlot Slot;
+    Slot.Counters = new llvm::GlobalVariable(*TheModule, CountersTy, false, llvm::GlobalValue::ExternalLinkage,
+                                             llvm::ConstantAggregateZero::get(CountersTy), F->getName() + ".prof");
+    llvm::GlobalVariable *Children = TheModule->getNamedGlobal("kaleidoscope.prof.children");
+    if (!Children)
+    {
+        Children = new llvm::GlobalVariable(*TheModule, I64, false, llvm::GlobalValue::ExternalLinkage, nullptr,
+                                            "kaleidoscope.prof.children");
+    }
+    emitProfileCall(Slot);
+    Slot.SavedChildren = Builder.CreateLoad(I64, Children, "prof.saved");
+    Builder.CreateStore(Builder.getInt64(0), Children);
+    Slot.Start = Builder.CreateIntrinsic(llvm::Intrinsic::readcyclecounter, {}, {}, nullptr, "prof.start");
+    return Slot;
+}
+
+// emitProfileCall - Add one to the calls of the function Slot profiles, at its
+// entry and on every self tail call that codegenTail() turns into a branch.
+void CodeGen::emitProfileCall(const ProfileSlot &Slot)
+{
+    llvm::Type *I64 = Builder.getInt64Ty();
+    llvm::Value *Calls = Builder.CreateInBoundsGEP(Slot.Counters->getValueType(), Slot.Counters,
+                                                   {Builder.getInt64(0), Builder.getInt64(0)});
+    Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(I64, Calls), Builder.getInt64(1)), Calls);
+}
+
+// emitProfileExits - Before every return of F: add the cycles since entry,
+// less those of its callees, to F's count, and report the whole span to the
+// caller on top of what its earlier callees spent.
+void CodeGen::emitProfileExits(llvm::Function *F, const ProfileSlot &Slot)
+{
+    llvm::Type *I64 = Builder.getInt64Ty();
+    llvm::GlobalVariable *Children = TheModule->getNamedGlobal("kaleidoscope.prof.children");
+    std::vector<llvm::ReturnInst *> Returns;
+    for (llvm::BasicBlock &BB : *F)
+    {
+        if (auto *Ret = llvm::dyn_cast<llvm::ReturnInst>(BB.getTerminator()))
+        {
+            Returns.push_back(Ret);
+        }
+    }
+    for (llvm::ReturnInst *Ret : Returns)
+    {
+        if (auto *Call = llvm::dyn_cast_or_null<llvm::CallInst>(Ret->getPrevNode()))
+        {
+            Call->setTailCallKind(llvm::CallInst::TCK_None);
+        }
+        Builder.SetInsertPoint(Ret);
+        llvm::Value *Now = Builder.CreateIntrinsic(llvm::Intrinsic::readcyclecounter, {}, {}, nullptr, "prof.end");
+        llvm::Value *Span = Builder.CreateSub(Now, Slot.Start, "prof.span");
+        llvm::Value *Self = Builder.CreateSub(Span, Builder.CreateLoad(I64, Children), "prof.self");
+        llvm::Value *Cycles = Builder.CreateInBoundsGEP(Slot.Counters->getValueType(), Slot.Counters,
+                                                        {Builder.getInt64(0), Builder.getInt64(1)});
+        Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(I64, Cycles), Self), Cycles);
+        Builder.CreateStore(Builder.CreateAdd(Slot.SavedChildren, Span), Children);
+    }
+}
+
+// codegen(ExprAST) - Lower E at the builder's insertion point. The walk keeps
+// its own stack of pending nodes and operand values rather than recursing, so
+// long operator chains (one deep spine of BinaryExprASTs) cannot overflow the
+// native stack. A node is visited once per Stage; operands are pushed so that
+// they are lowered left to right, as a recursive walk would.
+llvm::Value *CodeGen::codegen(const ExprAST *Root)
+{
+    size_t FrameBase = Frames.size(), ValueBase = Values.size(), IfBase = Ifs.size();
+    auto Fail = [&]() -> llvm::Value *
+    {
+        // Blocks of an unfinished if are still referenced by its branches;
+        // put them in the function so they go away when the caller erases it.
+        llvm::Function *TheFunction = Builder.GetInsertBlock()->getParent();
+        for (size_t I = IfBase; I != Ifs.size(); ++I)
+        {
+            if (!Ifs[I].Else->getParent())
+            {
+                TheFunction->getBasicBlockList().push_back(Ifs[I].Else);
+            }
+            TheFunction->getBasicBlockList().push_back(Ifs[I].Merge);
+        }
+        Frames.resize(FrameBase);
+        Values.resize(ValueBase);
+        Ifs.resize(IfBase);
+        return nullptr;
+    };
+    auto PopValue = [&]()
+    {
+        llvm::Value *V = Values.back();
+        Values.pop_back();
+        return V;
+    };
+
+    Frames.push_back({Root, 0});
+    while (Frames.size() > FrameBase)
+    {
+        Frame F = Frames.back();
+        Frames.pop_back();
+        switch (F.E->getKind())
+        {
+        case ExprAST::Number:
+        {
+            double Val = static_cast<const NumberExprAST *>(F.E)->get_val();
+            Values.push_back(llvm::ConstantFP::get(*Context, llvm::APFloat(Val)));
+            break;
+        }
+        case ExprAST::Variable:
+        {
+            // Look this variable up in the function.
+            Symbol Name = static_cast<const VariableExprAST *>(F.E)->get_val();
+            llvm::Value *V = NamedValues[Name.getID()];
+            if (!V)
+            {
+                logError("unknown variable name '%s'", name(Name));
+                return Fail();
+            }
+            Values.push_back(V);
+            break;
+        }
+        case ExprAST::Binary:
+        {
+            auto *B = static_cast<const BinaryExprAST *>(F.E);
+            if (F.Stage == 0)
+            {
+                Frames.push_back({F.E, 1});
+                Frames.push_back({B->getRHS(), 0});
+                Frames.push_back({B->getLHS(), 0});
+                break;
+            }
+            llvm::Value *R = PopValue();
+            llvm::Value *L = PopValue();
+            llvm::Value *V = emitBinary(B->getOp(), L, R);
+            if (!V)
+            {
+                return Fail();
+            }
+            Values.push_back(V);
+            break;
+        }
+        case ExprAST::Call:
+        {
+            auto *C = static_cast<const CallExprAST *>(F.E);
+            ASTArray<ExprAST *> Args = C->getArgs();
+            if (F.Stage == 0)
+            {
+                Frames.push_back({F.E, 1});
+                for (uint32_t I = Args.size(); I-- > 0;)
+                {
+                    Frames.push_back({Args[I], 0});
+                }
+                break;
+            }
+            llvm::Function *Callee = getFunction(C->getCallee(), Args.size());
+            if (Callee->arg_size() != Args.size())
+            {
+                logError("incorrect number of arguments passed to '%s'", name(C->getCallee()));
+                return Fail();
+            }
+            llvm::Value **ArgV = Values.data() + Values.size() - Args.size();
+            llvm::Value *V = Builder.CreateCall(Callee, llvm::ArrayRef<llvm::Value *>(ArgV, Args.size()), "calltmp");
+            Values.resize(Values.size() - Args.size());
+            Values.push_back(V);
+            break;
+        }
+        case ExprAST::If:
+        {
+            auto *If = static_cast<const IfExprAST *>(F.E);
+            switch (F.Stage)
+            {
+            case 0:
+                Frames.push_back({F.E, 1});
+                Frames.push_back({If->getCond(), 0});
+                break;
+            case 1:
+            {
+                // Convert condition to a bool by comparing non-equal to 0.0.
+                llvm::Value *CondV = Builder.CreateFCmpONE(
+                    PopValue(), llvm::ConstantFP::get(*Context, llvm::APFloat(0.0)), "ifcond");
+                llvm::Function *TheFunction = Builder.GetInsertBlock()->getParent();
+
+                // Create blocks for the then and else cases. Insert the 'then' block at the
+                // end of the function; the others are inserted once they are reached.
+                PendingIf P;
+                P.Then = llvm::BasicBlock::Create(*Context, "then", TheFunction);
+                P.Else = llvm::BasicBlock::Create(*Context, "else");
+                P.Merge = llvm::BasicBlock::Create(*Context, "ifcont");
+                P.ThenV = nullptr;
+                Builder.CreateCondBr(CondV, P.Then, P.Else);
+                Builder.SetInsertPoint(P.Then);
+                Ifs.push_back(P);
+
+                Frames.push_back({F.E, 2});
+                Frames.push_back({If->getThen(), 0});
+                break;
+            }
+            case 2:
+            {
+                PendingIf &P = Ifs.back();
+                P.ThenV = PopValue();
+                Builder.CreateBr(P.Merge);
+                // Codegen of 'Then' can change the current block, update Then for the PHI.
+                P.Then = Builder.GetInsertBlock();
+
+                llvm::Function *TheFunction = P.Then->getParent();
+                TheFunction->getBasicBlockList().push_back(P.Else);
+                Builder.SetInsertPoint(P.Else);
+
+                Frames.push_back({F.E, 3});
+                Frames.push_back({If->getElse(), 0});
+                break;
+            }
+            default:
+            {
+                PendingIf P = Ifs.back();
+                Ifs.pop_back();
+                llvm::Value *ElseV = PopValue();
+                Builder.CreateBr(P.Merge);
+                // Codegen of 'Else' can change the current block, update Else for the PHI.
+                P.Else = Builder.GetInsertBlock();
+
+                llvm::Function *TheFunction = P.Else->getParent();
+                TheFunction->getBasicBlockList().push_back(P.Merge);
+                Builder.SetInsertPoint(P.Merge);
+                llvm::PHINode *PN = Builder.CreatePHI(llvm::Type::getDoubleTy(*Context), 2, "iftmp");
+                PN->addIncoming(P.ThenV, P.Then);
+                PN->addIncoming(ElseV, P.Else);
+                Values.push_back(PN);
+                break;
+            }
+            }
+            break;
+        }
+        }
+    }
+
+    llvm::Value *Result = PopValue();
+    return Result;
+}
+
+// codegenTail - Lower Body, the whole body of F, with a ret on every path.
+// The ifs on the way to a returned value are lowered as branches without a
+// merge, so what each arm returns is in tail position. A self call that
+// becomes a branch still counts as a call of F in Profile, if F has one. If F
+// is memoized, each ret first stores its value, which is also the result for
+// the arguments F was entered with, into Memo's entry.
+bool CodeGen::codegenTail(llvm::Function *F, const PrototypeAST *P, const ExprAST *Body, const ProfileSlot &Profile,
+                          const MemoSlot &Memo)
+{
+    Symbol Self = P->getName();
+    ASTArray<Symbol> Params = P->getArgs();
+    auto SelfCall = [&](const ExprAST *E)
+    {
+        return E->getKind() == ExprAST::Call && static_cast<const CallExprAST *>(E)->getCallee() == Self &&
+               static_cast<const CallExprAST *>(E)->getArgs().size() == Params.size();
+    };
+    // SelfOperand - For "e op f(...)" or "f(...) op e" with the accumulator's
+    // op, the self call, and the other operand in Operand.
+    auto SelfOperand = [&](const ExprAST *E, char Op, const ExprAST *&Operand) -> const ExprAST *
+    {
+        if (E->getKind() != ExprAST::Binary || static_cast<const BinaryExprAST *>(E)->getOp() != Op)
+        {
+            return nullptr;
+        }
+        auto *B = static_cast<const BinaryExprAST *>(E);
+        if (SelfCall(B->getRHS()))
+        {
+            Operand = B->getLHS();
+            return B->getRHS();
+        }
+        if (SelfCall(B->getLHS()) && isCallFree(B->getRHS()))
+        {
+            Operand = B->getRHS();
+            return B->getLHS();
+        }
+        return nullptr;
+    };
+
+    // Find out whether there is a loop to build, and with which accumulator.
+    // The first operator found wins; tail positions using the other one stay
+    // plain recursion.
+    bool Loops = false;
+    char AccOp = 0;
+    std::vector<const ExprAST *> Scan{Body};
+    while (!Scan.empty())
+    {
+        const ExprAST *E = Scan.back();
+        Scan.pop_back();
+        const ExprAST *Operand;
+        if (E->getKind() == ExprAST::If)
+        {
+            Scan.push_back(static_cast<const IfExprAST *>(E)->getElse());
+            Scan.push_back(static_cast<const IfExprAST *>(E)->getThen());
+        }
+        else if (SelfCall(E))
+        {
+            Loops = true;
+        }
+        else if (TailMode == AccumulatorTailCalls && !AccOp &&
+                 (SelfOperand(E, '+', Operand) || SelfOperand(E, '*', Operand)))
+        {
+            Loops = true;
+            AccOp = static_cast<const BinaryExprAST *>(E)->getOp();
+        }
+    }
+
+    // The loop header takes the parameters' values for the next iteration
+    // and the running accumulator. Starting it at -0.0 for + and 1.0 for *
+    // leaves a value combined with it unchanged, -0.0 and NaN included.
+    llvm::Type *DoubleTy = Builder.getDoubleTy();
+    llvm::BasicBlock *Header = nullptr;
+    std::vector<llvm::PHINode *> ParamPhis;
+    llvm::PHINode *AccPhi = nullptr;
+    if (Loops)
+    {
+        llvm::BasicBlock *Entry = Builder.GetInsertBlock();
+        Header = llvm::BasicBlock::Create(*Context, "tailrecurse", F);
+        Builder.CreateBr(Header);
+        Builder.SetInsertPoint(Header);
+        for (unsigned I = 0; I != Params.size(); ++I)
+        {
+            llvm::PHINode *PN = Builder.CreatePHI(DoubleTy, 2, name(Params[I]));
+            PN->addIncoming(F->getArg(I), Entry);
+            NamedValues[Params[I].getID()] = PN;
+            ParamPhis.push_back(PN);
+        }
+        if (AccOp)
+        {
+            AccPhi = Builder.CreatePHI(DoubleTy, 2, "acc");
+            AccPhi->addIncoming(llvm::ConstantFP::get(DoubleTy, AccOp == '+' ? -0.0 : 1.0), Entry);
+        }
+    }
+
+    struct TailItem
+    {
+        const ExprAST *E;
+        llvm::BasicBlock *BB;
+    };
+    std::vector<TailItem> Worklist{{Body, Builder.GetInsertBlock()}};
+    while (!Worklist.empty())
+    {
+        TailItem T = Worklist.back();
+        Worklist.pop_back();
+        Builder.SetInsertPoint(T.BB);
+        const ExprAST *E = T.E;
+
+        if (E->getKind() == ExprAST::If)
+        {
+            auto *If = static_cast<const IfExprAST *>(E);
+            llvm::Value *CondV = codegen(If->getCond());
+            if (!CondV)
+            {
+                return false;
+            }
+            CondV = Builder.CreateFCmpONE(CondV, llvm::ConstantFP::get(DoubleTy, 0.0), "ifcond");
+            llvm::BasicBlock *Then = llvm::BasicBlock::Create(*Context, "then", F);
+            llvm::BasicBlock *Else = llvm::BasicBlock::Create(*Context, "else", F);
+            Builder.CreateCondBr(CondV, Then, Else);
+            Worklist.push_back({If->getElse(), Else});
+            Worklist.push_back({If->getThen(), Then});
+            continue;
+        }
+
+        const ExprAST *Operand = nullptr;
+        const ExprAST *Call = SelfCall(E) ? E : AccOp ? SelfOperand(E, AccOp, Operand) : nullptr;
+        if (Call && Loops)
+        {
+            llvm::Value *Acc = AccPhi;
+            if (Operand)
+            {
+                llvm::Value *V = codegen(Operand);
+                if (!V)
+                {
+                    return false;
+                }
+                Acc = emitBinary(AccOp, AccPhi, V);
+            }
+            std::vector<llvm::Value *> ArgV;
+            for (const ExprAST *Arg : static_cast<const CallExprAST *>(Call)->getArgs())
+            {
+                llvm::Value *V = codegen(Arg);
+                if (!V)
+                {
+                    return false;
+                }
+                ArgV.push_back(V);
+            }
+            llvm::BasicBlock *From = Builder.GetInsertBlock();
+            for (unsigned I = 0; I != ParamPhis.size(); ++I)
+            {
+                ParamPhis[I]->addIncoming(ArgV[I], From);
+            }
+            if (AccPhi)
+            {
+                AccPhi->addIncoming(Acc, From);
+            }
+            if (Profile.Counters)
+            {
+                emitProfileCall(Profile);
+            }
+            Builder.CreateBr(Header);
+            continue;
+        }
+
+        llvm::Value *V = codegen(E);
+        if (!V)
+        {
+            return false;
+        }
+        if (AccPhi)
+        {
+            V = emitBinary(AccOp, AccPhi, V);
+        }
+        if (Memo.Entry)
+        {
+            emitMemoStore(Memo, V);
+        }
+        else if (auto *CI = llvm::dyn_cast<llvm::CallInst>(V);
+                 !AccPhi && CI && CI == &Builder.GetInsertBlock()->back())
+        {
+            CI->setTailCallKind(CI->getFunctionType() == F->getFunctionType() ? llvm::CallInst::TCK_MustTail
+                                                                               : llvm::CallInst::TCK_Tail);
+        }
+        Builder.CreateRet(V);
+    }
+    return true;
+}
+
+llvm::Function *CodeGen::codegen(const PrototypeAST *P)
+{
+    unsigned NumArgs = P->getArgs().size();
+    llvm::StringRef Name = name(P->getName());
+
+    // An earlier call or extern may already have declared it.
+    llvm::Function *F = TheModule->getFunction(Name);
+    if (F && F->arg_size() != NumArgs)
+    {
+        logError("'%s' redeclared with a different number of arguments", Name);
+        return nullptr;
+    }
+    if (!F)
+    {
+        // Make the function type:  double(double,double) etc.
+        std::vector<llvm::Type *> Doubles(NumArgs, llvm::Type::getDoubleTy(*Context));
+        llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*Context), Doubles, false);
+        F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Name, TheModule.get());
+    }
+
+    // Set names for all arguments.
+    unsigned Idx = 0;
+    for (auto &Arg : F->args())
+    {
+        Arg.setName(name(P->getArgs()[Idx++]));
+    }
+    return F;
+}
+
+llvm::Function *CodeGen::codegen(const FunctionAST *Fn)
+{
+    const PrototypeAST *P = Fn->getProto();
+    bool IsTopLevelExpr = isTopLevelExpr(P, Symbols);
+
+    llvm::Function *TheFunction;
+    if (IsTopLevelExpr)
+    {
+        // Every top-level expression gets its own function; LLVM uniques the
+        // name, and internal linkage keeps it from clashing with other units.
+        llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*Context), false);
+        TheFunction = llvm::Function::Create(FT, llvm::Function::InternalLinkage, "__anon_expr", TheModule.get());
+    }
+    else
+    {
+        TheFunction = codegen(P);
+        if (!TheFunction)
+        {
+            return nullptr;
+        }
+        if (!TheFunction->empty())
+        {
+            logError("function '%s' cannot be redefined", TheFunction->getName());
+            return nullptr;
+        }
+    }
+
+    // Create a new basic block to start insertion into.
+    llvm::BasicBlock *BB = llvm::BasicBlock::Create(*Context, "entry", TheFunction);
+    Builder.SetInsertPoint(BB);
+
+    // Record the function arguments in the NamedValues table.
+    unsigned Idx = 0;
+    for (auto &Arg : TheFunction->args())
+    {
+        NamedValues[P->getArgs()[Idx++].getID()] = &Arg;
+    }
+
+    ProfileSlot Profile;
+    if (!IsTopLevelExpr && Profiling)
+    {
+        Profile = emitProfileEntry(TheFunction);
+    }
+
+    MemoSlot Memo;
+    if (!IsTopLevelExpr && MemoBits[P->getName().getID()])
+    {
+        Memo = emitMemoLookup(TheFunction, MemoBits[P->getName().getID()]);
+    }
+
+    bool Lowered;
+    if (TailMode != NoTailCalls)
+    {
+        Lowered = codegenTail(TheFunction, P, Fn->getBody(), Profile, Memo);
+    }
+    else if (llvm::Value *RetVal = codegen(Fn->getBody()))
+    {
+        // Finish off the function.
+        if (Memo.Entry)
+        {
+            emitMemoStore(Memo, RetVal);
+        }
+        Builder.CreateRet(RetVal);
+        Lowered = true;
+    }
+    else
+    {
+        Lowered = false;
+    }
+
+    for (Symbol Param : P->getArgs())
+    {
+        NamedValues[Param.getID()] = nullptr;
+    }
+
+    if (Lowered && Profile.Counters)
+    {
+        emitProfileExits(TheFunction, Profile);
+    }
+
+    if (Lowered)
+    {
+        // Validate the generated code, checking for consistency.
+        std::string Problems;
+        llvm::raw_string_ostream OS(Problems);
+        if (!llvm::verifyFunction(*TheFunction, &OS))
+        {
+            if (Optimizer)
+            {
+                Optimizer->run(*TheFunction);
+            }
+            if (isTracing())
+            {
+                traceCount(IRFunctions, 1);
+                traceCount(IRInstructions, TheFunction->getInstructionCount());
+            }
+            if (IsTopLevelExpr)
+            {
+                TopLevelExprs.push_back(TheFunction);
+            }
+            return TheFunction;
+        }
+        logError("invalid IR for function '%s':", TheFunction->getName());
+        fputs(OS.str().c_str(), stderr);
+    }
+
+    // Error reading body, remove function.
+    TheFunction->eraseFromParent();
+    if (Memo.Entry)
+    {
+        Memo.Cache->eraseFromParent();
+        Memo.Stats->eraseFromParent();
+    }
+    if (Profile.Counters)
+    {
+        Profile.Counters->eraseFromParent();
+    }
+    return nullptr;
+}
+
+// isBatchable - Whether codegenBatch() can lower F lane-wise; Defs holds
+// the functions of the module by Symbol ID. A depth-first walk over what F
+// calls, with a function's inlined size known once its callees are done.
+bool CodeGen::isBatchable(const FunctionAST *F, const std::vector<const FunctionAST *> &Defs) const
+{
+    enum VisitState : uint8_t
+    {
+        New,
+        Active, // on the walk's current path
+        Done,
+    };
+    std::vector<uint8_t> State(Defs.size(), New);
+    std::vector<uint64_t> Size(Defs.size(), 0);
+
+    // scan - Visit the nodes of G's body: false if one can't be lowered
+    // lane-wise; otherwise Callees gets the functions of Defs it calls and
+    // Nodes the body's inlined size, counting a callee that is Done by its
+    // size.
+    std::vector<const ExprAST *> Worklist;
+    auto scan = [&](const FunctionAST *G, std::vector<const FunctionAST *> &Callees, uint64_t &Nodes)
+    {
+        Nodes = 0;
+        Worklist.assign(1, G->getBody());
+        while (!Worklist.empty())
+        {
+            const ExprAST *E = Worklist.back();
+            Worklist.pop_back();
+            ++Nodes;
+            switch (E->getKind())
+            {
+            case ExprAST::Number:
+            case ExprAST::Variable:
+                break;
+            case ExprAST::Binary:
+            {
+                auto *B = static_cast<const BinaryExprAST *>(E);
+                if (B->getOp() != '+' && B->getOp() != '-' && B->getOp() != '*' && B->getOp() != '<')
+                {
+                    return false;
+                }
+                Worklist.push_back(B->getLHS());
+                Worklist.push_back(B->getRHS());
+                break;
+            }
+            case ExprAST::Call:
+            {
+                auto *C = static_cast<const CallExprAST *>(E);
+                if (const FunctionAST *Callee = Defs[C->getCallee().getID()])
+                {
+                    Callees.push_back(Callee);
+                    Nodes += Size[C->getCallee().getID()];
+                }
+                else if (!isPureExtern(Symbols.getName(C->getCallee())))
+                {
+                    return false;
+                }
+                for (const ExprAST *Arg : C->getArgs())
+                {
+                    Worklist.push_back(Arg);
+                }
+                break;
+            }
+            case ExprAST::If:
+            {
+                auto *If = static_cast<const IfExprAST *>(E);
+                Worklist.push_back(If->getCond());
+                Worklist.push_back(If->getThen());
+                Worklist.push_back(If->getElse());
+                break;
+            }
+            }
+        }
+        return Nodes <= MaxBatchNodes;
+    };
+
+    struct Visit
+    {
+        const FunctionAST *G;
+        bool Expanded;
+    };
+    std::vector<Visit> Stack{{F, false}};
+    std::vector<const FunctionAST *> Callees;
+    uint64_t Nodes;
+    while (!Stack.empty())
+    {
+        Visit &V = Stack.back();
+        uint32_t ID = V.G->getProto()->getName().getID();
+        if (V.Expanded)
+        {
+            // Every callee is Done now, so this counts their sizes.
+            Callees.clear();
+            if (!scan(V.G, Callees, Nodes))
+            {
+                return false;
+            }
+            Size[ID] = Nodes;
+            State[ID] = Done;
+            Stack.pop_back();
+            continue;
+        }
+        if (State[ID] == Done)
+        {
+            Stack.pop_back();
+            continue;
+        }
+        State[ID] = Active;
+        V.Expanded = true;
+        const FunctionAST *G = V.G;
+        Callees.clear();
+        if (!scan(G, Callees, Nodes))
+        {
+            return false;
+        }
+        for (const FunctionAST *Callee : Callees)
+        {
+            uint8_t S = State[Callee->getProto()->getName().getID()];
+            if (S == Active)
+            {
+                return false; // recursion
+            }
+            if (S == New)
+            {
+                Stack.push_back({Callee, false});
+            }
+        }
+    }
+    return true;
+}
+
+// codegenVector - Lower Root on <Width x double>, with the parameters' vectors
+// in NamedValues. Ifs evaluate both arms and select; calls to functions of
+// Defs are inlined, binding the callee's parameters for the length of its
+// body. isBatchable() has checked that all of this is possible.
+llvm::Value *CodeGen::codegenVector(const ExprAST *Root, unsigned Width, const std::vector<const FunctionAST *> &Defs)
+{
+    llvm::Type *DoubleTy = Builder.getDoubleTy();
+    auto *VecTy = llvm::FixedVectorType::get(DoubleTy, Width);
+    llvm::Value *Zero = llvm::ConstantFP::get(VecTy, 0.0);
+
+    struct VecFrame
+    {
+        const ExprAST *E;
+        unsigned Stage;
+    };
+    std::vector<VecFrame> Stack{{Root, 0}};
+    std::vector<llvm::Value *> Vals;
+    // The bindings an inlined call replaced, restored when its body is done.
+    std::vector<llvm::Value *> Saved;
+    auto Pop = [&]()
+    {
+        llvm::Value *V = Vals.back();
+        Vals.pop_back();
+        return V;
+    };
+
+    while (!Stack.empty())
+    {
+        VecFrame F = Stack.back();
+        Stack.pop_back();
+        switch (F.E->getKind())
+        {
+        case ExprAST::Number:
+            Vals.push_back(llvm::ConstantFP::get(VecTy, static_cast<const NumberExprAST *>(F.E)->get_val()));
+            break;
+        case ExprAST::Variable:
+            Vals.push_back(NamedValues[static_cast<const VariableExprAST *>(F.E)->get_val().getID()]);
+            break;
+        case ExprAST::Binary:
+        {
+            auto *B = static_cast<const BinaryExprAST *>(F.E);
+            if (F.Stage == 0)
+            {
+                Stack.push_back({F.E, 1});
+                Stack.push_back({B->getRHS(), 0});
+                Stack.push_back({B->getLHS(), 0});
+                break;
+            }
+            llvm::Value *R = Pop();
+            llvm::Value *L = Pop();
+            if (B->getOp() == '<')
+            {
+                Vals.push_back(Builder.CreateUIToFP(Builder.CreateFCmpULT(L, R, "cmptmp"), VecTy, "booltmp"));
+            }
+            else
+            {
+                Vals.push_back(emitBinary(B->getOp(), L, R));
+            }
+            break;
+        }
+        case ExprAST::If:
+        {
+            auto *If = static_cast<const IfExprAST *>(F.E);
+            if (F.Stage == 0)
+            {
+                Stack.push_back({F.E, 1});
+                Stack.push_back({If->getElse(), 0});
+                Stack.push_back({If->getThen(), 0});
+                Stack.push_back({If->getCond(), 0});
+                break;
+            }
+            llvm::Value *ElseV = Pop();
+            llvm::Value *ThenV = Pop();
+            llvm::Value *Cond = Builder.CreateFCmpONE(Pop(), Zero, "ifcond");
+            Vals.push_back(Builder.CreateSelect(Cond, ThenV, ElseV, "iftmp"));
+            break;
+        }
+        case ExprAST::Call:
+        {
+            auto *C = static_cast<const CallExprAST *>(F.E);
+            ASTArray<ExprAST *> Args = C->getArgs();
+            const FunctionAST *Callee = Defs[C->getCallee().getID()];
+            if (F.Stage == 0)
+            {
+                Stack.push_back({F.E, 1});
+                for (uint32_t I = Args.size(); I-- > 0;)
+                {
+                    Stack.push_back({Args[I], 0});
+                }
+                break;
+            }
+            ASTArray<Symbol> Params = Callee ? Callee->getProto()->getArgs() : ASTArray<Symbol>();
+            if (F.Stage == 2)
+            {
+                for (uint32_t I = Params.size(); I-- > 0;)
+                {
+                    NamedValues[Params[I].getID()] = Saved.back();
+                    Saved.pop_back();
+                }
+                break;
+            }
+            std::vector<llvm::Value *> ArgV(Vals.end() - Args.size(), Vals.end());
+            Vals.resize(Vals.size() - Args.size());
+            if (Callee)
+            {
+                for (uint32_t I = 0; I != Params.size(); ++I)
+                {
+                    Saved.push_back(NamedValues[Params[I].getID()]);
+                    NamedValues[Params[I].getID()] = ArgV[I];
+                }
+                Stack.push_back({F.E, 2});
+                Stack.push_back({Callee->getBody(), 0});
+                break;
+            }
+            llvm::StringRef Name = name(C->getCallee());
+            llvm::Intrinsic::ID ID = vectorIntrinsic(Name, Args.size());
+            if (ID != llvm::Intrinsic::not_intrinsic)
+            {
+                Vals.push_back(Builder.CreateIntrinsic(ID, {VecTy}, ArgV, nullptr, Name));
+                break;
+            }
+            // No vector form: call the scalar function on each lane.
+            llvm::Function *Scalar = getFunction(C->getCallee(), Args.size());
+            llvm::Value *V = llvm::UndefValue::get(VecTy);
+            for (unsigned Lane = 0; Lane != Width; ++Lane)
+            {
+                std::vector<llvm::Value *> LaneArgs;
+                for (llvm::Value *Arg : ArgV)
+                {
+                    LaneArgs.push_back(Builder.CreateExtractElement(Arg, Lane));
+                }
+                V = Builder.CreateInsertElement(V, Builder.CreateCall(Scalar, LaneArgs, "calltmp"), Lane);
+            }
+            Vals.push_back(V);
+            break;
+        }
+        }
+    }
+    return Vals.back();
+}
+
+llvm::Function *CodeGen::codegenBatch(const ModuleAST &M, Symbol Name, unsigned &Width)
+{
+    std::vector<const FunctionAST *> Defs(Symbols.size(), nullptr);
+    for (const FunctionAST *F : M.Functions)
+    {
+        const PrototypeAST *P = F->getProto();
+        if (!isTopLevelExpr(P, Symbols))
+        {
+            Defs[P->getName().getID()] = F;
+        }
+    }
+    const FunctionAST *Def = Defs[Name.getID()];
+    llvm::Function *Scalar = TheModule->getFunction(name(Name));
+    if (!Def || !Scalar || Scalar->isDeclaration())
+    {
+        logError("no function '%s' to batch", name(Name));
+        return nullptr;
+    }
+    if (Width == 0 || (Width & (Width - 1)) != 0)
+    {
+        logError("batch width for '%s' must be a power of two", name(Name));
+        return nullptr;
+    }
+
+    llvm::Type *DoubleTy = Builder.getDoubleTy();
+    llvm::Type *I64 = Builder.getInt64Ty();
+    llvm::PointerType *DoublePtrTy = DoubleTy->getPointerTo();
+    llvm::FunctionType *FT =
+        llvm::FunctionType::get(Builder.getVoidTy(), {DoublePtrTy->getPointerTo(), DoublePtrTy, I64}, false);
+    llvm::Function *K =
+        llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Scalar->getName() + ".batch", TheModule.get());
+    llvm::Value *ColumnsArg = K->getArg(0), *Out = K->getArg(1), *NumRows = K->getArg(2);
+    ColumnsArg->setName("columns");
+    Out->setName("out");
+    NumRows->setName("rows");
+
+    llvm::BasicBlock *Entry = llvm::BasicBlock::Create(*Context, "entry", K);
+    Builder.SetInsertPoint(Entry);
+    ASTArray<Symbol> Params = Def->getProto()->getArgs();
+    std::vector<llvm::Value *> Columns;
+    for (unsigned I = 0; I != Params.size(); ++I)
+    {
+        llvm::Value *Ptr = Builder.CreateInBoundsGEP(DoublePtrTy, ColumnsArg, Builder.getInt64(I));
+        Columns.push_back(Builder.CreateLoad(DoublePtrTy, Ptr, name(Params[I]) + ".column"));
+    }
+    llvm::BasicBlock *RowsCheck = llvm::BasicBlock::Create(*Context, "rows.check", K);
+    llvm::BasicBlock *RowBody = llvm::BasicBlock::Create(*Context, "row.body", K);
+    llvm::BasicBlock *Exit = llvm::BasicBlock::Create(*Context, "exit", K);
+
+    // Width rows at a time up to VecEnd, then one at a time.
+    llvm::Value *VecEnd = Builder.getInt64(0);
+    if (Width > 1 && isBatchable(Def, Defs))
+    {
+        auto *VecTy = llvm::FixedVectorType::get(DoubleTy, Width);
+        VecEnd = Builder.CreateAnd(NumRows, Builder.getInt64(~uint64_t(Width - 1)), "vec.end");
+        llvm::BasicBlock *VecBody = llvm::BasicBlock::Create(*Context, "vec.body", K, RowsCheck);
+        Builder.CreateCondBr(Builder.CreateICmpNE(VecEnd, Builder.getInt64(0)), VecBody, RowsCheck);
+
+        Builder.SetInsertPoint(VecBody);
+        llvm::PHINode *I = Builder.CreatePHI(I64, 2, "i");
+        I->addIncoming(Builder.getInt64(0), Entry);
+        for (unsigned P = 0; P != Params.size(); ++P)
+        {
+            llvm::Value *Ptr = Builder.CreateInBoundsGEP(DoubleTy, Columns[P], I);
+            Ptr = Builder.CreateBitCast(Ptr, VecTy->getPointerTo());
+            NamedValues[Params[P].getID()] = Builder.CreateAlignedLoad(VecTy, Ptr, llvm::Align(8), name(Params[P]));
+        }
+        llvm::Value *V = codegenVector(Def->getBody(), Width, Defs);
+        for (Symbol Param : Params)
+        {
+            NamedValues[Param.getID()] = nullptr;
+        }
+        llvm::Value *Ptr = Builder.CreateBitCast(Builder.CreateInBoundsGEP(DoubleTy, Out, I), VecTy->getPointerTo());
+        Builder.CreateAlignedStore(V, Ptr, llvm::Align(8));
+        llvm::Value *Next = Builder.CreateAdd(I, Builder.getInt64(Width), "i.next");
+        I->addIncoming(Next, Builder.GetInsertBlock());
+        Builder.CreateCondBr(Builder.CreateICmpULT(Next, VecEnd), VecBody, RowsCheck);
+    }
+    else
+    {
+        Width = 1;
+        Builder.CreateBr(RowsCheck);
+    }
+
+    Builder.SetInsertPoint(RowsCheck);
+    Builder.CreateCondBr(Builder.CreateICmpULT(VecEnd, NumRows), RowBody, Exit);
+
+    Builder.SetInsertPoint(RowBody);
+    llvm::PHINode *J = Builder.CreatePHI(I64, 2, "j");
+    J->addIncoming(VecEnd, RowsCheck);
+    std::vector<llvm::Value *> Row;
+    for (unsigned P = 0; P != Params.size(); ++P)
+    {
+        Row.push_back(
+            Builder.CreateLoad(DoubleTy, Builder.CreateInBoundsGEP(DoubleTy, Columns[P], J), name(Params[P])));
+    }
+    Builder.CreateStore(Builder.CreateCall(Scalar, Row, "calltmp"), Builder.CreateInBoundsGEP(DoubleTy, Out, J));
+    llvm::Value *Next = Builder.CreateAdd(J, Builder.getInt64(1), "j.next");
+    J->addIncoming(Next, RowBody);
+    Builder.CreateCondBr(Builder.CreateICmpULT(Next, NumRows), RowBody, Exit);
+
+    Builder.SetInsertPoint(Exit);
+    Builder.CreateRetVoid();
+
+    std::string Problems;
+    llvm::raw_string_ostream OS(Problems);
+    if (llvm::verifyFunction(*K, &OS))
+    {
+        logError("invalid IR for function '%s':", K->getName());
+        fputs(OS.str().c_str(), stderr);
+        K->eraseFromParent();
+        return nullptr;
+    }
+    if (Optimizer)
+    {
+        Optimizer->run(*K);
+    }
+    return K;
+}
+
+unsigned CodeGen::codegenModule(const ModuleAST &M)
+{
+    // Externs first, so their declarations take the parameter names.
+    for (const PrototypeAST *P : M.Externs)
+    {
+        codegen(P);
+    }
+    for (const FunctionAST *F : M.Functions)
+    {
+        codegen(F);
+    }
+    return NumErrors;
+}
@@ -0,0 +1,205 @@
+#ifndef KALEIDOSCOPE_UTILS_CODEGEN_H
+#define KALEIDOSCOPE_UTILS_CODEGEN_H
+
+#include "ast.h"
+#include "symboltable.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <memory>
+#include <vector>
+
+class FunctionOptimizer;
+
+//===-------------------------------------------------------------===//
+// Code generation
+//===-------------------------------------------------------------===//
+// CodeGen - Lowers the AST of one compilation unit to LLVM IR. The unit owns
+// its LLVMContext, Module and IRBuilder instead of sharing globals, so units
+// can be lowered on different threads at once. Every value is a double:
+// arithmetic is floating point and '<' yields 0.0 or 1.0.
+//
+// Calls to functions the unit neither defines nor declares become external
+// declarations, to be resolved against the other units; the driver's link
+// step has already checked that they exist with the right arity. Top-level
+// expressions become internal zero-argument functions, kept in source order
+// in getTopLevelExprs().
+//
+// With an optimizer set, every function is optimized as soon as it has been
+// lowered and verified.
+//
+// Functions marked with memoize() get a result cache in front of their body.
+// The cache is direct-mapped on a hash of the arguments' bit patterns, so
+// -0.0 and 0.0 (and NaNs with different payloads) are different keys; a
+// colliding call evicts the entry it lands on. It lives in the external
+// globals "<f>.memo" and, counting hits and misses, "<f>.memo.stats"
+// ([2 x i64]). Only pure functions may be memoized, since a hit skips the
+// body's calls.
+//
+// Unless tail calls are turned off, a call whose value the function returns
+// is marked as a tail call: musttail, which guarantees it, when the callee
+// takes as many arguments as the caller, tail otherwise. A function's tail
+// calls to itself become a loop around its body, so iteration written as
+// recursion runs in constant stack. Memoized functions are left alone; their
+// result still has to be stored.
+//
+// With profiling on, every function but the top-level expressions counts its
+// calls and the cycles spent in its own body (llvm.readcyclecounter, less
+// what the profiled functions it calls spent) in the external global
+// "<f>.prof" ([2 x i64]). The cycles of the callee that just returned are
+// passed up in "kaleidoscope.prof.children", which the JIT's runtime
+// defines. The counters are plain loads and stores, for one thread at a
+// time. Calls in tail position become ordinary calls, since the counters are
+// updated after they return. Loops for self tail calls stay loops, and count
+// a call on every trip round.
+//
+// codegenBatch() adds a kernel that applies a function to whole columns of
+// arguments; see there.
+class CodeGen
+{
+public:
+    // TailCallMode - What setTailCalls() enables.
+    enum TailCallMode
+    {
+        NoTailCalls,
+        TailCalls,
+        // Also loops for "e op f(...)" and "f(...) op e" in tail position,
+        // with op + or * and e free of calls when it comes second: the
+        // function keeps a running e1 op e2 op ... and combines it with the
+        // value it finally returns. This reassociates floating-point
+        // arithmetic, so results can differ in the last bits.
+        AccumulatorTailCalls,
+    };
+
+private:
+    std::unique_ptr<llvm::LLVMContext> Context;
+    std::unique_ptr<llvm::Module> TheModule;
+    llvm::IRBuilder<> Builder;
+    const SymbolTable &Symbols;
+    FunctionOptimizer *Optimizer = nullptr;
+    TailCallMode TailMode = TailCalls;
+    bool Profiling = false;
+
+    // NamedValues - The argument bound to each symbol in the function being
+    // lowered, indexed by Symbol ID; null for anything that isn't a parameter.
+    std::vector<llvm::Value *> NamedValues;
+
+    std::vector<llvm::Function *> TopLevelExprs;
+    unsigned NumErrors = 0;
+
+    // MemoBits - log2 of the cache entries of each memoized function, indexed
+    // by Symbol ID; 0 for the rest.
+    std::vector<uint8_t> MemoBits;
+
+    // Scratch stacks of the expression walk, kept across calls.
+    struct Frame
+    {
+        const ExprAST *E;
+        unsigned Stage;
+    };
+    struct PendingIf
+    {
+        llvm::BasicBlock *Then, *Else, *Merge;
+        llvm::Value *ThenV;
+    };
+    std::vector<Frame> Frames;
+    std::vector<llvm::Value *> Values;
+    std::vector<PendingIf> Ifs;
+
+    llvm::StringRef name(Symbol S) const;
+    llvm::Value *logError(const char *Fmt, llvm::StringRef Name);
+    llvm::Function *getFunction(Symbol Name, unsigned NumArgs);
+    llvm::Value *emitBinary(char Op, llvm::Value *L, llvm::Value *R);
+
+    // MemoSlot - The entry of a memoized call, filled in once the body has
+    // produced its result.
+    struct MemoSlot
+    {
+        llvm::GlobalVariable *Cache = nullptr, *Stats = nullptr;
+        llvm::StructType *EntryTy = nullptr;
+        llvm::Value *Entry = nullptr;
+        std::vector<llvm::Value *> Keys;
+    };
+    MemoSlot emitMemoLookup(llvm::Function *F, unsigned CacheBits);
+    void emitMemoCount(const MemoSlot &Slot, unsigned Counter);
+    void emitMemoStore(const MemoSlot &Slot, llvm::Value *Result);
+
+    // ProfileSlot - What emitProfileEntry() leaves for emitProfileExits().
+    struct ProfileSlot
+    {
+        llvm::GlobalVariable *Counters = nullptr;
+        llvm::Value *Start = nullptr, *SavedChildren = nullptr;
+    };
+    ProfileSlot emitProfileEntry(llvm::Function *F);
+    void emitProfileCall(const ProfileSlot &Slot);
+    void emitProfileExits(llvm::Function *F, const ProfileSlot &Slot);
+
+    bool codegenTail(llvm::Function *F, const PrototypeAST *P, const ExprAST *Body, const ProfileSlot &Profile,
+                     const MemoSlot &Memo);
+
+    bool isBatchable(const FunctionAST *F, const std::vector<const FunctionAST *> &Defs) const;
+    llvm::Value *codegenVector(const ExprAST *Root, unsigned Width, const std::vector<const FunctionAST *> &Defs);
+
+public:
+    CodeGen(const SymbolTable &Symbols, llvm::StringRef ModuleName);
+
+    // setOptimizer - Optimize the functions lowered from now on with O, which
+    // must outlive those calls (null to stop). Also adopts O's target triple
+    // and data layout for the module.
+    void setOptimizer(FunctionOptimizer *O);
+
+    // setTailCalls - How to lower calls in tail position from now on;
+    // TailCalls by default.
+    void setTailCalls(TailCallMode Mode) { TailMode = Mode; }
+
+    // setProfiling - Whether the functions lowered from now on count their
+    // calls and cycles; off by default.
+    void setProfiling(bool On) { Profiling = On; }
+
+    // memoize - Give the function Name a cache of 2^CacheBits results
+    // (CacheBits in [1, 24]) when it is lowered. Call before codegen.
+    void memoize(Symbol Name, unsigned CacheBits);
+
+    llvm::Value *codegen(const ExprAST *E);
+    llvm::Function *codegen(const PrototypeAST *P);
+    llvm::Function *codegen(const FunctionAST *F);
+
+    // codegenModule - Lower every extern and function of M, in source order.
+    // Returns the number of errors reported.
+    unsigned codegenModule(const ModuleAST &M);
+
+    // codegenBatch - Add "<f>.batch" for the function Name of M, which
+    // codegenModule() has lowered:
+    //
+    //   void f.batch(const double **Columns, double *Out, i64 NumRows)
+    //
+    // sets Out[i] = f(Columns[0][i], ..., Columns[N-1][i]) for every row i.
+    // Rows go Width (a power of two) at a time through a copy of f's body
+    // lowered on <Width x double>, with every if a select, when that computes
+    // the same thing: f and the functions it calls, which are inlined, may
+    // call only pure externs, mustn't recurse or use user-defined operators,
+    // and must stay small once inlined. Pure externs become vector
+    // intrinsics where LLVM has one and a call per lane otherwise. The rows
+    // left over, and every row if f doesn't qualify or Width is 1, call f;
+    // Width is set to 1 when the kernel has no vector loop. Returns null
+    // after reporting an error.
+    llvm::Function *codegenBatch(const ModuleAST &M, Symbol Name, unsigned &Width);
+
+    // takeModule - Hand the module and its context over together, e.g. to
+    // the JIT. The CodeGen must not be used afterwards.
+    llvm::orc::ThreadSafeModule takeModule()
+    {
+        return llvm::orc::ThreadSafeModule(std::move(TheModule), std::move(Context));
+    }
+
+    llvm::Module &getModule() { return *TheModule; }
+    llvm::LLVMContext &getContext() { return *Context; }
+    const std::vector<llvm::Function *> &getTopLevelExprs() const { return TopLevelExprs; }
+    unsigned getNumErrors() const { return NumErrors; }
+};
+
+#endif // KALEIDOSCOPE_UTILS_CODEGEN_H
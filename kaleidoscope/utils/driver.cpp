@@ -0,0 +1,1059 @@
+#include "driver.h"
+
+#include "aot.h"
+#include "chunkparse.h"
+#include "codegen.h"
+#include "fold.h"
+#include "frontend.h"
+#include "inline.h"
+#include "jit.h"
+#include "moduleimage.h"
+#include "objcache.h"
+#include "optimizer.h"
+#include "profile.h"
+#include "purity.h"
+#include "session.h"
+#include "sema.h"
+#include "sourcebuffer.h"
+#include "stream.h"
+#include "threadpool.h"
+#include "tiered.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    int64_t nowNanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // StageTimer - Wall time of one stage across all files. With files in
+    // flight on several threads a stage has two useful numbers: the span from
+    // its first start to its last finish, and the summed time its tasks were
+    // busy. Their ratio is the parallelism the stage actually got. While
+    // tracing, each run is also an event named after the stage.
+    struct StageTimer
+    {
+        const char *Name;
+        std::atomic<int64_t> First{INT64_MAX};
+        std::atomic<int64_t> Last{0};
+        std::atomic<int64_t> Busy{0};
+
+        explicit StageTimer(const char *Name) : Name(Name) {}
+
+        // run - Time Body. Detail, e.g. the unit's file name, goes with its
+        // trace event.
+        template <typename F>
+        void run(F &&Body, std::string_view Detail = {})
+        {
+            int64_t Start = nowNanos();
+            Body();
+            int64_t End = nowNanos();
+            if (isTracing())
+            {
+                traceEvent(Name, Start, End, Detail);
+            }
+            Busy.fetch_add(End - Start);
+            int64_t Cur = First.load();
+            while (Start < Cur && !First.compare_exchange_weak(Cur, Start))
+            {
+            }
+            Cur = Last.load();
+            while (End > Cur && !Last.compare_exchange_weak(Cur, End))
+            {
+            }
+        }
+
+        double wallSeconds() const
+        {
+            return Last.load() > First.load() ? (Last.load() - First.load()) * 1e-9 : 0.0;
+        }
+        double busySeconds() const { return Busy.load() * 1e-9; }
+    };
+
+    // CompilationUnit - Everything the pipeline keeps for one input. Units
+    // share nothing, so the tasks of different files never synchronize; only
+    // the chunks of one large file count down Pending together.
+    struct CompilationUnit
+    {
+        std::string Path;
+        uint64_t Size = 0;
+        std::unique_ptr<SourceBuffer> Source;
+        SymbolTable Symbols;
+        ASTContext Ctx;
+        ModuleAST Module;
+        ModuleInterface Interface;
+        FoldStats Folded;
+        InlineStats Inlined;
+        std::vector<Symbol> Memo; // functions to lower with a result cache
+        std::vector<std::pair<uint64_t, uint64_t>> MemoCounts; // their hits and misses after -jit
+        std::unique_ptr<CodeGen> IR;
+        unsigned NumErrors = 0;
+        uint64_t SourceHash = 0; // hashSource() of Source, with -module-cache
+        bool FromImage = false;  // Module was loaded from -module-cache
+
+        std::unique_ptr<ChunkedParse> Chunks;
+        std::atomic<unsigned> Pending{0};
+    };
+
+    // A file is split into chunks only when each chunk would still be large
+    // enough to amortize its task and symbol remapping, and into no more than
+    // a few chunks per worker so stealing can even out the load.
+    const uint64_t MinChunkSize = 256 * 1024;
+    const unsigned ChunksPerThread = 4;
+
+    CodeGen::TailCallMode tailCallMode(const DriverOptions &Opts)
+    {
+        if (!Opts.TailCalls)
+        {
+            return CodeGen::NoTailCalls;
+        }
+        return Opts.AssociativeMath ? CodeGen::AccumulatorTailCalls : CodeGen::TailCalls;
+    }
+
+    // Pipeline - The per-file task graph. Each stage queues the next from
+    // inside a worker, so it lands on that worker's own deque and normally
+    // runs next on the same thread, while the file is still in its caches.
+    //
+    //   read -> parse                                  -> sema -> fold -> codegen
+    //        \-> parse chunk * N -> map -> remap * N -> merge -/
+    class Pipeline
+    {
+    private:
+        ThreadPool &Pool;
+        bool Fold;
+        bool Inline;
+        unsigned OptLevel;
+        CodeGen::TailCallMode TailCalls;
+        unsigned MemoCacheBits;
+        PassTimings *Timings;
+        const AOTTarget *Target;
+        bool Profiling;
+        const ProfileData *Profile;
+        std::string ImageDir; // -module-cache, if not empty
+
+        // imagePath - Where the image of a source hashing to SourceHash goes.
+        std::string imagePath(uint64_t SourceHash) const
+        {
+            char Name[32];
+            snprintf(Name, sizeof(Name), "%016llx.ksm", static_cast<unsigned long long>(SourceHash));
+            llvm::SmallString<256> Path(ImageDir);
+            llvm::sys::path::append(Path, Name);
+            return std::string(Path);
+        }
+
+    public:
+        StageTimer Parse{"parse"};
+        StageTimer Sema{"sema"};
+        StageTimer Folding{"fold"};
+        StageTimer Inlining{"inline"};
+        StageTimer Codegen{"codegen"};
+
+        // Timings, if not null, collects -time-passes for every unit.
+        // MemoCacheBits is 0 unless pure recursive functions get a cache.
+        // Target, if not null, is the machine to optimize for instead of the
+        // host. Profiling instruments every function; Profile, if not null,
+        // guides inlining.
+        Pipeline(ThreadPool &Pool, bool Fold, bool Inline, unsigned OptLevel, CodeGen::TailCallMode TailCalls,
+                 unsigned MemoCacheBits, PassTimings *Timings, const AOTTarget *Target, bool Profiling,
+                 const ProfileData *Profile)
+            : Pool(Pool), Fold(Fold), Inline(Inline), OptLevel(OptLevel), TailCalls(TailCalls),
+              MemoCacheBits(MemoCacheBits), Timings(Timings), Target(Target), Profiling(Profiling), Profile(Profile)
+        {
+        }
+
+        std::atomic<unsigned> ImagesLoaded{0}, ImagesSaved{0};
+
+        // setModuleCache - Load each unit's module from an image in Dir when
+        // there is one for its source, and save one after parsing it when
+        // there isn't (moduleimage.h).
+        void setModuleCache(const std::string &Dir) { ImageDir = Dir; }
+
+        void start(CompilationUnit *U)
+        {
+            Pool.async([this, U]
+                       { read(U); });
+        }
+
+    private:
+        void read(CompilationUnit *U)
+        {
+            U->Source = U->Path == "-" ? SourceBuffer::getSTDIN() : SourceBuffer::getFile(U->Path.c_str());
+            if (!U->Source)
+            {
+                fprintf(stderr, "Error: cannot read '%s': %s\n", U->Interface.FileName.c_str(),
+                        strerror(errno));
+                ++U->NumErrors;
+                return;
+            }
+            if (!ImageDir.empty() && loadImage(U))
+            {
+                check(U);
+                return;
+            }
+
+            // With a single worker, chunks would only add remapping work.
+            unsigned MaxChunks = Pool.getNumThreads() > 1 ? Pool.getNumThreads() * ChunksPerThread : 1;
+            uint64_t BySize = U->Source->size() / MinChunkSize;
+            MaxChunks = BySize < MaxChunks ? static_cast<unsigned>(BySize) : MaxChunks;
+            std::vector<SourceChunk> Ranges;
+            if (MaxChunks > 1)
+            {
+                Parse.run([&]
+                          { Ranges = splitTopLevel(*U->Source, MaxChunks); }, U->Interface.FileName);
+            }
+            if (Ranges.size() <= 1)
+            {
+                Parse.run([&]
+                          {
+                              Lexer Lex(*U->Source, U->Symbols);
+                              Parser P(Lex);
+                              U->Module = P.parseModule(U->Ctx);
+                              U->NumErrors += P.getNumErrors();
+                          }, U->Interface.FileName);
+                check(U);
+                return;
+            }
+
+            U->Chunks = std::make_unique<ChunkedParse>(*U->Source, Ranges);
+            forEachChunk(U, [](CompilationUnit *U, unsigned I)
+                         { U->Chunks->parseChunk(I); },
+                         [this](CompilationUnit *U)
+                         { mapSymbols(U); });
+        }
+
+        // loadImage - Load U's module from the image of its source instead of
+        // parsing it; false if there is no usable image. That is part of the
+        // parse stage, which it replaces.
+        bool loadImage(CompilationUnit *U)
+        {
+            Parse.run([&]
+                      {
+                          U->SourceHash = hashSource(U->Source->begin(), U->Source->size());
+                          auto Image = ModuleImage::open(imagePath(U->SourceHash), U->SourceHash, U->Source->size());
+                          U->FromImage = Image && Image->load(U->Ctx, U->Symbols, U->Module);
+                      }, U->Interface.FileName);
+            if (U->FromImage)
+            {
+                ImagesLoaded.fetch_add(1);
+            }
+            return U->FromImage;
+        }
+
+        // saveImage - Save the module just parsed for U, before anything
+        // rewrites it. The cache only saves parsing, so failing to write it
+        // is not an error.
+        void saveImage(CompilationUnit *U)
+        {
+            Parse.run([&]
+                      {
+                          // Nothing in the grammar changes the operators yet.
+                          if (ModuleImage::write(imagePath(U->SourceHash), U->Module, U->Symbols,
+                                                 makeDefaultPrecedence(), U->SourceHash, U->Source->size()))
+                          {
+                              ImagesSaved.fetch_add(1);
+                          }
+                      }, U->Interface.FileName);
+        }
+
+        void mapSymbols(CompilationUnit *U)
+        {
+            Parse.run([&]
+                      { U->Chunks->mapSymbols(U->Symbols); }, U->Interface.FileName);
+            forEachChunk(U, [](CompilationUnit *U, unsigned I)
+                         { U->Chunks->remapChunk(I); },
+                         [this](CompilationUnit *U)
+                         {
+                             Parse.run([&]
+                                       {
+                                           U->NumErrors += U->Chunks->merge(U->Ctx, U->Module);
+                                           U->Chunks.reset();
+                                       }, U->Interface.FileName);
+                             check(U);
+                         });
+        }
+
+        // forEachChunk - Run Body for every chunk of U as separate tasks, then
+        // Done in whichever task finishes last.
+        template <typename BodyT, typename DoneT>
+        void forEachChunk(CompilationUnit *U, BodyT Body, DoneT Done)
+        {
+            unsigned N = U->Chunks->getNumChunks();
+            U->Pending.store(N);
+            for (unsigned I = 0; I < N; ++I)
+            {
+                Pool.async([this, U, I, Body, Done]
+                           {
+                               Parse.run([&]
+                                         { Body(U, I); }, U->Interface.FileName);
+                               if (U->Pending.fetch_sub(1) == 1)
+                               {
+                                   Done(U);
+                               }
+                           });
+            }
+        }
+
+        void check(CompilationUnit *U)
+        {
+            Pool.async([this, U]
+                       {
+                           if (!ImageDir.empty() && !U->FromImage && U->NumErrors == 0)
+                           {
+                               saveImage(U);
+                           }
+                           Sema.run([&]
+                                    { U->NumErrors += checkModule(U->Module, U->Symbols, U->Interface); },
+                                    U->Interface.FileName);
+                           if (U->NumErrors == 0 && Fold)
+                           {
+                               Folding.run([&]
+                                           { U->Folded = foldModule(U->Module, U->Ctx); }, U->Interface.FileName);
+                           }
+                           if (U->NumErrors == 0 && Inline)
+                           {
+                               Inlining.run([&]
+                                            { U->Inlined = inlineModule(U->Module, U->Symbols, U->Ctx, Profile); },
+                                            U->Interface.FileName);
+                           }
+                           if (U->NumErrors == 0 && MemoCacheBits != 0)
+                           {
+                               U->Memo = findMemoCandidates(U->Module, U->Symbols);
+                           }
+                           if (U->NumErrors == 0)
+                           {
+                               lower(U);
+                           }
+                       });
+        }
+
+        // lower - Codegen, optimizing each function as it is lowered. The
+        // optimizer is per unit and only lives as long as this task.
+        void lower(CompilationUnit *U)
+        {
+            Pool.async([this, U]
+                       { Codegen.run([&]
+                                     {
+                                         U->IR = std::make_unique<CodeGen>(U->Symbols, U->Interface.FileName);
+                                         std::unique_ptr<FunctionOptimizer> Optimizer;
+                                         if (Target)
+                                         {
+                                             auto TM = createAOTTargetMachine(*Target, OptLevel);
+                                             if (TM)
+                                             {
+                                                 Optimizer = std::make_unique<FunctionOptimizer>(
+                                                     OptLevel, std::move(TM), Timings);
+                                             }
+                                         }
+                                         else if (OptLevel > 0 || Timings)
+                                         {
+                                             Optimizer = FunctionOptimizer::create(OptLevel, Timings);
+                                         }
+                                         if (Target || OptLevel > 0 || Timings)
+                                         {
+                                             if (!Optimizer)
+                                             {
+                                                 ++U->NumErrors;
+                                                 return;
+                                             }
+                                             U->IR->setOptimizer(Optimizer.get());
+                                         }
+                                         U->IR->setTailCalls(TailCalls);
+                                         U->IR->setProfiling(Profiling);
+                                         for (Symbol S : U->Memo)
+                                         {
+                                             U->IR->memoize(S, MemoCacheBits);
+                                         }
+                                         U->NumErrors += U->IR->codegenModule(U->Module);
+                                         U->IR->setOptimizer(nullptr);
+                                     }, U->Interface.FileName); });
+        }
+    };
+
+    uint64_t inputSize(const std::string &Path)
+    {
+        struct stat St;
+        if (Path == "-" || stat(Path.c_str(), &St) != 0)
+        {
+            return 0;
+        }
+        return static_cast<uint64_t>(St.st_size);
+    }
+
+    // emitLLVM - Write U's IR to stdout for standard input, else to the input's
+    // file name with a .ll extension in the current directory, like clang.
+    bool emitLLVM(CompilationUnit &U)
+    {
+        if (U.Path == "-")
+        {
+            U.IR->getModule().print(llvm::outs(), nullptr);
+            return true;
+        }
+        llvm::SmallString<128> OutPath(llvm::sys::path::filename(U.Path));
+        llvm::sys::path::replace_extension(OutPath, "ll");
+        std::error_code EC;
+        llvm::raw_fd_ostream OS(OutPath, EC, llvm::sys::fs::OF_Text);
+        if (EC)
+        {
+            fprintf(stderr, "Error: cannot write '%s': %s\n", OutPath.c_str(), EC.message().c_str());
+            return false;
+        }
+        U.IR->getModule().print(OS, nullptr);
+        return true;
+    }
+
+    // emitObject - Compile U with TM to <name>.o, or with Assembly to
+    // <name>.s, and declare its functions in <name>.h, all in the current
+    // directory; from standard input, assembly goes to stdout and the files
+    // are named "stdin". Codegen passes change the IR, so this runs last.
+    bool emitObject(CompilationUnit &U, llvm::TargetMachine &TM, bool Assembly)
+    {
+        llvm::Module &M = U.IR->getModule();
+        M.setTargetTriple(TM.getTargetTriple().str());
+        M.setDataLayout(TM.createDataLayout());
+        llvm::SmallString<128> Base(U.Path == "-" ? llvm::StringRef("stdin") : llvm::sys::path::filename(U.Path));
+        llvm::SmallString<128> HeaderPath(Base), OutPath(Base);
+        llvm::sys::path::replace_extension(HeaderPath, "h");
+        llvm::sys::path::replace_extension(OutPath, Assembly ? "s" : "o");
+
+        std::error_code EC;
+        llvm::raw_fd_ostream Header(HeaderPath, EC, llvm::sys::fs::OF_Text);
+        if (EC)
+        {
+            fprintf(stderr, "Error: cannot write '%s': %s\n", HeaderPath.c_str(), EC.message().c_str());
+            return false;
+        }
+        Header << generateCHeader(U.Module, U.Symbols, Base);
+
+        if (U.Path == "-" && Assembly)
+        {
+            return emitMachineCode(M, TM, Assembly, llvm::outs());
+        }
+        llvm::raw_fd_ostream OS(OutPath, EC, Assembly ? llvm::sys::fs::OF_Text : llvm::sys::fs::OF_None);
+        if (EC)
+        {
+            fprintf(stderr, "Error: cannot write '%s': %s\n", OutPath.c_str(), EC.message().c_str());
+            return false;
+        }
+        return emitMachineCode(M, TM, Assembly, OS);
+    }
+
+    // readMemoCounts - Copy out the hit and miss counters codegen keeps next
+    // to each memoized function's cache, before the JIT goes away.
+    void readMemoCounts(KaleidoscopeJIT &JIT, std::vector<std::unique_ptr<CompilationUnit>> &Units)
+    {
+        for (auto &U : Units)
+        {
+            for (Symbol S : U->Memo)
+            {
+                auto Stats = JIT.getLLJIT().lookup(std::string(U->Symbols.getName(S)) + ".memo.stats");
+                if (!Stats)
+                {
+                    // Never compiled by the lazy JIT.
+                    llvm::consumeError(Stats.takeError());
+                    U->MemoCounts.push_back({0, 0});
+                    continue;
+                }
+                auto *Counts = llvm::jitTargetAddressToPointer<const uint64_t *>(Stats->getAddress());
+                U->MemoCounts.push_back({Counts[0], Counts[1]});
+            }
+        }
+    }
+
+    // readProfile - The calls and cycles of every function of every unit,
+    // from the counters of an instrumented build, before the JIT goes away.
+    std::unique_ptr<ProfileData> readProfile(KaleidoscopeJIT &JIT,
+                                             const std::vector<std::unique_ptr<CompilationUnit>> &Units)
+    {
+        std::map<std::string, FunctionProfile, std::less<>> Functions;
+        for (const auto &U : Units)
+        {
+            for (const FunctionAST *F : U->Module.Functions)
+            {
+                if (isTopLevelExpr(F->getProto(), U->Symbols))
+                {
+                    continue;
+                }
+                std::string Name(U->Symbols.getName(F->getProto()->getName()));
+                FunctionProfile &P = Functions[Name];
+                auto Counters = JIT.getLLJIT().lookup(Name + ".prof");
+                if (!Counters)
+                {
+                    // Never compiled by the lazy JIT, so never called.
+                    llvm::consumeError(Counters.takeError());
+                    continue;
+                }
+                auto *Counts = llvm::jitTargetAddressToPointer<const uint64_t *>(Counters->getAddress());
+                P.Calls = Counts[0];
+                P.Cycles = Counts[1];
+            }
+        }
+        return std::make_unique<ProfileData>(std::move(Functions));
+    }
+
+    // splitForCache - U's module in pieces named by cache keys.
+    std::vector<llvm::orc::ThreadSafeModule> splitForCache(CompilationUnit &U, const std::string &Salt,
+                                                          unsigned MemoCacheBits)
+    {
+        std::vector<char> Memoized(U.Symbols.size(), 0);
+        for (Symbol S : U.Memo)
+        {
+            Memoized[S.getID()] = 1;
+        }
+        std::string MemoSalt = Salt + " memo=" + std::to_string(MemoCacheBits);
+
+        std::vector<std::pair<llvm::Function *, std::string>> Keys;
+        const std::vector<llvm::Function *> &TopLevel = U.IR->getTopLevelExprs();
+        size_t NextExpr = 0;
+        for (const FunctionAST *F : U.Module.Functions)
+        {
+            Symbol Name = F->getProto()->getName();
+            std::string_view Str = U.Symbols.getName(Name);
+            llvm::Function *Fn = isTopLevelExpr(F->getProto(), U.Symbols)
+                                     ? TopLevel[NextExpr++]
+                                     : U.IR->getModule().getFunction(llvm::StringRef(Str.data(), Str.size()));
+            Keys.emplace_back(Fn, functionKey(*F, U.Symbols, Fn->getName(), Memoized[Name.getID()] ? MemoSalt : Salt));
+        }
+        return partitionForCache(U.IR->takeModule(), Keys);
+    }
+
+    // runJIT - Add every unit to one JIT and evaluate the top-level
+    // expressions, file by file in command-line order. With a Cache, Salt
+    // covers the target and options for the functions' keys. With Profile,
+    // the units are instrumented and their counts end up there. Returns the
+    // number of errors.
+    unsigned runJIT(std::vector<std::unique_ptr<CompilationUnit>> &Units, bool Lazy, DiskObjectCache *Cache,
+                    const std::string &Salt, unsigned MemoCacheBits, std::unique_ptr<ProfileData> *Profile)
+    {
+        auto JIT = KaleidoscopeJIT::create(Lazy ? KaleidoscopeJIT::Lazy : KaleidoscopeJIT::Eager,
+                                           /*Concurrent=*/false, Cache);
+        if (!JIT)
+        {
+            fprintf(stderr, "Error: cannot create JIT: %s\n", llvm::toString(JIT.takeError()).c_str());
+            return 1;
+        }
+
+        // Top-level expressions are internal to their unit; give them names
+        // that are unique across units (identifiers can't contain '.') and
+        // export them so the JIT can look them up.
+        std::vector<std::string> Exprs;
+        for (size_t I = 0; I != Units.size(); ++I)
+        {
+            const std::vector<llvm::Function *> &TopLevel = Units[I]->IR->getTopLevelExprs();
+            for (size_t N = 0; N != TopLevel.size(); ++N)
+            {
+                Exprs.push_back("__anon_expr." + std::to_string(I) + "." + std::to_string(N));
+                TopLevel[N]->setName(Exprs.back());
+                TopLevel[N]->setLinkage(llvm::Function::ExternalLinkage);
+            }
+            std::vector<llvm::orc::ThreadSafeModule> Modules;
+            if (Cache)
+            {
+                Modules = splitForCache(*Units[I], Salt, MemoCacheBits);
+            }
+            else
+            {
+                Modules.push_back(Units[I]->IR->takeModule());
+            }
+            for (llvm::orc::ThreadSafeModule &TSM : Modules)
+            {
+                if (llvm::Error Err = (*JIT)->addModule(std::move(TSM)))
+                {
+                    fprintf(stderr, "Error: %s: %s\n", Units[I]->Interface.FileName.c_str(),
+                            llvm::toString(std::move(Err)).c_str());
+                    return 1;
+                }
+            }
+        }
+
+        for (const std::string &Name : Exprs)
+        {
+            auto Expr = (*JIT)->lookupExpr(Name);
+            if (!Expr)
+            {
+                fprintf(stderr, "Error: %s\n", llvm::toString(Expr.takeError()).c_str());
+                return 1;
+            }
+            fprintf(stdout, "Evaluated to %f\n", (*Expr)());
+        }
+        readMemoCounts(**JIT, Units);
+        if (Profile)
+        {
+            *Profile = readProfile(**JIT, Units);
+        }
+        return 0;
+    }
+
+    // runTiered - Evaluate the top-level expressions in the bytecode
+    // interpreter, compiling functions that get hot unless Threshold is 0.
+    // The functions a Profile calls hot are compiled from the start. Returns
+    // the number of errors.
+    unsigned runTiered(std::vector<std::unique_ptr<CompilationUnit>> &Units, uint32_t Threshold, bool Report,
+                       const ProfileData *Profile)
+    {
+        auto Engine = TieredEngine::create(Threshold);
+        if (!Engine)
+        {
+            fprintf(stderr, "Error: cannot create JIT: %s\n", llvm::toString(Engine.takeError()).c_str());
+            return 1;
+        }
+        unsigned NumErrors = 0;
+        for (auto &U : Units)
+        {
+            NumErrors += (*Engine)->addUnit(U->Module, U->Symbols, U->Interface.FileName, U->IR->takeModule());
+        }
+        if (NumErrors != 0)
+        {
+            return NumErrors;
+        }
+        if (Profile && Threshold != 0)
+        {
+            for (const std::string &Name : Profile->getHotFunctions())
+            {
+                (*Engine)->precompile(Name); // a profile of other sources may name anything
+            }
+        }
+
+        for (uint32_t Expr : (*Engine)->getTopLevelExprs())
+        {
+            double Result;
+            if (!(*Engine)->run(Expr, Result))
+            {
+                return 1;
+            }
+            fprintf(stdout, "Evaluated to %f\n", Result);
+        }
+        if (Report && Threshold != 0)
+        {
+            fprintf(stderr, "  tier-up: %u hot function%s, %u compiled\n", (*Engine)->getNumPromoted(),
+                    (*Engine)->getNumPromoted() == 1 ? "" : "s", (*Engine)->getNumCompiled());
+        }
+        return 0;
+    }
+
+    void printStageTimes(const std::vector<const StageTimer *> &Stages, double Total, size_t NumFiles,
+                         unsigned NumThreads)
+    {
+        fprintf(stderr, "===-------------------------------------------------------------===\n");
+        fprintf(stderr, "  Stage times: %zu file%s on %u thread%s\n", NumFiles, NumFiles == 1 ? "" : "s",
+                NumThreads, NumThreads == 1 ? "" : "s");
+        fprintf(stderr, "===-------------------------------------------------------------===\n");
+        fprintf(stderr, "  %-10s %12s %12s %10s\n", "Stage", "Wall (s)", "Busy (s)", "Parallel");
+        for (const StageTimer *S : Stages)
+        {
+            double Wall = S->wallSeconds();
+            fprintf(stderr, "  %-10s %12.6f %12.6f %9.2fx\n", S->Name, Wall, S->busySeconds(),
+                    Wall > 0 ? S->busySeconds() / Wall : 0.0);
+        }
+        fprintf(stderr, "  %-10s %12.6f\n", "total", Total);
+    }
+
+    void printFoldStats(const std::vector<std::unique_ptr<CompilationUnit>> &Units)
+    {
+        fprintf(stderr, "  %-24s %10s %10s %7s %9s %9s %9s\n", "Folded", "Nodes", "Removed", "%", "Constants",
+                "Identity", "Branches");
+        for (const auto &U : Units)
+        {
+            const FoldStats &F = U->Folded;
+            fprintf(stderr, "  %-24s %10llu %10llu %6.1f%% %9llu %9llu %9llu\n", U->Interface.FileName.c_str(),
+                    static_cast<unsigned long long>(F.NodesBefore),
+                    static_cast<unsigned long long>(F.NodesEliminated),
+                    F.NodesBefore ? 100.0 * F.NodesEliminated / F.NodesBefore : 0.0,
+                    static_cast<unsigned long long>(F.ConstantsFolded),
+                    static_cast<unsigned long long>(F.Identities),
+                    static_cast<unsigned long long>(F.BranchesFolded));
+        }
+    }
+
+    void printInlineStats(const std::vector<std::unique_ptr<CompilationUnit>> &Units)
+    {
+        fprintf(stderr, "  %-24s %10s %10s %9s %11s %6s\n", "Inlined", "Nodes", "After", "Inlined", "Specialized",
+                "Clones");
+        for (const auto &U : Units)
+        {
+            const InlineStats &I = U->Inlined;
+            fprintf(stderr, "  %-24s %10llu %10llu %9llu %11llu %6llu\n", U->Interface.FileName.c_str(),
+                    static_cast<unsigned long long>(I.NodesBefore), static_cast<unsigned long long>(I.NodesAfter),
+                    static_cast<unsigned long long>(I.CallsInlined),
+                    static_cast<unsigned long long>(I.CallsSpecialized),
+                    static_cast<unsigned long long>(I.Specializations));
+        }
+    }
+
+    void printMemoStats(const std::vector<std::unique_ptr<CompilationUnit>> &Units)
+    {
+        fprintf(stderr, "  %-24s %14s %14s %7s\n", "Memoized", "Hits", "Misses", "Hit %");
+        for (const auto &U : Units)
+        {
+            for (size_t I = 0; I != U->MemoCounts.size(); ++I)
+            {
+                uint64_t Hits = U->MemoCounts[I].first, Misses = U->MemoCounts[I].second;
+                fprintf(stderr, "  %-24s %14llu %14llu %6.1f%%\n", std::string(U->Symbols.getName(U->Memo[I])).c_str(),
+                        static_cast<unsigned long long>(Hits), static_cast<unsigned long long>(Misses),
+                        Hits + Misses ? 100.0 * Hits / (Hits + Misses) : 0.0);
+            }
+        }
+    }
+
+    // runRepl - The -repl mode of runDriver().
+    int runRepl(const DriverOptions &Opts)
+    {
+        std::unique_ptr<Session> S = Session::create(Opts.OptLevel, Opts.Fold, tailCallMode(Opts));
+        if (!S)
+        {
+            return 1;
+        }
+        unsigned NumErrors = 0;
+        std::vector<double> Results;
+        auto addPiece = [&](std::string_view Source, std::string Name)
+        {
+            int64_t Start = nowNanos();
+            Results.clear();
+            NumErrors += S->add(Source, Results, std::move(Name));
+            for (double Result : Results)
+            {
+                fprintf(stdout, "Evaluated to %f\n", Result);
+            }
+            fflush(stdout);
+            if (Opts.TimeStages)
+            {
+                fprintf(stderr, "  piece: %.3f ms, %u functions defined\n", (nowNanos() - Start) * 1e-6,
+                        S->getNumFunctions());
+            }
+        };
+
+        for (const std::string &Path : Opts.Inputs)
+        {
+            if (Path == "-")
+            {
+                continue; // standard input comes last anyway
+            }
+            std::unique_ptr<SourceBuffer> Source = SourceBuffer::getFile(Path.c_str());
+            if (!Source)
+            {
+                fprintf(stderr, "Error: cannot read '%s': %s\n", Path.c_str(), strerror(errno));
+                ++NumErrors;
+                continue;
+            }
+            addPiece(std::string_view(Source->begin(), Source->size()), Path);
+        }
+
+        bool Interactive = isatty(fileno(stdin));
+        std::string Piece;
+        char *Line = nullptr;
+        size_t Capacity = 0;
+        while (true)
+        {
+            if (Interactive)
+            {
+                fprintf(stderr, Piece.empty() ? "ready> " : "...> ");
+            }
+            ssize_t Len = getline(&Line, &Capacity, stdin);
+            std::string_view Text = Len < 0 ? std::string_view() : std::string_view(Line, static_cast<size_t>(Len));
+            Piece.append(Text);
+            while (!Text.empty() && isspace(static_cast<unsigned char>(Text.back())))
+            {
+                Text.remove_suffix(1);
+            }
+            if (Len < 0 || Text.empty() || Text.back() == ';')
+            {
+                if (Piece.find_first_not_of(" \t\r\n") != std::string::npos)
+                {
+                    addPiece(Piece, "");
+                }
+                Piece.clear();
+            }
+            if (Len < 0)
+            {
+                break;
+            }
+        }
+        free(Line);
+        return NumErrors ? 1 : 0;
+    }
+
+    // runStream - The -stream mode of runDriver().
+    int runStream(const DriverOptions &Opts)
+    {
+        std::unique_ptr<Session> S = Session::create(Opts.OptLevel, Opts.Fold, tailCallMode(Opts));
+        if (!S)
+        {
+            return 1;
+        }
+        auto printResult = [](double Result)
+        {
+            fprintf(stdout, "Evaluated to %f\n", Result);
+            fflush(stdout);
+        };
+        unsigned NumErrors = 0;
+        StreamStats Stats;
+        int64_t Start = nowNanos();
+        for (const std::string &Path : Opts.Inputs.empty() ? std::vector<std::string>{"-"} : Opts.Inputs)
+        {
+            int FD = Path == "-" ? STDIN_FILENO : open(Path.c_str(), O_RDONLY);
+            if (FD < 0)
+            {
+                fprintf(stderr, "Error: cannot read '%s': %s\n", Path.c_str(), strerror(errno));
+                ++NumErrors;
+                continue;
+            }
+            NumErrors += streamSource(FD, Path == "-" ? "<stdin>" : Path, *S, printResult, &Stats);
+            if (FD != STDIN_FILENO)
+            {
+                close(FD);
+            }
+        }
+        if (Opts.TimeStages)
+        {
+            fprintf(stderr, "  stream: %.3f ms, %llu bytes, %llu tokens, %llu items in %llu pieces, %zu queued\n",
+                    (nowNanos() - Start) * 1e-6, static_cast<unsigned long long>(Stats.Bytes),
+                    static_cast<unsigned long long>(Stats.Tokens), static_cast<unsigned long long>(Stats.Items),
+                    static_cast<unsigned long long>(Stats.Pieces), Stats.MaxQueued);
+        }
+        return NumErrors ? 1 : 0;
+    }
+
+    // finishTracing - Print -stats and write -trace once everything traced
+    // has finished; Status, or 1 if the trace can't be written.
+    int finishTracing(const DriverOptions &Opts, int Status)
+    {
+        if (Opts.Stats)
+        {
+            printTraceSummary(stderr);
+        }
+        if (!Opts.TraceFile.empty() && !writeChromeTrace(Opts.TraceFile))
+        {
+            return 1;
+        }
+        return Status;
+    }
+}
+
+int runDriver(const DriverOptions &Opts)
+{
+    if (Opts.Stats || !Opts.TraceFile.empty())
+    {
+        enableTracing();
+    }
+    if (Opts.JITListeners != 0 && !setJITListeners(Opts.JITListeners))
+    {
+        return 1;
+    }
+    if (Opts.Execute == DriverOptions::ExecuteRepl)
+    {
+        return finishTracing(Opts, runRepl(Opts));
+    }
+    if (Opts.Execute == DriverOptions::ExecuteStream)
+    {
+        return finishTracing(Opts, runStream(Opts));
+    }
+    int64_t Start = nowNanos();
+
+    std::vector<std::unique_ptr<CompilationUnit>> Units;
+    for (const std::string &Path : Opts.Inputs.empty() ? std::vector<std::string>{"-"} : Opts.Inputs)
+    {
+        Units.push_back(std::make_unique<CompilationUnit>());
+        Units.back()->Path = Path;
+        Units.back()->Interface.FileName = Path == "-" ? "<stdin>" : Path;
+        Units.back()->Size = inputSize(Path);
+    }
+
+    StageTimer Link("link");
+    StageTimer Emit("emit");
+    StageTimer Run(Opts.Execute == DriverOptions::ExecuteJIT ? "jit" : "run");
+    std::unique_ptr<ProfileData> Profile, UseProfile;
+    if (!Opts.ProfileUse.empty() && !(UseProfile = ProfileData::read(Opts.ProfileUse)))
+    {
+        return 1;
+    }
+    // Instrumented code is for one run, and inlining would hide the calls
+    // it is meant to count.
+    bool Inline = Opts.Inline && Opts.OptLevel > 0 && !Opts.Profile;
+    std::unique_ptr<DiskObjectCache> Cache;
+    if (!Opts.CacheDir.empty() && Opts.Execute == DriverOptions::ExecuteJIT && !Opts.Profile)
+    {
+        Cache = DiskObjectCache::create(Opts.CacheDir);
+        if (!Cache)
+        {
+            return 1;
+        }
+    }
+    if (!Opts.ModuleCacheDir.empty())
+    {
+        if (std::error_code EC = llvm::sys::fs::create_directories(Opts.ModuleCacheDir))
+        {
+            fprintf(stderr, "Error: cannot create module cache '%s': %s\n", Opts.ModuleCacheDir.c_str(),
+                    EC.message().c_str());
+            return 1;
+        }
+    }
+    std::unique_ptr<AOTTarget> Target;
+    if (Opts.EmitObj || Opts.EmitAsm || !Opts.TargetTriple.empty() || !Opts.TargetCPU.empty() ||
+        !Opts.TargetAttrs.empty())
+    {
+        Target.reset(new AOTTarget{Opts.TargetTriple, Opts.TargetCPU, Opts.TargetAttrs});
+    }
+    PassTimings Timings;
+    std::unique_ptr<Pipeline> Stages;
+    unsigned NumThreads;
+    {
+        ThreadPool Pool(Opts.NumThreads);
+        NumThreads = Pool.getNumThreads();
+        Stages = std::make_unique<Pipeline>(Pool, Opts.Fold, Inline, Opts.OptLevel, tailCallMode(Opts),
+                                            Opts.Memoize ? Opts.MemoCacheBits : 0,
+                                            Opts.TimePasses || Opts.Stats ? &Timings : nullptr, Target.get(),
+                                            Opts.Profile, UseProfile.get());
+        if (!Opts.ModuleCacheDir.empty())
+        {
+            Stages->setModuleCache(Opts.ModuleCacheDir);
+        }
+
+        // Submit the largest files first; outside submissions are dealt out
+        // round-robin and thieves take the oldest task, so big files start
+        // early and small ones fill in the gaps at the end.
+        std::vector<CompilationUnit *> Order;
+        for (auto &U : Units)
+        {
+            Order.push_back(U.get());
+        }
+        std::stable_sort(Order.begin(), Order.end(),
+                         [](const CompilationUnit *L, const CompilationUnit *R)
+                         { return L->Size > R->Size; });
+
+        for (CompilationUnit *U : Order)
+        {
+            Stages->start(U);
+        }
+        Pool.wait();
+    }
+
+    unsigned NumErrors = 0;
+    for (auto &U : Units)
+    {
+        NumErrors += U->NumErrors;
+    }
+
+    // Cross-module checks only make sense once every module is complete.
+    if (NumErrors == 0)
+    {
+        Link.run([&]
+                 {
+                     std::vector<const ModuleInterface *> Interfaces;
+                     for (auto &U : Units)
+                     {
+                         Interfaces.push_back(&U->Interface);
+                     }
+                     NumErrors += linkModules(Interfaces);
+                 });
+    }
+
+    if (NumErrors == 0 && Opts.EmitLLVM)
+    {
+        Emit.run([&]
+                 {
+                     for (auto &U : Units)
+                     {
+                         NumErrors += !emitLLVM(*U);
+                     }
+                 });
+    }
+    if (NumErrors == 0 && (Opts.EmitObj || Opts.EmitAsm))
+    {
+        Emit.run([&]
+                 {
+                     auto TM = createAOTTargetMachine(*Target, Opts.OptLevel);
+                     if (!TM)
+                     {
+                         ++NumErrors;
+                         return;
+                     }
+                     for (auto &U : Units)
+                     {
+                         NumErrors += !emitObject(*U, *TM, Opts.EmitAsm);
+                     }
+                 });
+    }
+
+    // The JIT takes the modules, so it runs after anything else that needs them.
+    if (NumErrors == 0 && Opts.Execute == DriverOptions::ExecuteJIT)
+    {
+        Run.run([&]
+                {
+                    std::string Salt = Cache ? Cache->getTargetID().str() + " -O" + std::to_string(Opts.OptLevel) +
+                                                   " tail=" + std::to_string(tailCallMode(Opts))
+                                             : "";
+                    NumErrors += runJIT(Units, Opts.LazyJIT, Cache.get(), Salt, Opts.MemoCacheBits,
+                                        Opts.Profile ? &Profile : nullptr);
+                });
+    }
+    else if (NumErrors == 0 && Opts.Execute != DriverOptions::NoExecution)
+    {
+        uint32_t Threshold = Opts.Execute == DriverOptions::ExecuteTiered ? Opts.TierThreshold : 0;
+        Run.run([&]
+                { NumErrors += runTiered(Units, Threshold, Opts.TimeStages, UseProfile.get()); });
+    }
+    if (Profile)
+    {
+        Profile->printReport(stderr);
+        if (!Opts.ProfileOut.empty() && !Profile->write(Opts.ProfileOut))
+        {
+            ++NumErrors;
+        }
+    }
+
+    if (Opts.TimePasses || Opts.Stats)
+    {
+        Timings.print(Opts.OptLevel);
+    }
+    if (Opts.TimeStages)
+    {
+        printStageTimes({&Stages->Parse, &Stages->Sema, &Stages->Folding, &Stages->Inlining, &Stages->Codegen, &Link,
+                         &Emit, &Run},
+                        (nowNanos() - Start) * 1e-9, Units.size(), NumThreads);
+        if (Opts.Fold)
+        {
+            printFoldStats(Units);
+        }
+        if (Inline)
+        {
+            printInlineStats(Units);
+        }
+        if (Opts.Memoize && Opts.Execute == DriverOptions::ExecuteJIT)
+        {
+            printMemoStats(Units);
+        }
+        if (Cache)
+        {
+            fprintf(stderr, "  Object cache: %u hit%s, %u compiled, in %s\n", Cache->getNumHits(),
+                    Cache->getNumHits() == 1 ? "" : "s", Cache->getNumMisses(), Cache->getDir().c_str());
+        }
+        if (!Opts.ModuleCacheDir.empty())
+        {
+            fprintf(stderr, "  Module cache: %u loaded, %u saved, in %s\n", Stages->ImagesLoaded.load(),
+                    Stages->ImagesSaved.load(), Opts.ModuleCacheDir.c_str());
+        }
+    }
+    return finishTracing(Opts, NumErrors == 0 ? 0 : 1);
+}
@@ -0,0 +1,107 @@
+#ifndef KALEIDOSCOPE_UTILS_DRIVER_H
+#define KALEIDOSCOPE_UTILS_DRIVER_H
+
+#include <string>
+#include <vector>
+
+// DriverOptions - What the command line asked for.
+struct DriverOptions
+{
+    std::vector<std::string> Inputs; // "-" reads standard input
+    unsigned NumThreads = 0;         // -j N; 0 means one per hardware thread
+    bool TimeStages = false;         // -time-stages
+    bool EmitLLVM = false;           // -emit-llvm: write each unit's IR to <name>.ll
+    bool EmitObj = false;            // -emit-obj: compile each unit to <name>.o and <name>.h
+    bool EmitAsm = false;            // -emit-asm: compile each unit to <name>.s and <name>.h
+    std::string TargetTriple;        // -mtriple=T: compile for T instead of the host
+    std::string TargetCPU;           // -mcpu=NAME, or native
+    std::string TargetAttrs;         // -mattr=+a,-b
+    bool Fold = true;                // -fno-fold turns off AST constant folding
+    bool Inline = true;              // -fno-inline: no AST inlining or specialization at -O1 and up
+    bool TailCalls = true;           // -fno-tail-calls: no tail calls, no loops for self tail calls
+    bool AssociativeMath = false;    // -fassociative-math: loops for accumulator recursion too
+    unsigned OptLevel = 0;           // -O0 .. -O3
+    bool TimePasses = false;         // -time-passes
+    bool Stats = false;              // -stats: counters, phase totals and pass times
+    std::string TraceFile;           // -trace=FILE: a Chrome trace_event timeline
+    bool Memoize = false;            // -memo: cache results of pure, tree-recursive functions
+    unsigned MemoCacheBits = 12;     // -memo-cache-bits=N: 2^N entries per cache
+    std::string CacheDir;            // -cache-dir=DIR: reuse -jit object code across runs
+    std::string ModuleCacheDir;      // -module-cache=DIR: reuse parsed modules across runs
+    unsigned JITListeners = 0;       // -jit-listeners=perfmap,jitdump,gdb,vtune: JITListener bits
+    bool Profile = false;            // -profile: count calls and cycles per function under -jit
+    std::string ProfileOut;          // -profile-out=FILE: ... and save them, implies -profile
+    std::string ProfileUse;          // -profile-use=FILE: inline and tier up by a saved profile
+
+    // How to run the top-level expressions, if at all.
+    enum ExecutionMode
+    {
+        NoExecution,
+        ExecuteJIT,       // -jit[=lazy|eager]
+        ExecuteInterpret, // -interp: bytecode only
+        ExecuteTiered,    // -tiered: bytecode, then the JIT for hot functions
+        ExecuteRepl,      // -repl: a session fed from standard input
+        ExecuteStream,    // -stream: a session fed as the input is lexed and parsed
+    };
+    ExecutionMode Execute = NoExecution;
+    bool LazyJIT = true;           // compile each function on its first call
+    unsigned TierThreshold = 1000; // -tier-threshold=N: calls before a function is compiled
+};
+
+// runDriver - Compile every input on a work-stealing thread pool. Each file
+// is parsed, checked and lowered to LLVM IR by its own chain of tasks; once
+// all of them have finished, the link step checks the modules against each
+// other. Returns the process exit code.
+//
+// From -O1 on, calls to small functions of the same unit are inlined and
+// calls with literal arguments specialized on the AST (inline.h), unless
+// -fno-inline.
+//
+// With -time-stages, the AST folding and inlining statistics of each unit
+// are printed with the stage times, and with -memo and -jit also the hits
+// and misses of every memoized function. With -cache-dir, the JIT splits
+// each unit into groups of consecutive functions (about 32 each, cut where
+// the functions' AST hashes say so; see partitionForCache() in objcache.h),
+// compiles every group as a module of its own, and loads the objects of
+// unchanged groups from the directory instead of compiling them.
+//
+// With -module-cache=DIR, a unit whose source has an image in DIR (see
+// moduleimage.h; images are named by the source's content hash) is loaded
+// from it instead of being lexed and parsed, and a unit parsed without
+// errors leaves one for the next run.
+//
+// With -emit-obj or -emit-asm, each unit is compiled ahead of time for
+// -mtriple, -mcpu and -mattr (by default the host with the target's default
+// CPU) to an object or assembly file, with a C header declaring its
+// functions. -emit-llvm then writes IR for that target as well.
+//
+// With -stats, the counters of every phase (tokens, AST nodes by kind, arena
+// bytes, IR instructions, JIT materializations), the count and time of each
+// kind of event, the slowest materializations and the pass times are printed
+// at the end. With -trace=FILE the events (each stage of each unit, each
+// function's optimization, each module the JIT compiles) are written to FILE
+// as a timeline. See trace.h.
+//
+// With -jit-listeners, the JIT registers the code it emits with perf (a
+// /tmp/perf-<pid>.map, or a jitdump file for perf inject), GDB or VTune, so
+// they can name the JIT'd functions.
+//
+// With -profile, every function counts its calls and the cycles spent in
+// its own body, and after -jit the functions with the most cycles are
+// printed; AST inlining and the object cache are off, so the counts are
+// those of the source. -profile-out=FILE also writes the counts to FILE,
+// and -profile-use=FILE reads them back to inline hot functions more
+// eagerly and cold ones not at all, and, with -tiered, to compile hot
+// functions before their first call. See profile.h.
+//
+// With -repl, the inputs are instead added one by one to a Session, and then
+// standard input, a piece at a time: a piece ends at a line whose last
+// character is ';', at a blank line or at the end of input. Functions may be
+// redefined; only the new definition is compiled.
+//
+// With -stream, each input (standard input if none) is instead lexed,
+// parsed and run by a Session as it is read, on three threads, so results of
+// a long script piped in appear before it ends; see stream.h.
+int runDriver(const DriverOptions &Opts);
+
+#endif // KALEIDOSCOPE_UTILS_DRIVER_H
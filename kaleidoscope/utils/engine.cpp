@@ -0,0 +1,218 @@
+#include "engine.h"
+
+#include "codegen.h"
+#include "fold.h"
+#include "frontend.h"
+#include "optimizer.h"
+#include "sema.h"
+#include "sourcebuffer.h"
+#include "symboltable.h"
+
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+
+#include <cstdio>
+
+namespace
+{
+    // addEntry - Define "<F>.entry", which loads F's arguments from the
+    // array it is given and tail-calls F.
+    void addEntry(llvm::Function &F)
+    {
+        llvm::LLVMContext &Context = F.getContext();
+        llvm::Type *DoubleTy = llvm::Type::getDoubleTy(Context);
+        llvm::PointerType *DoublePtrTy = DoubleTy->getPointerTo();
+        auto *FT = llvm::FunctionType::get(DoubleTy, {DoublePtrTy}, false);
+        llvm::Function *Entry =
+            llvm::Function::Create(FT, llvm::Function::ExternalLinkage, F.getName() + ".entry", F.getParent());
+        llvm::Value *Args = Entry->getArg(0);
+        Args->setName("args");
+
+        llvm::IRBuilder<> Builder(llvm::BasicBlock::Create(Context, "entry", Entry));
+        std::vector<llvm::Value *> ArgV;
+        for (unsigned I = 0; I != F.arg_size(); ++I)
+        {
+            llvm::Value *Ptr = Builder.CreateInBoundsGEP(DoubleTy, Args, Builder.getInt64(I));
+            ArgV.push_back(Builder.CreateLoad(DoubleTy, Ptr, F.getArg(I)->getName()));
+        }
+        llvm::CallInst *Call = Builder.CreateCall(&F, ArgV, "calltmp");
+        Call->setTailCall();
+        Builder.CreateRet(Call);
+    }
+}
+
+CompiledFunction CompiledUnit::get(std::string_view Name) const
+{
+    for (const CompiledFunction &F : Functions)
+    {
+        if (F.getName() == Name)
+        {
+            return F;
+        }
+    }
+    return CompiledFunction();
+}
+
+Engine::Engine(std::unique_ptr<KaleidoscopeJIT> JIT, std::unique_ptr<FunctionOptimizer> Optimizer)
+    : JIT(std::move(JIT)), Optimizer(std::move(Optimizer))
+{
+}
+
+std::unique_ptr<Engine> Engine::create(unsigned OptLevel)
+{
+    auto JIT = KaleidoscopeJIT::create(KaleidoscopeJIT::Eager);
+    if (!JIT)
+    {
+        fprintf(stderr, "Error: %s\n", llvm::toString(JIT.takeError()).c_str());
+        return nullptr;
+    }
+    std::unique_ptr<FunctionOptimizer> Optimizer;
+    if (OptLevel > 0)
+    {
+        Optimizer = FunctionOptimizer::create(OptLevel, nullptr);
+        if (!Optimizer)
+        {
+            return nullptr;
+        }
+    }
+    std::unique_ptr<Engine> E(new Engine(std::move(*JIT), std::move(Optimizer)));
+    E->Compiler = std::thread([E = E.get()] { E->compileLoop(); });
+    return E;
+}
+
+Engine::~Engine()
+{
+    {
+        std::lock_guard<std::mutex> Guard(QueueLock);
+        Stopping = true;
+    }
+    QueueReady.notify_one();
+    Compiler.join();
+}
+
+std::future<CompiledUnit> Engine::compile(std::string_view Source)
+{
+    std::future<CompiledUnit> Result;
+    {
+        std::lock_guard<std::mutex> Guard(QueueLock);
+        Queue.push_back({std::string(Source), std::promise<CompiledUnit>()});
+        Result = Queue.back().Result.get_future();
+    }
+    QueueReady.notify_one();
+    return Result;
+}
+
+void Engine::compileLoop()
+{
+    for (;;)
+    {
+        Request R;
+        {
+            std::unique_lock<std::mutex> Guard(QueueLock);
+            QueueReady.wait(Guard, [this] { return Stopping || !Queue.empty(); });
+            if (Queue.empty())
+            {
+                return;
+            }
+            R = std::move(Queue.front());
+            Queue.pop_front();
+        }
+        R.Result.set_value(compileUnit(R.Source));
+    }
+}
+
+// compileUnit - Compile one source into a module of its own. Every function
+// it defines is renamed "u<N>.<name>" so that units don't collide in the
+// JITDylib; calls within the module refer to the functions themselves and
+// follow the rename.
+CompiledUnit Engine::compileUnit(const std::string &Source)
+{
+    CompiledUnit Unit;
+    std::string FileName = "<unit " + std::to_string(++NumUnits) + ">";
+    std::string Prefix = "u" + std::to_string(NumUnits) + ".";
+    auto Buffer = SourceBuffer::getMemBuffer(Source, FileName);
+    SymbolTable Symbols;
+    ASTContext Ctx;
+    Lexer Lex(*Buffer, Symbols);
+    Parser P(Lex);
+    ModuleAST M = P.parseModule(Ctx);
+    if ((Unit.NumErrors = P.getNumErrors()))
+    {
+        return Unit;
+    }
+    ModuleInterface Interface;
+    Interface.FileName = FileName;
+    if ((Unit.NumErrors = checkModule(M, Symbols, Interface)))
+    {
+        return Unit;
+    }
+    for (const FunctionSignature &Import : Interface.Imports)
+    {
+        fprintf(stderr, "Error: %s: unknown function '%s'\n", FileName.c_str(), Import.Name.c_str());
+        ++Unit.NumErrors;
+    }
+    if (Unit.NumErrors)
+    {
+        return Unit;
+    }
+    foldModule(M, Ctx);
+
+    CodeGen CG(Symbols, FileName);
+    CG.setOptimizer(Optimizer.get());
+    if ((Unit.NumErrors = CG.codegenModule(M)))
+    {
+        return Unit;
+    }
+    std::vector<llvm::Function *> Defined;
+    for (llvm::Function &F : CG.getModule())
+    {
+        if (!F.isDeclaration() && F.hasExternalLinkage())
+        {
+            Defined.push_back(&F);
+        }
+    }
+    // The JIT frees the module once it is compiled.
+    std::vector<std::string> Names;
+    std::vector<unsigned> Arities;
+    for (llvm::Function *F : Defined)
+    {
+        Names.push_back(F->getName().str());
+        Arities.push_back(static_cast<unsigned>(F->arg_size()));
+        F->setName(Prefix + Names.back());
+        addEntry(*F);
+    }
+
+    if (llvm::Error Err = JIT->addModule(CG.takeModule()))
+    {
+        fprintf(stderr, "Error: %s: %s\n", FileName.c_str(), llvm::toString(std::move(Err)).c_str());
+        ++Unit.NumErrors;
+        return Unit;
+    }
+    llvm::orc::LLJIT &J = JIT->getLLJIT();
+    auto lookup = [&](const std::string &Name) -> llvm::JITTargetAddress
+    {
+        auto Sym = J.lookup(Name);
+        if (!Sym)
+        {
+            fprintf(stderr, "Error: %s: %s\n", FileName.c_str(), llvm::toString(Sym.takeError()).c_str());
+            return 0;
+        }
+        return Sym->getAddress();
+    };
+    for (unsigned I = 0; I != Names.size(); ++I)
+    {
+        llvm::JITTargetAddress Impl = lookup(Prefix + Names[I]);
+        llvm::JITTargetAddress Entry = Impl ? lookup(Prefix + Names[I] + ".entry") : 0;
+        if (!Entry)
+        {
+            ++Unit.NumErrors;
+            Unit.Functions.clear();
+            return Unit;
+        }
+        Unit.Functions.push_back(CompiledFunction(llvm::jitTargetAddressToPointer<void *>(Impl),
+                                                  llvm::jitTargetAddressToFunction<CompiledFunction::EntryFn>(Entry),
+                                                  Arities[I], std::move(Names[I])));
+    }
+    return Unit;
+}
@@ -0,0 +1,127 @@
+#ifndef KALEIDOSCOPE_UTILS_ENGINE_H
+#define KALEIDOSCOPE_UTILS_ENGINE_H
+
+#include "jit.h"
+
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class FunctionOptimizer;
+
+//===-------------------------------------------------------------===//
+// Embedding
+//===-------------------------------------------------------------===//
+// CompiledFunction - A handle to one function compiled by an Engine. It is
+// an immutable value: the function's address, an entry that takes the
+// arguments as an array, and its name and arity. Calls go straight to the
+// machine code, so any number of threads may call the same handle at once
+// without synchronization. A handle is valid as long as its Engine lives;
+// a default-constructed one is empty.
+class CompiledFunction
+{
+public:
+    using EntryFn = double (*)(const double *Args);
+
+private:
+    void *Address = nullptr;
+    EntryFn Entry = nullptr;
+    unsigned Arity = 0;
+    std::string Name;
+
+    friend class Engine;
+    CompiledFunction(void *Address, EntryFn Entry, unsigned Arity, std::string Name)
+        : Address(Address), Entry(Entry), Arity(Arity), Name(std::move(Name))
+    {
+    }
+
+public:
+    CompiledFunction() = default;
+
+    explicit operator bool() const { return Address != nullptr; }
+    const std::string &getName() const { return Name; }
+    unsigned getArity() const { return Arity; }
+    // getAddress - The function itself, a double(double, ...) with getArity()
+    // parameters.
+    void *getAddress() const { return Address; }
+
+    // call - Call the function on Args[0], ..., Args[getArity() - 1].
+    double call(const double *Args) const { return Entry(Args); }
+
+    // operator() - Call the function directly, with exactly getArity()
+    // arguments.
+    template <typename... ArgTys>
+    double operator()(ArgTys... Args) const
+    {
+        assert(sizeof...(ArgTys) == Arity && "wrong number of arguments");
+        using FnTy = double (*)(decltype(static_cast<double>(Args))...);
+        return reinterpret_cast<FnTy>(Address)(static_cast<double>(Args)...);
+    }
+};
+
+// CompiledUnit - What Engine::compile() made of one source: a handle per
+// function it defines, in source order, or the number of errors reported
+// instead.
+struct CompiledUnit
+{
+    unsigned NumErrors = 0;
+    std::vector<CompiledFunction> Functions;
+
+    // get - The function called Name, or an empty handle.
+    CompiledFunction get(std::string_view Name) const;
+};
+
+// Engine - Compiles sources into CompiledFunctions for a host program, on a
+// compile thread of its own so that callers never block on LLVM unless they
+// wait for the result. Sources are compiled one at a time in the order they
+// were submitted. Each is a unit of its own: it may call the functions it
+// defines and its externs, but not those of other units, and two units may
+// define the same name. The code of every unit stays in the JIT until the
+// Engine is destroyed.
+class Engine
+{
+private:
+    struct Request
+    {
+        std::string Source;
+        std::promise<CompiledUnit> Result;
+    };
+
+    std::unique_ptr<KaleidoscopeJIT> JIT;
+    std::unique_ptr<FunctionOptimizer> Optimizer;
+    unsigned NumUnits = 0; // compile thread only
+
+    std::thread Compiler;
+    std::mutex QueueLock;
+    std::condition_variable QueueReady;
+    std::deque<Request> Queue;
+    bool Stopping = false;
+
+    Engine(std::unique_ptr<KaleidoscopeJIT> JIT, std::unique_ptr<FunctionOptimizer> Optimizer);
+    void compileLoop();
+    CompiledUnit compileUnit(const std::string &Source);
+
+public:
+    // create - An engine that optimizes at OptLevel (0 to 3). Reports its
+    // own error and returns null if the JIT can't be set up.
+    static std::unique_ptr<Engine> create(unsigned OptLevel = 2);
+    // The destructor finishes the sources already submitted.
+    ~Engine();
+    Engine(const Engine &) = delete;
+    Engine &operator=(const Engine &) = delete;
+
+    // compile - Queue Source for the compile thread; safe to call from any
+    // thread. Errors are printed to stderr, naming the source "<unit N>" for
+    // the N-th one compiled. Top-level expressions in Source are checked and
+    // compiled but never run.
+    std::future<CompiledUnit> compile(std::string_view Source);
+};
+
+#endif // KALEIDOSCOPE_UTILS_ENGINE_H
@@ -0,0 +1,243 @@
+#include "flatast.h"
+
+#include <cassert>
+
+FlatModule::NodeID FlatModule::addNode(ExprAST::ExprKind Kind, char Op, uint32_t OpA, uint32_t OpB)
+{
+    Kinds.push_back(Kind);
+    Ops.push_back(Op);
+    A.push_back(OpA);
+    B.push_back(OpB);
+    return static_cast<NodeID>(Kinds.size() - 1);
+}
+
+FlatModule::NodeID FlatModule::addNumber(double Val)
+{
+    Literals.push_back(Val);
+    return addNode(ExprAST::Number, 0, static_cast<uint32_t>(Literals.size() - 1), 0);
+}
+
+FlatModule::NodeID FlatModule::addVariable(Symbol Name)
+{
+    return addNode(ExprAST::Variable, 0, Name.getID(), 0);
+}
+
+FlatModule::NodeID FlatModule::addBinary(char Op, NodeID LHS, NodeID RHS)
+{
+    return addNode(ExprAST::Binary, Op, LHS, RHS);
+}
+
+FlatModule::NodeID FlatModule::addCall(Symbol Callee, const NodeID *Args, uint32_t NumArgs)
+{
+    uint32_t ArgList = static_cast<uint32_t>(ArgPool.size());
+    ArgPool.push_back(NumArgs);
+    ArgPool.insert(ArgPool.end(), Args, Args + NumArgs);
+    return addNode(ExprAST::Call, 0, Callee.getID(), ArgList);
+}
+
+FlatModule::NodeID FlatModule::addIf(NodeID Cond, NodeID Then, NodeID Else)
+{
+    assert(Else == getNumNodes() - 1 && "else must be the previous node");
+    (void)Else;
+    return addNode(ExprAST::If, 0, Cond, Then);
+}
+
+FlatModule::Proto FlatModule::addProto(Symbol Name, const Symbol *ParamNames, uint32_t NumParams)
+{
+    Proto P;
+    P.Name = Name;
+    P.FirstParam = static_cast<uint32_t>(Params.size());
+    P.NumParams = NumParams;
+    Params.insert(Params.end(), ParamNames, ParamNames + NumParams);
+    return P;
+}
+
+void FlatModule::addFunction(Proto P, NodeID FirstNode, NodeID Root)
+{
+    Function F;
+    F.P = P;
+    F.FirstNode = FirstNode;
+    F.Root = Root;
+    Functions.push_back(F);
+}
+
+FlatModule::Checkpoint FlatModule::checkpoint() const
+{
+    return Checkpoint{getNumNodes(), static_cast<uint32_t>(Literals.size()),
+                      static_cast<uint32_t>(ArgPool.size()), static_cast<uint32_t>(Params.size())};
+}
+
+void FlatModule::rollback(Checkpoint C)
+{
+    Kinds.resize(C.Nodes);
+    Ops.resize(C.Nodes);
+    A.resize(C.Nodes);
+    B.resize(C.Nodes);
+    Literals.resize(C.Literals);
+    ArgPool.resize(C.ArgPool);
+    Params.resize(C.Params);
+}
+
+// addExpr - Append E's nodes in post-order. The walk uses an explicit stack,
+// since a long operator chain is one deep spine of binary nodes: a node is
+// visited once to push its children and once more, with their IDs on top of
+// Results, to add it.
+FlatModule::NodeID FlatModule::addExpr(const ExprAST *E)
+{
+    struct Frame
+    {
+        const ExprAST *E;
+        bool ChildrenDone;
+    };
+    std::vector<Frame> Frames{{E, false}};
+    std::vector<NodeID> Results;
+    while (!Frames.empty())
+    {
+        Frame F = Frames.back();
+        Frames.pop_back();
+        switch (F.E->getKind())
+        {
+        case ExprAST::Number:
+            Results.push_back(addNumber(static_cast<const NumberExprAST *>(F.E)->get_val()));
+            break;
+        case ExprAST::Variable:
+            Results.push_back(addVariable(static_cast<const VariableExprAST *>(F.E)->get_val()));
+            break;
+        case ExprAST::Binary:
+        {
+            auto *Bin = static_cast<const BinaryExprAST *>(F.E);
+            if (!F.ChildrenDone)
+            {
+                Frames.push_back({F.E, true});
+                Frames.push_back({Bin->getRHS(), false});
+                Frames.push_back({Bin->getLHS(), false});
+                break;
+            }
+            NodeID RHS = Results.back();
+            Results.pop_back();
+            Results.back() = addBinary(Bin->getOp(), Results.back(), RHS);
+            break;
+        }
+        case ExprAST::Call:
+        {
+            auto *Call = static_cast<const CallExprAST *>(F.E);
+            ASTArray<ExprAST *> Args = Call->getArgs();
+            if (!F.ChildrenDone)
+            {
+                Frames.push_back({F.E, true});
+                for (uint32_t I = Args.size(); I-- > 0;)
+                {
+                    Frames.push_back({Args[I], false});
+                }
+                break;
+            }
+            size_t ArgBase = Results.size() - Args.size();
+            NodeID N = addCall(Call->getCallee(), Results.data() + ArgBase, Args.size());
+            Results.resize(ArgBase);
+            Results.push_back(N);
+            break;
+        }
+        case ExprAST::If:
+        {
+            auto *If = static_cast<const IfExprAST *>(F.E);
+            if (!F.ChildrenDone)
+            {
+                Frames.push_back({F.E, true});
+                Frames.push_back({If->getElse(), false});
+                Frames.push_back({If->getThen(), false});
+                Frames.push_back({If->getCond(), false});
+                break;
+            }
+            NodeID Else = Results.back();
+            Results.pop_back();
+            NodeID Then = Results.back();
+            Results.pop_back();
+            Results.back() = addIf(Results.back(), Then, Else);
+            break;
+        }
+        }
+    }
+    return Results.back();
+}
+
+FlatModule::Proto FlatModule::addProto(const PrototypeAST *P)
+{
+    return addProto(P->getName(), P->getArgs().begin(), P->getArgs().size());
+}
+
+void FlatModule::addFunction(const FunctionAST *F)
+{
+    Proto P = addProto(F->getProto());
+    NodeID First = getNumNodes();
+    NodeID Root = addExpr(F->getBody());
+    addFunction(P, First, Root);
+}
+
+FlatModule FlatModule::fromAST(const ModuleAST &M)
+{
+    FlatModule Flat;
+    for (const PrototypeAST *P : M.Externs)
+    {
+        Flat.addExtern(Flat.addProto(P));
+    }
+    for (const FunctionAST *F : M.Functions)
+    {
+        Flat.addFunction(F);
+    }
+    return Flat;
+}
+
+bool FlatModule::verify() const
+{
+    for (const Function &F : Functions)
+    {
+        if (F.Root == InvalidNode || F.Root < F.FirstNode || F.Root >= getNumNodes())
+        {
+            return false;
+        }
+        // Every operand must point backwards into the same body.
+        auto InBody = [&](NodeID Child, NodeID Parent)
+        { return Child >= F.FirstNode && Child < Parent; };
+
+        for (NodeID N = F.FirstNode; N <= F.Root; ++N)
+        {
+            switch (Kinds[N])
+            {
+            case ExprAST::Number:
+                if (A[N] >= Literals.size())
+                {
+                    return false;
+                }
+                break;
+            case ExprAST::Variable:
+                break;
+            case ExprAST::Binary:
+                if (!InBody(A[N], N) || !InBody(B[N], N))
+                {
+                    return false;
+                }
+                break;
+            case ExprAST::Call:
+                if (B[N] >= ArgPool.size() || B[N] + 1 + ArgPool[B[N]] > ArgPool.size())
+                {
+                    return false;
+                }
+                for (NodeID Arg : getArgs(N))
+                {
+                    if (!InBody(Arg, N))
+                    {
+                        return false;
+                    }
+                }
+                break;
+            case ExprAST::If:
+                if (N == F.FirstNode || !InBody(A[N], B[N]) || !InBody(B[N], N - 1))
+                {
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+    return true;
+}
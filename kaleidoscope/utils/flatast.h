@@ -0,0 +1,118 @@
+#ifndef KALEIDOSCOPE_UTILS_FLATAST_H
+#define KALEIDOSCOPE_UTILS_FLATAST_H
+
+#include "ast.h"
+#include "symboltable.h"
+
+#include <cstdint>
+#include <vector>
+
+// FlatModule - An index-based encoding of a module's AST. Every expression node
+// is a 32-bit NodeID into parallel arrays (kind, operator, two operands), and
+// the nodes of each function body are stored contiguously in post-order:
+// children always come before their parent and the body's root is its last
+// node. Passes that only need bottom-up information (folding, type checks,
+// emission to a stack machine) can therefore walk a body with a plain loop
+// over [FirstNode, Root] instead of chasing pointers.
+//
+// Operand meaning per kind:
+//   Number   - A indexes the literal pool.
+//   Variable - A is the Symbol ID of the name.
+//   Binary   - A and B are the LHS and RHS nodes, the operator is in Ops.
+//   Call     - A is the Symbol ID of the callee, B indexes the argument pool,
+//              which holds the argument count followed by the argument nodes.
+//   If       - A and B are the condition and then nodes. The else node is the
+//              last child, so in post-order it is always the node right before.
+// Symbols are already dense IDs, so they are stored inline rather than through
+// a separate pool.
+class FlatModule
+{
+public:
+    using NodeID = uint32_t;
+    static constexpr NodeID InvalidNode = ~0u;
+
+    struct Proto
+    {
+        Symbol Name;
+        uint32_t FirstParam = 0; // index into the parameter pool
+        uint32_t NumParams = 0;
+    };
+
+    struct Function
+    {
+        Proto P;
+        NodeID FirstNode = 0;
+        NodeID Root = InvalidNode;
+    };
+
+    // Checkpoint - The sizes of every array, used to drop a partly built item.
+    struct Checkpoint
+    {
+        uint32_t Nodes, Literals, ArgPool, Params;
+    };
+
+private:
+    std::vector<ExprAST::ExprKind> Kinds;
+    std::vector<char> Ops;
+    std::vector<uint32_t> A, B;
+
+    std::vector<double> Literals;
+    std::vector<NodeID> ArgPool;
+    std::vector<Symbol> Params;
+
+    std::vector<Function> Functions;
+    std::vector<Proto> Externs;
+
+    friend class ModuleImage; // writes the arrays out as they are
+
+    NodeID addNode(ExprAST::ExprKind Kind, char Op, uint32_t OpA, uint32_t OpB);
+
+public:
+    //===--- Construction, children before parents ---===//
+    NodeID addNumber(double Val);
+    NodeID addVariable(Symbol Name);
+    NodeID addBinary(char Op, NodeID LHS, NodeID RHS);
+    NodeID addCall(Symbol Callee, const NodeID *Args, uint32_t NumArgs);
+    NodeID addIf(NodeID Cond, NodeID Then, NodeID Else);
+    Proto addProto(Symbol Name, const Symbol *Params, uint32_t NumParams);
+    void addFunction(Proto P, NodeID FirstNode, NodeID Root);
+    void addExtern(Proto P) { Externs.push_back(P); }
+
+    Checkpoint checkpoint() const;
+    void rollback(Checkpoint C);
+
+    //===--- Conversion from the tree form ---===//
+    NodeID addExpr(const ExprAST *E);
+    Proto addProto(const PrototypeAST *P);
+    void addFunction(const FunctionAST *F);
+    static FlatModule fromAST(const ModuleAST &M);
+
+    //===--- Access ---===//
+    uint32_t getNumNodes() const { return static_cast<uint32_t>(Kinds.size()); }
+    ExprAST::ExprKind getKind(NodeID N) const { return Kinds[N]; }
+    char getOp(NodeID N) const { return Ops[N]; }
+    NodeID getLHS(NodeID N) const { return A[N]; }
+    NodeID getRHS(NodeID N) const { return B[N]; }
+    NodeID getCond(NodeID N) const { return A[N]; }
+    NodeID getThen(NodeID N) const { return B[N]; }
+    NodeID getElse(NodeID N) const { return N - 1; }
+    double getNumber(NodeID N) const { return Literals[A[N]]; }
+    Symbol getSymbol(NodeID N) const { return Symbol(A[N]); } // Variable name or callee
+    ASTArray<const NodeID> getArgs(NodeID N) const
+    {
+        return ASTArray<const NodeID>(ArgPool.data() + B[N] + 1, ArgPool[B[N]]);
+    }
+    ASTArray<const Symbol> getParams(const Proto &P) const
+    {
+        return ASTArray<const Symbol>(Params.data() + P.FirstParam, P.NumParams);
+    }
+
+    const std::vector<Function> &functions() const { return Functions; }
+    const std::vector<Proto> &externs() const { return Externs; }
+
+    // verify - Check the post-order invariants. Returns false on the first
+    // malformed node.
+    bool verify() const;
+};
+
+#endif // KALEIDOSCOPE_UTILS_FLATAST_H
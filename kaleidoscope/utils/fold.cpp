@@ -0,0 +1,208 @@
+#include "fold.h"
+
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    bool isLiteral(const ExprAST *E, double &Val)
+    {
+        if (E->getKind() != ExprAST::Number)
+        {
+            return false;
+        }
+        Val = static_cast<const NumberExprAST *>(E)->get_val();
+        return true;
+    }
+
+    // isExactly - Val is C, telling -0.0 from +0.0 apart.
+    bool isExactly(double Val, double C) { return memcmp(&Val, &C, sizeof(double)) == 0; }
+
+    // Folder - The walk keeps its own stack, like sema and codegen, so long
+    // operator chains cannot overflow the native stack. Each visited node
+    // leaves its replacement and the sizes of its subtree before and after on
+    // Results.
+    class Folder
+    {
+    private:
+        ASTContext &Ctx;
+        FoldStats &Stats;
+
+        struct Frame
+        {
+            ExprAST *E;
+            unsigned Stage;
+        };
+        struct Result
+        {
+            ExprAST *E;
+            uint64_t Size, NewSize;
+        };
+        std::vector<Frame> Frames;
+        std::vector<Result> Results;
+
+        Result pop()
+        {
+            Result R = Results.back();
+            Results.pop_back();
+            return R;
+        }
+
+        ExprAST *literal(double Val) { return Ctx.create<NumberExprAST>(Val); }
+
+        // binary - The simplest expression equal to L Op R.
+        Result binary(BinaryExprAST *B, const Result &L, const Result &R)
+        {
+            B->setLHS(L.E);
+            B->setRHS(R.E);
+            uint64_t Size = L.Size + R.Size + 1;
+            double LV = 0, RV = 0;
+            bool LLit = isLiteral(L.E, LV), RLit = isLiteral(R.E, RV);
+            char Op = B->getOp();
+            if (LLit && RLit)
+            {
+                switch (Op)
+                {
+                case '+':
+                    ++Stats.ConstantsFolded;
+                    return {literal(LV + RV), Size, 1};
+                case '-':
+                    ++Stats.ConstantsFolded;
+                    return {literal(LV - RV), Size, 1};
+                case '*':
+                    ++Stats.ConstantsFolded;
+                    return {literal(LV * RV), Size, 1};
+                case '<':
+                    // fcmp ult: true when either side is NaN.
+                    ++Stats.ConstantsFolded;
+                    return {literal(!(LV >= RV) ? 1.0 : 0.0), Size, 1};
+                default:
+                    return {B, Size, L.NewSize + R.NewSize + 1}; // user-defined operators are calls
+                }
+            }
+            if ((Op == '+' && RLit && isExactly(RV, -0.0)) || (Op == '-' && RLit && isExactly(RV, 0.0)) ||
+                (Op == '*' && RLit && isExactly(RV, 1.0)))
+            {
+                ++Stats.Identities;
+                return {L.E, Size, L.NewSize};
+            }
+            if ((Op == '+' && LLit && isExactly(LV, -0.0)) || (Op == '*' && LLit && isExactly(LV, 1.0)))
+            {
+                ++Stats.Identities;
+                return {R.E, Size, R.NewSize};
+            }
+            return {B, Size, L.NewSize + R.NewSize + 1};
+        }
+
+    public:
+        Folder(ASTContext &Ctx, FoldStats &Stats) : Ctx(Ctx), Stats(Stats) {}
+
+        ExprAST *fold(ExprAST *Root)
+        {
+            Frames.push_back({Root, 0});
+            while (!Frames.empty())
+            {
+                Frame F = Frames.back();
+                Frames.pop_back();
+                switch (F.E->getKind())
+                {
+                case ExprAST::Number:
+                case ExprAST::Variable:
+                    Results.push_back({F.E, 1, 1});
+                    break;
+                case ExprAST::Binary:
+                {
+                    auto *B = static_cast<BinaryExprAST *>(F.E);
+                    if (F.Stage == 0)
+                    {
+                        Frames.push_back({F.E, 1});
+                        Frames.push_back({B->getRHS(), 0});
+                        Frames.push_back({B->getLHS(), 0});
+                        break;
+                    }
+                    Result R = pop();
+                    Result L = pop();
+                    Results.push_back(binary(B, L, R));
+                    break;
+                }
+                case ExprAST::Call:
+                {
+                    auto *C = static_cast<CallExprAST *>(F.E);
+                    ASTArray<ExprAST *> Args = C->getArgs();
+                    if (F.Stage == 0)
+                    {
+                        Frames.push_back({F.E, 1});
+                        for (uint32_t I = Args.size(); I-- > 0;)
+                        {
+                            Frames.push_back({Args[I], 0});
+                        }
+                        break;
+                    }
+                    uint64_t Size = 1, NewSize = 1;
+                    Result *ArgResults = Results.data() + Results.size() - Args.size();
+                    for (uint32_t I = 0; I < Args.size(); ++I)
+                    {
+                        Args[I] = ArgResults[I].E;
+                        Size += ArgResults[I].Size;
+                        NewSize += ArgResults[I].NewSize;
+                    }
+                    Results.resize(Results.size() - Args.size());
+                    Results.push_back({C, Size, NewSize});
+                    break;
+                }
+                case ExprAST::If:
+                {
+                    auto *If = static_cast<IfExprAST *>(F.E);
+                    if (F.Stage == 0)
+                    {
+                        Frames.push_back({F.E, 1});
+                        Frames.push_back({If->getElse(), 0});
+                        Frames.push_back({If->getThen(), 0});
+                        Frames.push_back({If->getCond(), 0});
+                        break;
+                    }
+                    Result Else = pop();
+                    Result Then = pop();
+                    Result Cond = pop();
+                    uint64_t Size = Cond.Size + Then.Size + Else.Size + 1;
+                    double CV = 0;
+                    if (isLiteral(Cond.E, CV))
+                    {
+                        // fcmp one 0.0: NaN takes the else branch.
+                        ++Stats.BranchesFolded;
+                        const Result &Taken = CV < 0.0 || CV > 0.0 ? Then : Else;
+                        Results.push_back({Taken.E, Size, Taken.NewSize});
+                        break;
+                    }
+                    If->setCond(Cond.E);
+                    If->setThen(Then.E);
+                    If->setElse(Else.E);
+                    Results.push_back({If, Size, Cond.NewSize + Then.NewSize + Else.NewSize + 1});
+                    break;
+                }
+                }
+            }
+            Result R = pop();
+            Stats.NodesBefore += R.Size;
+            Stats.NodesEliminated += R.Size - R.NewSize;
+            return R.E;
+        }
+    };
+}
+
+FoldStats foldModule(ModuleAST &M, ASTContext &Ctx)
+{
+    FoldStats Stats;
+    Folder F(Ctx, Stats);
+    for (FunctionAST *Fn : M.Functions)
+    {
+        Fn->setBody(F.fold(Fn->getBody()));
+    }
+    return Stats;
+}
+
+ExprAST *foldExpr(ExprAST *Root, ASTContext &Ctx, FoldStats &Stats)
+{
+    Folder F(Ctx, Stats);
+    return F.fold(Root);
+}
@@ -0,0 +1,36 @@
+#ifndef KALEIDOSCOPE_UTILS_FOLD_H
+#define KALEIDOSCOPE_UTILS_FOLD_H
+
+#include "ast.h"
+
+#include <cstdint>
+
+// FoldStats - What foldModule() did to one module.
+struct FoldStats
+{
+    uint64_t NodesBefore = 0;     // expression nodes reachable before folding
+    uint64_t NodesEliminated = 0; // ... and how many fewer are reachable after
+    uint64_t ConstantsFolded = 0; // operators over two literals
+    uint64_t Identities = 0;      // x + -0.0, x - 0.0, x * 1.0 and 1.0 * x
+    uint64_t BranchesFolded = 0;  // ifs with a literal condition
+};
+
+// foldModule - Constant folding and algebraic simplification on the AST,
+// before any IR is built, so -O0 and the JIT don't pay LLVM to do it.
+//
+// Every rewrite gives the same result as the original for every input,
+// including NaN, infinities and signed zeros, so only a few identities
+// qualify: x * 0.0 is not 0.0 (NaN, -0.0) and x + 0.0 is not x (-0.0 +
+// 0.0 is +0.0). Operators over two literals are evaluated with the same
+// double arithmetic and comparison semantics as codegen; literal
+// conditions select their branch. Folding never drops an expression that
+// could call a function, except a branch that could never run.
+//
+// New literals are allocated in Ctx. Child pointers are rewritten in place.
+FoldStats foldModule(ModuleAST &M, ASTContext &Ctx);
+
+// foldExpr - Fold the one expression Root, adding to Stats; returns its
+// replacement.
+ExprAST *foldExpr(ExprAST *Root, ASTContext &Ctx, FoldStats &Stats);
+
+#endif // KALEIDOSCOPE_UTILS_FOLD_H
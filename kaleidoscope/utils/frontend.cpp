@@ -1,8 +1,18 @@
+#include "frontend.h"
+#include "ast.h"
+#include "charclass.h"
+#include "flatast.h"
+#include "numberscan.h"
+#include "sourcebuffer.h"
+#include "trace.h"
+
+#include <algorithm>
 #include <cctype>
+#include <cstdarg>
+#include <cstddef>
 #include <cstdio>
-#include <cstdlib>
+#include <cstring>
 #include <map>
-#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -11,207 +21,287 @@
 // Lexer
 //===-------------------------------------------------------------===//
 
-// The lexer returns tokens [0-255] if it is an unknown character, otherwise one
-// of these for the known things.
-enum Token
+SourceLocation LineCounter::locate(const char *P)
 {
-    tok_eof = -1,
-
-    // commands
-    tok_def = -2,
-    tok_extern = -3,
+    if (P < Pos)
+    {
+        Pos = LineStart = Start;
+        Line = FirstLine;
+    }
+    while (const void *NL = memchr(Pos, '\n', static_cast<size_t>(P - Pos)))
+    {
+        Pos = LineStart = static_cast<const char *>(NL) + 1;
+        ++Line;
+    }
+    Pos = P;
+    return {Line, static_cast<unsigned>(P - LineStart) + 1};
+}
 
-    // primary
-    tok_identifier = -4,
-    tok_number = -5,
-};
+Lexer::Lexer(const SourceBuffer &Buf, SymbolTable &Symbols)
+    : BufStart(Buf.begin()), CurPtr(Buf.begin()), BufEnd(Buf.end()), Symbols(Symbols), FileName(Buf.getName())
+{
+}
 
-static std::string IdentifierStr; // Filled in if tok_identifier
-static double NumVal;             // Filled in if tok_number
+Lexer::Lexer(const SourceBuffer &Buf, uint32_t Begin, uint32_t End, SymbolTable &Symbols)
+    : BufStart(Buf.begin()), CurPtr(Buf.begin() + Begin), BufEnd(Buf.begin() + End), Symbols(Symbols),
+      FileName(Buf.getName())
+{
+}
 
-// gettok - Return the next token from standard input.
-static int gettok()
+// formToken - Fill in the kind and source range of a token that started at
+// TokStart and ends at the current cursor.
+inline Token Lexer::formToken(int Kind, const char *TokStart) const
 {
-    static int LastChar = ' ';
+    Token Tok;
+    Tok.Kind = Kind;
+    Tok.Begin = static_cast<uint32_t>(TokStart - BufStart);
+    Tok.End = static_cast<uint32_t>(CurPtr - BufStart);
+    Tok.Text = std::string_view(TokStart, static_cast<size_t>(CurPtr - TokStart));
+    return Tok;
+}
 
-    // Skip any whitespace.
-    while (isspace(LastChar))
+// lex (gettok in the tutorial) - Return the next token from the source buffer.
+Token Lexer::lex()
+{
+    while (true)
     {
-        LastChar = getchar();
-    }
+        // Skip any whitespace, a vector at a time for long runs.
+        CurPtr = skipWhitespace(CurPtr, BufEnd);
 
-    if (isalpha(LastChar))
-    { // identifier:[a-zA-Z][a-zA-Z0-9]*
-        IdentifierStr = LastChar;
-        while (isalnum((LastChar = getchar())))
+        const char *TokStart = CurPtr;
+        char ThisChar = *CurPtr;
+
+        // Check for the end of the range first: a sub-range ends right before
+        // the next token rather than on the '\0' sentinel. Don't eat the EOF.
+        if (CurPtr == BufEnd)
         {
-            IdentifierStr += LastChar;
+            return formToken(tok_eof, TokStart);
         }
 
-        if (IdentifierStr == "def")
-        {
-            return tok_def;
+        if (isIdentStart(ThisChar))
+        { // identifier:[a-zA-Z][a-zA-Z0-9]*
+            do
+            {
+                ++CurPtr;
+            } while (isIdentChar(*CurPtr));
+
+            Token Tok = formToken(tok_identifier, TokStart);
+            Tok.Sym = Symbols.intern(Tok.Text);
+            // Keywords have the lowest symbol IDs, in TokenKind order.
+            if (Tok.Sym.getID() < kw::NumKeywords)
+            {
+                static constexpr int KeywordKinds[kw::NumKeywords] = {tok_def, tok_extern, tok_if, tok_then,
+                                                                      tok_else};
+                Tok.Kind = KeywordKinds[Tok.Sym.getID()];
+            }
+            return Tok;
         }
 
-        if (IdentifierStr == "extern")
-        {
-            return tok_extern;
+        if (isNumberStart(ThisChar))
+        { // Number [0-9]*.?[0-9]*, scanned in place without a temporary string
+            NumberLiteral Lit = scanNumber(TokStart);
+            CurPtr = Lit.End;
+            if (!Lit.Valid)
+            {
+                return formToken(tok_error, TokStart); // the parser reports it
+            }
+            Token Tok = formToken(tok_number, TokStart);
+            Tok.NumVal = Lit.Value;
+            return Tok;
         }
-        return tok_identifier;
-    }
 
-    if (isdigit(LastChar) || LastChar == '.')
-    { // Number [0-9.]+
-        std::string NumStr;
-        do
+        if (ThisChar == '#')
         {
-            NumStr += LastChar;
-            LastChar = getchar();
-        } while (isdigit(LastChar) || LastChar == '.');
+            // Comment until end of line.
+            CurPtr = skipToLineEnd(CurPtr, BufEnd);
+            continue;
+        }
 
-        NumVal = strtod(NumStr.c_str(), nullptr);
-        return tok_number;
+        // Otherwise, just return the character as its ascii value.
+        ++CurPtr;
+        return formToken(static_cast<unsigned char>(ThisChar), TokStart);
     }
+}
 
-    if (LastChar == '#')
-    {
-        // Comment until end of line.
-        do
-        {
-            LastChar = getchar();
-        } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+//===-------------------------------------------------------------===//
+// Parser
+//===-------------------------------------------------------------===//
+// Some basic helper routines.
+// CurTok/getNextToken - Provide a simple token buffer. CurTok is the current
+// token the parser is looking at. getNextToken reads another token from the
+// lexer and updates the CurTok with its results.
+int Parser::getNextToken()
+{
+    ++NumTokens;
+    CurTok = Lex ? Lex->lex() : Source->next();
+    return CurTok.Kind;
+}
 
-        if (LastChar != EOF)
-        {
-            return gettok();
-        }
+// LogError - This is a little helper function for error handling. It
+// returns nullptr, which converts to the error value of every builder's node
+// handle, so the parser can propagate the error for signaling, this is
+// common pattern in recursive descent parsers. The location is only worked
+// out here, so parsing without errors never counts lines.
+std::nullptr_t Parser::LogError(const char *Fmt, ...)
+{
+    char Msg[256];
+    va_list Args;
+    va_start(Args, Fmt);
+    vsnprintf(Msg, sizeof(Msg), Fmt, Args);
+    va_end(Args);
+
+    SourceLocation Loc = Lex ? Lex->getLocation(CurTok) : Source->getLocation();
+    std::string Text = "Error: ";
+    Text += Lex ? Lex->getFileName() : Source->getFileName();
+    Text += ':' + std::to_string(Loc.Line) + ':' + std::to_string(Loc.Column) + ": " + Msg;
+    Text += CurTok.Kind == tok_eof ? " at end of input\n" : "\n";
+    if (Diagnostics)
+    {
+        *Diagnostics += Text;
     }
-
-    // Check for the end of file. Don't eat the EOF.
-    if (LastChar == EOF)
+    else
     {
-        return tok_eof;
+        fputs(Text.c_str(), stderr);
     }
-
-    // Otherwise, just return the character as its ascii value.
-    int ThisChar = LastChar;
-    LastChar = getchar();
-    return ThisChar;
+    return nullptr;
 }
 
-//===-------------------------------------------------------------===//
-// AST
-//===-------------------------------------------------------------===//
-// ExprAST - Base class for all expression nodes.
+///////////////////////////////////////////////////////////////////////
+///// Builders
+// The parser is written once against a small builder interface, so the same
+// grammar code can emit either the ASTContext tree or the flat post-order
+// encoding directly. A builder provides
+//   ExprRef/ProtoRef  - node handles, constructible from nullptr on error
+//   ArgStack          - scratch stack for call arguments; a nested call pushes
+//                       above its caller's pending arguments and pops back
+//                       when its own list is built, so argument lists cost no
+//                       heap allocation once the stack has warmed up
+//   OperandStack      - scratch stack of left operands waiting for their
+//                       operator's right-hand side, shared the same way
+//   ParamStack        - scratch list of the prototype being parsed
+//   number/variable/binary/call/ifExpr/proto - node construction
+//   beginItem/abandonItem/addFunction/addExtern - top-level items
 namespace
 {
-    class ExprAST
+    // TreeBuilder - Allocate ASTContext nodes and collect them in a ModuleAST.
+    class TreeBuilder
     {
     private:
-        /* data */
+        ASTContext &Ctx;
+
     public:
-        // Default destructor of the compiler,
-        // set it to virtual to properly destroy derived class.
-        virtual ~ExprAST() = default;
-    };
+        using ExprRef = ExprAST *;
+        using ProtoRef = PrototypeAST *;
 
-    // Numrical literals class
-    class NumberExprAST : public ExprAST
-    {
-    private:
-        double Val;
+        std::vector<ExprRef> ArgStack;
+        std::vector<ExprRef> OperandStack;
+        std::vector<Symbol> ParamStack;
+        ModuleAST Module;
+        uint64_t NumNodes[ExprAST::If + 1] = {}; // by ExprKind, for -stats
 
-    public:
-        NumberExprAST(double Val) : Val(Val) {}
-        // double get_val() {return Val; }
-    };
+        TreeBuilder(ASTContext &Ctx) : Ctx(Ctx) {}
 
-    // VariableExprAST - Expression class for referencing a variable, like "a".
-    class VariableExprAST : public ExprAST
-    {
-    private:
-        std::string Name;
+        ExprRef number(double Val)
+        {
+            ++NumNodes[ExprAST::Number];
+            return Ctx.create<NumberExprAST>(Val);
+        }
+        ExprRef variable(Symbol Name)
+        {
+            ++NumNodes[ExprAST::Variable];
+            return Ctx.create<VariableExprAST>(Name);
+        }
+        ExprRef binary(char Op, ExprRef LHS, ExprRef RHS)
+        {
+            ++NumNodes[ExprAST::Binary];
+            return Ctx.create<BinaryExprAST>(Op, LHS, RHS);
+        }
+        ExprRef ifExpr(ExprRef Cond, ExprRef Then, ExprRef Else)
+        {
+            ++NumNodes[ExprAST::If];
+            return Ctx.create<IfExprAST>(Cond, Then, Else);
+        }
+        ExprRef call(Symbol Callee, size_t ArgBase)
+        {
+            ++NumNodes[ExprAST::Call];
+            ASTArray<ExprAST *> Args = Ctx.copyArray(ArgStack, ArgBase);
+            ArgStack.resize(ArgBase);
+            return Ctx.create<CallExprAST>(Callee, Args);
+        }
+        ProtoRef proto(Symbol Name) { return Ctx.create<PrototypeAST>(Name, Ctx.copyArray(ParamStack)); }
 
-    public:
-        VariableExprAST(const std::string &Name) : Name(Name) {}
-        std::string get_val() { return Name; }
+        // Nodes of a failed item are simply left unused in the arena.
+        void beginItem() {}
+        void abandonItem() {}
+        void addFunction(ProtoRef Proto, ExprRef Body) { Module.Functions.push_back(Ctx.create<FunctionAST>(Proto, Body)); }
+        void addExtern(ProtoRef Proto) { Module.Externs.push_back(Proto); }
     };
 
-    // BinaryExprAST - Expression class for a binary operator.
-    class BinaryExprAST : public ExprAST
+    // FlatRef/FlatProtoRef - Handles into a FlatModule that can signal errors.
+    struct FlatRef
     {
-    private:
-        char Op;
-        std::unique_ptr<ExprAST> LHS, RHS;
+        FlatModule::NodeID ID = FlatModule::InvalidNode;
 
-    public:
-        // Transfer the ownership of expression node to the class members .
-        // e.g. Op(Op) means initialize class member Op with parameter Op.
-        BinaryExprAST(char Op, std::unique_ptr<ExprAST> LHS, std::unique_ptr<ExprAST> RHS) : Op(Op),
-                                                                                             LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+        FlatRef() = default;
+        FlatRef(std::nullptr_t) {}
+        FlatRef(FlatModule::NodeID ID) : ID(ID) {}
+        explicit operator bool() const { return ID != FlatModule::InvalidNode; }
     };
 
-    class CallExprAST : public ExprAST
+    struct FlatProtoRef
     {
-    private:
-        std::string Callee;
-        std::vector<std::unique_ptr<ExprAST>> Args;
+        FlatModule::Proto P;
+        bool Valid = false;
 
-    public:
-        CallExprAST(const std::string &Callee, std::vector<std::unique_ptr<ExprAST>> Args) : Callee(Callee), Args(std::move(Args)) {}
+        FlatProtoRef(std::nullptr_t) {}
+        FlatProtoRef(FlatModule::Proto P) : P(P), Valid(true) {}
+        explicit operator bool() const { return Valid; }
     };
 
-    // PrototypeAST - This class represents the "prototype" for a function,
-    // which captures its name, and its argument names (thus implicitly the number
-    // of arguments the function takes).
-    class PrototypeAST
+    // FlatBuilder - Append nodes to a FlatModule. Recursive descent reduces
+    // every child before its parent, so nodes come out in post-order.
+    class FlatBuilder
     {
     private:
-        std::string Name;
-        std::vector<std::string> Args;
+        FlatModule &Flat;
+        FlatModule::Checkpoint ItemStart{};
+        std::vector<FlatModule::NodeID> ArgIDs;
 
     public:
-        PrototypeAST(const std::string &Name, std::vector<std::string> Args) : Name(Name), Args(std::move(Args)) {}
+        using ExprRef = FlatRef;
+        using ProtoRef = FlatProtoRef;
 
-        const std::string &getName() const { return Name; }
-    };
+        std::vector<ExprRef> ArgStack;
+        std::vector<ExprRef> OperandStack;
+        std::vector<Symbol> ParamStack;
 
-    // FunctionAST - This class represents a function definition itself.
-    class FunctionAST
-    {
-    private:
-        std::unique_ptr<PrototypeAST> Proto;
-        std::unique_ptr<ExprAST> Body;
+        FlatBuilder(FlatModule &Flat) : Flat(Flat) {}
 
-    public:
-        FunctionAST(std::unique_ptr<PrototypeAST> Proto, std::unique_ptr<ExprAST> Body) : Proto(std::move(Proto)), Body(std::move(Body)) {}
-    };
-}
-//===-------------------------------------------------------------===//
-// Parser
-//===-------------------------------------------------------------===//
-// Some basic helper routines.
-// CurTok/getNextToken - Provide a simple token buffer. CurTok is the current
-// token the parser is looking at. getNextToken reads another token from the
-// lexer and updates the CurTok with its results.
-static int CurTok;
-static int getNextToken()
-{
-    return CurTok = gettok();
-}
+        ExprRef number(double Val) { return Flat.addNumber(Val); }
+        ExprRef variable(Symbol Name) { return Flat.addVariable(Name); }
+        ExprRef binary(char Op, ExprRef LHS, ExprRef RHS) { return Flat.addBinary(Op, LHS.ID, RHS.ID); }
+        ExprRef ifExpr(ExprRef Cond, ExprRef Then, ExprRef Else) { return Flat.addIf(Cond.ID, Then.ID, Else.ID); }
+        ExprRef call(Symbol Callee, size_t ArgBase)
+        {
+            ArgIDs.clear();
+            for (size_t I = ArgBase; I != ArgStack.size(); ++I)
+            {
+                ArgIDs.push_back(ArgStack[I].ID);
+            }
+            ArgStack.resize(ArgBase);
+            return Flat.addCall(Callee, ArgIDs.data(), static_cast<uint32_t>(ArgIDs.size()));
+        }
+        ProtoRef proto(Symbol Name)
+        {
+            return Flat.addProto(Name, ParamStack.data(), static_cast<uint32_t>(ParamStack.size()));
+        }
 
-// LogError* - These are little helper functions for error handling.
-// Error handling of the expression node.
-std::unique_ptr<ExprAST> LogError(const char *Str)
-{
-    fprintf(stderr, "Error: %s\n", Str);
-    return nullptr; // the nullptr is to propagate the error for signaling, this is common pattern in recursive descent parsers
-}
-// Error handling of the prototype.
-std::unique_ptr<PrototypeAST> LogErrorP(const char *Str)
-{
-    LogError(Str);
-    return nullptr;
+        // A failed item is truncated away so the arrays stay dense.
+        void beginItem() { ItemStart = Flat.checkpoint(); }
+        void abandonItem() { Flat.rollback(ItemStart); }
+        void addFunction(ProtoRef Proto, ExprRef Body) { Flat.addFunction(Proto.P, ItemStart.Nodes, Body.ID); }
+        void addExtern(ProtoRef Proto) { Flat.addExtern(Proto.P); }
+    };
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -220,47 +310,43 @@ std::unique_ptr<PrototypeAST> LogErrorP(const char *Str)
 // mathematically correct. The method to use is the operator precedence parsing, which uses
 // the binary operation to guide recursion. We thus need a table of precedences.
 
-// BinopPrecedence - This holds the precedence for each binary operator that is defined.
-static std::map<char, int> BinopPrecedence;
-
 // GetTokPrecedence - Get the precedence of the pending binary operator token.
-static int GetTokPrecedence()
+int Parser::GetTokPrecedence() const
 {
-    if (!isascii(CurTok))
+    // Keywords, identifiers and numbers have negative kinds, which wrap
+    // around to large unsigned values and fall outside the table.
+    unsigned Kind = static_cast<unsigned>(CurTok.Kind);
+    if (Kind >= BinopPrecedence.size())
     {
         return -1;
     }
     // Make sure it's a declared binop.
-    int TokPrec = BinopPrecedence[CurTok];
-    if (TokPrec <= 0)
-    {
-        return -1;
-    }
-    return TokPrec;
+    int TokPrec = BinopPrecedence[Kind];
+    return TokPrec > 0 ? TokPrec : -1;
 }
 
-static std::unique_ptr<ExprAST> ParseExpression();
-
 ///////////////////////////////////////////////////////////////////////
 ///// Base expr parsing
 // numberexpr ::= number
-static std::unique_ptr<ExprAST> ParseNumberExpr()
+template <typename B>
+typename B::ExprRef Parser::ParseNumberExpr(B &Build)
 {
-    auto Result = std::make_unique<NumberExprAST>(NumVal); // make_unique performs allocation and smart pointer construction in one step
-    getNextToken();                                        // consume the number, standard in recursive descent parsers
+    auto Result = Build.number(CurTok.NumVal);
+    getNextToken(); // consume the number, standard in recursive descent parsers
     return Result;
 }
 
 // parenexpr ::= '(' expression ')', the parenthesis operator
-static std::unique_ptr<ExprAST> ParseParenExpr()
+template <typename B>
+typename B::ExprRef Parser::ParseParenExpr(B &Build)
 {
     getNextToken(); // eat ( .
-    auto V = ParseExpression();
+    auto V = ParseExpression(Build);
     if (!V)
     {
         return nullptr;
     }
-    if (CurTok != ')')
+    if (CurTok.Kind != ')')
     {
         return LogError("expected ')'");
     }
@@ -271,35 +357,38 @@ static std::unique_ptr<ExprAST> ParseParenExpr()
 // identifierexpr
 // ::= identifier
 // ::= identifier '(' expression* ')'
-static std::unique_ptr<ExprAST> ParseIdentifierExpr()
+template <typename B>
+typename B::ExprRef Parser::ParseIdentifierExpr(B &Build)
 {
-    std::string IdName = IdentifierStr;
+    Symbol IdName = CurTok.Sym;
     getNextToken(); // eat identifier. if no (expr), it is a variable.
-    if (CurTok != '(')
+    if (CurTok.Kind != '(')
     {
-        return std::make_unique<VariableExprAST>(IdName);
+        return Build.variable(IdName);
     }
     // Call.
     getNextToken(); // eat (
-    std::vector<std::unique_ptr<ExprAST>> Args;
-    if (CurTok != ')')
+    size_t ArgBase = Build.ArgStack.size();
+    if (CurTok.Kind != ')')
     {
         while (true)
         {
-            if (auto Arg = ParseExpression())
+            if (auto Arg = ParseExpression(Build))
             {
-                Args.push_back(std::move(Arg));
+                Build.ArgStack.push_back(Arg);
             }
             else
             {
+                Build.ArgStack.resize(ArgBase);
                 return nullptr;
             }
-            if (CurTok == ')')
+            if (CurTok.Kind == ')')
             {
                 break;
             }
-            if (CurTok != ',')
+            if (CurTok.Kind != ',')
             {
+                Build.ArgStack.resize(ArgBase);
                 return LogError("Expected ')' or ',' in argument list");
             }
             getNextToken(); // eat
@@ -308,16 +397,55 @@ static std::unique_ptr<ExprAST> ParseIdentifierExpr()
 
     // eat the ')'. The Args contain the expr in (expr), it is a call expression.
     getNextToken();
-    return std::make_unique<CallExprAST>(IdName, std::move(Args));
+    return Build.call(IdName, ArgBase);
+}
+
+// ifexpr ::= 'if' expression 'then' expression 'else' expression
+template <typename B>
+typename B::ExprRef Parser::ParseIfExpr(B &Build)
+{
+    getNextToken(); // eat the if.
+
+    // condition.
+    auto Cond = ParseExpression(Build);
+    if (!Cond)
+    {
+        return nullptr;
+    }
+    if (CurTok.Kind != tok_then)
+    {
+        return LogError("expected then");
+    }
+    getNextToken(); // eat the then
+
+    auto Then = ParseExpression(Build);
+    if (!Then)
+    {
+        return nullptr;
+    }
+    if (CurTok.Kind != tok_else)
+    {
+        return LogError("expected else");
+    }
+    getNextToken(); // eat the else
+
+    auto Else = ParseExpression(Build);
+    if (!Else)
+    {
+        return nullptr;
+    }
+    return Build.ifExpr(Cond, Then, Else);
 }
 
 // Primary expression
 // ::= identifierexpr
 // ::= numberexpr
 // ::= parenexpr
-static std::unique_ptr<ExprAST> ParsePrimary()
+// ::= ifexpr
+template <typename B>
+typename B::ExprRef Parser::ParsePrimary(B &Build)
 {
-    switch (CurTok)
+    switch (CurTok.Kind)
     {
     default:
     {
@@ -325,107 +453,305 @@ static std::unique_ptr<ExprAST> ParsePrimary()
     }
     case tok_identifier:
     {
-        return ParseIdentifierExpr();
+        return ParseIdentifierExpr(Build);
     }
     case tok_number:
     {
-        return ParseNumberExpr();
+        return ParseNumberExpr(Build);
     }
     case '(':
     {
-        return ParseParenExpr();
+        return ParseParenExpr(Build);
+    }
+    case tok_if:
+    {
+        return ParseIfExpr(Build);
+    }
+    case tok_error:
+    {
+        return LogError("malformed number literal '%.*s'", static_cast<int>(std::min<size_t>(CurTok.Text.size(), 64)),
+                        CurTok.Text.data());
     }
     }
 }
 
-// the BinopPrecedence can be initialized
-// 1 is the lowest
-// BinopPrecedence['<'] = 10;
-// BinopPrecedence['+'] = 20;
-// BinopPrecedence['-'] = 20;
-// BinopPrecedence['*'] = 40;
-
 // Consider expression a+b+(c+d)*e*f+g , the parser will see "a" first,
 // then + b ... , so we parse and expression of primary expression
 // followed by [binop, primaryexpr] pairs
 //  ::= primary binoprhs
 /// binoprhs
 ///   ::= ('+' primary)*
-static std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
-                                              std::unique_ptr<ExprAST> LHS)
+//
+// Rather than recursing for every operator that binds tighter than the one
+// before it, the pending operators and their left operands are kept on two
+// explicit stacks. Each stack holds strictly increasing precedences, so before
+// pushing an operator every pending one that binds at least as tightly is
+// reduced first; that makes all operators left-associative, as in the
+// recursive formulation, and builds the nodes in the same post-order.
+template <typename B>
+typename B::ExprRef Parser::ParseBinOpRHS(B &Build, int ExprPrec, typename B::ExprRef LHS)
 {
-    // If this is a binop, find its precedence.
+    // Nested expressions (parentheses, call arguments) push above their
+    // enclosing expression's pending operators and pop back to these bases.
+    size_t OpBase = OpStack.size();
+    size_t OperandBase = Build.OperandStack.size();
+
     while (true)
     {
+        // If this is a binop, find its precedence.
         int TokPrec = GetTokPrecedence();
 
-        // If this is a binop that binds at least as tightly as the current binop,
-        // consume it, otherwise we are done.
+        // Merge pending LHS/RHS pairs that bind at least as tightly.
+        while (OpStack.size() > OpBase && OpStack.back().Prec >= TokPrec)
+        {
+            LHS = Build.binary(OpStack.back().Op, Build.OperandStack.back(), LHS);
+            OpStack.pop_back();
+            Build.OperandStack.pop_back();
+        }
+
+        // If this binop binds less tightly than the expression allows, we are
+        // done; every pending operator has just been reduced.
         if (TokPrec < ExprPrec)
+        {
             return LHS;
+        }
 
         // Okay, we know this is a binop.
-        int BinOp = CurTok;
+        OpStack.push_back({static_cast<char>(CurTok.Kind), TokPrec});
+        Build.OperandStack.push_back(LHS);
         getNextToken(); // eat binop
 
         // Parse the primary expression after the binary operator.
-        auto RHS = ParsePrimary();
-        if (!RHS)
-            return nullptr;
-
-        // If BinOp binds less tightly with RHS than the operator after RHS, let
-        // the pending operator take RHS as its LHS.
-        int NextPrec = GetTokPrecedence();
-        if (TokPrec < NextPrec)
+        LHS = ParsePrimary(Build);
+        if (!LHS)
         {
-            RHS = ParseBinOpRHS(TokPrec + 1, std::move(RHS));
-            if (!RHS)
-                return nullptr;
+            OpStack.resize(OpBase);
+            Build.OperandStack.resize(OperandBase);
+            return nullptr;
         }
-
-        // Merge LHS/RHS.
-        LHS =
-            std::make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
     }
 }
 
 /// expression
 ///   ::= primary binoprhs
 ///
-static std::unique_ptr<ExprAST> ParseExpression()
+template <typename B>
+typename B::ExprRef Parser::ParseExpression(B &Build)
 {
-    auto LHS = ParsePrimary();
+    auto LHS = ParsePrimary(Build);
     if (!LHS)
         return nullptr;
 
-    return ParseBinOpRHS(0, std::move(LHS));
+    return ParseBinOpRHS(Build, 0, LHS);
 }
 
 // Function prototype
 // ::=id'('id* ')'
-static std::unique_ptr<PrototypeAST> ParsePrototype()
+template <typename B>
+typename B::ProtoRef Parser::ParsePrototype(B &Build)
 {
-    if (CurTok != tok_identifier)
+    if (CurTok.Kind != tok_identifier)
     {
-        return LogErrorP("Expected function name in prototype");
+        return LogError("Expected function name in prototype");
     }
-    std::string FnName = IdentifierStr;
+    Symbol FnName = CurTok.Sym;
     getNextToken(); // eat function name
-    if (CurTok != '(')
+    if (CurTok.Kind != '(')
     {
-        return LogErrorP("Expected '(' in prototype");
+        return LogError("Expected '(' in prototype");
     }
-    std::vector<std::string> ArgNames;
+    Build.ParamStack.clear();
     while (getNextToken() == tok_identifier)
     {
-        ArgNames.push_back(IdentifierStr);
+        Build.ParamStack.push_back(CurTok.Sym);
     }
-    if (CurTok != ')')
+    if (CurTok.Kind != ')')
     {
-        return LogErrorP("Expected ')' in prototype");
+        return LogError("Expected ')' in prototype");
     }
 
     getNextToken(); // succeed and eat ')'.
 
-    return std::make_unique<PrototypeAST>(FnName, std::move(ArgNames));
-}
\ No newline at end of file
+    return Build.proto(FnName);
+}
+
+// definition ::= 'def' prototype expression
+template <typename B>
+bool Parser::ParseDefinition(B &Build)
+{
+    getNextToken(); // eat def.
+    auto Proto = ParsePrototype(Build);
+    if (!Proto)
+    {
+        return false;
+    }
+    if (auto E = ParseExpression(Build))
+    {
+        Build.addFunction(Proto, E);
+        return true;
+    }
+    return false;
+}
+
+// external ::= 'extern' prototype
+template <typename B>
+bool Parser::ParseExtern(B &Build)
+{
+    getNextToken(); // eat extern.
+    if (auto Proto = ParsePrototype(Build))
+    {
+        Build.addExtern(Proto);
+        return true;
+    }
+    return false;
+}
+
+// toplevelexpr ::= expression
+// The expression becomes the body of an anonymous nullary function.
+template <typename B>
+bool Parser::ParseTopLevelExpr(B &Build)
+{
+    if (auto E = ParseExpression(Build))
+    {
+        Build.ParamStack.clear();
+        Build.addFunction(Build.proto(AnonExpr), E);
+        return true;
+    }
+    return false;
+}
+
+Parser::Parser(Lexer &Lex) : Lex(&Lex), AnonExpr(Lex.getSymbolTable().intern("__anon_expr"))
+{
+    // The standard binary operators come from makeDefaultPrecedence().
+}
+
+Parser::Parser(TokenSource &Source, SymbolTable &Symbols) : Source(&Source), AnonExpr(Symbols.intern("__anon_expr"))
+{
+}
+
+// ParseNextItem - One item of top, after any semicolons; false at the end of
+// the source. The first token must have been read.
+template <typename B>
+bool Parser::ParseNextItem(B &Build)
+{
+    while (CurTok.Kind == ';') // ignore top-level semicolons.
+    {
+        getNextToken();
+    }
+    while (CurTok.Kind != tok_eof)
+    {
+        Build.beginItem();
+        bool Parsed;
+        switch (CurTok.Kind)
+        {
+        case tok_def:
+        {
+            Parsed = ParseDefinition(Build);
+            break;
+        }
+        case tok_extern:
+        {
+            Parsed = ParseExtern(Build);
+            break;
+        }
+        default:
+        {
+            Parsed = ParseTopLevelExpr(Build);
+            break;
+        }
+        }
+        if (Parsed)
+        {
+            return true;
+        }
+        ++NumErrors;
+        Build.abandonItem();
+        SkipToNextItem();
+    }
+    return false;
+}
+
+// SkipToNextItem - Skip the rest of an item that failed to parse: up to the
+// next `def` or `extern`, which starts an item, or past the next ';', which
+// ends one. The token the error was reported at is skipped too unless it
+// starts an item; a failed item has always consumed its own `def` or
+// `extern`, so this makes progress.
+void Parser::SkipToNextItem()
+{
+    while (CurTok.Kind != tok_eof && CurTok.Kind != tok_def && CurTok.Kind != tok_extern)
+    {
+        int Kind = CurTok.Kind;
+        getNextToken();
+        if (Kind == ';')
+        {
+            break;
+        }
+    }
+    while (CurTok.Kind == ';')
+    {
+        getNextToken();
+    }
+}
+
+// top ::= definition | external | expression | ';'
+template <typename B>
+void Parser::ParseTopLevel(B &Build)
+{
+    getNextToken(); // prime the first token.
+    while (ParseNextItem(Build))
+    {
+    }
+}
+
+namespace
+{
+    // countParse - Add what a TreeBuilder built to the -stats counters.
+    void countParse(const TreeBuilder &Build, uint64_t Tokens, size_t Bytes)
+    {
+        traceCount(TokensLexed, Tokens);
+        traceCount(NumberNodes, Build.NumNodes[ExprAST::Number]);
+        traceCount(VariableNodes, Build.NumNodes[ExprAST::Variable]);
+        traceCount(BinaryNodes, Build.NumNodes[ExprAST::Binary]);
+        traceCount(CallNodes, Build.NumNodes[ExprAST::Call]);
+        traceCount(IfNodes, Build.NumNodes[ExprAST::If]);
+        traceCount(ArenaBytes, Bytes);
+    }
+}
+
+ModuleAST Parser::parseModule(ASTContext &Ctx)
+{
+    TreeBuilder Build(Ctx);
+    uint64_t Tokens = NumTokens;
+    size_t Bytes = Ctx.getBytesAllocated();
+    ParseTopLevel(Build);
+    if (isTracing())
+    {
+        countParse(Build, NumTokens - Tokens, Ctx.getBytesAllocated() - Bytes);
+    }
+    return std::move(Build.Module);
+}
+
+bool Parser::parseItem(ASTContext &Ctx, ModuleAST &M)
+{
+    TreeBuilder Build(Ctx);
+    uint64_t Tokens = NumTokens;
+    size_t Bytes = Ctx.getBytesAllocated();
+    if (NumTokens == 0)
+    {
+        getNextToken(); // prime the first token.
+    }
+    bool Parsed = ParseNextItem(Build);
+    if (isTracing())
+    {
+        countParse(Build, NumTokens - Tokens, Ctx.getBytesAllocated() - Bytes);
+    }
+    M.Functions.insert(M.Functions.end(), Build.Module.Functions.begin(), Build.Module.Functions.end());
+    M.Externs.insert(M.Externs.end(), Build.Module.Externs.begin(), Build.Module.Externs.end());
+    return Parsed;
+}
+
+void Parser::parseFlatModule(FlatModule &Flat)
+{
+    FlatBuilder Build(Flat);
+    ParseTopLevel(Build);
+}
@@ -0,0 +1,257 @@
+#ifndef KALEIDOSCOPE_UTILS_FRONTEND_H
+#define KALEIDOSCOPE_UTILS_FRONTEND_H
+
+#include "ast.h"
+#include "flatast.h"
+#include "symboltable.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class SourceBuffer;
+
+// The lexer returns tokens [0-255] if it is an unknown character, otherwise one
+// of these for the known things.
+enum TokenKind
+{
+    tok_eof = -1,
+
+    // commands
+    tok_def = -2,
+    tok_extern = -3,
+
+    // primary
+    tok_identifier = -4,
+    tok_number = -5,
+
+    // a malformed token, e.g. a number with two decimal points
+    tok_error = -6,
+
+    // control
+    tok_if = -7,
+    tok_then = -8,
+    tok_else = -9,
+};
+
+// Token - One lexed token. Text points into the source buffer, so a token is a
+// small value that never allocates; Begin/End are byte offsets into the same
+// buffer.
+struct Token
+{
+    int Kind = tok_eof;    // a TokenKind, or the character itself
+    uint32_t Begin = 0;    // offset of the first character
+    uint32_t End = 0;      // offset one past the last character
+    std::string_view Text; // spelling of the token
+    double NumVal = 0;     // filled in if tok_number
+    Symbol Sym;            // filled in if tok_identifier or a keyword
+};
+
+// SourceLocation - A 1-based line and column of a source buffer; columns
+// count bytes.
+struct SourceLocation
+{
+    unsigned Line = 0;
+    unsigned Column = 0;
+};
+
+// LineCounter - Finds the lines and columns of positions in one buffer for
+// diagnostics, so the lexer needn't count lines as it goes. Asked about
+// positions in increasing order, as the parser's errors come, it scans the
+// buffer once in all; an earlier position starts it over. Lines end at '\n',
+// so a "\r\n" pair is one line break.
+class LineCounter
+{
+private:
+    const char *Start;     // where counting begins, on line FirstLine
+    const char *Pos;       // counted up to here
+    const char *LineStart; // the start of the line Pos is on
+    unsigned FirstLine;
+    unsigned Line;
+
+public:
+    explicit LineCounter(const char *Start, unsigned FirstLine = 1)
+        : Start(Start), Pos(Start), LineStart(Start), FirstLine(FirstLine), Line(FirstLine)
+    {
+    }
+
+    SourceLocation locate(const char *P);
+};
+
+//===-------------------------------------------------------------===//
+// Lexer
+//===-------------------------------------------------------------===//
+// Lexer - Splits one source buffer into Tokens. All state lives in the
+// instance, so independent sources can be lexed on different threads as long
+// as each thread uses its own SymbolTable.
+class Lexer
+{
+private:
+    // The lexer walks a cursor over the whole source buffer. SourceBuffer
+    // guarantees a '\0' after the last character, so the scanning loops stop
+    // on it without separate end-of-buffer checks.
+    const char *BufStart;
+    const char *CurPtr;
+    const char *BufEnd;
+    SymbolTable &Symbols;
+    const std::string &FileName;
+    LineCounter Lines{BufStart};
+
+    Token formToken(int Kind, const char *TokStart) const;
+
+public:
+    // The buffer and the symbol table must outlive the lexer and its tokens.
+    Lexer(const SourceBuffer &Buf, SymbolTable &Symbols);
+
+    // Lex only the bytes [Begin, End) of Buf; token offsets still count from
+    // the start of the buffer. The range must start and end on token
+    // boundaries, as the ranges from splitTopLevel() do.
+    Lexer(const SourceBuffer &Buf, uint32_t Begin, uint32_t End, SymbolTable &Symbols);
+
+    // lex - Return the next token, tok_eof at the end of the buffer.
+    Token lex();
+
+    SymbolTable &getSymbolTable() const { return Symbols; }
+    const std::string &getFileName() const { return FileName; }
+
+    // getLocation - Where Tok, one of this lexer's tokens, starts. Only for
+    // diagnostics; see LineCounter.
+    SourceLocation getLocation(const Token &Tok) { return Lines.locate(BufStart + Tok.Begin); }
+};
+
+// TokenSource - Tokens that don't come straight from a Lexer, e.g. from a
+// lexer on another thread (stream.h).
+class TokenSource
+{
+public:
+    virtual ~TokenSource() = default;
+
+    // next - The next token; tok_eof at the end, and again after it.
+    virtual Token next() = 0;
+
+    // getLocation - Where the token next() returned last starts, for
+    // diagnostics about it.
+    virtual SourceLocation getLocation() = 0;
+    virtual const std::string &getFileName() const = 0;
+};
+
+//===-------------------------------------------------------------===//
+// Parser
+//===-------------------------------------------------------------===//
+// PrecedenceTable - The precedence of every possible single-byte operator,
+// indexed by the character; 0 means it is not a binary operator.
+using PrecedenceTable = std::array<int, 256>;
+
+// makeDefaultPrecedence - The standard binary operators. 1 is the lowest
+// precedence.
+constexpr PrecedenceTable makeDefaultPrecedence()
+{
+    PrecedenceTable Table{};
+    Table['<'] = 10;
+    Table['+'] = 20;
+    Table['-'] = 20;
+    Table['*'] = 40;
+    return Table;
+}
+
+// Parser - Recursive descent parser over one Lexer. Like the lexer it keeps
+// everything (the current token, the operator precedences) in the instance.
+//
+// A syntax error is reported as "Error: file:line:column: message", at the
+// token where the parse went wrong, and only its item is dropped: the parser
+// skips ahead to the next `def`, `extern` or ';' and carries on, so one pass
+// reports the first error of every item that has one.
+class Parser
+{
+private:
+    Lexer *Lex = nullptr;          // where tokens come from, or else
+    TokenSource *Source = nullptr; // ... from here
+    Symbol AnonExpr;               // "__anon_expr", the name of every top-level expression
+    Token CurTok;
+    unsigned NumErrors = 0;
+    uint64_t NumTokens = 0;
+    std::string *Diagnostics = nullptr; // where errors go instead of stderr, if set
+
+    // BinopPrecedence - This holds the precedence for each binary operator that is defined.
+    PrecedenceTable BinopPrecedence = makeDefaultPrecedence();
+
+    // PendingOp - An operator whose right operand is still being parsed. The
+    // left operands wait on the builder's OperandStack.
+    struct PendingOp
+    {
+        char Op;
+        int Prec;
+    };
+    std::vector<PendingOp> OpStack;
+
+    int GetTokPrecedence() const;
+
+    // LogError - Report a syntax error at the current token; returns nullptr,
+    // which converts to every builder's error handle.
+    std::nullptr_t LogError(const char *Fmt, ...);
+
+    // SkipToNextItem - Panic-mode recovery after a failed item.
+    void SkipToNextItem();
+
+    // The grammar is written once against a builder, see frontend.cpp.
+    template <typename B> typename B::ExprRef ParseNumberExpr(B &Build);
+    template <typename B> typename B::ExprRef ParseParenExpr(B &Build);
+    template <typename B> typename B::ExprRef ParseIdentifierExpr(B &Build);
+    template <typename B> typename B::ExprRef ParseIfExpr(B &Build);
+    template <typename B> typename B::ExprRef ParsePrimary(B &Build);
+    template <typename B> typename B::ExprRef ParseBinOpRHS(B &Build, int ExprPrec, typename B::ExprRef LHS);
+    template <typename B> typename B::ExprRef ParseExpression(B &Build);
+    template <typename B> typename B::ProtoRef ParsePrototype(B &Build);
+    template <typename B> bool ParseDefinition(B &Build);
+    template <typename B> bool ParseExtern(B &Build);
+    template <typename B> bool ParseTopLevelExpr(B &Build);
+    template <typename B> bool ParseNextItem(B &Build);
+    template <typename B> void ParseTopLevel(B &Build);
+
+public:
+    // Installs the standard binary operators.
+    Parser(Lexer &Lex);
+
+    // Parse the tokens of Source, whose symbols are those of Symbols. The
+    // parser itself only touches Symbols here, on the constructing thread.
+    Parser(TokenSource &Source, SymbolTable &Symbols);
+
+    // setBinopPrecedence - Make Op a binary operator with precedence Prec, e.g.
+    // for a user-defined operator; Prec <= 0 removes it.
+    void setBinopPrecedence(char Op, int Prec) { BinopPrecedence[static_cast<unsigned char>(Op)] = Prec > 0 ? Prec : 0; }
+    int getBinopPrecedence(char Op) const { return BinopPrecedence[static_cast<unsigned char>(Op)]; }
+    const PrecedenceTable &getPrecedenceTable() const { return BinopPrecedence; }
+
+    // getNextToken - Read another token from the lexer and make it current.
+    int getNextToken();
+    const Token &getCurTok() const { return CurTok; }
+
+    // getNumErrors - The number of top-level items that failed to parse,
+    // which is also the number of errors reported.
+    unsigned getNumErrors() const { return NumErrors; }
+
+    // setDiagnostics - Append error messages to Out rather than print them,
+    // e.g. to print those of parsers on several threads in source order.
+    void setDiagnostics(std::string *Out) { Diagnostics = Out; }
+
+    // getNumTokens - The number of tokens read so far, EOF included.
+    uint64_t getNumTokens() const { return NumTokens; }
+
+    // parseModule - Parse the rest of the source. All nodes are allocated in
+    // Ctx, which must outlive the returned module.
+    ModuleAST parseModule(ASTContext &Ctx);
+
+    // parseItem - Parse the next top-level item and append it to M, with its
+    // nodes in Ctx. An item that fails to parse is reported and skipped.
+    // Returns false, adding nothing, once the source is exhausted.
+    bool parseItem(ASTContext &Ctx, ModuleAST &M);
+
+    // parseFlatModule - Parse the rest of the source straight into the flat
+    // post-order encoding, without building the tree form first.
+    void parseFlatModule(FlatModule &Flat);
+};
+
+#endif // KALEIDOSCOPE_UTILS_FRONTEND_H
@@ -0,0 +1,595 @@
+#include "inline.h"
+
+#include "fold.h"
+#include "profile.h"
+#include "purity.h"
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    // Callees of at most MaxInlineSize nodes (MaxHotInlineSize for those a
+    // profile calls hot) are inlined until the caller has grown to
+    // MaxCallerSize; up to MaxSpecializations specializations are made of
+    // each callee of at most MaxSpecializeSize nodes.
+    const uint64_t MaxInlineSize = 16;
+    const uint64_t MaxHotInlineSize = 64;
+    const uint64_t MaxCallerSize = 1024;
+    const uint64_t MaxSpecializeSize = 256;
+    const unsigned MaxSpecializations = 8;
+
+    bool isTrivial(const ExprAST *E) { return E->getKind() == ExprAST::Number || E->getKind() == ExprAST::Variable; }
+
+    bool isBuiltinOp(char Op) { return Op == '+' || Op == '-' || Op == '*' || Op == '<'; }
+
+    // isCallFree - Whether evaluating E calls nothing, not even a
+    // user-defined operator.
+    bool isCallFree(const ExprAST *Root)
+    {
+        std::vector<const ExprAST *> Worklist{Root};
+        while (!Worklist.empty())
+        {
+            const ExprAST *E = Worklist.back();
+            Worklist.pop_back();
+            switch (E->getKind())
+            {
+            case ExprAST::Number:
+            case ExprAST::Variable:
+                break;
+            case ExprAST::Binary:
+            {
+                auto *B = static_cast<const BinaryExprAST *>(E);
+                if (!isBuiltinOp(B->getOp()))
+                {
+                    return false;
+                }
+                Worklist.push_back(B->getLHS());
+                Worklist.push_back(B->getRHS());
+                break;
+            }
+            case ExprAST::Call:
+                return false;
+            case ExprAST::If:
+            {
+                auto *If = static_cast<const IfExprAST *>(E);
+                Worklist.push_back(If->getCond());
+                Worklist.push_back(If->getThen());
+                Worklist.push_back(If->getElse());
+                break;
+            }
+            }
+        }
+        return true;
+    }
+
+    uint64_t countNodes(const ExprAST *Root)
+    {
+        uint64_t N = 0;
+        std::vector<const ExprAST *> Worklist{Root};
+        while (!Worklist.empty())
+        {
+            const ExprAST *E = Worklist.back();
+            Worklist.pop_back();
+            ++N;
+            switch (E->getKind())
+            {
+            case ExprAST::Number:
+            case ExprAST::Variable:
+                break;
+            case ExprAST::Binary:
+            {
+                auto *B = static_cast<const BinaryExprAST *>(E);
+                Worklist.push_back(B->getLHS());
+                Worklist.push_back(B->getRHS());
+                break;
+            }
+            case ExprAST::Call:
+                for (const ExprAST *Arg : static_cast<const CallExprAST *>(E)->getArgs())
+                {
+                    Worklist.push_back(Arg);
+                }
+                break;
+            case ExprAST::If:
+            {
+                auto *If = static_cast<const IfExprAST *>(E);
+                Worklist.push_back(If->getCond());
+                Worklist.push_back(If->getThen());
+                Worklist.push_back(If->getElse());
+                break;
+            }
+            }
+        }
+        return N;
+    }
+
+    // paramIndex - The position of S among Params, or -1.
+    int32_t paramIndex(ASTArray<Symbol> Params, Symbol S)
+    {
+        for (uint32_t I = 0; I != Params.size(); ++I)
+        {
+            if (Params[I] == S)
+            {
+                return static_cast<int32_t>(I);
+            }
+        }
+        return -1;
+    }
+
+    // Summary - What a call site needs to know about a callee's finished
+    // body: its size, whether it calls anything, and for each parameter how
+    // often it is read, whether any read is inside a branch, and when the
+    // first read happens among the body's leaves in evaluation order.
+    struct Summary
+    {
+        struct ParamUse
+        {
+            uint32_t Count = 0;
+            bool Conditional = false;
+            uint32_t First = 0;
+        };
+        uint64_t Size = 0;
+        bool CallFree = true;
+        std::vector<ParamUse> Uses;
+    };
+
+    Summary summarize(const FunctionAST *F)
+    {
+        ASTArray<Symbol> Params = F->getProto()->getArgs();
+        Summary S;
+        S.Uses.resize(Params.size());
+        struct Item
+        {
+            const ExprAST *E;
+            bool Conditional;
+        };
+        // Children are pushed right to left, so leaves come off the stack in
+        // the order they are evaluated.
+        std::vector<Item> Worklist{{F->getBody(), false}};
+        uint32_t Leaf = 0;
+        while (!Worklist.empty())
+        {
+            Item I = Worklist.back();
+            Worklist.pop_back();
+            ++S.Size;
+            switch (I.E->getKind())
+            {
+            case ExprAST::Number:
+                ++Leaf;
+                break;
+            case ExprAST::Variable:
+            {
+                int32_t P = paramIndex(Params, static_cast<const VariableExprAST *>(I.E)->get_val());
+                if (P >= 0)
+                {
+                    Summary::ParamUse &U = S.Uses[static_cast<uint32_t>(P)];
+                    U.First = U.Count++ == 0 ? Leaf : U.First;
+                    U.Conditional |= I.Conditional;
+                }
+                ++Leaf;
+                break;
+            }
+            case ExprAST::Binary:
+            {
+                auto *B = static_cast<const BinaryExprAST *>(I.E);
+                S.CallFree &= isBuiltinOp(B->getOp());
+                Worklist.push_back({B->getRHS(), I.Conditional});
+                Worklist.push_back({B->getLHS(), I.Conditional});
+                break;
+            }
+            case ExprAST::Call:
+            {
+                S.CallFree = false;
+                ASTArray<ExprAST *> Args = static_cast<const CallExprAST *>(I.E)->getArgs();
+                for (uint32_t A = Args.size(); A-- > 0;)
+                {
+                    Worklist.push_back({Args[A], I.Conditional});
+                }
+                break;
+            }
+            case ExprAST::If:
+            {
+                auto *If = static_cast<const IfExprAST *>(I.E);
+                Worklist.push_back({If->getElse(), true});
+                Worklist.push_back({If->getThen(), true});
+                Worklist.push_back({If->getCond(), I.Conditional});
+                break;
+            }
+            }
+        }
+        return S;
+    }
+
+    // canSubstitute - Whether replacing the parameters of a body summarized
+    // by S with Args evaluates what the call would, in the same order.
+    bool canSubstitute(ASTArray<ExprAST *> Args, const Summary &S)
+    {
+        int64_t LastRead = -1;
+        for (uint32_t I = 0; I != Args.size(); ++I)
+        {
+            if (isTrivial(Args[I]))
+            {
+                continue;
+            }
+            const Summary::ParamUse &U = S.Uses[I];
+            if (isCallFree(Args[I]))
+            {
+                if (U.Count > 1)
+                {
+                    return false;
+                }
+                continue;
+            }
+            if (U.Count != 1 || U.Conditional || !S.CallFree || static_cast<int64_t>(U.First) <= LastRead)
+            {
+                return false;
+            }
+            LastRead = U.First;
+        }
+        return true;
+    }
+
+    // Inliner - Rewrites the module's functions callees first. Walks keep
+    // their own stacks, like the folder's.
+    class Inliner
+    {
+    private:
+        ModuleAST &M;
+        SymbolTable &Symbols;
+        ASTContext &Ctx;
+        InlineStats &Stats;
+        const ProfileData *Profile;
+        FoldStats Folded; // not reported; foldModule() already was
+        CallGraph G;
+        std::vector<char> Recursive;
+        std::vector<uint64_t> InlineLimit; // by node; 0 if the profile never called it
+        std::vector<int32_t> NodeOf;       // by Symbol ID
+        std::vector<Summary> Summaries;    // by node, once it is finished
+        std::vector<unsigned> NumSpecs;    // by node
+        std::unordered_map<std::string, Symbol> Specs;
+        std::vector<FunctionAST *> NewFunctions;
+
+        ExprAST *copyLeaf(const ExprAST *E)
+        {
+            if (E->getKind() == ExprAST::Number)
+            {
+                return Ctx.create<NumberExprAST>(static_cast<const NumberExprAST *>(E)->get_val());
+            }
+            return Ctx.create<VariableExprAST>(static_cast<const VariableExprAST *>(E)->get_val());
+        }
+
+        // clone - A copy of Root, where a read of Params[I] becomes
+        // Replacements[I] when that is not null: trivial replacements are
+        // copied for every read, others are used as they are.
+        ExprAST *clone(const ExprAST *Root, ASTArray<Symbol> Params, const std::vector<ExprAST *> &Replacements)
+        {
+            struct Frame
+            {
+                const ExprAST *E;
+                unsigned Stage;
+            };
+            std::vector<Frame> Frames{{Root, 0}};
+            std::vector<ExprAST *> Results;
+            while (!Frames.empty())
+            {
+                Frame F = Frames.back();
+                Frames.pop_back();
+                switch (F.E->getKind())
+                {
+                case ExprAST::Number:
+                    Results.push_back(copyLeaf(F.E));
+                    break;
+                case ExprAST::Variable:
+                {
+                    int32_t P = paramIndex(Params, static_cast<const VariableExprAST *>(F.E)->get_val());
+                    ExprAST *R = P >= 0 ? Replacements[static_cast<uint32_t>(P)] : nullptr;
+                    Results.push_back(!R ? copyLeaf(F.E) : isTrivial(R) ? copyLeaf(R) : R);
+                    break;
+                }
+                case ExprAST::Binary:
+                {
+                    auto *B = static_cast<const BinaryExprAST *>(F.E);
+                    if (F.Stage == 0)
+                    {
+                        Frames.push_back({F.E, 1});
+                        Frames.push_back({B->getRHS(), 0});
+                        Frames.push_back({B->getLHS(), 0});
+                        break;
+                    }
+                    ExprAST *R = Results.back();
+                    Results.pop_back();
+                    Results.back() = Ctx.create<BinaryExprAST>(B->getOp(), Results.back(), R);
+                    break;
+                }
+                case ExprAST::Call:
+                {
+                    auto *C = static_cast<const CallExprAST *>(F.E);
+                    ASTArray<ExprAST *> Args = C->getArgs();
+                    if (F.Stage == 0)
+                    {
+                        Frames.push_back({F.E, 1});
+                        for (uint32_t I = Args.size(); I-- > 0;)
+                        {
+                            Frames.push_back({Args[I], 0});
+                        }
+                        break;
+                    }
+                    ASTArray<ExprAST *> NewArgs = Ctx.copyArray(Results, Results.size() - Args.size());
+                    Results.resize(Results.size() - Args.size());
+                    Results.push_back(Ctx.create<CallExprAST>(C->getCallee(), NewArgs));
+                    break;
+                }
+                case ExprAST::If:
+                {
+                    auto *If = static_cast<const IfExprAST *>(F.E);
+                    if (F.Stage == 0)
+                    {
+                        Frames.push_back({F.E, 1});
+                        Frames.push_back({If->getElse(), 0});
+                        Frames.push_back({If->getThen(), 0});
+                        Frames.push_back({If->getCond(), 0});
+                        break;
+                    }
+                    ExprAST *Else = Results.back();
+                    Results.pop_back();
+                    ExprAST *Then = Results.back();
+                    Results.pop_back();
+                    Results.back() = Ctx.create<IfExprAST>(Results.back(), Then, Else);
+                    break;
+                }
+                }
+            }
+            return Results.back();
+        }
+
+        // specialize - The function computing node C with its literal
+        // arguments among Args built in, or an invalid symbol once C has
+        // all the specializations it may get.
+        Symbol specialize(uint32_t C, ASTArray<ExprAST *> Args)
+        {
+            std::string Key = std::to_string(C);
+            for (uint32_t I = 0; I != Args.size(); ++I)
+            {
+                Key += ',';
+                if (Args[I]->getKind() == ExprAST::Number)
+                {
+                    double Val = static_cast<const NumberExprAST *>(Args[I])->get_val();
+                    uint64_t Bits;
+                    memcpy(&Bits, &Val, sizeof(Bits));
+                    Key += std::to_string(Bits);
+                }
+            }
+            auto It = Specs.find(Key);
+            if (It != Specs.end())
+            {
+                return It->second;
+            }
+            if (NumSpecs[C] == MaxSpecializations)
+            {
+                return Symbol();
+            }
+
+            const FunctionAST *Callee = G.Nodes[C];
+            ASTArray<Symbol> Params = Callee->getProto()->getArgs();
+            std::vector<Symbol> Kept;
+            std::vector<ExprAST *> Replacements(Params.size(), nullptr);
+            for (uint32_t I = 0; I != Params.size(); ++I)
+            {
+                if (Args[I]->getKind() == ExprAST::Number)
+                {
+                    Replacements[I] = Args[I];
+                }
+                else
+                {
+                    Kept.push_back(Params[I]);
+                }
+            }
+            Symbol Name = Symbols.intern(std::string(Symbols.getName(Callee->getProto()->getName())) + ".spec" +
+                                         std::to_string(NumSpecs[C]++));
+            NodeOf.resize(Symbols.size(), -1);
+            auto *Proto = Ctx.create<PrototypeAST>(Name, Ctx.copyArray(Kept));
+            auto *Spec = Ctx.create<FunctionAST>(Proto, clone(Callee->getBody(), Params, Replacements));
+            // The literals may now reach calls in the body; its callees are
+            // all finished, as the callee's were.
+            rewrite(Spec);
+            Spec->setBody(foldExpr(Spec->getBody(), Ctx, Folded));
+            NewFunctions.push_back(Spec);
+            Specs.emplace(std::move(Key), Name);
+            ++Stats.Specializations;
+            return Name;
+        }
+
+        // call - The replacement of a call whose arguments are final.
+        ExprAST *call(CallExprAST *Call, uint64_t &Size)
+        {
+            uint32_t ID = Call->getCallee().getID();
+            int32_t Node = ID < NodeOf.size() ? NodeOf[ID] : -1;
+            if (Node < 0 || Recursive[static_cast<uint32_t>(Node)])
+            {
+                return Call;
+            }
+            uint32_t C = static_cast<uint32_t>(Node);
+            const Summary &S = Summaries[C];
+            ASTArray<ExprAST *> Args = Call->getArgs();
+            if (S.Size <= InlineLimit[C] && Size + S.Size <= MaxCallerSize && canSubstitute(Args, S))
+            {
+                std::vector<ExprAST *> Replacements(Args.begin(), Args.end());
+                Size += S.Size;
+                ++Stats.CallsInlined;
+                return clone(G.Nodes[C]->getBody(), G.Nodes[C]->getProto()->getArgs(), Replacements);
+            }
+            bool AnyLiteral = false;
+            for (const ExprAST *Arg : Args)
+            {
+                AnyLiteral |= Arg->getKind() == ExprAST::Number;
+            }
+            if (!AnyLiteral || S.Size > MaxSpecializeSize || InlineLimit[C] == 0)
+            {
+                return Call;
+            }
+            Symbol Spec = specialize(C, Args);
+            if (!Spec.isValid())
+            {
+                return Call;
+            }
+            std::vector<ExprAST *> Kept;
+            for (ExprAST *Arg : Args)
+            {
+                if (Arg->getKind() != ExprAST::Number)
+                {
+                    Kept.push_back(Arg);
+                }
+            }
+            ++Stats.CallsSpecialized;
+            return Ctx.create<CallExprAST>(Spec, Ctx.copyArray(Kept));
+        }
+
+        // rewrite - Inline into and specialize the calls of F, innermost
+        // first; whether anything changed.
+        bool rewrite(FunctionAST *F)
+        {
+            struct Frame
+            {
+                ExprAST *E;
+                unsigned Stage;
+            };
+            std::vector<Frame> Frames{{F->getBody(), 0}};
+            std::vector<ExprAST *> Results;
+            uint64_t Size = countNodes(F->getBody());
+            bool Changed = false;
+            while (!Frames.empty())
+            {
+                Frame Fr = Frames.back();
+                Frames.pop_back();
+                switch (Fr.E->getKind())
+                {
+                case ExprAST::Number:
+                case ExprAST::Variable:
+                    Results.push_back(Fr.E);
+                    break;
+                case ExprAST::Binary:
+                {
+                    auto *B = static_cast<BinaryExprAST *>(Fr.E);
+                    if (Fr.Stage == 0)
+                    {
+                        Frames.push_back({Fr.E, 1});
+                        Frames.push_back({B->getRHS(), 0});
+                        Frames.push_back({B->getLHS(), 0});
+                        break;
+                    }
+                    B->setRHS(Results.back());
+                    Results.pop_back();
+                    B->setLHS(Results.back());
+                    Results.back() = B;
+                    break;
+                }
+                case ExprAST::Call:
+                {
+                    auto *C = static_cast<CallExprAST *>(Fr.E);
+                    ASTArray<ExprAST *> Args = C->getArgs();
+                    if (Fr.Stage == 0)
+                    {
+                        Frames.push_back({Fr.E, 1});
+                        for (uint32_t I = Args.size(); I-- > 0;)
+                        {
+                            Frames.push_back({Args[I], 0});
+                        }
+                        break;
+                    }
+                    for (uint32_t I = 0; I != Args.size(); ++I)
+                    {
+                        Args[I] = Results[Results.size() - Args.size() + I];
+                    }
+                    Results.resize(Results.size() - Args.size());
+                    ExprAST *Replacement = call(C, Size);
+                    Changed |= Replacement != C;
+                    Results.push_back(Replacement);
+                    break;
+                }
+                case ExprAST::If:
+                {
+                    auto *If = static_cast<IfExprAST *>(Fr.E);
+                    if (Fr.Stage == 0)
+                    {
+                        Frames.push_back({Fr.E, 1});
+                        Frames.push_back({If->getElse(), 0});
+                        Frames.push_back({If->getThen(), 0});
+                        Frames.push_back({If->getCond(), 0});
+                        break;
+                    }
+                    If->setElse(Results.back());
+                    Results.pop_back();
+                    If->setThen(Results.back());
+                    Results.pop_back();
+                    If->setCond(Results.back());
+                    Results.back() = If;
+                    break;
+                }
+                }
+            }
+            F->setBody(Results.back());
+            return Changed;
+        }
+
+    public:
+        Inliner(ModuleAST &M, SymbolTable &Symbols, ASTContext &Ctx, InlineStats &Stats, const ProfileData *Profile)
+            : M(M), Symbols(Symbols), Ctx(Ctx), Stats(Stats), Profile(Profile), G(buildCallGraph(M, Symbols)),
+              NodeOf(Symbols.size(), -1)
+        {
+        }
+
+        void run()
+        {
+            std::vector<uint32_t> BottomUp;
+            Recursive = findRecursive(G, &BottomUp);
+            for (uint32_t N = 0; N != G.Nodes.size(); ++N)
+            {
+                NodeOf[G.Nodes[N]->getProto()->getName().getID()] = static_cast<int32_t>(N);
+            }
+            Summaries.resize(G.Nodes.size());
+            NumSpecs.resize(G.Nodes.size(), 0);
+            InlineLimit.resize(G.Nodes.size(), MaxInlineSize);
+            for (uint32_t N = 0; Profile && N != G.Nodes.size(); ++N)
+            {
+                std::string_view Name = Symbols.getName(G.Nodes[N]->getProto()->getName());
+                InlineLimit[N] = Profile->isHot(Name) ? MaxHotInlineSize : Profile->isCold(Name) ? 0 : MaxInlineSize;
+            }
+            for (FunctionAST *F : M.Functions)
+            {
+                Stats.NodesBefore += countNodes(F->getBody());
+            }
+
+            for (uint32_t N : BottomUp)
+            {
+                FunctionAST *F = G.Nodes[N];
+                if (rewrite(F))
+                {
+                    F->setBody(foldExpr(F->getBody(), Ctx, Folded));
+                }
+                Summaries[N] = summarize(F);
+            }
+            for (FunctionAST *F : M.Functions)
+            {
+                if (isTopLevelExpr(F->getProto(), Symbols) && rewrite(F))
+                {
+                    F->setBody(foldExpr(F->getBody(), Ctx, Folded));
+                }
+            }
+
+            M.Functions.insert(M.Functions.end(), NewFunctions.begin(), NewFunctions.end());
+            for (FunctionAST *F : M.Functions)
+            {
+                Stats.NodesAfter += countNodes(F->getBody());
+            }
+        }
+    };
+}
+
+InlineStats inlineModule(ModuleAST &M, SymbolTable &Symbols, ASTContext &Ctx, const ProfileData *Profile)
+{
+    InlineStats Stats;
+    Inliner(M, Symbols, Ctx, Stats, Profile).run();
+    return Stats;
+}
@@ -0,0 +1,49 @@
+#ifndef KALEIDOSCOPE_UTILS_INLINE_H
+#define KALEIDOSCOPE_UTILS_INLINE_H
+
+#include "ast.h"
+#include "symboltable.h"
+
+#include <cstdint>
+
+class ProfileData;
+
+// InlineStats - What inlineModule() did to one module.
+struct InlineStats
+{
+    uint64_t CallsInlined = 0;     // call sites replaced by the callee's body
+    uint64_t CallsSpecialized = 0; // call sites redirected to a specialization
+    uint64_t Specializations = 0;  // functions cloned for constant arguments
+    uint64_t NodesBefore = 0;      // expression nodes in the module before
+    uint64_t NodesAfter = 0;       // ... and after, specializations included
+};
+
+// inlineModule - Inlining and constant-argument specialization on the AST,
+// across the functions of one module. LLVM optimizes each function on its
+// own, so this is the only place a call to a one-line helper goes away.
+//
+// Functions are visited callees first over the call graph (see
+// purity.h), so a helper's own calls are already inlined when it is
+// inlined itself. A call to a function of M that isn't recursive is
+// replaced by a copy of the callee's body, with the arguments in place of
+// the parameters, when the body has at most a handful of nodes and the
+// substitution evaluates the same things in the same order: an argument
+// that is a literal or a variable may be copied any number of times; one
+// without calls may be used at most once; one with calls must be used
+// exactly once, outside any branch, in argument order, by a body without
+// calls of its own. Otherwise, when some arguments are literals, the call
+// goes to a copy of the callee with those parameters replaced by the
+// literals and folded, "<f>.spec<N>", shared by every call with the same
+// literals; each callee gets a few such copies at most. Recursive functions
+// are neither inlined nor specialized, so tail calls and memoization see
+// them as written.
+//
+// With a Profile (profile.h), callees it calls hot may be four times the
+// size, and callees it never called are neither inlined nor specialized, so
+// code that didn't run stays compact.
+//
+// Every rewritten body is folded again (fold.h). New nodes are allocated in
+// Ctx and specializations appended to M.Functions.
+InlineStats inlineModule(ModuleAST &M, SymbolTable &Symbols, ASTContext &Ctx, const ProfileData *Profile = nullptr);
+
+#endif // KALEIDOSCOPE_UTILS_INLINE_H
@@ -0,0 +1,179 @@
+#include "interpreter.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    // Registers in the frame stack (32 MB, only touched as deep as the
+    // program goes) and interpreted calls in flight.
+    const size_t StackSize = size_t(1) << 22;
+    const uint32_t MaxCallDepth = 1 << 16;
+}
+
+TierListener::~TierListener() = default;
+
+Interpreter::Interpreter(BytecodeModule &BC, TierListener *Listener, uint32_t Threshold)
+    : BC(BC), Listener(Listener), Threshold(Threshold), Stack(new double[StackSize]),
+      StackEnd(Stack.get() + StackSize)
+{
+}
+
+Interpreter::~Interpreter() = default;
+
+bool Interpreter::fail(const char *Msg, const bc::Function &F)
+{
+    fprintf(stderr, "Error: %s in '%s'\n", Msg, F.Name.c_str());
+    Failed = true;
+    return false;
+}
+
+double Interpreter::execute(const bc::Function &F, double *Regs)
+{
+    bc::Instr *Code = BC.getCode().data();
+    const double *K = BC.getConstants().data();
+
+    for (bc::Instr *PC = Code + F.Entry;; ++PC)
+    {
+        switch (PC->Op)
+        {
+        case bc::LoadK:
+            Regs[PC->Dst] = K[PC->B];
+            break;
+        case bc::Move:
+            Regs[PC->Dst] = Regs[PC->A];
+            break;
+        case bc::Add:
+            Regs[PC->Dst] = Regs[PC->A] + Regs[PC->B];
+            break;
+        case bc::Sub:
+            Regs[PC->Dst] = Regs[PC->A] - Regs[PC->B];
+            break;
+        case bc::Mul:
+            Regs[PC->Dst] = Regs[PC->A] * Regs[PC->B];
+            break;
+        case bc::Lt:
+            // fcmp ult: true when either side is NaN.
+            Regs[PC->Dst] = !(Regs[PC->A] >= Regs[PC->B]) ? 1.0 : 0.0;
+            break;
+        case bc::Jump:
+            PC = Code + PC->B - 1;
+            break;
+        case bc::JumpIfFalse:
+        {
+            // fcmp one 0.0: NaN is false.
+            double Cond = Regs[PC->A];
+            if (!(Cond < 0.0 || Cond > 0.0))
+            {
+                PC = Code + PC->B - 1;
+            }
+            break;
+        }
+        case bc::Call:
+        {
+            bc::Function &Callee = BC.getFunction(PC->B);
+            bc::NativeEntry Native = Callee.Native.load(std::memory_order_acquire);
+            if (!Native && !Callee.Defined)
+            {
+                if (!Listener)
+                {
+                    fail("no native code for extern", Callee);
+                    return 0.0;
+                }
+                Native = Listener->resolve(PC->B);
+                if (!Native)
+                {
+                    Failed = true;
+                    return 0.0;
+                }
+            }
+            if (Native)
+            {
+                // Patch the call site; it stays native from now on.
+                PC->Op = bc::CallNative;
+                Regs[PC->Dst] = Native(Regs + PC->A);
+                break;
+            }
+
+            if (++Callee.Calls == Threshold && Threshold != 0 && Listener)
+            {
+                Listener->promote(PC->B);
+            }
+            double *Frame = Regs + PC->A;
+            if (Frame + Callee.NumRegs > StackEnd || Depth == MaxCallDepth)
+            {
+                fail("stack overflow", Callee);
+                return 0.0;
+            }
+            ++Depth;
+            double Result = execute(Callee, Frame);
+            --Depth;
+            if (Failed)
+            {
+                return 0.0;
+            }
+            Regs[PC->Dst] = Result;
+            break;
+        }
+        case bc::CallNative:
+            Regs[PC->Dst] = BC.getFunction(PC->B).Native.load(std::memory_order_relaxed)(Regs + PC->A);
+            break;
+        case bc::TailCall:
+        {
+            bc::Function &Callee = BC.getFunction(PC->B);
+            bc::NativeEntry Native = Callee.Native.load(std::memory_order_acquire);
+            if (!Native && !Callee.Defined)
+            {
+                if (!Listener)
+                {
+                    fail("no native code for extern", Callee);
+                    return 0.0;
+                }
+                Native = Listener->resolve(PC->B);
+                if (!Native)
+                {
+                    Failed = true;
+                    return 0.0;
+                }
+            }
+            if (Native)
+            {
+                PC->Op = bc::TailNative;
+                return Native(Regs + PC->A);
+            }
+
+            if (++Callee.Calls == Threshold && Threshold != 0 && Listener)
+            {
+                Listener->promote(PC->B);
+            }
+            if (Regs + Callee.NumRegs > StackEnd)
+            {
+                fail("stack overflow", Callee);
+                return 0.0;
+            }
+            // The callee takes over this frame; its arguments become the
+            // bottom registers.
+            memmove(Regs, Regs + PC->A, Callee.NumParams * sizeof(double));
+            PC = Code + Callee.Entry - 1;
+            break;
+        }
+        case bc::TailNative:
+            return BC.getFunction(PC->B).Native.load(std::memory_order_relaxed)(Regs + PC->A);
+        case bc::Ret:
+            return Regs[PC->A];
+        }
+    }
+}
+
+bool Interpreter::run(uint32_t Fn, double &Result)
+{
+    const bc::Function &F = BC.getFunction(Fn);
+    Depth = 0;
+    Failed = false;
+    if (F.NumRegs > StackSize)
+    {
+        return fail("stack overflow", F);
+    }
+    Result = execute(F, Stack.get());
+    return !Failed;
+}
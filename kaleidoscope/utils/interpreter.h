@@ -0,0 +1,60 @@
+#ifndef KALEIDOSCOPE_UTILS_INTERPRETER_H
+#define KALEIDOSCOPE_UTILS_INTERPRETER_H
+
+#include "bytecode.h"
+
+#include <cstdint>
+#include <memory>
+
+//===-------------------------------------------------------------===//
+// Interpreter
+//===-------------------------------------------------------------===//
+// TierListener - How the interpreter asks for native code. promote() is
+// called once per function, when it reaches the hot threshold, and should
+// compile it in the background and publish bc::Function::Native when done.
+// resolve() is called for a function without bytecode, i.e. an extern, the
+// first time a call site reaches it, and must return its native entry (or
+// null after reporting an error).
+class TierListener
+{
+public:
+    virtual ~TierListener();
+    virtual void promote(uint32_t Fn) = 0;
+    virtual bc::NativeEntry resolve(uint32_t Fn) = 0;
+};
+
+// Interpreter - Tier 0: runs bytecode straight away. Every call counts
+// towards its callee's Calls. Once a callee has native code, the call
+// instruction is patched into a CallNative (or TailNative), so that site
+// never looks at the counter or the interpreter's frame stack again.
+//
+// Frames live on one register stack; the native stack grows by one
+// execute() per interpreted call other than a tail call, and both are
+// bounded so runaway recursion is reported as an error rather than crashing
+// the process.
+class Interpreter
+{
+private:
+    BytecodeModule &BC;
+    TierListener *Listener;
+    uint32_t Threshold;
+
+    std::unique_ptr<double[]> Stack;
+    double *StackEnd;
+    uint32_t Depth = 0;
+    bool Failed = false;
+
+    double execute(const bc::Function &F, double *Regs);
+    bool fail(const char *Msg, const bc::Function &F);
+
+public:
+    // Threshold == 0 never promotes anything.
+    Interpreter(BytecodeModule &BC, TierListener *Listener, uint32_t Threshold);
+    ~Interpreter();
+
+    // run - Call the zero-argument function Fn and store what it returns in
+    // Result. Returns false after reporting a runtime error.
+    bool run(uint32_t Fn, double &Result);
+};
+
+#endif // KALEIDOSCOPE_UTILS_INTERPRETER_H
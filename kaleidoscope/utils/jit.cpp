@@ -0,0 +1,336 @@
+#include "jit.h"
+
+#include "trace.h"
+
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/TargetSelect.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+#include <unistd.h>
+
+extern "C" double putchard(double X)
+{
+    fputc(static_cast<char>(X), stderr);
+    return 0;
+}
+
+extern "C" double printd(double X)
+{
+    fprintf(stderr, "%f\n", X);
+    return 0;
+}
+
+namespace
+{
+    using CompileFunctionCreator = llvm::orc::LLJITBuilderState::CompileFunctionCreator;
+    using IRCompiler = llvm::orc::IRCompileLayer::IRCompiler;
+
+    // ProfileChildCycles - "kaleidoscope.prof.children", the cycles of the
+    // profiled callee that returned last; see CodeGen::setProfiling().
+    uint64_t ProfileChildCycles = 0;
+
+    // TracedCompiler - Another compiler, with a "materialize" event for each
+    // module it compiles (or loads from the object cache), named after the
+    // module's first function with a body.
+    class TracedCompiler : public IRCompiler
+    {
+    private:
+        std::unique_ptr<IRCompiler> Inner;
+
+    public:
+        explicit TracedCompiler(std::unique_ptr<IRCompiler> Inner)
+            : IRCompiler(Inner->getManglingOptions()), Inner(std::move(Inner))
+        {
+        }
+
+        llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> operator()(llvm::Module &M) override
+        {
+            llvm::StringRef Name;
+            uint64_t NumFunctions = 0;
+            for (llvm::Function &F : M)
+            {
+                if (!F.isDeclaration() && NumFunctions++ == 0)
+                {
+                    Name = F.getName();
+                }
+            }
+            std::string Detail = Name.str();
+            int64_t Start = traceNow();
+            auto Obj = (*Inner)(M);
+            traceEvent("materialize", Start, traceNow(), Detail);
+            traceCount(ModulesMaterialized, 1);
+            traceCount(FunctionsMaterialized, NumFunctions);
+            return Obj;
+        }
+    };
+
+    // PerfMapListener - Appends "<start> <size> <name>" for each function of
+    // each object the JIT loads to /tmp/perf-<pid>.map, where perf looks up
+    // addresses that no mapped file explains. One per process, shared by
+    // every JIT; entries stay when code is freed, as perf expects.
+    class PerfMapListener : public llvm::JITEventListener
+    {
+    private:
+        std::mutex Lock;
+        FILE *Map = nullptr;
+
+    public:
+        void notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile &Obj,
+                                const llvm::RuntimeDyld::LoadedObjectInfo &L) override
+        {
+            std::lock_guard<std::mutex> Guard(Lock);
+            if (!Map)
+            {
+                std::string Path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+                if (!(Map = fopen(Path.c_str(), "a")))
+                {
+                    return;
+                }
+            }
+            for (const auto &[Sym, Size] : llvm::object::computeSymbolSizes(Obj))
+            {
+                auto Type = llvm::expectedToOptional(Sym.getType());
+                auto Name = llvm::expectedToOptional(Sym.getName());
+                auto Addr = llvm::expectedToOptional(Sym.getAddress());
+                auto Sec = llvm::expectedToOptional(Sym.getSection());
+                if (!Type || *Type != llvm::object::SymbolRef::ST_Function || !Name || !Addr || !Sec ||
+                    *Sec == Obj.section_end())
+                {
+                    continue;
+                }
+                uint64_t Start = L.getSectionLoadAddress(**Sec) + (*Addr - (*Sec)->getAddress());
+                fprintf(Map, "%" PRIx64 " %" PRIx64 " %.*s\n", Start, Size, static_cast<int>(Name->size()),
+                        Name->data());
+            }
+            fflush(Map);
+        }
+    };
+
+    unsigned Listeners = 0; // setJITListeners()
+
+    // listenerFor - The listener for one JITListener bit, or null if this
+    // LLVM was built without it.
+    llvm::JITEventListener *listenerFor(unsigned Kind)
+    {
+        static PerfMapListener PerfMap;
+        switch (Kind)
+        {
+        case ListenPerfMap:
+            return &PerfMap;
+        case ListenJITDump:
+            return llvm::JITEventListener::createPerfJITEventListener();
+        case ListenGDB:
+            return llvm::JITEventListener::createGDBRegistrationListener();
+        case ListenVTune:
+            return llvm::JITEventListener::createIntelJITEventListener();
+        }
+        return nullptr;
+    }
+
+    // linkingLayerFor - What LLJIT uses on ELF, an RTDyld linking layer,
+    // with the listeners of Kinds registered.
+    llvm::orc::LLJITBuilderState::ObjectLinkingLayerCreator linkingLayerFor(unsigned Kinds)
+    {
+        return [Kinds](llvm::orc::ExecutionSession &ES, const llvm::Triple &)
+                   -> llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>>
+        {
+            auto Layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+                ES, []
+                { return std::make_unique<llvm::SectionMemoryManager>(); });
+            for (unsigned Kind = 1; Kind <= Kinds; Kind <<= 1)
+            {
+                if (Kinds & Kind)
+                {
+                    Layer->registerJITEventListener(*listenerFor(Kind));
+                }
+            }
+            return Layer;
+        };
+    }
+
+    // compilerFor - The compiler LLJIT would make, with Cache attached, or
+    // one that creates a TargetMachine per compile for Concurrent; traced if
+    // tracing was on when the JIT was created.
+    CompileFunctionCreator compilerFor(bool Concurrent, llvm::ObjectCache *Cache)
+    {
+        return [Concurrent, Cache](llvm::orc::JITTargetMachineBuilder JTMB)
+                   -> llvm::Expected<std::unique_ptr<IRCompiler>>
+        {
+            std::unique_ptr<IRCompiler> Compiler;
+            if (Concurrent)
+            {
+                Compiler = std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(JTMB), Cache);
+            }
+            else
+            {
+                auto TM = JTMB.createTargetMachine();
+                if (!TM)
+                {
+                    return TM.takeError();
+                }
+                Compiler = std::make_unique<llvm::orc::TMOwningSimpleCompiler>(std::move(*TM), Cache);
+            }
+            if (isTracing())
+            {
+                return std::make_unique<TracedCompiler>(std::move(Compiler));
+            }
+            return Compiler;
+        };
+    }
+}
+
+bool setJITListeners(unsigned Kinds)
+{
+    static const char *const Names[] = {"perfmap", "jitdump", "gdb", "vtune"};
+    for (unsigned I = 0; I != 4; ++I)
+    {
+        if ((Kinds & (1u << I)) && !listenerFor(1u << I))
+        {
+            fprintf(stderr, "Error: this LLVM was built without the %s JIT listener\n", Names[I]);
+            return false;
+        }
+    }
+    Listeners = Kinds;
+    return true;
+}
+
+void initializeNativeTarget()
+{
+    static std::once_flag TargetsInitialized;
+    std::call_once(TargetsInitialized, []
+                   {
+                       llvm::InitializeNativeTarget();
+                       llvm::InitializeNativeTargetAsmPrinter();
+                   });
+}
+
+llvm::Expected<std::unique_ptr<KaleidoscopeJIT>> KaleidoscopeJIT::create(JITMode Mode, bool Concurrent,
+                                                                         llvm::ObjectCache *Cache)
+{
+    initializeNativeTarget();
+
+    OwningJIT J(nullptr, Deleter{Mode});
+    if (Mode == Lazy)
+    {
+        llvm::orc::LLLazyJITBuilder Builder;
+        if (Concurrent || Cache || isTracing())
+        {
+            Builder.setCompileFunctionCreator(compilerFor(Concurrent, Cache));
+        }
+        if (Listeners)
+        {
+            Builder.setObjectLinkingLayerCreator(linkingLayerFor(Listeners));
+        }
+        auto LJ = Builder.create();
+        if (!LJ)
+        {
+            return LJ.takeError();
+        }
+        if (Cache)
+        {
+            // Extracting the called function would make a new module that
+            // the cache doesn't know; compile the module it came from.
+            (*LJ)->setPartitionFunction(llvm::orc::CompileOnDemandLayer::compileWholeModule);
+        }
+        J.reset(LJ->release());
+    }
+    else
+    {
+        llvm::orc::LLJITBuilder Builder;
+        if (Concurrent || Cache || isTracing())
+        {
+            Builder.setCompileFunctionCreator(compilerFor(Concurrent, Cache));
+        }
+        if (Listeners)
+        {
+            Builder.setObjectLinkingLayerCreator(linkingLayerFor(Listeners));
+        }
+        auto EJ = Builder.create();
+        if (!EJ)
+        {
+            return EJ.takeError();
+        }
+        J.reset(EJ->release());
+    }
+
+    llvm::orc::JITDylib &Main = J->getMainJITDylib();
+
+    // The runtime is defined by address, so the executable need not export
+    // its symbols (no -rdynamic).
+    llvm::orc::SymbolMap Runtime;
+    Runtime[J->mangleAndIntern("putchard")] =
+        llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(&putchard), llvm::JITSymbolFlags::Exported);
+    Runtime[J->mangleAndIntern("printd")] =
+        llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(&printd), llvm::JITSymbolFlags::Exported);
+    Runtime[J->mangleAndIntern("kaleidoscope.prof.children")] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(&ProfileChildCycles), llvm::JITSymbolFlags::Exported);
+    if (llvm::Error Err = Main.define(llvm::orc::absoluteSymbols(std::move(Runtime))))
+    {
+        return Err;
+    }
+
+    auto Process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        J->getDataLayout().getGlobalPrefix());
+    if (!Process)
+    {
+        return Process.takeError();
+    }
+    Main.addGenerator(std::move(*Process));
+
+    return std::unique_ptr<KaleidoscopeJIT>(new KaleidoscopeJIT(std::move(J), Mode));
+}
+
+KaleidoscopeJIT::~KaleidoscopeJIT() = default;
+
+void KaleidoscopeJIT::Deleter::operator()(llvm::orc::LLJIT *J) const
+{
+    if (Mode == Lazy)
+    {
+        delete static_cast<llvm::orc::LLLazyJIT *>(J);
+    }
+    else
+    {
+        delete J;
+    }
+}
+
+llvm::Error KaleidoscopeJIT::addModule(llvm::orc::ThreadSafeModule TSM, llvm::orc::ResourceTrackerSP RT)
+{
+    if (!RT)
+    {
+        RT = J->getMainJITDylib().getDefaultResourceTracker();
+    }
+    if (Mode == Lazy)
+    {
+        // addLazyIRModule() has no tracker overload; do what it does.
+        TSM.withModuleDo(
+            [&](llvm::Module &M)
+            {
+                if (M.getDataLayout().isDefault())
+                {
+                    M.setDataLayout(J->getDataLayout());
+                }
+            });
+        return static_cast<llvm::orc::LLLazyJIT &>(*J).getCompileOnDemandLayer().add(std::move(RT), std::move(TSM));
+    }
+    return J->addIRModule(std::move(RT), std::move(TSM));
+}
+
+llvm::Expected<double (*)()> KaleidoscopeJIT::lookupExpr(llvm::StringRef Name)
+{
+    auto Sym = J->lookup(Name);
+    if (!Sym)
+    {
+        return Sym.takeError();
+    }
+    return llvm::jitTargetAddressToFunction<double (*)()>(Sym->getAddress());
+}
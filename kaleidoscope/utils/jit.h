@@ -0,0 +1,102 @@
+#ifndef KALEIDOSCOPE_UTILS_JIT_H
+#define KALEIDOSCOPE_UTILS_JIT_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/Error.h"
+
+#include <memory>
+
+namespace llvm
+{
+    class ObjectCache;
+}
+
+//===-------------------------------------------------------------===//
+// JIT
+//===-------------------------------------------------------------===//
+// KaleidoscopeJIT - Runs compiled units in-process on ORC. In eager mode
+// (LLJIT) the first lookup into a module compiles the whole module. In lazy
+// mode (LLLazyJIT) every function is first emitted as a stub that calls into
+// the JIT; the function's body is extracted and compiled on its first call,
+// so a script that defines hundreds of functions only pays for those it runs.
+//
+// Symbols that no added module defines are resolved against the runtime
+// functions below and then the host process (libm's sin, cos, ...).
+class KaleidoscopeJIT
+{
+public:
+    enum JITMode
+    {
+        Eager,
+        Lazy,
+    };
+
+private:
+    // Deleter - LLJIT's destructor isn't virtual; an LLLazyJIT must be
+    // deleted as one.
+    struct Deleter
+    {
+        JITMode Mode;
+        void operator()(llvm::orc::LLJIT *J) const;
+    };
+    using OwningJIT = std::unique_ptr<llvm::orc::LLJIT, Deleter>;
+
+    OwningJIT J;
+    JITMode Mode;
+
+    KaleidoscopeJIT(OwningJIT J, JITMode Mode) : J(std::move(J)), Mode(Mode) {}
+
+public:
+    // create - With Concurrent, lookups may come from several threads at
+    // once: each compile gets its own TargetMachine instead of sharing one.
+    // With a Cache, which must outlive the JIT, every module is looked up
+    // there before it is compiled, and stored once it has been; the lazy JIT
+    // then compiles a module whole on the first call into it.
+    static llvm::Expected<std::unique_ptr<KaleidoscopeJIT>> create(JITMode Mode, bool Concurrent = false,
+                                                                   llvm::ObjectCache *Cache = nullptr);
+    ~KaleidoscopeJIT();
+
+    // addModule - Add a module to the main JITDylib. Nothing is compiled
+    // until one of its symbols is looked up (eager) or called (lazy). With
+    // RT, removing the tracker frees the module's code again.
+    llvm::Error addModule(llvm::orc::ThreadSafeModule TSM, llvm::orc::ResourceTrackerSP RT = nullptr);
+
+    // lookup - The address of a zero-argument function, compiling what the
+    // mode requires first.
+    llvm::Expected<double (*)()> lookupExpr(llvm::StringRef Name);
+
+    JITMode getMode() const { return Mode; }
+    llvm::orc::LLJIT &getLLJIT() { return *J; }
+};
+
+// JITListener - Profilers and debuggers that can be told about the code the
+// JIT emits, so they show function names instead of bare addresses.
+enum JITListener
+{
+    ListenPerfMap = 1 << 0, // append to /tmp/perf-<pid>.map, which perf report reads
+    ListenJITDump = 1 << 1, // write jit-<pid>.dump for perf inject --jit
+    ListenGDB = 1 << 2,     // register objects through GDB's JIT interface
+    ListenVTune = 1 << 3,   // Intel VTune, if LLVM was built with it
+};
+
+// setJITListeners - Register the listeners in Kinds, a set of JITListener
+// bits, with every KaleidoscopeJIT created from now on. Prints why and
+// returns false if this LLVM lacks one of them.
+bool setJITListeners(unsigned Kinds);
+
+// initializeNativeTarget - Register the host target with LLVM, once per
+// process; safe to call from any thread.
+void initializeNativeTarget();
+
+// Runtime functions that Kaleidoscope programs can declare with extern.
+extern "C"
+{
+    // putchard - putchar that takes a double and returns 0.
+    double putchard(double X);
+    // printd - printf that takes a double and prints it as "%f\n", returning 0.
+    double printd(double X);
+}
+
+#endif // KALEIDOSCOPE_UTILS_JIT_H
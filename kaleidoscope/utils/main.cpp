@@ -1,8 +1,299 @@
-#include <frontend.h>
+#include <driver.h>
+#include <jit.h>
+#include <trace.h>
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void printUsage(const char *Argv0)
+{
+    fprintf(stderr, "Usage: %s [-j N] [-O0..-O3] [-fno-fold] [-fno-inline] [-fno-tail-calls] [-fassociative-math]\n"
+            "       [-memo] [-memo-cache-bits=N] [-time-stages] [-time-passes] [-stats] [-trace=FILE]\n"
+            "       [-emit-llvm | -emit-obj | -emit-asm] [-mtriple=T] [-mcpu=NAME|native] [-mattr=+a,-b]\n"
+            "       [-jit[=lazy|eager] | -interp | -tiered | -repl | -stream] [-tier-threshold=N] [-cache-dir=DIR]\n"
+            "       [-module-cache=DIR] [-jit-listeners=perfmap,jitdump,gdb,vtune] [-profile] [-profile-out=FILE]\n"
+            "       [-profile-use=FILE] [file...]\n",
+            Argv0);
+}
+
+// parseCount - Parse a decimal count no larger than Max; false if it is not
+// one.
+static bool parseCount(const char *Str, unsigned long Max, unsigned &Out)
+{
+    char *End;
+    unsigned long N = strtoul(Str, &End, 10);
+    if (!isdigit(static_cast<unsigned char>(*Str)) || *End != '\0' || N > Max)
+    {
+        return false;
+    }
+    Out = static_cast<unsigned>(N);
+    return true;
+}
+
+// parseListeners - Parse the comma-separated list of -jit-listeners into
+// JITListener bits; false if it names something else.
+static bool parseListeners(const char *Str, unsigned &Out)
+{
+    static const struct
+    {
+        const char *Name;
+        JITListener Kind;
+    } Listeners[] = {
+        {"perfmap", ListenPerfMap},
+        {"jitdump", ListenJITDump},
+        {"gdb", ListenGDB},
+        {"vtune", ListenVTune},
+    };
+    Out = 0;
+    while (true)
+    {
+        size_t Len = strcspn(Str, ",");
+        unsigned Kind = 0;
+        for (const auto &L : Listeners)
+        {
+            if (strlen(L.Name) == Len && strncmp(Str, L.Name, Len) == 0)
+            {
+                Kind = L.Kind;
+            }
+        }
+        if (Kind == 0)
+        {
+            return false;
+        }
+        Out |= Kind;
+        if (Str[Len] == '\0')
+        {
+            return true;
+        }
+        Str += Len + 1;
+    }
+}
+
+// parseThreads - Parse the N of -j N.
+static bool parseThreads(const char *Str, unsigned &Out) { return parseCount(Str, 1024, Out); }
 
 int main(int argc, char *argv[])
 {
-    int a;
-    a = getNextToken();
-    return a;
+    DriverOptions Opts;
+    for (int I = 1; I < argc; ++I)
+    {
+        const char *Arg = argv[I];
+        if (strcmp(Arg, "-j") == 0)
+        {
+            if (++I == argc || !parseThreads(argv[I], Opts.NumThreads))
+            {
+                fprintf(stderr, "Error: -j expects a thread count\n");
+                return 1;
+            }
+        }
+        else if (strncmp(Arg, "-j", 2) == 0 && isdigit(static_cast<unsigned char>(Arg[2])))
+        {
+            if (!parseThreads(Arg + 2, Opts.NumThreads))
+            {
+                fprintf(stderr, "Error: -j expects a thread count\n");
+                return 1;
+            }
+        }
+        else if (strcmp(Arg, "-time-stages") == 0)
+        {
+            Opts.TimeStages = true;
+        }
+        else if (Arg[0] == '-' && Arg[1] == 'O' && Arg[2] >= '0' && Arg[2] <= '3' && Arg[3] == '\0')
+        {
+            Opts.OptLevel = static_cast<unsigned>(Arg[2] - '0');
+        }
+        else if (strcmp(Arg, "-fno-fold") == 0)
+        {
+            Opts.Fold = false;
+        }
+        else if (strcmp(Arg, "-fno-inline") == 0)
+        {
+            Opts.Inline = false;
+        }
+        else if (strcmp(Arg, "-fno-tail-calls") == 0)
+        {
+            Opts.TailCalls = false;
+        }
+        else if (strcmp(Arg, "-fassociative-math") == 0)
+        {
+            Opts.AssociativeMath = true;
+        }
+        else if (strcmp(Arg, "-memo") == 0)
+        {
+            Opts.Memoize = true;
+        }
+        else if (strncmp(Arg, "-memo-cache-bits=", 17) == 0)
+        {
+            if (!parseCount(Arg + 17, 24, Opts.MemoCacheBits) || Opts.MemoCacheBits == 0)
+            {
+                fprintf(stderr, "Error: -memo-cache-bits expects a number from 1 to 24\n");
+                return 1;
+            }
+        }
+        else if (strcmp(Arg, "-time-passes") == 0)
+        {
+            Opts.TimePasses = true;
+        }
+        else if (strcmp(Arg, "-stats") == 0 || strncmp(Arg, "-trace=", 7) == 0)
+        {
+            if (!KALEIDOSCOPE_TRACING)
+            {
+                fprintf(stderr, "Error: %s needs a build with KALEIDOSCOPE_TRACING\n", Arg);
+                return 1;
+            }
+            if (Arg[1] == 's')
+            {
+                Opts.Stats = true;
+            }
+            else if ((Opts.TraceFile = Arg + 7).empty())
+            {
+                fprintf(stderr, "Error: -trace expects a file name\n");
+                return 1;
+            }
+        }
+        else if (strcmp(Arg, "-emit-llvm") == 0)
+        {
+            Opts.EmitLLVM = true;
+        }
+        else if (strcmp(Arg, "-emit-obj") == 0)
+        {
+            Opts.EmitObj = true;
+        }
+        else if (strcmp(Arg, "-emit-asm") == 0)
+        {
+            Opts.EmitAsm = true;
+        }
+        else if (strncmp(Arg, "-mtriple=", 9) == 0 || strncmp(Arg, "-mcpu=", 6) == 0 || strncmp(Arg, "-mattr=", 7) == 0)
+        {
+            const char *Value = strchr(Arg, '=') + 1;
+            if (*Value == '\0')
+            {
+                fprintf(stderr, "Error: %.*s expects a value\n", static_cast<int>(Value - Arg - 1), Arg);
+                return 1;
+            }
+            std::string &Field = Arg[2] == 't' ? Opts.TargetTriple : Arg[2] == 'c' ? Opts.TargetCPU : Opts.TargetAttrs;
+            Field = Value;
+        }
+        else if (strcmp(Arg, "-jit") == 0 || strcmp(Arg, "-jit=lazy") == 0)
+        {
+            Opts.Execute = DriverOptions::ExecuteJIT;
+            Opts.LazyJIT = true;
+        }
+        else if (strcmp(Arg, "-jit=eager") == 0)
+        {
+            Opts.Execute = DriverOptions::ExecuteJIT;
+            Opts.LazyJIT = false;
+        }
+        else if (strcmp(Arg, "-interp") == 0)
+        {
+            Opts.Execute = DriverOptions::ExecuteInterpret;
+        }
+        else if (strcmp(Arg, "-tiered") == 0)
+        {
+            Opts.Execute = DriverOptions::ExecuteTiered;
+        }
+        else if (strcmp(Arg, "-repl") == 0)
+        {
+            Opts.Execute = DriverOptions::ExecuteRepl;
+        }
+        else if (strcmp(Arg, "-stream") == 0)
+        {
+            Opts.Execute = DriverOptions::ExecuteStream;
+        }
+        else if (strncmp(Arg, "-tier-threshold=", 16) == 0)
+        {
+            if (!parseCount(Arg + 16, UINT32_MAX, Opts.TierThreshold) || Opts.TierThreshold == 0)
+            {
+                fprintf(stderr, "Error: -tier-threshold expects a positive call count\n");
+                return 1;
+            }
+        }
+        else if (strncmp(Arg, "-cache-dir=", 11) == 0)
+        {
+            Opts.CacheDir = Arg + 11;
+            if (Opts.CacheDir.empty())
+            {
+                fprintf(stderr, "Error: -cache-dir expects a directory\n");
+                return 1;
+            }
+        }
+        else if (strncmp(Arg, "-module-cache=", 14) == 0)
+        {
+            Opts.ModuleCacheDir = Arg + 14;
+            if (Opts.ModuleCacheDir.empty())
+            {
+                fprintf(stderr, "Error: -module-cache expects a directory\n");
+                return 1;
+            }
+        }
+        else if (strncmp(Arg, "-jit-listeners=", 15) == 0)
+        {
+            if (!parseListeners(Arg + 15, Opts.JITListeners))
+            {
+                fprintf(stderr, "Error: -jit-listeners expects a list of perfmap, jitdump, gdb and vtune\n");
+                return 1;
+            }
+        }
+        else if (strcmp(Arg, "-profile") == 0)
+        {
+            Opts.Profile = true;
+        }
+        else if (strncmp(Arg, "-profile-out=", 13) == 0 || strncmp(Arg, "-profile-use=", 13) == 0)
+        {
+            std::string &File = Arg[9] == 'o' ? Opts.ProfileOut : Opts.ProfileUse;
+            if ((File = Arg + 13).empty())
+            {
+                fprintf(stderr, "Error: %.12s expects a file name\n", Arg);
+                return 1;
+            }
+            Opts.Profile |= Arg[9] == 'o';
+        }
+        else if (strcmp(Arg, "-h") == 0 || strcmp(Arg, "-help") == 0 || strcmp(Arg, "--help") == 0)
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else if (Arg[0] == '-' && Arg[1] != '\0')
+        {
+            fprintf(stderr, "Error: unknown option '%s'\n", Arg);
+            printUsage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            // Files, with "-" for standard input.
+            Opts.Inputs.push_back(Arg);
+        }
+    }
+    if (Opts.EmitObj && Opts.EmitAsm)
+    {
+        fprintf(stderr, "Error: -emit-obj and -emit-asm can't be combined\n");
+        return 1;
+    }
+    bool ForTarget = Opts.EmitObj || Opts.EmitAsm || !Opts.TargetTriple.empty() || !Opts.TargetCPU.empty() ||
+                     !Opts.TargetAttrs.empty();
+    if (ForTarget && Opts.Execute != DriverOptions::NoExecution)
+    {
+        // The JIT runs host code, and compiled objects are for linking.
+        fprintf(stderr, "Error: -emit-obj, -emit-asm and the -m options can't be combined with running the code\n");
+        return 1;
+    }
+    if (Opts.Profile && Opts.Execute != DriverOptions::ExecuteJIT)
+    {
+        // The counters are read out of the JIT.
+        fprintf(stderr, "Error: -profile and -profile-out need -jit\n");
+        return 1;
+    }
+    bool Session = Opts.Execute == DriverOptions::ExecuteRepl || Opts.Execute == DriverOptions::ExecuteStream;
+    if (Session && (Opts.Memoize || !Opts.CacheDir.empty() || !Opts.ModuleCacheDir.empty()))
+    {
+        // A session compiles each function as it arrives, on its own, with
+        // neither the module-wide analysis -memo needs nor the caches.
+        fprintf(stderr, "Error: -memo, -cache-dir and -module-cache can't be combined with -repl or -stream\n");
+        return 1;
+    }
+    return runDriver(Opts);
 }
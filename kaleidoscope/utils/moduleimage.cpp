@@ -0,0 +1,476 @@
+#include "moduleimage.h"
+
+#include "flatast.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+struct ModuleImage::Header
+{
+    char Magic[8];
+    uint32_t Version;
+    uint32_t ByteOrder; // ImageByteOrder as the writer stored it
+    uint64_t SourceSize;
+    uint64_t SourceHash;
+    uint64_t FileSize;
+    uint32_t NumSymbols;
+    uint32_t NameBytes;
+    uint32_t NumNodes;
+    uint32_t NumLiterals;
+    uint32_t NumArgs; // entries of the argument pool
+    uint32_t NumParams;
+    uint32_t NumFunctions;
+    uint32_t NumExterns;
+    int32_t Precedence[256];
+};
+
+namespace
+{
+    const char ImageMagic[8] = {'K', 'S', 'M', 'O', 'D', 'U', 'L', 'E'};
+    const uint32_t ImageByteOrder = 0x01020304;
+
+    // ImageProto/ImageFunction - FlatModule::Proto and Function as stored.
+    struct ImageProto
+    {
+        uint32_t Name;
+        uint32_t FirstParam;
+        uint32_t NumParams;
+    };
+
+    struct ImageFunction
+    {
+        ImageProto P;
+        uint32_t FirstNode;
+        uint32_t Root;
+    };
+
+    static_assert(sizeof(ModuleImage::Header) % 8 == 0, "sections start 8-byte aligned");
+    static_assert(sizeof(ImageProto) == 12 && sizeof(ImageFunction) == 20, "records are packed");
+    static_assert(sizeof(ExprAST::ExprKind) == 1 && sizeof(Symbol) == 4, "arrays are stored as they are");
+
+    // Layout - The offset of every section, and the size of the file.
+    struct Layout
+    {
+        uint64_t NameOffsets, Names, Literals, Kinds, Ops, A, B, Args, Params, Functions, Externs, End;
+    };
+
+    uint64_t align8(uint64_t Offset) { return (Offset + 7) & ~uint64_t(7); }
+
+    // layoutOf - Where the sections of an image with H's counts go. The
+    // counts are 32-bit, so none of this can overflow.
+    Layout layoutOf(const ModuleImage::Header &H)
+    {
+        Layout L;
+        uint64_t Offset = sizeof(ModuleImage::Header);
+        auto Place = [&Offset](uint64_t Count, uint64_t EltSize)
+        {
+            uint64_t At = Offset;
+            Offset = align8(Offset + Count * EltSize);
+            return At;
+        };
+        L.NameOffsets = Place(uint64_t(H.NumSymbols) + 1, sizeof(uint32_t));
+        L.Names = Place(H.NameBytes, 1);
+        L.Literals = Place(H.NumLiterals, sizeof(double));
+        L.Kinds = Place(H.NumNodes, 1);
+        L.Ops = Place(H.NumNodes, 1);
+        L.A = Place(H.NumNodes, sizeof(uint32_t));
+        L.B = Place(H.NumNodes, sizeof(uint32_t));
+        L.Args = Place(H.NumArgs, sizeof(uint32_t));
+        L.Params = Place(H.NumParams, sizeof(uint32_t));
+        L.Functions = Place(H.NumFunctions, sizeof(ImageFunction));
+        L.Externs = Place(H.NumExterns, sizeof(ImageProto));
+        L.End = Offset;
+        return L;
+    }
+
+    //===--- xxHash64 ---===//
+    const uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+    const uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+    const uint64_t Prime3 = 0x165667B19E3779F9ull;
+    const uint64_t Prime4 = 0x85EBCA77C2B2AE63ull;
+    const uint64_t Prime5 = 0x27D4EB2F165667C5ull;
+
+    uint64_t rotl(uint64_t X, unsigned R) { return (X << R) | (X >> (64 - R)); }
+
+    uint64_t read64(const char *P)
+    {
+        uint64_t V;
+        memcpy(&V, P, sizeof(V));
+        return V;
+    }
+
+    uint32_t read32(const char *P)
+    {
+        uint32_t V;
+        memcpy(&V, P, sizeof(V));
+        return V;
+    }
+
+    uint64_t hashRound(uint64_t Acc, uint64_t Input) { return rotl(Acc + Input * Prime2, 31) * Prime1; }
+    uint64_t mergeRound(uint64_t Acc, uint64_t V) { return (Acc ^ hashRound(0, V)) * Prime1 + Prime4; }
+}
+
+uint64_t hashSource(const char *Data, size_t Size)
+{
+    const char *P = Data;
+    const char *End = Data + Size;
+    uint64_t H;
+    if (Size >= 32)
+    {
+        // Four independent lanes over 32-byte stripes.
+        uint64_t V1 = Prime1 + Prime2, V2 = Prime2, V3 = 0, V4 = 0 - Prime1;
+        for (; End - P >= 32; P += 32)
+        {
+            V1 = hashRound(V1, read64(P));
+            V2 = hashRound(V2, read64(P + 8));
+            V3 = hashRound(V3, read64(P + 16));
+            V4 = hashRound(V4, read64(P + 24));
+        }
+        H = rotl(V1, 1) + rotl(V2, 7) + rotl(V3, 12) + rotl(V4, 18);
+        H = mergeRound(mergeRound(mergeRound(mergeRound(H, V1), V2), V3), V4);
+    }
+    else
+    {
+        H = Prime5;
+    }
+    H += Size;
+    for (; End - P >= 8; P += 8)
+    {
+        H = rotl(H ^ hashRound(0, read64(P)), 27) * Prime1 + Prime4;
+    }
+    if (End - P >= 4)
+    {
+        H = rotl(H ^ (read32(P) * Prime1), 23) * Prime2 + Prime3;
+        P += 4;
+    }
+    for (; P != End; ++P)
+    {
+        H = rotl(H ^ (static_cast<unsigned char>(*P) * Prime5), 11) * Prime1;
+    }
+    H ^= H >> 33;
+    H *= Prime2;
+    H ^= H >> 29;
+    H *= Prime3;
+    H ^= H >> 32;
+    return H;
+}
+
+ModuleImage::~ModuleImage()
+{
+    if (Data)
+    {
+        munmap(const_cast<char *>(Data), Size);
+    }
+}
+
+bool ModuleImage::write(const std::string &Path, const ModuleAST &M, const SymbolTable &Symbols,
+                        const PrecedenceTable &Precedence, uint64_t SourceHash, uint64_t SourceSize)
+{
+    FlatModule Flat = FlatModule::fromAST(M);
+
+    std::vector<uint32_t> NameOffsets{0};
+    std::string Names;
+    for (uint32_t ID = 0; ID < Symbols.size(); ++ID)
+    {
+        Names += Symbols.getName(Symbol(ID));
+        NameOffsets.push_back(static_cast<uint32_t>(Names.size()));
+    }
+    std::vector<ImageFunction> Functions;
+    for (const FlatModule::Function &F : Flat.Functions)
+    {
+        Functions.push_back({{F.P.Name.getID(), F.P.FirstParam, F.P.NumParams}, F.FirstNode, F.Root});
+    }
+    std::vector<ImageProto> Externs;
+    for (const FlatModule::Proto &P : Flat.Externs)
+    {
+        Externs.push_back({P.Name.getID(), P.FirstParam, P.NumParams});
+    }
+
+    Header H{};
+    memcpy(H.Magic, ImageMagic, sizeof(H.Magic));
+    H.Version = Version;
+    H.ByteOrder = ImageByteOrder;
+    H.SourceSize = SourceSize;
+    H.SourceHash = SourceHash;
+    H.NumSymbols = static_cast<uint32_t>(Symbols.size());
+    H.NameBytes = static_cast<uint32_t>(Names.size());
+    H.NumNodes = Flat.getNumNodes();
+    H.NumLiterals = static_cast<uint32_t>(Flat.Literals.size());
+    H.NumArgs = static_cast<uint32_t>(Flat.ArgPool.size());
+    H.NumParams = static_cast<uint32_t>(Flat.Params.size());
+    H.NumFunctions = static_cast<uint32_t>(Functions.size());
+    H.NumExterns = static_cast<uint32_t>(Externs.size());
+    for (size_t I = 0; I < Precedence.size(); ++I)
+    {
+        H.Precedence[I] = Precedence[I];
+    }
+    H.FileSize = layoutOf(H).End;
+
+    // Unique per process and call, since units with the same source write
+    // the same image.
+    static std::atomic<unsigned> NumTemps{0};
+    std::string Temp = Path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(NumTemps.fetch_add(1));
+    FILE *Out = fopen(Temp.c_str(), "wb");
+    if (!Out)
+    {
+        return false;
+    }
+    uint64_t Written = 0;
+    auto Put = [&](const void *Bytes, uint64_t Len)
+    {
+        static const char Zeros[8] = {};
+        if (Len)
+        {
+            fwrite(Bytes, 1, Len, Out);
+        }
+        fwrite(Zeros, 1, align8(Written + Len) - (Written + Len), Out);
+        Written = align8(Written + Len);
+    };
+    Put(&H, sizeof(H));
+    Put(NameOffsets.data(), NameOffsets.size() * sizeof(uint32_t));
+    Put(Names.data(), Names.size());
+    Put(Flat.Literals.data(), Flat.Literals.size() * sizeof(double));
+    Put(Flat.Kinds.data(), Flat.Kinds.size());
+    Put(Flat.Ops.data(), Flat.Ops.size());
+    Put(Flat.A.data(), Flat.A.size() * sizeof(uint32_t));
+    Put(Flat.B.data(), Flat.B.size() * sizeof(uint32_t));
+    Put(Flat.ArgPool.data(), Flat.ArgPool.size() * sizeof(uint32_t));
+    Put(Flat.Params.data(), Flat.Params.size() * sizeof(Symbol));
+    Put(Functions.data(), Functions.size() * sizeof(ImageFunction));
+    Put(Externs.data(), Externs.size() * sizeof(ImageProto));
+    bool OK = !ferror(Out);
+    OK = fclose(Out) == 0 && OK;
+    if (!OK || rename(Temp.c_str(), Path.c_str()) != 0)
+    {
+        int SavedErrno = errno;
+        unlink(Temp.c_str());
+        errno = SavedErrno;
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<ModuleImage> ModuleImage::open(const std::string &Path, uint64_t SourceHash, uint64_t SourceSize)
+{
+    int FD = ::open(Path.c_str(), O_RDONLY);
+    if (FD < 0)
+    {
+        return nullptr;
+    }
+    struct stat St;
+    if (fstat(FD, &St) != 0 || !S_ISREG(St.st_mode) || static_cast<uint64_t>(St.st_size) < sizeof(Header))
+    {
+        close(FD);
+        return nullptr;
+    }
+    size_t Size = static_cast<size_t>(St.st_size);
+    void *Addr = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, FD, 0);
+    close(FD);
+    if (Addr == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<ModuleImage> Image(new ModuleImage());
+    Image->Data = static_cast<const char *>(Addr);
+    Image->Size = Size;
+    Image->H = static_cast<const Header *>(Addr);
+    const Header &H = *Image->H;
+    if (memcmp(H.Magic, ImageMagic, sizeof(H.Magic)) != 0 || H.Version != Version ||
+        H.ByteOrder != ImageByteOrder || H.SourceSize != SourceSize || H.SourceHash != SourceHash ||
+        H.FileSize != Size || layoutOf(H).End != Size)
+    {
+        return nullptr;
+    }
+    // load() reads several sections side by side.
+    madvise(Addr, Size, MADV_WILLNEED);
+    return Image;
+}
+
+uint32_t ModuleImage::getNumSymbols() const { return H->NumSymbols; }
+uint32_t ModuleImage::getNumNodes() const { return H->NumNodes; }
+
+PrecedenceTable ModuleImage::getPrecedence() const
+{
+    PrecedenceTable Table{};
+    for (size_t I = 0; I < Table.size(); ++I)
+    {
+        Table[I] = H->Precedence[I];
+    }
+    return Table;
+}
+
+bool ModuleImage::load(ASTContext &Ctx, SymbolTable &Symbols, ModuleAST &M) const
+{
+    Layout L = layoutOf(*H);
+    auto *NameOffsets = reinterpret_cast<const uint32_t *>(Data + L.NameOffsets);
+    const char *Names = Data + L.Names;
+    auto *Literals = reinterpret_cast<const double *>(Data + L.Literals);
+    auto *Kinds = reinterpret_cast<const uint8_t *>(Data + L.Kinds);
+    const char *Ops = Data + L.Ops;
+    auto *A = reinterpret_cast<const uint32_t *>(Data + L.A);
+    auto *B = reinterpret_cast<const uint32_t *>(Data + L.B);
+    auto *Args = reinterpret_cast<const uint32_t *>(Data + L.Args);
+    auto *Params = reinterpret_cast<const uint32_t *>(Data + L.Params);
+    auto *Functions = reinterpret_cast<const ImageFunction *>(Data + L.Functions);
+    auto *Externs = reinterpret_cast<const ImageProto *>(Data + L.Externs);
+
+    // Image symbol ID -> Symbols' symbol; the same IDs if Symbols is fresh.
+    std::vector<Symbol> Remap(H->NumSymbols);
+    for (uint32_t ID = 0; ID < H->NumSymbols; ++ID)
+    {
+        uint32_t Begin = NameOffsets[ID], End = NameOffsets[ID + 1];
+        if (Begin > End || End > H->NameBytes)
+        {
+            return false;
+        }
+        Remap[ID] = Symbols.intern(std::string_view(Names + Begin, End - Begin));
+    }
+    auto IsSymbol = [&](uint32_t ID)
+    { return ID < H->NumSymbols; };
+
+    std::vector<Symbol> ParamScratch;
+    auto Proto = [&](const ImageProto &P) -> PrototypeAST *
+    {
+        if (!IsSymbol(P.Name) || uint64_t(P.FirstParam) + P.NumParams > H->NumParams)
+        {
+            return nullptr;
+        }
+        ParamScratch.clear();
+        for (uint32_t I = 0; I < P.NumParams; ++I)
+        {
+            if (!IsSymbol(Params[P.FirstParam + I]))
+            {
+                return nullptr;
+            }
+            ParamScratch.push_back(Remap[Params[P.FirstParam + I]]);
+        }
+        return Ctx.create<PrototypeAST>(Remap[P.Name], Ctx.copyArray(ParamScratch));
+    };
+
+    ModuleAST Loaded;
+    for (uint32_t I = 0; I < H->NumExterns; ++I)
+    {
+        PrototypeAST *P = Proto(Externs[I]);
+        if (!P)
+        {
+            return false;
+        }
+        Loaded.Externs.push_back(P);
+    }
+
+    // Each body is rebuilt bottom-up: Built holds the nodes made so far that
+    // no parent has taken yet, by their index in the body.
+    std::vector<ExprAST *> Built;
+    std::vector<ExprAST *> ArgScratch;
+    for (uint32_t I = 0; I < H->NumFunctions; ++I)
+    {
+        const ImageFunction &F = Functions[I];
+        PrototypeAST *P = Proto(F.P);
+        if (!P || F.FirstNode > F.Root || F.Root >= H->NumNodes)
+        {
+            return false;
+        }
+        uint32_t First = F.FirstNode;
+        Built.assign(F.Root - First + 1, nullptr);
+        uint32_t NumTaken = 0;
+        // Take - The child at Child of the node at N, which must come before
+        // N in the same body and not belong to another parent already.
+        auto Take = [&](uint32_t Child, uint32_t N) -> ExprAST *
+        {
+            if (Child < First || Child >= N || !Built[Child - First])
+            {
+                return nullptr;
+            }
+            ++NumTaken;
+            ExprAST *E = Built[Child - First];
+            Built[Child - First] = nullptr;
+            return E;
+        };
+        for (uint32_t N = First; N <= F.Root; ++N)
+        {
+            ExprAST *E = nullptr;
+            switch (Kinds[N])
+            {
+            case ExprAST::Number:
+                if (A[N] < H->NumLiterals)
+                {
+                    E = Ctx.create<NumberExprAST>(Literals[A[N]]);
+                }
+                break;
+            case ExprAST::Variable:
+                if (IsSymbol(A[N]))
+                {
+                    E = Ctx.create<VariableExprAST>(Remap[A[N]]);
+                }
+                break;
+            case ExprAST::Binary:
+            {
+                ExprAST *LHS = Take(A[N], N);
+                ExprAST *RHS = Take(B[N], N);
+                if (LHS && RHS)
+                {
+                    E = Ctx.create<BinaryExprAST>(Ops[N], LHS, RHS);
+                }
+                break;
+            }
+            case ExprAST::Call:
+            {
+                if (!IsSymbol(A[N]) || B[N] >= H->NumArgs || uint64_t(B[N]) + 1 + Args[B[N]] > H->NumArgs)
+                {
+                    break;
+                }
+                ArgScratch.clear();
+                for (uint32_t J = 0; J < Args[B[N]]; ++J)
+                {
+                    ExprAST *Arg = Take(Args[B[N] + 1 + J], N);
+                    if (!Arg)
+                    {
+                        break;
+                    }
+                    ArgScratch.push_back(Arg);
+                }
+                if (ArgScratch.size() == Args[B[N]])
+                {
+                    E = Ctx.create<CallExprAST>(Remap[A[N]], Ctx.copyArray(ArgScratch));
+                }
+                break;
+            }
+            case ExprAST::If:
+            {
+                ExprAST *Else = Take(N - 1, N);
+                ExprAST *Cond = Take(A[N], N);
+                ExprAST *Then = Take(B[N], N);
+                if (Cond && Then && Else)
+                {
+                    E = Ctx.create<IfExprAST>(Cond, Then, Else);
+                }
+                break;
+            }
+            }
+            if (!E)
+            {
+                return false;
+            }
+            Built[N - First] = E;
+        }
+        // A tree of K nodes has K - 1 edges: every node but the root was taken.
+        if (NumTaken != F.Root - First)
+        {
+            return false;
+        }
+        Loaded.Functions.push_back(Ctx.create<FunctionAST>(P, Built.back()));
+    }
+
+    M.Functions.insert(M.Functions.end(), Loaded.Functions.begin(), Loaded.Functions.end());
+    M.Externs.insert(M.Externs.end(), Loaded.Externs.begin(), Loaded.Externs.end());
+    return true;
+}
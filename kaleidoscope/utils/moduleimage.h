@@ -0,0 +1,86 @@
+#ifndef KALEIDOSCOPE_UTILS_MODULEIMAGE_H
+#define KALEIDOSCOPE_UTILS_MODULEIMAGE_H
+
+#include "ast.h"
+#include "frontend.h"
+#include "symboltable.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// hashSource - The content hash of Size bytes at Data (64-bit xxHash), which
+// ties a module image to the source it was parsed from.
+uint64_t hashSource(const char *Data, size_t Size);
+
+//===-------------------------------------------------------------===//
+// Module images
+//===-------------------------------------------------------------===//
+// ModuleImage - A parsed module saved to a file that loads without lexing or
+// parsing its source again. The file is mapped read-only and holds, after a
+// fixed header,
+//
+//   the symbol table  every name in ID order, as offsets into one string pool
+//   the nodes         FlatModule's arrays as they are (flatast.h): kinds,
+//                     operators, both operands, the literal, argument and
+//                     parameter pools, then the functions and the externs
+//
+// and the header gives the format version, the size and hashSource() of the
+// source, and the operator precedences the parser ended with. Every section
+// starts on an 8-byte boundary, in the byte order of the machine that wrote
+// it; an image from a machine of the other order is refused.
+//
+// Loading interns the names into the caller's table, remapping IDs if it
+// isn't empty, and rebuilds the tree in one pass over the node arrays. There
+// is no recursion, so a long operator chain loads as easily as it parses. An
+// image is only trusted as far as its header: load() bounds-checks every
+// index, and rejects nodes that are out of post-order or used twice, rather
+// than building a malformed tree from a damaged file.
+class ModuleImage
+{
+public:
+    static constexpr uint32_t Version = 1; // bump whenever the layout changes
+
+    struct Header;
+
+private:
+    const char *Data = nullptr;
+    size_t Size = 0;
+    const Header *H = nullptr;
+
+    ModuleImage() = default;
+
+public:
+    ModuleImage(const ModuleImage &) = delete;
+    ModuleImage &operator=(const ModuleImage &) = delete;
+    ~ModuleImage();
+
+    // write - Save M, whose symbols are those of Symbols, parsed with the
+    // operators of Precedence from SourceSize bytes whose hashSource() is
+    // SourceHash. The file is written under a temporary name and renamed
+    // into place, so a concurrent open() sees all of it or nothing. Returns
+    // false, with errno set, if Path can't be written.
+    static bool write(const std::string &Path, const ModuleAST &M, const SymbolTable &Symbols,
+                      const PrecedenceTable &Precedence, uint64_t SourceHash, uint64_t SourceSize);
+
+    // open - Map the image at Path if it is one of this Version for a source
+    // of SourceSize bytes hashing to SourceHash; null otherwise, without a
+    // report, since a missing or stale image only means parsing again.
+    static std::unique_ptr<ModuleImage> open(const std::string &Path, uint64_t SourceHash, uint64_t SourceSize);
+
+    // load - Rebuild the module into M, with its nodes in Ctx and its names
+    // interned into Symbols. Returns false, adding nothing to M, if the node
+    // arrays are malformed.
+    bool load(ASTContext &Ctx, SymbolTable &Symbols, ModuleAST &M) const;
+
+    // getPrecedence - The operator precedences at the end of the source, to
+    // carry on parsing after it with (Parser::setBinopPrecedence()).
+    PrecedenceTable getPrecedence() const;
+
+    uint32_t getNumSymbols() const;
+    uint32_t getNumNodes() const;
+    size_t getSize() const { return Size; }
+};
+
+#endif // KALEIDOSCOPE_UTILS_MODULEIMAGE_H
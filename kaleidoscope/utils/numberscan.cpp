@@ -0,0 +1,106 @@
+#include "numberscan.h"
+
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+
+namespace
+{
+    // Powers of ten that are exact in a double.
+    const double ExactPow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    const unsigned MaxFastDigits = 19;          // any 19-digit value fits in uint64_t
+    const uint64_t MaxExactMantissa = 1ull << 53; // every integer up to here is a double
+
+    inline bool isDigit(char C)
+    {
+        return static_cast<unsigned char>(C - '0') < 10;
+    }
+}
+
+NumberLiteral scanNumber(const char *Ptr)
+{
+    NumberLiteral Lit;
+    const char *Start = Ptr;
+
+    uint64_t Mantissa = 0;
+    unsigned NumDigits = 0;     // significant digits accumulated in Mantissa
+    unsigned FracDigits = 0;    // of those, how many follow the '.'
+    unsigned TotalDigits = 0;
+    const char *Dot = nullptr;
+    bool ExtraDot = false;
+
+    for (;; ++Ptr)
+    {
+        char C = *Ptr;
+        if (isDigit(C))
+        {
+            ++TotalDigits;
+            // Leading zeros are not significant.
+            if (NumDigits == 0 && C == '0')
+            {
+                if (Dot)
+                {
+                    ++FracDigits;
+                }
+                continue;
+            }
+            if (NumDigits < MaxFastDigits)
+            {
+                Mantissa = Mantissa * 10 + static_cast<unsigned>(C - '0');
+            }
+            ++NumDigits;
+            if (Dot)
+            {
+                ++FracDigits;
+            }
+            continue;
+        }
+        if (C == '.')
+        {
+            if (Dot)
+            {
+                ExtraDot = true;
+            }
+            Dot = Ptr;
+            continue;
+        }
+        break;
+    }
+    Lit.End = Ptr;
+
+    if (TotalDigits == 0 || ExtraDot)
+    {
+        return Lit;
+    }
+    Lit.Valid = true;
+
+    // Fast path (Clinger): an exact integer mantissa divided by an exact power
+    // of ten is correctly rounded by the single IEEE division.
+    if (NumDigits <= MaxFastDigits && Mantissa <= MaxExactMantissa &&
+        FracDigits < sizeof(ExactPow10) / sizeof(ExactPow10[0]))
+    {
+        Lit.Value = static_cast<double>(Mantissa) / ExactPow10[FracDigits];
+        return Lit;
+    }
+
+    // from_chars accepts the same spelling, including "5." and ".5".
+    std::from_chars_result R = std::from_chars(Start, Lit.End, Lit.Value, std::chars_format::fixed);
+    if (R.ec == std::errc::result_out_of_range)
+    {
+        // from_chars leaves the value alone; strtod gives +HUGE_VAL, 0 or the
+        // nearest denormal. It gets a copy of the run, so that it can't read
+        // on into an exponent or hex prefix the lexer doesn't accept.
+        Lit.Value = std::strtod(std::string(Start, Lit.End).c_str(), nullptr);
+    }
+    else if (R.ec != std::errc() || R.ptr != Lit.End)
+    {
+        Lit.Value = 0;
+        Lit.Valid = false;
+    }
+    return Lit;
+}
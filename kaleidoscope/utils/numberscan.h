@@ -0,0 +1,25 @@
+#ifndef KALEIDOSCOPE_UTILS_NUMBERSCAN_H
+#define KALEIDOSCOPE_UTILS_NUMBERSCAN_H
+
+// NumberLiteral - The result of scanning one numeric literal.
+struct NumberLiteral
+{
+    double Value = 0;          // correctly rounded value, 0 if !Valid
+    const char *End = nullptr; // one past the last character consumed
+    bool Valid = false;
+};
+
+// scanNumber - Scan the run of [0-9.] characters starting at Ptr as a decimal
+// literal, digits with at most one '.', directly from the source buffer. The
+// run must be followed by some other character; the SourceBuffer '\0' sentinel
+// is enough. A run with no digits or more than one '.' (like "1.2.3") is still
+// consumed whole, so the lexer resynchronises after it, but is marked invalid.
+//
+// Literals with up to 19 significant digits whose value is exactly
+// representable take an integer fast path; anything else falls back to a
+// correctly rounded conversion (std::from_chars, Eisel-Lemire in libstdc++).
+// A literal out of double range becomes what strtod makes of it: infinity,
+// zero or a denormal.
+NumberLiteral scanNumber(const char *Ptr);
+
+#endif // KALEIDOSCOPE_UTILS_NUMBERSCAN_H
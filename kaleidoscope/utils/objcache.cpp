@@ -0,0 +1,329 @@
+#include "objcache.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    // Bump whenever codegen changes what it emits for the same AST.
+    const char *const KeyVersion = "kaleidoscope-obj-2";
+    const char *const KeyPrefix = "ks-";
+
+    // Functions per cached module: GroupSize on average, MaxGroupSize at most.
+    const unsigned GroupSize = 32;
+    const size_t MaxGroupSize = 128;
+
+    bool isKey(llvm::StringRef ID)
+    {
+        if (!ID.consume_front(KeyPrefix) || ID.size() != 32)
+        {
+            return false;
+        }
+        return ID.find_first_not_of("0123456789abcdef") == llvm::StringRef::npos;
+    }
+
+    // KeyHasher - Feeds the hash unambiguous records: fixed-size values as
+    // raw bytes, strings with their length.
+    struct KeyHasher
+    {
+        llvm::MD5 Hash;
+
+        void add(uint8_t Tag) { Hash.update(llvm::ArrayRef<uint8_t>(&Tag, 1)); }
+        void add(uint64_t Val)
+        {
+            uint8_t Bytes[8];
+            memcpy(Bytes, &Val, sizeof(Val));
+            Hash.update(Bytes);
+        }
+        void add(llvm::StringRef Str)
+        {
+            add(static_cast<uint64_t>(Str.size()));
+            Hash.update(Str);
+        }
+    };
+
+    // userFunction - The function whose code refers to GV, if any, looking
+    // through constant expressions.
+    llvm::Function *userFunction(llvm::GlobalVariable &GV)
+    {
+        std::vector<llvm::User *> Worklist(GV.user_begin(), GV.user_end());
+        while (!Worklist.empty())
+        {
+            llvm::User *U = Worklist.back();
+            Worklist.pop_back();
+            if (auto *I = llvm::dyn_cast<llvm::Instruction>(U))
+            {
+                return I->getFunction();
+            }
+            Worklist.insert(Worklist.end(), U->user_begin(), U->user_end());
+        }
+        return nullptr;
+    }
+
+    // redirectCalls - Make every call in M to a function of another module
+    // call a declaration in M instead.
+    void redirectCalls(llvm::Module &M)
+    {
+        for (llvm::Function &F : M)
+        {
+            for (llvm::BasicBlock &BB : F)
+            {
+                for (llvm::Instruction &I : BB)
+                {
+                    auto *Call = llvm::dyn_cast<llvm::CallInst>(&I);
+                    llvm::Function *Callee = Call ? Call->getCalledFunction() : nullptr;
+                    if (Callee && Callee->getParent() != &M)
+                    {
+                        Call->setCalledFunction(M.getOrInsertFunction(Callee->getName(), Callee->getFunctionType()));
+                    }
+                }
+            }
+        }
+    }
+
+    bool hasDefinitions(const llvm::Module &M)
+    {
+        for (const llvm::GlobalValue &GV : M.global_values())
+        {
+            if (!GV.isDeclaration())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+std::unique_ptr<DiskObjectCache> DiskObjectCache::create(llvm::StringRef Dir)
+{
+    if (std::error_code EC = llvm::sys::fs::create_directories(Dir))
+    {
+        fprintf(stderr, "Error: cannot create cache directory '%s': %s\n", Dir.str().c_str(), EC.message().c_str());
+        return nullptr;
+    }
+    auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!JTMB)
+    {
+        fprintf(stderr, "Error: %s\n", llvm::toString(JTMB.takeError()).c_str());
+        return nullptr;
+    }
+    std::string TargetID =
+        JTMB->getTargetTriple().str() + " " + JTMB->getCPU() + " " + JTMB->getFeatures().getString();
+    return std::unique_ptr<DiskObjectCache>(new DiskObjectCache(Dir.str(), std::move(TargetID)));
+}
+
+std::string DiskObjectCache::pathFor(llvm::StringRef Key) const
+{
+    llvm::SmallString<256> Path(Dir);
+    llvm::sys::path::append(Path, Key + ".o");
+    return std::string(Path);
+}
+
+// notifyObjectCompiled - Failing to store an object only costs a recompile
+// next time, so errors are dropped.
+void DiskObjectCache::notifyObjectCompiled(const llvm::Module *M, llvm::MemoryBufferRef Obj)
+{
+    if (!isKey(M->getModuleIdentifier()))
+    {
+        return;
+    }
+    std::string Path = pathFor(M->getModuleIdentifier());
+    std::string Temp = Path + ".tmp" + std::to_string(llvm::sys::Process::getProcessId());
+    {
+        std::error_code EC;
+        llvm::raw_fd_ostream OS(Temp, EC, llvm::sys::fs::OF_None);
+        if (EC)
+        {
+            return;
+        }
+        OS << Obj.getBuffer();
+        OS.close();
+        if (OS.has_error())
+        {
+            OS.clear_error();
+            llvm::sys::fs::remove(Temp);
+            return;
+        }
+    }
+    if (llvm::sys::fs::rename(Temp, Path))
+    {
+        llvm::sys::fs::remove(Temp);
+    }
+}
+
+std::unique_ptr<llvm::MemoryBuffer> DiskObjectCache::getObject(const llvm::Module *M)
+{
+    if (!isKey(M->getModuleIdentifier()))
+    {
+        return nullptr;
+    }
+    auto Buf = llvm::MemoryBuffer::getFile(pathFor(M->getModuleIdentifier()), /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+    if (!Buf)
+    {
+        Misses.fetch_add(1);
+        return nullptr;
+    }
+    Hits.fetch_add(1);
+    return std::move(*Buf);
+}
+
+std::string functionKey(const FunctionAST &F, const SymbolTable &Symbols, llvm::StringRef LinkName,
+                        llvm::StringRef Salt)
+{
+    KeyHasher H;
+    H.add(llvm::StringRef(KeyVersion));
+    H.add(Salt);
+    H.add(LinkName);
+    ASTArray<Symbol> Params = F.getProto()->getArgs();
+    H.add(static_cast<uint64_t>(Params.size()));
+
+    // Preorder, one record per node; every kind has a fixed number of
+    // children, so the sequence determines the tree.
+    std::vector<const ExprAST *> Worklist{F.getBody()};
+    while (!Worklist.empty())
+    {
+        const ExprAST *E = Worklist.back();
+        Worklist.pop_back();
+        H.add(static_cast<uint8_t>(E->getKind()));
+        switch (E->getKind())
+        {
+        case ExprAST::Number:
+        {
+            double Val = static_cast<const NumberExprAST *>(E)->get_val();
+            uint64_t Bits;
+            memcpy(&Bits, &Val, sizeof(Bits));
+            H.add(Bits);
+            break;
+        }
+        case ExprAST::Variable:
+        {
+            Symbol Name = static_cast<const VariableExprAST *>(E)->get_val();
+            uint64_t Index = 0;
+            while (Index < Params.size() && Params[Index] != Name)
+            {
+                ++Index;
+            }
+            H.add(Index);
+            break;
+        }
+        case ExprAST::Binary:
+        {
+            auto *B = static_cast<const BinaryExprAST *>(E);
+            H.add(static_cast<uint8_t>(B->getOp()));
+            Worklist.push_back(B->getRHS());
+            Worklist.push_back(B->getLHS());
+            break;
+        }
+        case ExprAST::Call:
+        {
+            auto *C = static_cast<const CallExprAST *>(E);
+            std::string_view Callee = Symbols.getName(C->getCallee());
+            H.add(llvm::StringRef(Callee.data(), Callee.size()));
+            ASTArray<ExprAST *> Args = C->getArgs();
+            H.add(static_cast<uint64_t>(Args.size()));
+            for (uint32_t I = Args.size(); I-- > 0;)
+            {
+                Worklist.push_back(Args[I]);
+            }
+            break;
+        }
+        case ExprAST::If:
+        {
+            auto *If = static_cast<const IfExprAST *>(E);
+            Worklist.push_back(If->getElse());
+            Worklist.push_back(If->getThen());
+            Worklist.push_back(If->getCond());
+            break;
+        }
+        }
+    }
+
+    llvm::MD5::MD5Result Result;
+    H.Hash.final(Result);
+    return KeyPrefix + std::string(Result.digest().str());
+}
+
+std::vector<llvm::orc::ThreadSafeModule>
+partitionForCache(llvm::orc::ThreadSafeModule TSM, const std::vector<std::pair<llvm::Function *, std::string>> &Keys)
+{
+    std::vector<llvm::orc::ThreadSafeModule> Parts;
+    llvm::orc::ThreadSafeContext TSCtx = TSM.getContext();
+    TSM.withModuleDo(
+        [&](llvm::Module &M)
+        {
+            std::vector<std::unique_ptr<llvm::Module>> Groups;
+            llvm::DenseMap<const llvm::Function *, llvm::Module *> GroupOf;
+            size_t Begin = 0;
+            for (size_t I = 0; I != Keys.size(); ++I)
+            {
+                uint32_t Low = 0;
+                llvm::StringRef(Keys[I].second).take_back(8).getAsInteger(16, Low);
+                bool Cut = I + 1 == Keys.size() || I + 1 - Begin == MaxGroupSize || Low % GroupSize == 0;
+                if (!Cut)
+                {
+                    continue;
+                }
+                KeyHasher H;
+                H.add(llvm::StringRef(KeyVersion));
+                for (size_t J = Begin; J <= I; ++J)
+                {
+                    H.add(llvm::StringRef(Keys[J].second));
+                }
+                llvm::MD5::MD5Result Result;
+                H.Hash.final(Result);
+                Groups.push_back(
+                    std::make_unique<llvm::Module>(KeyPrefix + std::string(Result.digest().str()), M.getContext()));
+                Groups.back()->setDataLayout(M.getDataLayout());
+                Groups.back()->setTargetTriple(M.getTargetTriple());
+                for (size_t J = Begin; J <= I; ++J)
+                {
+                    llvm::Function *F = Keys[J].first;
+                    F->removeFromParent();
+                    Groups.back()->getFunctionList().push_back(F);
+                    GroupOf[F] = Groups.back().get();
+                }
+                Begin = I + 1;
+            }
+            for (llvm::GlobalVariable &GV : llvm::make_early_inc_range(M.globals()))
+            {
+                auto Group = GroupOf.find(userFunction(GV));
+                if (Group != GroupOf.end())
+                {
+                    GV.removeFromParent();
+                    Group->second->getGlobalList().push_back(&GV);
+                }
+            }
+
+            for (std::unique_ptr<llvm::Module> &Group : Groups)
+            {
+                redirectCalls(*Group);
+                Parts.emplace_back(std::move(Group), TSCtx);
+            }
+        });
+
+    // Anything left behind (nothing, if Keys was complete) stays in TSM.
+    bool Rest = TSM.withModuleDo(
+        [](llvm::Module &M)
+        {
+            redirectCalls(M);
+            return hasDefinitions(M);
+        });
+    if (Rest)
+    {
+        Parts.push_back(std::move(TSM));
+    }
+    return Parts;
+}
@@ -0,0 +1,81 @@
+#ifndef KALEIDOSCOPE_UTILS_OBJCACHE_H
+#define KALEIDOSCOPE_UTILS_OBJCACHE_H
+
+#include "ast.h"
+#include "symboltable.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+//===-------------------------------------------------------------===//
+// Object cache
+//===-------------------------------------------------------------===//
+// DiskObjectCache - Compiled object files kept in a directory across runs,
+// for ORC's compile layer to look into before it compiles a module.
+//
+// Only modules whose identifier is a cache key (see functionKey()) take
+// part; each key names one file, "<dir>/<key>.o". Since the key already
+// covers everything the object code depends on, an entry is never stale and
+// is never checked again: it is either missing or right. Files are written
+// to a temporary name and renamed into place, so concurrent runs sharing a
+// directory see whole objects or none.
+class DiskObjectCache : public llvm::ObjectCache
+{
+private:
+    std::string Dir;
+    std::string TargetID;
+    std::atomic<unsigned> Hits{0}, Misses{0};
+
+    DiskObjectCache(std::string Dir, std::string TargetID) : Dir(std::move(Dir)), TargetID(std::move(TargetID)) {}
+
+    std::string pathFor(llvm::StringRef Key) const;
+
+public:
+    // create - A cache in Dir, creating the directory if need be. Reports
+    // its own error and returns null if it can't.
+    static std::unique_ptr<DiskObjectCache> create(llvm::StringRef Dir);
+
+    void notifyObjectCompiled(const llvm::Module *M, llvm::MemoryBufferRef Obj) override;
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) override;
+
+    // getTargetID - The host triple, CPU and features that objects are
+    // compiled for, to be mixed into every key.
+    llvm::StringRef getTargetID() const { return TargetID; }
+    const std::string &getDir() const { return Dir; }
+    unsigned getNumHits() const { return Hits.load(); }
+    unsigned getNumMisses() const { return Misses.load(); }
+};
+
+// functionKey - The cache key of F's object code, once F has been lowered
+// under the symbol LinkName. It is a hash of F's AST with parameters
+// numbered rather than named, the name and arity of every function it
+// calls, and Salt, which must cover everything else codegen depends on
+// (target, optimization level, tail calls, result caches). Callees' bodies don't matter:
+// every function is compiled and optimized on its own.
+std::string functionKey(const FunctionAST &F, const SymbolTable &Symbols, llvm::StringRef LinkName,
+                        llvm::StringRef Salt);
+
+// partitionForCache - Split TSM into modules named by cache keys. Keys
+// lists every function defined in TSM, in source order, with its
+// functionKey(). Consecutive functions are grouped, and a group ends after a
+// function whose key has its low bits clear (one in GroupSize on average)
+// or once it is MaxGroupSize long. Since the cuts depend only on the keys,
+// editing, inserting or removing a function changes the keys of its own
+// group and maybe its neighbour's, not the rest of the file. Each group's key
+// hashes its functions' keys.
+//
+// A module per function would do that too, but ORC tracks dependencies
+// between modules; thousands of small modules calling one another make
+// linking slower than compiling. Calls across groups become declarations,
+// and each global goes with the function that uses it (the caches of -memo).
+std::vector<llvm::orc::ThreadSafeModule>
+partitionForCache(llvm::orc::ThreadSafeModule TSM, const std::vector<std::pair<llvm::Function *, std::string>> &Keys);
+
+#endif // KALEIDOSCOPE_UTILS_OBJCACHE_H
@@ -0,0 +1,234 @@
+#include "optimizer.h"
+
+#include "jit.h"
+#include "trace.h"
+
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar/EarlyCSE.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Scalar/IndVarSimplify.h"
+#include "llvm/Transforms/Scalar/LICM.h"
+#include "llvm/Transforms/Scalar/LoopDeletion.h"
+#include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include "llvm/Transforms/Scalar/LoopRotation.h"
+#include "llvm/Transforms/Scalar/LoopUnrollPass.h"
+#include "llvm/Transforms/Scalar/Reassociate.h"
+#include "llvm/Transforms/Scalar/SROA.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Transforms/Vectorize/LoopVectorize.h"
+#include "llvm/Transforms/Vectorize/SLPVectorizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+    int64_t nowNanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // isWrapper - Pass managers and adaptors only run other passes; their
+    // time is charged to what they run.
+    bool isWrapper(llvm::StringRef Name)
+    {
+        return Name.contains("PassManager") || Name.contains("PassAdaptor");
+    }
+}
+
+void PassTimings::merge(const llvm::StringMap<Entry> &Local, uint64_t Functions)
+{
+    std::lock_guard<std::mutex> Guard(Lock);
+    for (const auto &KV : Local)
+    {
+        Entry &E = Entries[KV.getKey()];
+        E.Name = KV.getValue().Name;
+        E.Nanos += KV.getValue().Nanos;
+        E.Runs += KV.getValue().Runs;
+    }
+    NumFunctions += Functions;
+}
+
+void PassTimings::print(unsigned OptLevel)
+{
+    std::lock_guard<std::mutex> Guard(Lock);
+    std::vector<const Entry *> Sorted;
+    int64_t Total = 0;
+    for (const auto &KV : Entries)
+    {
+        Sorted.push_back(&KV.getValue());
+        Total += KV.getValue().Nanos;
+    }
+    std::stable_sort(Sorted.begin(), Sorted.end(),
+                     [](const Entry *L, const Entry *R)
+                     { return L->Nanos > R->Nanos; });
+
+    fprintf(stderr, "===-------------------------------------------------------------===\n");
+    fprintf(stderr, "  Pass execution times: %llu function%s at -O%u\n",
+            static_cast<unsigned long long>(NumFunctions), NumFunctions == 1 ? "" : "s", OptLevel);
+    fprintf(stderr, "===-------------------------------------------------------------===\n");
+    fprintf(stderr, "  %12s %7s %10s  %s\n", "Time (s)", "%", "Runs", "Pass");
+    for (const Entry *E : Sorted)
+    {
+        fprintf(stderr, "  %12.6f %6.1f%% %10llu  %s\n", E->Nanos * 1e-9, Total ? 100.0 * E->Nanos / Total : 0.0,
+                static_cast<unsigned long long>(E->Runs), E->Name.c_str());
+    }
+    fprintf(stderr, "  %12.6f %6.1f%% %10s  total\n", Total * 1e-9, 100.0, "");
+}
+
+FunctionOptimizer::FunctionOptimizer(unsigned OptLevel, std::unique_ptr<llvm::TargetMachine> TM,
+                                     PassTimings *Timings)
+    : OptLevel(OptLevel), TM(std::move(TM)), Timings(Timings)
+{
+    if (Timings)
+    {
+        registerTimers();
+    }
+
+    llvm::PassBuilder PB(this->TM.get(), llvm::PipelineTuningOptions(), llvm::None, &PIC);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    if (OptLevel == 0)
+    {
+        return;
+    }
+
+    // Codegen emits no allocas yet, but SROA is what promotes them to
+    // registers once mutable variables exist.
+    FPM.addPass(llvm::SROAPass());
+    FPM.addPass(llvm::EarlyCSEPass(/*UseMemorySSA=*/true));
+    FPM.addPass(llvm::InstCombinePass());
+    if (OptLevel >= 2)
+    {
+        FPM.addPass(llvm::ReassociatePass());
+        FPM.addPass(llvm::GVNPass());
+    }
+    FPM.addPass(llvm::SimplifyCFGPass());
+
+    if (OptLevel >= 3)
+    {
+        llvm::LoopPassManager LPM;
+        LPM.addPass(llvm::LoopRotatePass());
+        LPM.addPass(llvm::LICMPass());
+        LPM.addPass(llvm::IndVarSimplifyPass());
+        LPM.addPass(llvm::LoopDeletionPass());
+        FPM.addPass(llvm::createFunctionToLoopPassAdaptor(std::move(LPM), /*UseMemorySSA=*/true));
+        FPM.addPass(llvm::LoopUnrollPass(llvm::LoopUnrollOptions(OptLevel)));
+        FPM.addPass(llvm::LoopVectorizePass());
+        FPM.addPass(llvm::SLPVectorizerPass());
+    }
+
+    if (OptLevel >= 2)
+    {
+        // Clean up after GVN and the loop passes.
+        FPM.addPass(llvm::InstCombinePass());
+        FPM.addPass(llvm::SimplifyCFGPass());
+    }
+}
+
+FunctionOptimizer::~FunctionOptimizer()
+{
+    if (Timings)
+    {
+        Timings->merge(Local, NumFunctions);
+    }
+}
+
+std::unique_ptr<FunctionOptimizer> FunctionOptimizer::create(unsigned OptLevel, PassTimings *Timings)
+{
+    initializeNativeTarget();
+    auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!JTMB)
+    {
+        fprintf(stderr, "Error: %s\n", llvm::toString(JTMB.takeError()).c_str());
+        return nullptr;
+    }
+    JTMB->setCodeGenOptLevel(OptLevel == 0   ? llvm::CodeGenOpt::None
+                             : OptLevel == 1 ? llvm::CodeGenOpt::Less
+                             : OptLevel == 2 ? llvm::CodeGenOpt::Default
+                                             : llvm::CodeGenOpt::Aggressive);
+    auto TM = JTMB->createTargetMachine();
+    if (!TM)
+    {
+        fprintf(stderr, "Error: %s\n", llvm::toString(TM.takeError()).c_str());
+        return nullptr;
+    }
+    return std::make_unique<FunctionOptimizer>(OptLevel, std::move(*TM), Timings);
+}
+
+void FunctionOptimizer::prepare(llvm::Module &M) const
+{
+    M.setTargetTriple(TM->getTargetTriple().str());
+    M.setDataLayout(TM->createDataLayout());
+}
+
+void FunctionOptimizer::run(llvm::Function &F)
+{
+    TraceScope Scope("optimize", {F.getName().data(), F.getName().size()});
+    FPM.run(F, FAM);
+    // Cached analyses point into F; it may be erased or changed by codegen
+    // before it would be looked at again.
+    FAM.clear();
+    ++NumFunctions;
+}
+
+void FunctionOptimizer::registerTimers()
+{
+    PIC.registerBeforeNonSkippedPassCallback([this](llvm::StringRef Name, llvm::Any)
+                                             { push(Name); });
+    PIC.registerAfterPassCallback([this](llvm::StringRef Name, llvm::Any, const llvm::PreservedAnalyses &)
+                                  {
+                                      if (!isWrapper(Name))
+                                      {
+                                          pop();
+                                      }
+                                  });
+    PIC.registerAfterPassInvalidatedCallback([this](llvm::StringRef Name, const llvm::PreservedAnalyses &)
+                                             {
+                                                 if (!isWrapper(Name))
+                                                 {
+                                                     pop();
+                                                 }
+                                             });
+    PIC.registerBeforeAnalysisCallback([this](llvm::StringRef Name, llvm::Any)
+                                       { push(Name); });
+    PIC.registerAfterAnalysisCallback([this](llvm::StringRef, llvm::Any)
+                                      { pop(); });
+}
+
+void FunctionOptimizer::push(llvm::StringRef Name)
+{
+    if (!isWrapper(Name))
+    {
+        Stack.push_back({Name, nowNanos(), 0});
+    }
+}
+
+// pop - Charge the innermost running pass its time minus that of the passes
+// and analyses it ran.
+void FunctionOptimizer::pop()
+{
+    Running R = Stack.back();
+    Stack.pop_back();
+    int64_t Elapsed = nowNanos() - R.Start;
+    PassTimings::Entry &E = Local[R.Name];
+    if (E.Name.empty())
+    {
+        E.Name = R.Name.str();
+    }
+    E.Nanos += Elapsed - R.Children;
+    ++E.Runs;
+    if (!Stack.empty())
+    {
+        Stack.back().Children += Elapsed;
+    }
+}
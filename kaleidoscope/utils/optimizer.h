@@ -0,0 +1,111 @@
+#ifndef KALEIDOSCOPE_UTILS_OPTIMIZER_H
+#define KALEIDOSCOPE_UTILS_OPTIMIZER_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//===-------------------------------------------------------------===//
+// Optimization
+//===-------------------------------------------------------------===//
+// PassTimings - Time spent in each pass and analysis, summed over every
+// FunctionOptimizer that reports to it. Optimizers keep their own tallies
+// and merge them once, so units optimized on different threads only meet
+// here.
+class PassTimings
+{
+public:
+    struct Entry
+    {
+        std::string Name;
+        int64_t Nanos = 0;
+        uint64_t Runs = 0;
+    };
+
+private:
+    std::mutex Lock;
+    llvm::StringMap<Entry> Entries;
+    uint64_t NumFunctions = 0;
+
+public:
+    void merge(const llvm::StringMap<Entry> &Local, uint64_t Functions);
+
+    // print - A -time-passes report to stderr, slowest first.
+    void print(unsigned OptLevel);
+};
+
+// FunctionOptimizer - Runs the -O<n> pipeline on one function at a time,
+// as soon as CodeGen has finished and verified it, so that the JIT is
+// handed optimized code function by function rather than after a module
+// pass. Each compilation unit needs its own: the analysis managers cache
+// results for the functions of one LLVMContext.
+//
+//   -O0  nothing
+//   -O1  SROA (mem2reg), early CSE, instcombine, simplifycfg
+//   -O2  -O1 + reassociate, GVN, a second instcombine/simplifycfg
+//   -O3  -O2 + loop rotate/LICM/indvars/deletion/unroll and the loop and SLP
+//        vectorizers
+//
+// The host TargetMachine supplies the cost model, and CodeGen stamps its
+// triple and data layout on the module so the JIT accepts it.
+class FunctionOptimizer
+{
+private:
+    unsigned OptLevel;
+    std::unique_ptr<llvm::TargetMachine> TM;
+
+    llvm::PassInstrumentationCallbacks PIC;
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::FunctionPassManager FPM;
+
+    // -time-passes: exclusive time per pass, with a stack for nesting.
+    PassTimings *Timings;
+    llvm::StringMap<PassTimings::Entry> Local;
+    struct Running
+    {
+        llvm::StringRef Name;
+        int64_t Start;
+        int64_t Children;
+    };
+    std::vector<Running> Stack;
+    uint64_t NumFunctions = 0;
+
+    void registerTimers();
+    void push(llvm::StringRef Name);
+    void pop();
+
+public:
+    // Timings may be null; OptLevel is 0 to 3.
+    FunctionOptimizer(unsigned OptLevel, std::unique_ptr<llvm::TargetMachine> TM, PassTimings *Timings);
+    ~FunctionOptimizer();
+    FunctionOptimizer(const FunctionOptimizer &) = delete;
+    FunctionOptimizer &operator=(const FunctionOptimizer &) = delete;
+
+    // create - An optimizer for the host, or null after printing why not.
+    static std::unique_ptr<FunctionOptimizer> create(unsigned OptLevel, PassTimings *Timings);
+
+    // prepare - Set M's target triple and data layout to the optimizer's.
+    void prepare(llvm::Module &M) const;
+
+    // run - Optimize F, a complete and verified function.
+    void run(llvm::Function &F);
+
+    unsigned getOptLevel() const { return OptLevel; }
+};
+
+#endif // KALEIDOSCOPE_UTILS_OPTIMIZER_H
@@ -0,0 +1,195 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+    // The first line of a profile file; the number changes with the format.
+    const char *const ProfileHeader = "# kaleidoscope profile 1";
+
+    // parseLine - "name calls cycles" into Name and P; false if Line isn't
+    // one.
+    bool parseLine(const char *Line, std::string &Name, FunctionProfile &P)
+    {
+        const char *NameEnd = strchr(Line, ' ');
+        if (!NameEnd || NameEnd == Line)
+        {
+            return false;
+        }
+        char *End;
+        errno = 0;
+        P.Calls = strtoull(NameEnd + 1, &End, 10);
+        if (!isdigit(static_cast<unsigned char>(NameEnd[1])) || *End != ' ' ||
+            !isdigit(static_cast<unsigned char>(End[1])))
+        {
+            return false;
+        }
+        P.Cycles = strtoull(End + 1, &End, 10);
+        if (errno != 0 || (*End != '\n' && *End != '\0'))
+        {
+            return false;
+        }
+        Name.assign(Line, NameEnd);
+        return true;
+    }
+}
+
+ProfileData::ProfileData(std::map<std::string, FunctionProfile, std::less<>> Functions)
+    : Functions(std::move(Functions))
+{
+    std::vector<uint64_t> Calls;
+    uint64_t Total = 0;
+    for (const auto &[Name, P] : this->Functions)
+    {
+        Calls.push_back(P.Calls);
+        Total += P.Calls;
+    }
+    std::sort(Calls.begin(), Calls.end(), [](uint64_t A, uint64_t B)
+              { return A > B; });
+    uint64_t Covered = 0;
+    for (uint64_t N : Calls)
+    {
+        if (N == 0 || Covered >= HotFraction * static_cast<double>(Total))
+        {
+            break;
+        }
+        Covered += N;
+        HotCalls = N;
+    }
+}
+
+std::unique_ptr<ProfileData> ProfileData::read(const std::string &Path)
+{
+    FILE *In = fopen(Path.c_str(), "r");
+    if (!In)
+    {
+        fprintf(stderr, "Error: cannot read '%s': %s\n", Path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    std::map<std::string, FunctionProfile, std::less<>> Functions;
+    char *Line = nullptr;
+    size_t Capacity = 0;
+    unsigned LineNo = 0;
+    bool OK = true;
+    while (OK && getline(&Line, &Capacity, In) >= 0)
+    {
+        ++LineNo;
+        std::string Name;
+        FunctionProfile P;
+        if (LineNo == 1)
+        {
+            OK = strncmp(Line, ProfileHeader, strlen(ProfileHeader)) == 0;
+        }
+        else if ((OK = parseLine(Line, Name, P)))
+        {
+            FunctionProfile &Sum = Functions[Name];
+            Sum.Calls += P.Calls;
+            Sum.Cycles += P.Cycles;
+        }
+    }
+    free(Line);
+    fclose(In);
+    if (!OK || LineNo == 0)
+    {
+        fprintf(stderr, "Error: %s:%u: not a kaleidoscope profile\n", Path.c_str(), LineNo ? LineNo : 1);
+        return nullptr;
+    }
+    return std::make_unique<ProfileData>(std::move(Functions));
+}
+
+bool ProfileData::write(const std::string &Path) const
+{
+    FILE *Out = fopen(Path.c_str(), "w");
+    if (!Out)
+    {
+        fprintf(stderr, "Error: cannot write '%s': %s\n", Path.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(Out, "%s\n", ProfileHeader);
+    for (const auto &[Name, P] : Functions)
+    {
+        fprintf(Out, "%s %llu %llu\n", Name.c_str(), static_cast<unsigned long long>(P.Calls),
+                static_cast<unsigned long long>(P.Cycles));
+    }
+    if (fclose(Out) != 0)
+    {
+        fprintf(stderr, "Error: cannot write '%s': %s\n", Path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+const FunctionProfile *ProfileData::find(std::string_view Name) const
+{
+    auto It = Functions.find(Name);
+    return It == Functions.end() ? nullptr : &It->second;
+}
+
+bool ProfileData::isHot(std::string_view Name) const
+{
+    const FunctionProfile *P = find(Name);
+    return P && P->Calls >= HotCalls;
+}
+
+bool ProfileData::isCold(std::string_view Name) const
+{
+    const FunctionProfile *P = find(Name);
+    return P && P->Calls == 0;
+}
+
+std::vector<std::string> ProfileData::getHotFunctions() const
+{
+    std::vector<std::pair<uint64_t, std::string>> Hot;
+    for (const auto &[Name, P] : Functions)
+    {
+        if (P.Calls >= HotCalls)
+        {
+            Hot.emplace_back(P.Calls, Name);
+        }
+    }
+    std::stable_sort(Hot.begin(), Hot.end(), [](const auto &A, const auto &B)
+                     { return A.first > B.first; });
+    std::vector<std::string> Names;
+    for (auto &[Calls, Name] : Hot)
+    {
+        Names.push_back(std::move(Name));
+    }
+    return Names;
+}
+
+void ProfileData::printReport(FILE *Out, size_t MaxRows) const
+{
+    std::vector<std::pair<const std::string *, const FunctionProfile *>> Rows;
+    uint64_t TotalCycles = 0;
+    for (const auto &[Name, P] : Functions)
+    {
+        Rows.emplace_back(&Name, &P);
+        TotalCycles += P.Cycles;
+    }
+    std::stable_sort(Rows.begin(), Rows.end(), [](const auto &A, const auto &B)
+                     { return A.second->Cycles > B.second->Cycles; });
+
+    fprintf(Out, "===-------------------------------------------------------------===\n");
+    fprintf(Out, "  Hot functions: %zu profiled, %llu cycles\n", Rows.size(),
+            static_cast<unsigned long long>(TotalCycles));
+    fprintf(Out, "===-------------------------------------------------------------===\n");
+    fprintf(Out, "  %-24s %14s %16s %12s %7s\n", "Function", "Calls", "Self cycles", "Cycles/call", "%");
+    for (size_t I = 0; I < Rows.size() && I < MaxRows; ++I)
+    {
+        const FunctionProfile &P = *Rows[I].second;
+        fprintf(Out, "  %-24s %14llu %16llu %12.1f %6.1f%%%s\n", Rows[I].first->c_str(),
+                static_cast<unsigned long long>(P.Calls), static_cast<unsigned long long>(P.Cycles),
+                P.Calls ? static_cast<double>(P.Cycles) / static_cast<double>(P.Calls) : 0.0,
+                TotalCycles ? 100.0 * static_cast<double>(P.Cycles) / static_cast<double>(TotalCycles) : 0.0,
+                P.Calls >= HotCalls ? "  hot" : "");
+    }
+    if (Rows.size() > MaxRows)
+    {
+        fprintf(Out, "  ... and %zu more\n", Rows.size() - MaxRows);
+    }
+}
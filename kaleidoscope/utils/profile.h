@@ -0,0 +1,62 @@
+#ifndef KALEIDOSCOPE_UTILS_PROFILE_H
+#define KALEIDOSCOPE_UTILS_PROFILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// FunctionProfile - What a -profile run counted for one function.
+struct FunctionProfile
+{
+    uint64_t Calls = 0;
+    uint64_t Cycles = 0; // in its own body, not in the profiled functions it called
+};
+
+//===-------------------------------------------------------------===//
+// Profiles
+//===-------------------------------------------------------------===//
+// ProfileData - The calls and cycles of every function of a -profile run
+// (see CodeGen::setProfiling()), by name. A profile is read-only once made,
+// so compile tasks on different threads can consult the same one.
+//
+// The hot functions are the fewest, most called ones that together take
+// HotFraction of all calls; the cold ones are those the run never called.
+// Functions the profile doesn't name are neither.
+class ProfileData
+{
+public:
+    static constexpr double HotFraction = 0.9;
+
+private:
+    std::map<std::string, FunctionProfile, std::less<>> Functions;
+    uint64_t HotCalls = UINT64_MAX; // the fewest calls of a hot function
+
+public:
+    explicit ProfileData(std::map<std::string, FunctionProfile, std::less<>> Functions);
+
+    // read - The profile written to Path by write(); null after reporting
+    // why it can't be read.
+    static std::unique_ptr<ProfileData> read(const std::string &Path);
+
+    // write - Save the profile as text, one "name calls cycles" line per
+    // function. Reports its own error; false if Path can't be written.
+    bool write(const std::string &Path) const;
+
+    const FunctionProfile *find(std::string_view Name) const;
+    bool isHot(std::string_view Name) const;
+    bool isCold(std::string_view Name) const;
+
+    // getHotFunctions - The hot functions, most called first.
+    std::vector<std::string> getHotFunctions() const;
+
+    // printReport - The MaxRows functions with the most cycles, with their
+    // calls, cycles per call and share of all cycles.
+    void printReport(FILE *Out, size_t MaxRows = 20) const;
+};
+
+#endif // KALEIDOSCOPE_UTILS_PROFILE_H
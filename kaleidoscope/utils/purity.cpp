@@ -0,0 +1,336 @@
+#include "purity.h"
+
+#include <algorithm>
+#include <cstdint>
+
+CallGraph buildCallGraph(const ModuleAST &M, const SymbolTable &Symbols)
+{
+    CallGraph G;
+    std::vector<int32_t> NodeOf(Symbols.size(), -1);
+    for (FunctionAST *F : M.Functions)
+    {
+        if (!isTopLevelExpr(F->getProto(), Symbols))
+        {
+            NodeOf[F->getProto()->getName().getID()] = static_cast<int32_t>(G.Nodes.size());
+            G.Nodes.push_back(F);
+        }
+    }
+    G.Callees.resize(G.Nodes.size());
+    G.Impure.resize(G.Nodes.size(), 0);
+    G.SelfCall.resize(G.Nodes.size(), 0);
+
+    std::vector<const ExprAST *> Worklist;
+    for (uint32_t N = 0; N < G.Nodes.size(); ++N)
+    {
+        Worklist.push_back(G.Nodes[N]->getBody());
+        while (!Worklist.empty())
+        {
+            const ExprAST *E = Worklist.back();
+            Worklist.pop_back();
+            switch (E->getKind())
+            {
+            case ExprAST::Number:
+            case ExprAST::Variable:
+                break;
+            case ExprAST::Binary:
+            {
+                auto *B = static_cast<const BinaryExprAST *>(E);
+                if (B->getOp() != '+' && B->getOp() != '-' && B->getOp() != '*' && B->getOp() != '<')
+                {
+                    G.Impure[N] = 1; // a call to binary<op>, defined who knows where
+                }
+                Worklist.push_back(B->getLHS());
+                Worklist.push_back(B->getRHS());
+                break;
+            }
+            case ExprAST::Call:
+            {
+                auto *C = static_cast<const CallExprAST *>(E);
+                int32_t Callee = NodeOf[C->getCallee().getID()];
+                if (Callee >= 0)
+                {
+                    G.Callees[N].push_back(static_cast<uint32_t>(Callee));
+                    G.SelfCall[N] |= static_cast<uint32_t>(Callee) == N;
+                }
+                else if (!isPureExtern(Symbols.getName(C->getCallee())))
+                {
+                    G.Impure[N] = 1;
+                }
+                for (const ExprAST *Arg : C->getArgs())
+                {
+                    Worklist.push_back(Arg);
+                }
+                break;
+            }
+            case ExprAST::If:
+            {
+                auto *If = static_cast<const IfExprAST *>(E);
+                Worklist.push_back(If->getCond());
+                Worklist.push_back(If->getThen());
+                Worklist.push_back(If->getElse());
+                break;
+            }
+            }
+        }
+        std::sort(G.Callees[N].begin(), G.Callees[N].end());
+        G.Callees[N].erase(std::unique(G.Callees[N].begin(), G.Callees[N].end()), G.Callees[N].end());
+    }
+    return G;
+}
+
+// propagateImpurity - A caller of an impure function is impure.
+void propagateImpurity(CallGraph &G)
+{
+    std::vector<std::vector<uint32_t>> Callers(G.Nodes.size());
+    for (uint32_t N = 0; N < G.Nodes.size(); ++N)
+    {
+        for (uint32_t C : G.Callees[N])
+        {
+            Callers[C].push_back(N);
+        }
+    }
+    std::vector<uint32_t> Worklist;
+    for (uint32_t N = 0; N < G.Nodes.size(); ++N)
+    {
+        if (G.Impure[N])
+        {
+            Worklist.push_back(N);
+        }
+    }
+    while (!Worklist.empty())
+    {
+        uint32_t N = Worklist.back();
+        Worklist.pop_back();
+        for (uint32_t Caller : Callers[N])
+        {
+            if (!G.Impure[Caller])
+            {
+                G.Impure[Caller] = 1;
+                Worklist.push_back(Caller);
+            }
+        }
+    }
+}
+
+// findRecursive - Tarjan's SCC algorithm with an explicit stack; a node
+// is recursive if its component has more than one node or it calls
+// itself. Components are completed callees first.
+std::vector<char> findRecursive(const CallGraph &G, std::vector<uint32_t> *BottomUp,
+                                std::vector<uint32_t> *Components)
+{
+    const uint32_t Unvisited = UINT32_MAX;
+    size_t N = G.Nodes.size();
+    std::vector<uint32_t> Index(N, Unvisited), Low(N, 0);
+    std::vector<char> OnStack(N, 0), Recursive(N, 0);
+    std::vector<uint32_t> Stack;
+    struct Visit
+    {
+        uint32_t Node;
+        uint32_t NextEdge;
+    };
+    std::vector<Visit> Calls;
+    uint32_t NextIndex = 0, NextComponent = 0;
+    if (Components)
+    {
+        Components->assign(N, 0);
+    }
+
+    for (uint32_t Root = 0; Root < N; ++Root)
+    {
+        if (Index[Root] != Unvisited)
+        {
+            continue;
+        }
+        Calls.push_back({Root, 0});
+        Index[Root] = Low[Root] = NextIndex++;
+        Stack.push_back(Root);
+        OnStack[Root] = 1;
+        while (!Calls.empty())
+        {
+            Visit &V = Calls.back();
+            if (V.NextEdge < G.Callees[V.Node].size())
+            {
+                uint32_t W = G.Callees[V.Node][V.NextEdge++];
+                if (Index[W] == Unvisited)
+                {
+                    Index[W] = Low[W] = NextIndex++;
+                    Stack.push_back(W);
+                    OnStack[W] = 1;
+                    Calls.push_back({W, 0});
+                }
+                else if (OnStack[W])
+                {
+                    Low[V.Node] = std::min(Low[V.Node], Index[W]);
+                }
+                continue;
+            }
+
+            uint32_t Node = V.Node;
+            Calls.pop_back();
+            if (!Calls.empty())
+            {
+                Low[Calls.back().Node] = std::min(Low[Calls.back().Node], Low[Node]);
+            }
+            if (Low[Node] == Index[Node])
+            {
+                size_t Begin = Stack.size();
+                do
+                {
+                    --Begin;
+                } while (Stack[Begin] != Node);
+                bool Cycle = Stack.size() - Begin > 1 || G.SelfCall[Node];
+                for (size_t I = Begin; I < Stack.size(); ++I)
+                {
+                    OnStack[Stack[I]] = 0;
+                    Recursive[Stack[I]] = Cycle;
+                    if (BottomUp)
+                    {
+                        BottomUp->push_back(Stack[I]);
+                    }
+                    if (Components)
+                    {
+                        (*Components)[Stack[I]] = NextComponent;
+                    }
+                }
+                ++NextComponent;
+                Stack.resize(Begin);
+            }
+        }
+    }
+    return Recursive;
+}
+
+bool isPureExtern(std::string_view Name)
+{
+    static const char *const Pure[] = {
+        "acos", "asin", "atan", "atan2", "cbrt", "ceil", "cos", "cosh", "exp", "exp2", "fabs", "floor",
+        "fmax", "fmin", "fmod", "hypot", "log", "log10", "log2", "pow", "round", "sin", "sinh", "sqrt",
+        "tan", "tanh", "trunc",
+    };
+    for (const char *P : Pure)
+    {
+        if (Name == P)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<Symbol> findMemoCandidates(const ModuleAST &M, const SymbolTable &Symbols)
+{
+    CallGraph G = buildCallGraph(M, Symbols);
+    propagateImpurity(G);
+    std::vector<uint32_t> Components;
+    std::vector<char> Recursive = findRecursive(G, nullptr, &Components);
+
+    std::vector<int32_t> NodeOf(Symbols.size(), -1);
+    for (uint32_t N = 0; N < G.Nodes.size(); ++N)
+    {
+        NodeOf[G.Nodes[N]->getProto()->getName().getID()] = static_cast<int32_t>(N);
+    }
+
+    std::vector<Symbol> Candidates;
+    std::vector<const ExprAST *> Worklist;
+    for (uint32_t N = 0; N < G.Nodes.size(); ++N)
+    {
+        if (G.Impure[N] || !Recursive[N])
+        {
+            continue;
+        }
+        // Count the call sites that lead back into N's own cycle, up to two.
+        unsigned Recursions = 0;
+        Worklist.assign(1, G.Nodes[N]->getBody());
+        while (!Worklist.empty() && Recursions < 2)
+        {
+            const ExprAST *E = Worklist.back();
+            Worklist.pop_back();
+            switch (E->getKind())
+            {
+            case ExprAST::Number:
+            case ExprAST::Variable:
+                break;
+            case ExprAST::Binary:
+            {
+                auto *B = static_cast<const BinaryExprAST *>(E);
+                Worklist.push_back(B->getLHS());
+                Worklist.push_back(B->getRHS());
+                break;
+            }
+            case ExprAST::Call:
+            {
+                auto *C = static_cast<const CallExprAST *>(E);
+                int32_t Callee = NodeOf[C->getCallee().getID()];
+                if (Callee >= 0 && Components[static_cast<uint32_t>(Callee)] == Components[N])
+                {
+                    ++Recursions;
+                }
+                for (const ExprAST *Arg : C->getArgs())
+                {
+                    Worklist.push_back(Arg);
+                }
+                break;
+            }
+            case ExprAST::If:
+            {
+                auto *If = static_cast<const IfExprAST *>(E);
+                Worklist.push_back(If->getCond());
+                Worklist.push_back(If->getThen());
+                Worklist.push_back(If->getElse());
+                break;
+            }
+            }
+        }
+        if (Recursions > 1)
+        {
+            Candidates.push_back(G.Nodes[N]->getProto()->getName());
+        }
+    }
+    return Candidates;
+}
+
+std::vector<Symbol> collectCallees(const ExprAST *Body)
+{
+    std::vector<Symbol> Callees;
+    std::vector<const ExprAST *> Worklist{Body};
+    while (!Worklist.empty())
+    {
+        const ExprAST *E = Worklist.back();
+        Worklist.pop_back();
+        switch (E->getKind())
+        {
+        case ExprAST::Number:
+        case ExprAST::Variable:
+            break;
+        case ExprAST::Binary:
+        {
+            auto *B = static_cast<const BinaryExprAST *>(E);
+            Worklist.push_back(B->getLHS());
+            Worklist.push_back(B->getRHS());
+            break;
+        }
+        case ExprAST::Call:
+        {
+            auto *C = static_cast<const CallExprAST *>(E);
+            Callees.push_back(C->getCallee());
+            for (const ExprAST *Arg : C->getArgs())
+            {
+                Worklist.push_back(Arg);
+            }
+            break;
+        }
+        case ExprAST::If:
+        {
+            auto *If = static_cast<const IfExprAST *>(E);
+            Worklist.push_back(If->getCond());
+            Worklist.push_back(If->getThen());
+            Worklist.push_back(If->getElse());
+            break;
+        }
+        }
+    }
+    std::sort(Callees.begin(), Callees.end(),
+              [](Symbol A, Symbol B) { return A.getID() < B.getID(); });
+    Callees.erase(std::unique(Callees.begin(), Callees.end()), Callees.end());
+    return Callees;
+}
@@ -0,0 +1,54 @@
+#ifndef KALEIDOSCOPE_UTILS_PURITY_H
+#define KALEIDOSCOPE_UTILS_PURITY_H
+
+#include "ast.h"
+#include "symboltable.h"
+
+#include <vector>
+
+// isPureExtern - Whether calling the runtime or libm function Name has no
+// effect besides its result (sin, sqrt, ...). putchard and printd do not
+// qualify, nor does anything unknown.
+bool isPureExtern(std::string_view Name);
+
+// CallGraph - The functions a module defines, numbered in source order,
+// with the defined functions each one calls (sorted, once each). Impure is
+// set for a function that calls an impure extern, a function of another
+// module or a user-defined operator, SelfCall for one that calls itself.
+struct CallGraph
+{
+    std::vector<FunctionAST *> Nodes;
+    std::vector<std::vector<uint32_t>> Callees;
+    std::vector<char> Impure;
+    std::vector<char> SelfCall;
+};
+
+// buildCallGraph - The call graph of M; top-level expressions are left out.
+CallGraph buildCallGraph(const ModuleAST &M, const SymbolTable &Symbols);
+
+// propagateImpurity - Mark every caller of an impure function impure.
+void propagateImpurity(CallGraph &G);
+
+// findRecursive - Which nodes of G can reach themselves. With BottomUp,
+// also every node in an order where a function comes after all the
+// functions it calls outside its own recursive cycle; with Components, the
+// number of each node's strongly connected component.
+std::vector<char> findRecursive(const CallGraph &G, std::vector<uint32_t> *BottomUp = nullptr,
+                                std::vector<uint32_t> *Components = nullptr);
+
+// collectCallees - The functions named by the calls in Body, each once, in
+// symbol order.
+std::vector<Symbol> collectCallees(const ExprAST *Body);
+
+// findMemoCandidates - The functions of M worth a result cache: those that
+// are pure and call back into their own recursive cycle from more than one
+// place. A function is pure when everything it calls is a pure function
+// defined in M or a pure extern (isPureExtern); calls into other modules
+// count as impure, since their bodies aren't visible here. A function that
+// recurses from a single call site (a loop written as tail recursion,
+// n + sum(n - 1), even/odd) passes each argument tuple once per evaluation,
+// so a cache would never hit and only cost a probe and a native frame per
+// level. Returns the functions' names in source order.
+std::vector<Symbol> findMemoCandidates(const ModuleAST &M, const SymbolTable &Symbols);
+
+#endif // KALEIDOSCOPE_UTILS_PURITY_H
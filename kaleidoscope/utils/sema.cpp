@@ -0,0 +1,274 @@
+#include "sema.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <unordered_map>
+
+namespace
+{
+    // reportError - Print one diagnostic with a single stdio call, so messages
+    // from modules checked on different threads do not interleave.
+    void reportError(const std::string &FileName, const char *Fmt, ...)
+    {
+        char Msg[512];
+        va_list Args;
+        va_start(Args, Fmt);
+        vsnprintf(Msg, sizeof(Msg), Fmt, Args);
+        va_end(Args);
+        fprintf(stderr, "Error: %s: %s\n", FileName.c_str(), Msg);
+    }
+
+    // ModuleChecker - Per-symbol facts are kept in vectors indexed by Symbol ID,
+    // so every lookup in the walk is an array access.
+    class ModuleChecker
+    {
+    private:
+        const ModuleAST &M;
+        const SymbolTable &Symbols;
+        ModuleInterface &Interface;
+        unsigned NumErrors = 0;
+
+        static constexpr int Unknown = -1;
+        std::vector<int> KnownArity;  // arity of functions defined or declared here
+        std::vector<int> ImportArity; // arity of calls to functions from elsewhere
+
+        // ParamMark[S] == CurMark iff S is a parameter of the current function.
+        std::vector<uint32_t> ParamMark;
+        uint32_t CurMark = 0;
+        const PrototypeAST *CurProto = nullptr;
+
+        std::vector<const ExprAST *> Worklist;
+
+        std::string name(Symbol S) const { return std::string(Symbols.getName(S)); }
+
+        std::string where() const
+        {
+            if (isTopLevelExpr(CurProto, Symbols))
+            {
+                return "in top-level expression";
+            }
+            return "in function '" + name(CurProto->getName()) + "'";
+        }
+
+        void declare(const PrototypeAST *P, bool IsDefinition, std::vector<char> &Defined)
+        {
+            uint32_t ID = P->getName().getID();
+            int Arity = static_cast<int>(P->getArgs().size());
+            if (IsDefinition && Defined[ID])
+            {
+                reportError(Interface.FileName, "redefinition of function '%s'", name(P->getName()).c_str());
+                ++NumErrors;
+                return;
+            }
+            if (KnownArity[ID] != Unknown && KnownArity[ID] != Arity)
+            {
+                reportError(Interface.FileName, "'%s' declared with %d parameters, previously %d",
+                            name(P->getName()).c_str(), Arity, KnownArity[ID]);
+                ++NumErrors;
+                return;
+            }
+            KnownArity[ID] = Arity;
+            if (IsDefinition)
+            {
+                Defined[ID] = 1;
+            }
+        }
+
+        // checkExpr - Walk E with an explicit stack: a long operator chain is
+        // one deep spine of BinaryExprASTs, which would overflow the native stack.
+        void checkExpr(const ExprAST *Root)
+        {
+            Worklist.clear();
+            Worklist.push_back(Root);
+            while (!Worklist.empty())
+            {
+                const ExprAST *E = Worklist.back();
+                Worklist.pop_back();
+                switch (E->getKind())
+                {
+                case ExprAST::Number:
+                    break;
+                case ExprAST::Variable:
+                {
+                    Symbol S = static_cast<const VariableExprAST *>(E)->get_val();
+                    if (ParamMark[S.getID()] != CurMark)
+                    {
+                        reportError(Interface.FileName, "%s: unknown variable name '%s'", where().c_str(),
+                                    name(S).c_str());
+                        ++NumErrors;
+                    }
+                    break;
+                }
+                case ExprAST::Binary:
+                {
+                    // Push the right-hand side first so the left is checked first.
+                    auto *B = static_cast<const BinaryExprAST *>(E);
+                    Worklist.push_back(B->getRHS());
+                    Worklist.push_back(B->getLHS());
+                    break;
+                }
+                case ExprAST::Call:
+                {
+                    auto *C = static_cast<const CallExprAST *>(E);
+                    checkCall(C->getCallee(), static_cast<int>(C->getArgs().size()));
+                    for (uint32_t I = C->getArgs().size(); I-- > 0;)
+                    {
+                        Worklist.push_back(C->getArgs()[I]);
+                    }
+                    break;
+                }
+                case ExprAST::If:
+                {
+                    auto *If = static_cast<const IfExprAST *>(E);
+                    Worklist.push_back(If->getElse());
+                    Worklist.push_back(If->getThen());
+                    Worklist.push_back(If->getCond());
+                    break;
+                }
+                }
+            }
+        }
+
+        void checkCall(Symbol Callee, int NumArgs)
+        {
+            uint32_t ID = Callee.getID();
+            if (KnownArity[ID] != Unknown)
+            {
+                if (KnownArity[ID] != NumArgs)
+                {
+                    reportError(Interface.FileName, "%s: '%s' called with %d arguments, expects %d",
+                                where().c_str(), name(Callee).c_str(), NumArgs, KnownArity[ID]);
+                    ++NumErrors;
+                }
+                return;
+            }
+            // Defined in another module, or nowhere; the link step decides.
+            if (ImportArity[ID] == Unknown)
+            {
+                ImportArity[ID] = NumArgs;
+                Interface.Imports.push_back({name(Callee), static_cast<unsigned>(NumArgs)});
+            }
+            else if (ImportArity[ID] != NumArgs)
+            {
+                reportError(Interface.FileName, "%s: '%s' called with %d arguments, elsewhere with %d",
+                            where().c_str(), name(Callee).c_str(), NumArgs, ImportArity[ID]);
+                ++NumErrors;
+            }
+        }
+
+    public:
+        ModuleChecker(const ModuleAST &M, const SymbolTable &Symbols, ModuleInterface &Interface)
+            : M(M), Symbols(Symbols), Interface(Interface), KnownArity(Symbols.size(), Unknown),
+              ImportArity(Symbols.size(), Unknown), ParamMark(Symbols.size(), 0)
+        {
+        }
+
+        unsigned run()
+        {
+            // Collect every signature first so calls may precede definitions.
+            std::vector<char> Defined(Symbols.size(), 0);
+            for (const PrototypeAST *P : M.Externs)
+            {
+                declare(P, false, Defined);
+                Interface.Externs.push_back({name(P->getName()), static_cast<unsigned>(P->getArgs().size())});
+            }
+            for (const FunctionAST *F : M.Functions)
+            {
+                const PrototypeAST *P = F->getProto();
+                if (isTopLevelExpr(P, Symbols))
+                {
+                    continue;
+                }
+                declare(P, true, Defined);
+                Interface.Definitions.push_back({name(P->getName()), static_cast<unsigned>(P->getArgs().size())});
+            }
+
+            for (const FunctionAST *F : M.Functions)
+            {
+                CurProto = F->getProto();
+                ++CurMark;
+                for (Symbol Param : CurProto->getArgs())
+                {
+                    if (ParamMark[Param.getID()] == CurMark)
+                    {
+                        reportError(Interface.FileName, "%s: duplicate parameter '%s'", where().c_str(),
+                                    name(Param).c_str());
+                        ++NumErrors;
+                    }
+                    ParamMark[Param.getID()] = CurMark;
+                }
+                checkExpr(F->getBody());
+            }
+            return NumErrors;
+        }
+    };
+}
+
+unsigned checkModule(const ModuleAST &M, const SymbolTable &Symbols, ModuleInterface &Interface)
+{
+    return ModuleChecker(M, Symbols, Interface).run();
+}
+
+unsigned linkModules(const std::vector<const ModuleInterface *> &Modules)
+{
+    struct Definition
+    {
+        unsigned Arity;
+        const ModuleInterface *Module;
+    };
+    std::unordered_map<std::string, Definition> Defs;
+    unsigned NumErrors = 0;
+
+    size_t NumDefs = 0;
+    for (const ModuleInterface *MI : Modules)
+    {
+        NumDefs += MI->Definitions.size();
+    }
+    Defs.reserve(NumDefs);
+
+    for (const ModuleInterface *MI : Modules)
+    {
+        for (const FunctionSignature &Sig : MI->Definitions)
+        {
+            auto Ins = Defs.emplace(Sig.Name, Definition{Sig.Arity, MI});
+            if (!Ins.second)
+            {
+                reportError(MI->FileName, "function '%s' is also defined in %s", Sig.Name.c_str(),
+                            Ins.first->second.Module->FileName.c_str());
+                ++NumErrors;
+            }
+        }
+    }
+
+    for (const ModuleInterface *MI : Modules)
+    {
+        for (const FunctionSignature &Sig : MI->Externs)
+        {
+            auto It = Defs.find(Sig.Name);
+            if (It != Defs.end() && It->second.Arity != Sig.Arity)
+            {
+                reportError(MI->FileName, "extern '%s' has %u parameters, but %s defines it with %u",
+                            Sig.Name.c_str(), Sig.Arity, It->second.Module->FileName.c_str(),
+                            It->second.Arity);
+                ++NumErrors;
+            }
+        }
+        for (const FunctionSignature &Sig : MI->Imports)
+        {
+            auto It = Defs.find(Sig.Name);
+            if (It == Defs.end())
+            {
+                reportError(MI->FileName, "call to undefined function '%s'", Sig.Name.c_str());
+                ++NumErrors;
+            }
+            else if (It->second.Arity != Sig.Arity)
+            {
+                reportError(MI->FileName, "'%s' called with %u arguments, but %s defines it with %u",
+                            Sig.Name.c_str(), Sig.Arity, It->second.Module->FileName.c_str(),
+                            It->second.Arity);
+                ++NumErrors;
+            }
+        }
+    }
+    return NumErrors;
+}
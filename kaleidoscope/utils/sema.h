@@ -0,0 +1,41 @@
+#ifndef KALEIDOSCOPE_UTILS_SEMA_H
+#define KALEIDOSCOPE_UTILS_SEMA_H
+
+#include "ast.h"
+#include "symboltable.h"
+
+#include <string>
+#include <vector>
+
+// FunctionSignature - A function name and arity. Names are spelled out because
+// every module has its own SymbolTable.
+struct FunctionSignature
+{
+    std::string Name;
+    unsigned Arity = 0;
+};
+
+// ModuleInterface - What one module defines, declares with extern, and calls
+// without defining or declaring it. The link step checks these across modules.
+struct ModuleInterface
+{
+    std::string FileName;
+    std::vector<FunctionSignature> Definitions;
+    std::vector<FunctionSignature> Externs;
+    std::vector<FunctionSignature> Imports;
+};
+
+// checkModule - Semantic checks that need only one module: every variable is a
+// parameter of its function, parameters are unique, a function is defined
+// once, and calls to functions known in the module pass the right number of
+// arguments. Errors are printed to stderr; returns how many were found and
+// fills in Interface for linkModules().
+unsigned checkModule(const ModuleAST &M, const SymbolTable &Symbols, ModuleInterface &Interface);
+
+// linkModules - Cross-module checks: no function is defined by two modules,
+// every import is defined somewhere, and externs and imports agree with the
+// definition's arity. Externs with no definition are left to the runtime.
+// Returns the number of errors printed.
+unsigned linkModules(const std::vector<const ModuleInterface *> &Modules);
+
+#endif // KALEIDOSCOPE_UTILS_SEMA_H
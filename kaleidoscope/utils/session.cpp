@@ -0,0 +1,371 @@
+#include "session.h"
+
+#include "codegen.h"
+#include "fold.h"
+#include "frontend.h"
+#include "optimizer.h"
+#include "purity.h"
+#include "sema.h"
+#include "sourcebuffer.h"
+
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/IR/Module.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+    // undefinedFunction - Where a stub points until its function has a body:
+    // a call into a piece that failed to compile halfway. The stub is called
+    // with the function's arguments, which this ignores.
+    double undefinedFunction()
+    {
+        fprintf(stderr, "Error: called a function whose definition failed to compile\n");
+        return 0;
+    }
+
+    bool report(llvm::Error Err)
+    {
+        if (!Err)
+        {
+            return true;
+        }
+        fprintf(stderr, "Error: %s\n", llvm::toString(std::move(Err)).c_str());
+        return false;
+    }
+}
+
+Session::Session(std::unique_ptr<KaleidoscopeJIT> JIT, std::unique_ptr<llvm::orc::IndirectStubsManager> StubsMgr,
+                 std::unique_ptr<FunctionOptimizer> Optimizer, bool Fold, CodeGen::TailCallMode TailCalls)
+    : JIT(std::move(JIT)), StubsMgr(std::move(StubsMgr)), Optimizer(std::move(Optimizer)), Fold(Fold),
+      TailCalls(TailCalls)
+{
+}
+
+// Resource trackers must go before the JIT they belong to. They are removed
+// rather than just released: a released tracker hands its resources to the
+// JITDylib's default one, which LLVM 14's RTDyldObjectLinkingLayer can get
+// wrong once it holds many memory managers.
+Session::~Session()
+{
+    for (Definition &D : Defs)
+    {
+        if (D.Code)
+        {
+            report(D.Code->remove());
+        }
+        if (D.Stub)
+        {
+            report(D.Stub->remove());
+        }
+    }
+    Defs.clear();
+    JIT.reset();
+}
+
+std::unique_ptr<Session> Session::create(unsigned OptLevel, bool Fold, CodeGen::TailCallMode TailCalls)
+{
+    auto JIT = KaleidoscopeJIT::create(KaleidoscopeJIT::Eager);
+    if (!JIT)
+    {
+        report(JIT.takeError());
+        return nullptr;
+    }
+    auto Builder = llvm::orc::createLocalIndirectStubsManagerBuilder((*JIT)->getLLJIT().getTargetTriple());
+    if (!Builder)
+    {
+        fprintf(stderr, "Error: sessions need indirect stubs, which this target lacks\n");
+        return nullptr;
+    }
+    std::unique_ptr<FunctionOptimizer> Optimizer;
+    if (OptLevel > 0)
+    {
+        Optimizer = FunctionOptimizer::create(OptLevel, nullptr);
+        if (!Optimizer)
+        {
+            return nullptr;
+        }
+    }
+    return std::unique_ptr<Session>(new Session(std::move(*JIT), Builder(), std::move(Optimizer), Fold, TailCalls));
+}
+
+Session::Definition &Session::def(Symbol S)
+{
+    return Defs[S.getID()];
+}
+
+bool Session::isDeclared(Symbol S) const
+{
+    return S.getID() < Defs.size() && Defs[S.getID()].Kind != Definition::None;
+}
+
+unsigned Session::getNumFunctions() const
+{
+    return static_cast<unsigned>(
+        std::count_if(Defs.begin(), Defs.end(), [](const Definition &D) { return D.Kind == Definition::Function; }));
+}
+
+// checkPiece - What checkModule() can't know: calls out of the piece must
+// match what the session has, externs stay externs, and no function may
+// change its arity under callers outside the piece.
+bool Session::checkPiece(const ModuleAST &M, const std::string &FileName)
+{
+    ModuleInterface Interface;
+    Interface.FileName = FileName;
+    if (checkModule(M, Symbols, Interface))
+    {
+        return false;
+    }
+
+    unsigned NumErrors = 0;
+    for (const FunctionSignature &Import : Interface.Imports)
+    {
+        const Definition &D = def(Symbols.lookup(Import.Name));
+        if (D.Kind == Definition::None)
+        {
+            fprintf(stderr, "Error: %s: unknown function '%s'\n", FileName.c_str(), Import.Name.c_str());
+            ++NumErrors;
+        }
+        else if (D.Arity != Import.Arity)
+        {
+            fprintf(stderr, "Error: %s: '%s' is called with %u arguments but takes %u\n", FileName.c_str(),
+                    Import.Name.c_str(), Import.Arity, D.Arity);
+            ++NumErrors;
+        }
+    }
+
+    std::vector<char> Redefined(Symbols.size(), 0);
+    for (const FunctionSignature &Def : Interface.Definitions)
+    {
+        Redefined[Symbols.lookup(Def.Name).getID()] = 1;
+    }
+    auto checkChange = [&](const FunctionSignature &Sig, Definition::KindTy Kind)
+    {
+        const Definition &D = def(Symbols.lookup(Sig.Name));
+        if (D.Kind == Definition::None || (D.Kind == Kind && D.Arity == Sig.Arity))
+        {
+            return;
+        }
+        if (D.Kind == Definition::Extern && Kind == Definition::Function)
+        {
+            // Once resolved, the extern's address is in the JITDylib for good.
+            fprintf(stderr, "Error: %s: cannot define '%s', which is an extern\n", FileName.c_str(), Sig.Name.c_str());
+            ++NumErrors;
+            return;
+        }
+        if (D.Kind == Definition::Function && Kind == Definition::Extern)
+        {
+            if (D.Arity != Sig.Arity)
+            {
+                fprintf(stderr, "Error: %s: extern '%s' takes %u arguments but the function takes %u\n",
+                        FileName.c_str(), Sig.Name.c_str(), Sig.Arity, D.Arity);
+                ++NumErrors;
+            }
+            return;
+        }
+        for (Symbol Caller : D.Callers)
+        {
+            if (!Redefined[Caller.getID()])
+            {
+                fprintf(stderr, "Error: %s: cannot change '%s' to %u parameters while '%s' calls it\n",
+                        FileName.c_str(), Sig.Name.c_str(), Sig.Arity, name(Caller).c_str());
+                ++NumErrors;
+                return;
+            }
+        }
+    };
+    for (const FunctionSignature &Extern : Interface.Externs)
+    {
+        checkChange(Extern, Definition::Extern);
+    }
+    for (const FunctionSignature &Def : Interface.Definitions)
+    {
+        checkChange(Def, Definition::Function);
+    }
+    return NumErrors == 0;
+}
+
+// createStub - Give S a stub and the symbol "S" for it. The stub points
+// nowhere useful until install() compiles a body.
+bool Session::createStub(Symbol S)
+{
+    Definition &D = def(S);
+    if (D.Stub)
+    {
+        return true;
+    }
+    D.StubName = name(S);
+    if (!report(StubsMgr->createStub(D.StubName, llvm::pointerToJITTargetAddress(&undefinedFunction),
+                                     llvm::JITSymbolFlags::Exported)))
+    {
+        return false;
+    }
+    llvm::JITEvaluatedSymbol Stub = StubsMgr->findStub(D.StubName, /*ExportedStubsOnly=*/false);
+    llvm::orc::LLJIT &J = JIT->getLLJIT();
+    llvm::orc::SymbolMap Symbols;
+    Symbols[J.mangleAndIntern(D.StubName)] =
+        llvm::JITEvaluatedSymbol(Stub.getAddress(), llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+    llvm::orc::ResourceTrackerSP RT = J.getMainJITDylib().createResourceTracker();
+    if (!report(J.getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(Symbols)), RT)))
+    {
+        return false;
+    }
+    D.Stub = std::move(RT);
+    return true;
+}
+
+// install - Compile F as "f.<version>", point f's stub at it and free the
+// body it replaces.
+bool Session::install(const FunctionAST *F)
+{
+    Symbol S = F->getProto()->getName();
+    Definition &D = def(S);
+    std::string ImplName = name(S) + "." + std::to_string(D.Version);
+
+    CodeGen CG(Symbols, ImplName);
+    CG.setOptimizer(Optimizer.get());
+    CG.setTailCalls(TailCalls);
+    llvm::Function *Fn = CG.codegen(F);
+    if (!Fn)
+    {
+        return false;
+    }
+    // Self-calls refer to Fn itself, so they become direct calls.
+    Fn->setName(ImplName);
+
+    llvm::orc::LLJIT &J = JIT->getLLJIT();
+    llvm::orc::ResourceTrackerSP RT = J.getMainJITDylib().createResourceTracker();
+    if (!report(JIT->addModule(CG.takeModule(), RT)))
+    {
+        return false;
+    }
+    auto Sym = J.lookup(ImplName);
+    if (!Sym)
+    {
+        report(Sym.takeError());
+        report(RT->remove());
+        return false;
+    }
+    if (!report(StubsMgr->updatePointer(D.StubName, Sym->getAddress())))
+    {
+        report(RT->remove());
+        return false;
+    }
+    if (D.Code)
+    {
+        report(D.Code->remove());
+    }
+    D.Code = std::move(RT);
+    D.Kind = Definition::Function;
+    D.Arity = F->getProto()->getArgs().size();
+    ++D.Version;
+
+    for (Symbol Callee : D.Callees)
+    {
+        std::vector<Symbol> &Callers = def(Callee).Callers;
+        Callers.erase(std::find(Callers.begin(), Callers.end(), S));
+    }
+    D.Callees = collectCallees(F->getBody());
+    for (Symbol Callee : D.Callees)
+    {
+        def(Callee).Callers.push_back(S);
+    }
+    return true;
+}
+
+bool Session::evaluate(const FunctionAST *F, double &Result)
+{
+    std::string Name = "__anon_expr." + std::to_string(NumExprs++);
+    CodeGen CG(Symbols, Name);
+    CG.setOptimizer(Optimizer.get());
+    CG.setTailCalls(TailCalls);
+    llvm::Function *Fn = CG.codegen(F);
+    if (!Fn)
+    {
+        return false;
+    }
+    Fn->setName(Name);
+    Fn->setLinkage(llvm::Function::ExternalLinkage);
+
+    llvm::orc::ResourceTrackerSP RT = JIT->getLLJIT().getMainJITDylib().createResourceTracker();
+    if (!report(JIT->addModule(CG.takeModule(), RT)))
+    {
+        return false;
+    }
+    auto Expr = JIT->lookupExpr(Name);
+    if (!Expr)
+    {
+        report(Expr.takeError());
+        report(RT->remove());
+        return false;
+    }
+    Result = (*Expr)();
+    return report(RT->remove());
+}
+
+unsigned Session::add(std::string_view Source, std::vector<double> &Results, std::string Name)
+{
+    ++NumPieces;
+    std::string FileName = Name.empty() ? "<input " + std::to_string(NumPieces) + ">" : std::move(Name);
+    auto Buffer = SourceBuffer::getMemBuffer(std::string(Source), FileName);
+    Lexer Lex(*Buffer, Symbols);
+    Parser P(Lex);
+    ModuleAST M = P.parseModule(Ctx);
+    if (P.getNumErrors())
+    {
+        return P.getNumErrors();
+    }
+    return addModule(M, Ctx, Results, FileName);
+}
+
+unsigned Session::addModule(ModuleAST &M, ASTContext &Ctx, std::vector<double> &Results, const std::string &FileName)
+{
+    Defs.resize(Symbols.size());
+    if (!checkPiece(M, FileName))
+    {
+        return 1;
+    }
+    if (Fold)
+    {
+        foldModule(M, Ctx);
+    }
+
+    // Every name the piece defines gets its stub first, so definitions may
+    // call ones further down (or each other) before those are compiled.
+    unsigned NumErrors = 0;
+    for (const FunctionAST *F : M.Functions)
+    {
+        if (!isTopLevelExpr(F->getProto(), Symbols) && !createStub(F->getProto()->getName()))
+        {
+            return 1;
+        }
+    }
+    for (const PrototypeAST *E : M.Externs)
+    {
+        Definition &D = def(E->getName());
+        if (D.Kind != Definition::Function)
+        {
+            D.Kind = Definition::Extern;
+            D.Arity = E->getArgs().size();
+        }
+    }
+    for (const FunctionAST *F : M.Functions)
+    {
+        if (!isTopLevelExpr(F->getProto(), Symbols))
+        {
+            NumErrors += !install(F);
+            continue;
+        }
+        double Result;
+        if (evaluate(F, Result))
+        {
+            Results.push_back(Result);
+        }
+        else
+        {
+            ++NumErrors;
+        }
+    }
+    return NumErrors;
+}
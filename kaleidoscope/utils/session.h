@@ -0,0 +1,112 @@
+#ifndef KALEIDOSCOPE_UTILS_SESSION_H
+#define KALEIDOSCOPE_UTILS_SESSION_H
+
+#include "ast.h"
+#include "codegen.h"
+#include "jit.h"
+#include "symboltable.h"
+
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class FunctionOptimizer;
+
+//===-------------------------------------------------------------===//
+// Interactive sessions
+//===-------------------------------------------------------------===//
+// Session - A long-lived JIT that takes source a piece at a time and lets
+// functions be redefined, as in a REPL or a service.
+//
+// Every function is called through an indirect stub: the symbol "f" that
+// callers link against is the address of a stub that jumps through a
+// pointer. Redefining f compiles the new body as "f.<n>" in a module of its
+// own, points the stub at it and frees the old body's code through its ORC
+// ResourceTracker. Callers never inline a callee (each function is
+// optimized on its own), so their machine code stays valid and is reused
+// as it is; a redefinition costs the one function, not the session.
+//
+// The session keeps the caller -> callee graph of its definitions. A
+// redefinition or extern that changes a name's arity would leave existing
+// callers passing the wrong arguments, so it is rejected while the name has
+// callers outside the piece. Externs are resolved against the process once
+// and for all; a name declared extern can't be defined later.
+class Session
+{
+private:
+    // Definition - What the session knows about one name.
+    struct Definition
+    {
+        enum KindTy
+        {
+            None,     // only called so far, within the piece being added
+            Extern,   // resolved against the runtime or the process
+            Function, // defined in the session
+        };
+        KindTy Kind = None;
+        unsigned Arity = 0;
+        unsigned Version = 0;               // number of bodies compiled so far
+        std::string StubName;               // Function: the stub's name in StubsMgr
+        llvm::orc::ResourceTrackerSP Stub;  // Function: owns the symbol "f"
+        llvm::orc::ResourceTrackerSP Code;  // Function: owns the current body
+        std::vector<Symbol> Callees;        // Function: unique, in no order
+        std::vector<Symbol> Callers;        // definitions whose bodies call it
+    };
+
+    std::unique_ptr<KaleidoscopeJIT> JIT;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> StubsMgr;
+    std::unique_ptr<FunctionOptimizer> Optimizer;
+    bool Fold;
+    CodeGen::TailCallMode TailCalls;
+    SymbolTable Symbols;
+    // All ASTs of the session; a redefinition leaves the old body behind, so
+    // memory grows with the input, not with the number of live functions.
+    ASTContext Ctx;
+    std::vector<Definition> Defs; // indexed by Symbol ID
+    unsigned NumPieces = 0, NumExprs = 0;
+
+    Session(std::unique_ptr<KaleidoscopeJIT> JIT, std::unique_ptr<llvm::orc::IndirectStubsManager> StubsMgr,
+            std::unique_ptr<FunctionOptimizer> Optimizer, bool Fold, CodeGen::TailCallMode TailCalls);
+
+    Definition &def(Symbol S);
+    std::string name(Symbol S) const { return std::string(Symbols.getName(S)); }
+    bool checkPiece(const ModuleAST &M, const std::string &FileName);
+    bool createStub(Symbol S);
+    bool install(const FunctionAST *F);
+    bool evaluate(const FunctionAST *F, double &Result);
+
+public:
+    // create - A session compiling at OptLevel, folding ASTs first if Fold.
+    // Reports its own error and returns null if the JIT can't be set up.
+    static std::unique_ptr<Session> create(unsigned OptLevel, bool Fold,
+                                           CodeGen::TailCallMode TailCalls = CodeGen::TailCalls);
+    ~Session();
+
+    // add - Parse Source, check it against the session and then, item by
+    // item in source order, install its externs and definitions and evaluate
+    // its top-level expressions, appending their values to Results. Errors
+    // name the piece Name, or "<input N>" for the N-th piece without one.
+    //
+    // A piece with parse or semantic errors changes nothing. Returns the
+    // number of errors reported.
+    unsigned add(std::string_view Source, std::vector<double> &Results, std::string Name = "");
+
+    // addModule - add() for a piece that is already parsed, with its symbols
+    // in getSymbolTable(). Folding allocates in Ctx; the session keeps no
+    // pointer into M once this returns.
+    unsigned addModule(ModuleAST &M, ASTContext &Ctx, std::vector<double> &Results, const std::string &FileName);
+
+    SymbolTable &getSymbolTable() { return Symbols; }
+
+    // isDeclared - Whether S is an extern or a function of the session.
+    bool isDeclared(Symbol S) const;
+
+    // getNumFunctions - The number of functions defined so far.
+    unsigned getNumFunctions() const;
+};
+
+#endif // KALEIDOSCOPE_UTILS_SESSION_H
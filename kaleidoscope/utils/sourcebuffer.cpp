@@ -0,0 +1,124 @@
+#include "sourcebuffer.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // Small files are cheaper to read than to map, and a file whose size is an
+    // exact multiple of the page size has no zero bytes after it to serve as the
+    // '\0' sentinel, so those are read as well.
+    const size_t MinMapSize = 16 * 1024;
+
+    // Block size used when the total size is not known up front (pipes, ttys).
+    const size_t ReadBlockSize = 1024 * 1024;
+
+    // readAll - Append everything readable from FD to Out. SizeHint is the
+    // expected size for regular files, or 0 if it is unknown.
+    bool readAll(int FD, std::string &Out, size_t SizeHint)
+    {
+        size_t Len = Out.size();
+        Out.resize(Len + (SizeHint ? SizeHint : ReadBlockSize));
+        while (true)
+        {
+            if (Len == Out.size())
+            {
+                Out.resize(Out.size() * 2);
+            }
+            ssize_t N = read(FD, &Out[Len], Out.size() - Len);
+            if (N < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            if (N == 0)
+            {
+                break;
+            }
+            Len += static_cast<size_t>(N);
+        }
+        Out.resize(Len);
+        return true;
+    }
+}
+
+SourceBuffer::~SourceBuffer()
+{
+    if (IsMapped)
+    {
+        munmap(const_cast<char *>(BufStart), BufSize);
+    }
+}
+
+std::unique_ptr<SourceBuffer> SourceBuffer::getFile(const char *Path)
+{
+    int FD = open(Path, O_RDONLY);
+    if (FD < 0)
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<SourceBuffer> Buf(new SourceBuffer(Path));
+    struct stat St;
+    size_t SizeHint = 0;
+    if (fstat(FD, &St) == 0 && S_ISREG(St.st_mode))
+    {
+        size_t Size = static_cast<size_t>(St.st_size);
+        size_t PageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        if (Size >= MinMapSize && Size % PageSize != 0)
+        {
+            void *Addr = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, FD, 0);
+            if (Addr != MAP_FAILED)
+            {
+                // The lexer makes a single forward pass.
+                madvise(Addr, Size, MADV_SEQUENTIAL);
+                close(FD);
+                Buf->BufStart = static_cast<const char *>(Addr);
+                Buf->BufSize = Size;
+                Buf->IsMapped = true;
+                return Buf;
+            }
+        }
+        SizeHint = Size + 1; // +1 so EOF is seen without growing the buffer
+    }
+
+    bool Ok = readAll(FD, Buf->Storage, SizeHint);
+    int SavedErrno = errno;
+    close(FD);
+    if (!Ok)
+    {
+        errno = SavedErrno;
+        return nullptr;
+    }
+    Buf->BufStart = Buf->Storage.c_str();
+    Buf->BufSize = Buf->Storage.size();
+    return Buf;
+}
+
+std::unique_ptr<SourceBuffer> SourceBuffer::getSTDIN()
+{
+    std::unique_ptr<SourceBuffer> Buf(new SourceBuffer("<stdin>"));
+    if (!readAll(STDIN_FILENO, Buf->Storage, 0))
+    {
+        return nullptr;
+    }
+    Buf->BufStart = Buf->Storage.c_str();
+    Buf->BufSize = Buf->Storage.size();
+    return Buf;
+}
+
+std::unique_ptr<SourceBuffer> SourceBuffer::getMemBuffer(std::string Text,
+                                                         std::string Name)
+{
+    std::unique_ptr<SourceBuffer> Buf(new SourceBuffer(std::move(Name)));
+    Buf->Storage = std::move(Text);
+    Buf->BufStart = Buf->Storage.c_str();
+    Buf->BufSize = Buf->Storage.size();
+    return Buf;
+}
@@ -0,0 +1,47 @@
+#ifndef KALEIDOSCOPE_UTILS_SOURCEBUFFER_H
+#define KALEIDOSCOPE_UTILS_SOURCEBUFFER_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// SourceBuffer - An immutable, contiguous copy (or mapping) of a whole source
+// file. Regular files are memory-mapped, stdin and pipes are slurped with large
+// block reads. The bytes in [begin(), end()) are always followed by a '\0'
+// sentinel, so the lexer may look at *end() without a bounds check.
+class SourceBuffer
+{
+private:
+    std::string Name;
+    const char *BufStart = nullptr;
+    size_t BufSize = 0;
+    bool IsMapped = false;
+    std::string Storage; // owns the bytes when the buffer is not mapped
+
+    SourceBuffer(std::string Name) : Name(std::move(Name)) {}
+
+public:
+    ~SourceBuffer();
+    SourceBuffer(const SourceBuffer &) = delete;
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+
+    // getFile - Open Path and map it into memory. Returns nullptr and leaves
+    // errno set if the file cannot be opened or read.
+    static std::unique_ptr<SourceBuffer> getFile(const char *Path);
+
+    // getSTDIN - Read all of standard input. Works for pipes and terminals.
+    static std::unique_ptr<SourceBuffer> getSTDIN();
+
+    // getMemBuffer - Wrap a copy of Text, mostly useful for benchmarks and
+    // programmatic compilation.
+    static std::unique_ptr<SourceBuffer> getMemBuffer(std::string Text,
+                                                      std::string Name = "<memory>");
+
+    const char *begin() const { return BufStart; }
+    const char *end() const { return BufStart + BufSize; }
+    size_t size() const { return BufSize; }
+    bool isMapped() const { return IsMapped; }
+    const std::string &getName() const { return Name; }
+};
+
+#endif // KALEIDOSCOPE_UTILS_SOURCEBUFFER_H
@@ -0,0 +1,182 @@
+#ifndef KALEIDOSCOPE_UTILS_SPSCRING_H
+#define KALEIDOSCOPE_UTILS_SPSCRING_H
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+//===-------------------------------------------------------------===//
+// Single-producer, single-consumer rings
+//===-------------------------------------------------------------===//
+// SPSCRing - A bounded FIFO between exactly one producer thread and one
+// consumer thread, without a lock on the way in or out.
+//
+// Each side keeps its own index in a cache line of its own and a cached copy
+// of the other side's, so it only reads the shared index when the cached one
+// says the ring is full (or empty). Writes are published in batches: the
+// index the other side sees moves every PublishInterval elements, on flush()
+// and before a side waits, which keeps the shared lines from bouncing on
+// every token. A producer must flush() when it has handed over something the
+// consumer should see now, e.g. before it blocks on input of its own.
+//
+// A side that finds the ring full (or empty) yields for a while and then
+// sleeps on a condition variable; the other side only takes the lock to wake
+// it when a flag says it is asleep.
+template <typename T>
+class SPSCRing
+{
+public:
+    static constexpr size_t PublishInterval = 64;
+
+private:
+    static constexpr size_t CacheLine = 64;
+    static constexpr unsigned SpinLimit = 64; // yields before a side sleeps
+
+    std::unique_ptr<T[]> Slots;
+    const size_t Capacity;
+
+    // Producer side.
+    alignas(CacheLine) std::atomic<size_t> Tail{0}; // elements published
+    size_t LocalTail = 0;                           // ... and written
+    size_t CachedHead = 0;
+
+    // Consumer side.
+    alignas(CacheLine) std::atomic<size_t> Head{0}; // elements released
+    size_t LocalHead = 0;                           // ... and taken
+    size_t CachedTail = 0;
+
+    alignas(CacheLine) std::mutex Lock;
+    std::condition_variable Wakeup;
+    std::atomic<bool> ProducerSleeping{false};
+    std::atomic<bool> ConsumerSleeping{false};
+    std::atomic<bool> Closed{false};
+
+    // wake - After publishing: wake the other side if it went to sleep. The
+    // fences pair with the ones in waitUntil(), so either the sleeper sees the
+    // new index or this sees its flag.
+    void wake(const std::atomic<bool> &Sleeping)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (Sleeping.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> Guard(Lock);
+            Wakeup.notify_all();
+        }
+    }
+
+    template <typename P>
+    void waitUntil(std::atomic<bool> &Sleeping, P Ready)
+    {
+        for (unsigned I = 0; I < SpinLimit; ++I)
+        {
+            if (Ready())
+            {
+                return;
+            }
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> Guard(Lock);
+        Sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!Ready())
+        {
+            Wakeup.wait(Guard);
+        }
+        Sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    void publishHead()
+    {
+        Head.store(LocalHead, std::memory_order_release);
+        wake(ProducerSleeping);
+    }
+
+    // takeReady - The consumer's check for something to take, reloading the
+    // producer's index: true if there is an element or the ring is closed.
+    bool takeReady()
+    {
+        bool IsClosed = Closed.load(std::memory_order_acquire);
+        CachedTail = Tail.load(std::memory_order_acquire);
+        return LocalHead != CachedTail || IsClosed;
+    }
+
+public:
+    // Capacity must be a power of two no smaller than PublishInterval.
+    explicit SPSCRing(size_t Capacity) : Slots(new T[Capacity]), Capacity(Capacity)
+    {
+        assert(Capacity >= PublishInterval && (Capacity & (Capacity - 1)) == 0 && "bad ring capacity");
+    }
+    SPSCRing(const SPSCRing &) = delete;
+    SPSCRing &operator=(const SPSCRing &) = delete;
+
+    // push - Append V, waiting while the ring is full. Producer only.
+    void push(T V)
+    {
+        if (LocalTail - CachedHead == Capacity)
+        {
+            flush(); // let the consumer drain what is already there
+            waitUntil(ProducerSleeping, [this]
+                      { return LocalTail - (CachedHead = Head.load(std::memory_order_acquire)) != Capacity; });
+        }
+        Slots[LocalTail & (Capacity - 1)] = std::move(V);
+        if (++LocalTail - Tail.load(std::memory_order_relaxed) >= PublishInterval)
+        {
+            flush();
+        }
+    }
+
+    // flush - Publish everything pushed so far. Producer only.
+    void flush()
+    {
+        Tail.store(LocalTail, std::memory_order_release);
+        wake(ConsumerSleeping);
+    }
+
+    // close - Flush and mark the end of the stream. Producer only; nothing
+    // may be pushed afterwards.
+    void close()
+    {
+        Tail.store(LocalTail, std::memory_order_release);
+        Closed.store(true, std::memory_order_release);
+        wake(ConsumerSleeping);
+    }
+
+    // tryPop - Take the oldest element into Out if one has been published.
+    // Consumer only.
+    bool tryPop(T &Out)
+    {
+        if (LocalHead == CachedTail && LocalHead == (CachedTail = Tail.load(std::memory_order_acquire)))
+        {
+            if (LocalHead != Head.load(std::memory_order_relaxed))
+            {
+                publishHead(); // the producer may be waiting for room
+            }
+            return false;
+        }
+        Out = std::move(Slots[LocalHead & (Capacity - 1)]);
+        if (++LocalHead - Head.load(std::memory_order_relaxed) >= PublishInterval)
+        {
+            publishHead();
+        }
+        return true;
+    }
+
+    // pop - Take the oldest element into Out, waiting for one; false once
+    // the ring is closed and empty. Consumer only.
+    bool pop(T &Out)
+    {
+        if (tryPop(Out))
+        {
+            return true;
+        }
+        waitUntil(ConsumerSleeping, [this] { return takeReady(); });
+        return tryPop(Out);
+    }
+};
+
+#endif // KALEIDOSCOPE_UTILS_SPSCRING_H
@@ -0,0 +1,555 @@
+#include "stream.h"
+
+#include "ast.h"
+#include "chunkparse.h"
+#include "frontend.h"
+#include "purity.h"
+#include "session.h"
+#include "sourcebuffer.h"
+#include "spscring.h"
+#include "symboltable.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    const size_t ReadBlockSize = 64 * 1024;
+    const size_t TokenRingSize = 4096;
+    const size_t ItemRingSize = 256;
+    const size_t ArenaBytes = 256 * 1024; // the parser starts a new arena past this
+
+    // StreamItem - One top-level item on its way from the parser to the
+    // session, with its symbols still those of the stream's table.
+    struct StreamItem
+    {
+        std::shared_ptr<ASTContext> Arena; // owns the item's nodes
+        FunctionAST *Function = nullptr;   // a definition or a top-level expression
+        PrototypeAST *Extern = nullptr;    // ... or else an extern
+        // The names of the stream symbols first read since the previous item,
+        // in ID order. They point into the stream's table, which outlives
+        // every stage.
+        std::vector<std::string_view> NewSymbols;
+        bool Done = false; // handed to the session (calling thread only)
+    };
+
+    // StreamToken - A token and where it starts, worked out on the lexer
+    // thread while the text it points into is still there.
+    struct StreamToken
+    {
+        Token Tok;
+        SourceLocation Loc;
+    };
+
+    //===-------------------------------------------------------------===//
+    // Lexer thread
+    //===-------------------------------------------------------------===//
+    class LexStage
+    {
+    private:
+        int FD;
+        const std::string &Name;
+        SymbolTable &Symbols;
+        SPSCRing<StreamToken> &Tokens;
+        unsigned Line = 1;                 // the line the next segment starts on
+        std::deque<std::string> BadTokens; // the spelling of every tok_error, for the parser's message
+
+        // lexSegment - Push the tokens of Text, which starts Base bytes into
+        // the input, and the final tok_eof if Text is the Last segment. Text is
+        // freed before the parser is done with its tokens, so only names and
+        // malformed tokens keep their spelling, the copy in Symbols or
+        // BadTokens.
+        void lexSegment(std::string Text, uint64_t Base, bool Last)
+        {
+            auto Buf = SourceBuffer::getMemBuffer(std::move(Text), Name);
+            Lexer Lex(*Buf, Symbols);
+            while (true)
+            {
+                Token Tok = Lex.lex();
+                SourceLocation Loc = Lex.getLocation(Tok);
+                Loc.Line += Line - 1;
+                if (Tok.Kind == tok_eof && !Last)
+                {
+                    Line = Loc.Line; // segments end on a line break
+                    return;
+                }
+                if (Tok.Kind == tok_error)
+                {
+                    Tok.Text = BadTokens.emplace_back(Tok.Text);
+                }
+                else
+                {
+                    Tok.Text = Tok.Sym.isValid() ? Symbols.getName(Tok.Sym) : std::string_view();
+                }
+                Tok.Begin = static_cast<uint32_t>(Tok.Begin + Base);
+                Tok.End = static_cast<uint32_t>(Tok.End + Base);
+                Tokens.push({Tok, Loc});
+                if (Tok.Kind == tok_eof)
+                {
+                    return;
+                }
+            }
+        }
+
+    public:
+        uint64_t Bytes = 0;
+        bool Failed = false;
+
+        LexStage(int FD, const std::string &Name, SymbolTable &Symbols, SPSCRing<StreamToken> &Tokens)
+            : FD(FD), Name(Name), Symbols(Symbols), Tokens(Tokens)
+        {
+        }
+
+        void run()
+        {
+            TraceScope Scope("lex", Name);
+            std::unique_ptr<char[]> Block(new char[ReadBlockSize]);
+            std::string Rest; // the bytes after the last line break so far
+            uint64_t Base = 0;
+            while (true)
+            {
+                ssize_t N = read(FD, Block.get(), ReadBlockSize);
+                if (N < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (N < 0)
+                {
+                    fprintf(stderr, "Error: cannot read '%s': %s\n", Name.c_str(), strerror(errno));
+                    Failed = true;
+                    break;
+                }
+                if (N == 0)
+                {
+                    break;
+                }
+                Bytes += static_cast<uint64_t>(N);
+
+                // No token spans a line break, so the bytes up to the last one
+                // lex the same on their own.
+                const char *Begin = Block.get();
+                const char *Cut = Begin + N;
+                while (Cut != Begin && Cut[-1] != '\n' && Cut[-1] != '\r')
+                {
+                    --Cut;
+                }
+                if (Cut == Begin)
+                {
+                    Rest.append(Begin, static_cast<size_t>(N));
+                    continue;
+                }
+                std::string Segment = std::move(Rest);
+                Segment.append(Begin, Cut);
+                Rest.assign(Cut, Begin + N);
+                size_t Size = Segment.size();
+                lexSegment(std::move(Segment), Base, /*Last=*/false);
+                Base += Size;
+                Tokens.flush(); // the next read may block
+            }
+            lexSegment(std::move(Rest), Base, /*Last=*/true);
+            Tokens.close();
+        }
+    };
+
+    //===-------------------------------------------------------------===//
+    // Parser thread
+    //===-------------------------------------------------------------===//
+    // RingTokens - The parser's view of the token ring. It notes the names
+    // of new symbols on the way, for the calling thread to intern.
+    class RingTokens : public TokenSource
+    {
+    private:
+        SPSCRing<StreamToken> &Tokens;
+        SPSCRing<StreamItem> &Items;
+        const std::string &Name;
+        uint32_t NumSymbols; // stream symbols whose names have been noted
+        std::vector<std::string_view> NewSymbols;
+        SourceLocation Loc; // of the last token, which after the end stays the tok_eof
+
+    public:
+        RingTokens(SPSCRing<StreamToken> &Tokens, SPSCRing<StreamItem> &Items, const std::string &Name,
+                   uint32_t NumSymbols)
+            : Tokens(Tokens), Items(Items), Name(Name), NumSymbols(NumSymbols)
+        {
+        }
+
+        Token next() override
+        {
+            StreamToken Next;
+            if (!Tokens.tryPop(Next))
+            {
+                Items.flush(); // what is parsed so far may be all there is for a while
+                if (!Tokens.pop(Next))
+                {
+                    return Token();
+                }
+            }
+            const Token &Tok = Next.Tok;
+            Loc = Next.Loc;
+            // The lexer numbers symbols as it first meets them, so a new one
+            // always has the next ID.
+            if (Tok.Kind == tok_identifier && Tok.Sym.getID() == NumSymbols)
+            {
+                NewSymbols.push_back(Tok.Text);
+                ++NumSymbols;
+            }
+            return Tok;
+        }
+
+        SourceLocation getLocation() override { return Loc; }
+        const std::string &getFileName() const override { return Name; }
+
+        std::vector<std::string_view> takeNewSymbols()
+        {
+            std::vector<std::string_view> Names;
+            Names.swap(NewSymbols);
+            return Names;
+        }
+    };
+
+    // parseStage - Parse items off Source into Items until the tokens run
+    // out; returns the number of items.
+    uint64_t parseStage(Parser &P, RingTokens &Source, Symbol AnonExpr, SPSCRing<StreamItem> &Items,
+                        const std::string &Name)
+    {
+        TraceScope Scope("parse", Name);
+        std::shared_ptr<ASTContext> Arena;
+        uint64_t NumItems = 0;
+        while (true)
+        {
+            if (!Arena || Arena->getBytesAllocated() >= ArenaBytes)
+            {
+                Arena = std::make_shared<ASTContext>();
+            }
+            ModuleAST M;
+            if (!P.parseItem(*Arena, M))
+            {
+                break;
+            }
+            StreamItem Item;
+            Item.Arena = Arena;
+            Item.Function = M.Functions.empty() ? nullptr : M.Functions.front();
+            Item.Extern = M.Externs.empty() ? nullptr : M.Externs.front();
+            Item.NewSymbols = Source.takeNewSymbols();
+            bool IsExpr = Item.Function && Item.Function->getProto()->getName() == AnonExpr;
+            Items.push(std::move(Item));
+            if (IsExpr)
+            {
+                Items.flush(); // it can run now
+            }
+            ++NumItems;
+        }
+        Items.close();
+        return NumItems;
+    }
+
+    //===-------------------------------------------------------------===//
+    // Calling thread
+    //===-------------------------------------------------------------===//
+    // StreamScheduler - Hands the items to the session as soon as it can
+    // take them, with the meaning they have in source order.
+    //
+    // Items are scanned in order. A definition (or extern) of a new name is
+    // held until it is closed: a run of held definitions, from the first, is
+    // added as one piece once everything they call is declared in the session
+    // or defined in the run. A new name can't change what an earlier item
+    // means, so held definitions may go in ahead of expressions that are
+    // still waiting. Those run in order, each once everything it calls is
+    // declared. A redefinition is a barrier: the scan stops at it until
+    // every item before it has been handed over.
+    class StreamScheduler
+    {
+    private:
+        Session &S;
+        SymbolTable &Symbols; // S's
+        const std::string &FileName;
+        const std::function<void(double)> &OnResult;
+        Symbol AnonExpr;
+        std::vector<Symbol> Remap; // stream symbol ID -> session symbol
+
+        // The items from number Popped on; their numbers count every item
+        // added so far.
+        std::deque<StreamItem> Queue;
+        uint64_t Popped = 0;
+
+        uint64_t Scanned = 0;         // items before this number are scanned
+        bool Blocked = false;         // the scan stopped at a redefinition
+        std::deque<uint64_t> Held;    // scanned definitions not handed over
+        size_t Closed = 0;            // how many of Held, from the first, are closed
+        std::deque<uint64_t> Waiting; // scanned expressions not run yet
+        // By session symbol ID: the names Held defines and the ones they call
+        // that aren't known yet, of which there are NumNeeded.
+        std::vector<char> Defined, Needed;
+        std::vector<Symbol> Marked; // to clear Defined and Needed
+        size_t NumNeeded = 0;
+        std::vector<double> Results;
+
+        StreamItem &item(uint64_t N) { return Queue[N - Popped]; }
+
+        Symbol nameOf(const StreamItem &Item) const
+        {
+            return Item.Function ? Item.Function->getProto()->getName() : Item.Extern->getName();
+        }
+        bool isExpression(const StreamItem &Item) const
+        {
+            return Item.Function && Item.Function->getProto()->getName() == AnonExpr;
+        }
+
+        void mark(std::vector<char> &Flags, Symbol Sym)
+        {
+            Flags[Sym.getID()] = 1;
+            Marked.push_back(Sym);
+        }
+
+        void clearMarks()
+        {
+            for (Symbol Sym : Marked)
+            {
+                Defined[Sym.getID()] = Needed[Sym.getID()] = 0;
+            }
+            Marked.clear();
+            NumNeeded = 0;
+        }
+
+        // scan - Scan the items that have arrived, up to a barrier.
+        void scan()
+        {
+            Defined.resize(Symbols.size());
+            Needed.resize(Symbols.size());
+            while (!Blocked && Scanned < Popped + Queue.size())
+            {
+                const StreamItem &Item = item(Scanned);
+                if (Item.Done)
+                {
+                    ++Scanned; // handed over before a rescan()
+                    continue;
+                }
+                if (isExpression(Item))
+                {
+                    Waiting.push_back(Scanned++);
+                    continue;
+                }
+                Symbol Name = nameOf(Item);
+                bool AtFront = Held.empty() && Waiting.empty();
+                if (!AtFront && (Defined[Name.getID()] || S.isDeclared(Name)))
+                {
+                    Blocked = true;
+                    break;
+                }
+                mark(Defined, Name);
+                if (Needed[Name.getID()])
+                {
+                    Needed[Name.getID()] = 0;
+                    --NumNeeded;
+                }
+                if (Item.Function)
+                {
+                    for (Symbol Callee : collectCallees(Item.Function->getBody()))
+                    {
+                        if (!Defined[Callee.getID()] && !Needed[Callee.getID()] && !S.isDeclared(Callee))
+                        {
+                            mark(Needed, Callee);
+                            ++NumNeeded;
+                        }
+                    }
+                }
+                Held.push_back(Scanned++);
+                if (NumNeeded == 0)
+                {
+                    Closed = Held.size();
+                }
+            }
+        }
+
+        // rescan - Start the scan afresh from the first item.
+        void rescan()
+        {
+            clearMarks();
+            Held.clear();
+            Waiting.clear();
+            Closed = 0;
+            Blocked = false;
+            Scanned = Popped;
+        }
+
+        bool calleesDeclared(const StreamItem &Item) const
+        {
+            for (Symbol Callee : collectCallees(Item.Function->getBody()))
+            {
+                if (!S.isDeclared(Callee))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // handOver - Add the items numbered Numbers to the session as one
+        // piece.
+        void handOver(const std::vector<uint64_t> &Numbers)
+        {
+            ModuleAST M;
+            for (uint64_t N : Numbers)
+            {
+                StreamItem &Item = item(N);
+                if (Item.Function)
+                {
+                    M.Functions.push_back(Item.Function);
+                }
+                else
+                {
+                    M.Externs.push_back(Item.Extern);
+                }
+                Item.Done = true;
+            }
+            ASTContext Scratch; // for what folding allocates
+            Results.clear();
+            NumErrors += S.addModule(M, Scratch, Results, FileName);
+            ++NumPieces;
+            for (double Result : Results)
+            {
+                OnResult(Result);
+            }
+            while (!Queue.empty() && Queue.front().Done)
+            {
+                Queue.pop_front(); // and with the last item of an arena, the arena
+                ++Popped;
+            }
+            if (Held.empty() && Waiting.empty())
+            {
+                clearMarks();
+            }
+        }
+
+    public:
+        unsigned NumErrors = 0;
+        uint64_t NumPieces = 0;
+        size_t MaxQueued = 0;
+
+        // The stream's symbols so far are StreamSymbols'; later ones come
+        // with the items.
+        StreamScheduler(Session &S, const std::string &FileName, const std::function<void(double)> &OnResult,
+                        const SymbolTable &StreamSymbols)
+            : S(S), Symbols(S.getSymbolTable()), FileName(FileName), OnResult(OnResult),
+              AnonExpr(Symbols.intern("__anon_expr"))
+        {
+            for (uint32_t ID = 0; ID < StreamSymbols.size(); ++ID)
+            {
+                Remap.push_back(Symbols.intern(StreamSymbols.getName(Symbol(ID))));
+            }
+        }
+
+        void add(StreamItem Item)
+        {
+            for (std::string_view Name : Item.NewSymbols)
+            {
+                Remap.push_back(Symbols.intern(Name));
+            }
+            Item.NewSymbols.clear();
+            ModuleAST M;
+            if (Item.Function)
+            {
+                M.Functions.push_back(Item.Function);
+            }
+            else
+            {
+                M.Externs.push_back(Item.Extern);
+            }
+            remapModule(M, Remap);
+            Queue.push_back(std::move(Item));
+            MaxQueued = std::max(MaxQueued, Queue.size());
+        }
+
+        // schedule - Hand over everything that can go now. AtEnd, when no
+        // more items will come, also what is still waiting, for the session
+        // to report what it lacks.
+        void schedule(bool AtEnd)
+        {
+            while (true)
+            {
+                scan();
+                if (Closed != 0)
+                {
+                    std::vector<uint64_t> Piece(Held.begin(), Held.begin() + static_cast<ptrdiff_t>(Closed));
+                    Held.erase(Held.begin(), Held.begin() + static_cast<ptrdiff_t>(Closed));
+                    Closed = 0;
+                    handOver(Piece);
+                }
+                else if (!Waiting.empty() && calleesDeclared(item(Waiting.front())))
+                {
+                    uint64_t N = Waiting.front();
+                    Waiting.pop_front();
+                    handOver({N});
+                }
+                else if (Blocked && Held.empty() && Waiting.empty())
+                {
+                    Blocked = false; // the redefinition is the first item now
+                }
+                else if (AtEnd && (!Held.empty() || !Waiting.empty()))
+                {
+                    bool Expr = Held.empty() || (!Waiting.empty() && Waiting.front() < Held.front());
+                    uint64_t N = Expr ? Waiting.front() : Held.front();
+                    (Expr ? Waiting : Held).pop_front();
+                    handOver({N});
+                    rescan();
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+    };
+}
+
+unsigned streamSource(int FD, const std::string &Name, Session &S, const std::function<void(double)> &OnResult,
+                      StreamStats *Stats)
+{
+    SPSCRing<StreamToken> Tokens(TokenRingSize);
+    SPSCRing<StreamItem> Items(ItemRingSize);
+
+    // Everything the parser interns goes in before the lexer thread starts;
+    // from then on the lexer thread alone writes to StreamSymbols.
+    SymbolTable StreamSymbols;
+    Symbol AnonExpr = StreamSymbols.intern("__anon_expr");
+    RingTokens Source(Tokens, Items, Name, static_cast<uint32_t>(StreamSymbols.size()));
+    Parser P(Source, StreamSymbols);
+    StreamScheduler Scheduler(S, Name, OnResult, StreamSymbols);
+
+    LexStage Lex(FD, Name, StreamSymbols, Tokens);
+    std::thread Lexing([&]
+                       { Lex.run(); });
+    uint64_t NumItems = 0;
+    std::thread Parsing([&]
+                        { NumItems = parseStage(P, Source, AnonExpr, Items, Name); });
+
+    StreamItem Item;
+    while (Items.pop(Item))
+    {
+        Scheduler.add(std::move(Item));
+        Scheduler.schedule(/*AtEnd=*/false);
+    }
+    Scheduler.schedule(/*AtEnd=*/true);
+    Lexing.join();
+    Parsing.join();
+
+    if (Stats)
+    {
+        Stats->Bytes += Lex.Bytes;
+        Stats->Tokens += P.getNumTokens();
+        Stats->Items += NumItems;
+        Stats->Pieces += Scheduler.NumPieces;
+        Stats->MaxQueued = std::max(Stats->MaxQueued, Scheduler.MaxQueued);
+    }
+    return Scheduler.NumErrors + P.getNumErrors() + (Lex.Failed ? 1 : 0);
+}
@@ -0,0 +1,57 @@
+#ifndef KALEIDOSCOPE_UTILS_STREAM_H
+#define KALEIDOSCOPE_UTILS_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+class Session;
+
+// StreamStats - What streamSource() moved through its stages.
+struct StreamStats
+{
+    uint64_t Bytes = 0;   // read from the input
+    uint64_t Tokens = 0;  // lexed, EOF included
+    uint64_t Items = 0;   // top-level items parsed
+    uint64_t Pieces = 0;  // handed to the session
+    size_t MaxQueued = 0; // most items parsed but not yet handed over
+};
+
+//===-------------------------------------------------------------===//
+// Streaming execution
+//===-------------------------------------------------------------===//
+// streamSource - Run the source read from FD through S as it arrives, for
+// input piped in by a job that may take a long time to finish writing it.
+// Name is the source's name in diagnostics. Three stages overlap:
+//
+//   lexer thread   reads FD in 64 KB blocks, cuts them at the last line
+//                  break (no token spans lines) and lexes each segment into
+//                  an SPSCRing of tokens (spscring.h). A segment is freed
+//                  once lexed; identifiers are interned in a table of the
+//                  stream's own.
+//   parser thread  parses the tokens a top-level item at a time into a ring
+//                  of items, allocating their nodes in arenas it starts
+//                  afresh every 256 KB; an arena lives as long as its items.
+//   calling thread maps each item's symbols into S's table and hands it to
+//                  S, at once or as soon as it can be.
+//
+// As with -jit, definitions and expressions may call functions defined
+// further down. A definition of a new name is held back until everything
+// it calls is known, then added together with the ones it needs, so
+// mutually recursive functions go in as one piece; it may overtake
+// expressions still waiting, since a new name can't change what they
+// compute. Top-level expressions run in order, each as soon as everything it
+// calls is compiled, and OnResult gets its value. A redefinition waits for
+// everything above it. Whatever still waits at the end of the input is added
+// item by item, so that its unknown callees are reported; until then, an
+// expression calling a function that is never defined holds up the items
+// after it.
+//
+// Memory is bounded by the rings, the arenas of the items in flight and the
+// definitions held back, not by the size of the input. Returns the number of
+// errors reported, by any stage.
+unsigned streamSource(int FD, const std::string &Name, Session &S, const std::function<void(double)> &OnResult,
+                      StreamStats *Stats = nullptr);
+
+#endif // KALEIDOSCOPE_UTILS_STREAM_H
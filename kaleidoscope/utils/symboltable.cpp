@@ -0,0 +1,96 @@
+#include "symboltable.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+    const size_t InitialBuckets = 1024;
+
+    // hashName - 32-bit FNV-1a. Identifiers are short, so a byte loop is fine.
+    inline uint32_t hashName(std::string_view Name)
+    {
+        uint32_t H = 2166136261u;
+        for (char C : Name)
+        {
+            H = (H ^ static_cast<unsigned char>(C)) * 16777619u;
+        }
+        return H;
+    }
+}
+
+SymbolTable::SymbolTable() : Buckets(InitialBuckets, 0)
+{
+    // Must match the constants in namespace kw.
+    intern("def");
+    intern("extern");
+    intern("if");
+    intern("then");
+    intern("else");
+    assert(lookup("else") == kw::Else && size() == kw::NumKeywords && "keyword IDs out of sync");
+}
+
+std::string_view SymbolTable::copyName(std::string_view Name)
+{
+    char *Copy = static_cast<char *>(NameStorage.allocate(Name.size(), 1));
+    memcpy(Copy, Name.data(), Name.size());
+    return std::string_view(Copy, Name.size());
+}
+
+// grow - Double the bucket array and reinsert every symbol.
+void SymbolTable::grow()
+{
+    std::vector<uint32_t> NewBuckets(Buckets.size() * 2, 0);
+    size_t Mask = NewBuckets.size() - 1;
+    for (uint32_t ID = 0; ID < Names.size(); ++ID)
+    {
+        size_t I = Hashes[ID] & Mask;
+        while (NewBuckets[I])
+        {
+            I = (I + 1) & Mask;
+        }
+        NewBuckets[I] = ID + 1;
+    }
+    Buckets.swap(NewBuckets);
+}
+
+Symbol SymbolTable::intern(std::string_view Name)
+{
+    uint32_t H = hashName(Name);
+    size_t Mask = Buckets.size() - 1;
+    size_t I = H & Mask;
+    while (uint32_t B = Buckets[I])
+    {
+        if (Hashes[B - 1] == H && Names[B - 1] == Name)
+        {
+            return Symbol(B - 1);
+        }
+        I = (I + 1) & Mask;
+    }
+
+    uint32_t ID = static_cast<uint32_t>(Names.size());
+    Names.push_back(copyName(Name));
+    Hashes.push_back(H);
+    Buckets[I] = ID + 1;
+
+    // Keep the load factor under 1/2 so probe sequences stay short.
+    if (Names.size() * 2 > Buckets.size())
+    {
+        grow();
+    }
+    return Symbol(ID);
+}
+
+Symbol SymbolTable::lookup(std::string_view Name) const
+{
+    uint32_t H = hashName(Name);
+    size_t Mask = Buckets.size() - 1;
+    for (size_t I = H & Mask; uint32_t B = Buckets[I]; I = (I + 1) & Mask)
+    {
+        if (Hashes[B - 1] == H && Names[B - 1] == Name)
+        {
+            return Symbol(B - 1);
+        }
+    }
+    return Symbol();
+}
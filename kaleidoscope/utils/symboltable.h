@@ -0,0 +1,89 @@
+#ifndef KALEIDOSCOPE_UTILS_SYMBOLTABLE_H
+#define KALEIDOSCOPE_UTILS_SYMBOLTABLE_H
+
+#include "bumpallocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Symbol - A dense 32-bit handle for an interned identifier. Two symbols from
+// the same SymbolTable are equal exactly when their spellings are equal, so
+// name comparisons and lookups become integer operations.
+class Symbol
+{
+private:
+    uint32_t ID;
+
+public:
+    static constexpr uint32_t InvalidID = ~0u;
+
+    constexpr Symbol() : ID(InvalidID) {}
+    constexpr explicit Symbol(uint32_t ID) : ID(ID) {}
+
+    constexpr uint32_t getID() const { return ID; }
+    constexpr bool isValid() const { return ID != InvalidID; }
+
+    friend constexpr bool operator==(Symbol A, Symbol B) { return A.ID == B.ID; }
+    friend constexpr bool operator!=(Symbol A, Symbol B) { return A.ID != B.ID; }
+};
+
+namespace std
+{
+    template <>
+    struct hash<Symbol>
+    {
+        size_t operator()(Symbol S) const { return S.getID(); }
+    };
+}
+
+// Keywords are interned by every SymbolTable before anything else, so their
+// IDs are fixed and the lexer's keyword test is an integer compare.
+namespace kw
+{
+    constexpr Symbol Def{0};
+    constexpr Symbol Extern{1};
+    constexpr Symbol If{2};
+    constexpr Symbol Then{3};
+    constexpr Symbol Else{4};
+
+    constexpr uint32_t NumKeywords = 5;
+}
+
+// SymbolTable - Maps identifier spellings to Symbols. Spellings are copied into
+// table-owned storage, so symbols stay valid after the source buffer is gone.
+class SymbolTable
+{
+private:
+    // Open-addressed hash index over Names. A bucket holds ID + 1, or 0 if it
+    // is empty; Hashes caches each name's hash to skip most string compares.
+    std::vector<uint32_t> Buckets;
+    std::vector<std::string_view> Names;
+    std::vector<uint32_t> Hashes;
+
+    // Spellings are packed into slabs instead of one string per name.
+    BumpAllocator NameStorage;
+
+    std::string_view copyName(std::string_view Name);
+    void grow();
+
+public:
+    SymbolTable();
+    SymbolTable(const SymbolTable &) = delete;
+    SymbolTable &operator=(const SymbolTable &) = delete;
+
+    // intern - Return the symbol for Name, creating it on first use.
+    Symbol intern(std::string_view Name);
+
+    // lookup - Return the symbol for Name, or an invalid symbol if Name has
+    // never been interned.
+    Symbol lookup(std::string_view Name) const;
+
+    std::string_view getName(Symbol S) const { return Names[S.getID()]; }
+    size_t size() const { return Names.size(); }
+};
+
+#endif // KALEIDOSCOPE_UTILS_SYMBOLTABLE_H
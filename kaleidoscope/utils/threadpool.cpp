@@ -0,0 +1,132 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+namespace
+{
+    // The pool and queue index of the worker running on this thread, if any.
+    thread_local const ThreadPool *CurrentPool = nullptr;
+    thread_local unsigned CurrentWorker = 0;
+}
+
+ThreadPool::ThreadPool(unsigned NumThreads)
+{
+    if (NumThreads == 0)
+    {
+        NumThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned I = 0; I < NumThreads; ++I)
+    {
+        Queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (unsigned I = 0; I < NumThreads; ++I)
+    {
+        Workers.emplace_back([this, I]
+                             { workerLoop(I); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> Guard(SleepLock);
+        Stopping = true;
+    }
+    WorkAvailable.notify_all();
+    for (std::thread &T : Workers)
+    {
+        T.join();
+    }
+}
+
+void ThreadPool::async(Task T)
+{
+    unsigned Target;
+    if (CurrentPool == this)
+    {
+        Target = CurrentWorker;
+    }
+    else
+    {
+        Target = static_cast<unsigned>(NextQueue++ % Queues.size());
+    }
+
+    Outstanding.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> Guard(Queues[Target]->Lock);
+        Queues[Target]->Tasks.push_back(std::move(T));
+    }
+    // Publish under SleepLock so a worker that just found nothing to do
+    // cannot miss the wakeup.
+    {
+        std::lock_guard<std::mutex> Guard(SleepLock);
+        Queued.fetch_add(1);
+    }
+    WorkAvailable.notify_one();
+}
+
+bool ThreadPool::tryPop(unsigned Self, Task &Out)
+{
+    // Own deque first, newest task first.
+    {
+        WorkQueue &Q = *Queues[Self];
+        std::lock_guard<std::mutex> Guard(Q.Lock);
+        if (!Q.Tasks.empty())
+        {
+            Out = std::move(Q.Tasks.back());
+            Q.Tasks.pop_back();
+            Queued.fetch_sub(1);
+            return true;
+        }
+    }
+    // Then steal the oldest task of another worker.
+    for (size_t I = 1; I < Queues.size(); ++I)
+    {
+        WorkQueue &Q = *Queues[(Self + I) % Queues.size()];
+        std::lock_guard<std::mutex> Guard(Q.Lock);
+        if (!Q.Tasks.empty())
+        {
+            Out = std::move(Q.Tasks.front());
+            Q.Tasks.pop_front();
+            Queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned Self)
+{
+    CurrentPool = this;
+    CurrentWorker = Self;
+    while (true)
+    {
+        Task T;
+        if (tryPop(Self, T))
+        {
+            T();
+            if (Outstanding.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> Guard(SleepLock);
+                AllDone.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> Guard(SleepLock);
+        WorkAvailable.wait(Guard, [this]
+                           { return Stopping || Queued.load() != 0; });
+        if (Stopping && Queued.load() == 0)
+        {
+            return;
+        }
+    }
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> Guard(SleepLock);
+    AllDone.wait(Guard, [this]
+                 { return Outstanding.load() == 0; });
+}
@@ -0,0 +1,62 @@
+#ifndef KALEIDOSCOPE_UTILS_THREADPOOL_H
+#define KALEIDOSCOPE_UTILS_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ThreadPool - A fixed set of workers with one task deque each. A task
+// submitted from inside a worker goes to the back of that worker's own deque
+// and is picked up LIFO, so follow-up stages of a file tend to run on the
+// thread whose caches already hold it; idle workers steal FIFO from the front
+// of the other deques, which takes the oldest, usually largest, pending work.
+class ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+
+private:
+    struct WorkQueue
+    {
+        std::mutex Lock;
+        std::deque<Task> Tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> Queues;
+    std::vector<std::thread> Workers;
+
+    std::mutex SleepLock;
+    std::condition_variable WorkAvailable;
+    std::condition_variable AllDone;
+    std::atomic<size_t> Queued{0};      // tasks sitting in some deque
+    std::atomic<size_t> Outstanding{0}; // queued plus running
+    std::atomic<size_t> NextQueue{0};   // round-robin target for outside submits
+    bool Stopping = false;
+
+    bool tryPop(unsigned Self, Task &Out);
+    void workerLoop(unsigned Self);
+
+public:
+    // NumThreads == 0 means one worker per hardware thread.
+    explicit ThreadPool(unsigned NumThreads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // async - Queue T. Tasks may themselves call async().
+    void async(Task T);
+
+    // wait - Block until every queued task, including those queued by other
+    // tasks in the meantime, has finished.
+    void wait();
+
+    unsigned getNumThreads() const { return static_cast<unsigned>(Workers.size()); }
+};
+
+#endif // KALEIDOSCOPE_UTILS_THREADPOOL_H
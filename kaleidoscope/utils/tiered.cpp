@@ -0,0 +1,264 @@
+#include "tiered.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <cstdio>
+
+namespace
+{
+    // entryName - The stub that calls Name with its arguments unpacked from
+    // an array. Identifiers can't contain '.', so it can't clash.
+    std::string entryName(const std::string &Name) { return Name + ".entry"; }
+
+    // makeEntries - A module with an entry stub for each of Fns:
+    //   double f.entry(double *Args) { return f(Args[0], ..., Args[N-1]); }
+    llvm::orc::ThreadSafeModule makeEntries(const BytecodeModule &BC, const std::vector<uint32_t> &Fns,
+                                            llvm::StringRef ModuleName)
+    {
+        auto Context = std::make_unique<llvm::LLVMContext>();
+        auto M = std::make_unique<llvm::Module>(ModuleName, *Context);
+        llvm::IRBuilder<> Builder(*Context);
+        llvm::Type *Double = llvm::Type::getDoubleTy(*Context);
+        llvm::FunctionType *EntryTy =
+            llvm::FunctionType::get(Double, {llvm::Type::getDoublePtrTy(*Context)}, false);
+
+        for (uint32_t I : Fns)
+        {
+            const bc::Function &F = BC.getFunction(I);
+            std::vector<llvm::Type *> Doubles(F.NumParams, Double);
+            llvm::Function *Target = llvm::Function::Create(llvm::FunctionType::get(Double, Doubles, false),
+                                                            llvm::Function::ExternalLinkage, F.Name, M.get());
+            llvm::Function *Entry =
+                llvm::Function::Create(EntryTy, llvm::Function::ExternalLinkage, entryName(F.Name), M.get());
+
+            Builder.SetInsertPoint(llvm::BasicBlock::Create(*Context, "entry", Entry));
+            std::vector<llvm::Value *> Args;
+            for (uint32_t A = 0; A < F.NumParams; ++A)
+            {
+                llvm::Value *Slot = Builder.CreateConstInBoundsGEP1_64(Double, Entry->getArg(0), A);
+                Args.push_back(Builder.CreateLoad(Double, Slot));
+            }
+            Builder.CreateRet(Builder.CreateCall(Target, Args));
+        }
+        return llvm::orc::ThreadSafeModule(std::move(M), std::move(Context));
+    }
+}
+
+TieredEngine::TieredEngine(std::unique_ptr<KaleidoscopeJIT> JIT) : JIT(std::move(JIT)) {}
+
+llvm::Expected<std::unique_ptr<TieredEngine>> TieredEngine::create(uint32_t Threshold)
+{
+    // Compiled code goes in all at once for each promotion, so the JIT
+    // itself need not be lazy; it must take lookups from the compile thread
+    // and, for externs, the interpreter's.
+    auto JIT = KaleidoscopeJIT::create(KaleidoscopeJIT::Eager, /*Concurrent=*/true);
+    if (!JIT)
+    {
+        return JIT.takeError();
+    }
+    std::unique_ptr<TieredEngine> E(new TieredEngine(std::move(*JIT)));
+    E->Interp = std::make_unique<Interpreter>(E->BC, E.get(), Threshold);
+    if (Threshold != 0)
+    {
+        E->Compiler = std::thread([Engine = E.get()]
+                                  { Engine->compileLoop(); });
+    }
+    return E;
+}
+
+TieredEngine::~TieredEngine()
+{
+    {
+        std::lock_guard<std::mutex> Guard(QueueLock);
+        Stopping = true;
+    }
+    QueueReady.notify_one();
+    if (Compiler.joinable())
+    {
+        Compiler.join();
+    }
+}
+
+unsigned TieredEngine::addUnit(const ModuleAST &M, const SymbolTable &Symbols, const std::string &FileName,
+                               llvm::orc::ThreadSafeModule TSM)
+{
+    Units.push_back(std::move(TSM));
+    return BC.addUnit(M, Symbols, FileName);
+}
+
+void TieredEngine::promote(uint32_t Fn)
+{
+    NumPromoted.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> Guard(QueueLock);
+        Queue.push_back(Fn);
+    }
+    QueueReady.notify_one();
+}
+
+bool TieredEngine::precompile(const std::string &Name)
+{
+    int64_t Fn = BC.lookup(Name);
+    if (Fn < 0 || !BC.getFunction(static_cast<uint32_t>(Fn)).Defined)
+    {
+        return false;
+    }
+    // Not a promotion: the function isn't hot yet, and counts as one if it
+    // gets there.
+    {
+        std::lock_guard<std::mutex> Guard(QueueLock);
+        Queue.push_back(static_cast<uint32_t>(Fn));
+    }
+    QueueReady.notify_one();
+    return true;
+}
+
+void TieredEngine::compileLoop()
+{
+    for (;;)
+    {
+        uint32_t Fn;
+        {
+            std::unique_lock<std::mutex> Guard(QueueLock);
+            QueueReady.wait(Guard, [this]
+                            { return Stopping || !Queue.empty(); });
+            if (Stopping)
+            {
+                return;
+            }
+            Fn = Queue.front();
+            Queue.pop_front();
+        }
+        if (llvm::Error Err = compileClosure(Fn))
+        {
+            // Not fatal: the function just stays in the interpreter.
+            fprintf(stderr, "Error: cannot compile '%s': %s\n", BC.getFunction(Fn).Name.c_str(),
+                    llvm::toString(std::move(Err)).c_str());
+        }
+    }
+}
+
+// compileClosure - Compile Root and every function it can reach that isn't
+// in the JIT yet, since compiled code can only call compiled code.
+llvm::Error TieredEngine::compileClosure(uint32_t Root)
+{
+    InJIT.resize(BC.getNumFunctions(), 0);
+    if (InJIT[Root])
+    {
+        // Reached from an earlier promotion; its entry is already published.
+        return llvm::Error::success();
+    }
+
+    std::vector<uint32_t> Closure, Worklist{Root};
+    std::vector<std::vector<uint32_t>> ByUnit(Units.size());
+    InJIT[Root] = 1;
+    while (!Worklist.empty())
+    {
+        uint32_t Fn = Worklist.back();
+        Worklist.pop_back();
+        Closure.push_back(Fn);
+        const bc::Function &F = BC.getFunction(Fn);
+        ByUnit[F.Unit].push_back(Fn);
+
+        Units[F.Unit].withModuleDo(
+            [&](llvm::Module &M)
+            {
+                for (llvm::BasicBlock &BB : *M.getFunction(F.Name))
+                {
+                    for (llvm::Instruction &I : BB)
+                    {
+                        auto *Call = llvm::dyn_cast<llvm::CallInst>(&I);
+                        llvm::Function *Callee = Call ? Call->getCalledFunction() : nullptr;
+                        int64_t Idx = Callee ? BC.lookup(Callee->getName().str()) : -1;
+                        if (Idx >= 0 && BC.getFunction(Idx).Defined && !InJIT[Idx])
+                        {
+                            InJIT[Idx] = 1;
+                            Worklist.push_back(static_cast<uint32_t>(Idx));
+                        }
+                    }
+                }
+            });
+    }
+
+    // Copy the closure's definitions out of each unit, with the caches of
+    // memoized ones; everything else in the copy becomes a declaration.
+    for (size_t U = 0; U != Units.size(); ++U)
+    {
+        if (ByUnit[U].empty())
+        {
+            continue;
+        }
+        std::unique_ptr<llvm::Module> Part;
+        Units[U].withModuleDo(
+            [&](llvm::Module &M)
+            {
+                llvm::SmallPtrSet<const llvm::GlobalValue *, 16> Wanted;
+                for (uint32_t Fn : ByUnit[U])
+                {
+                    const std::string &Name = BC.getFunction(Fn).Name;
+                    Wanted.insert(M.getFunction(Name));
+                    if (llvm::GlobalVariable *Cache = M.getNamedGlobal(Name + ".memo"))
+                    {
+                        Wanted.insert(Cache);
+                        Wanted.insert(M.getNamedGlobal(Name + ".memo.stats"));
+                    }
+                }
+                llvm::ValueToValueMapTy VMap;
+                Part = llvm::CloneModule(M, VMap, [&](const llvm::GlobalValue *GV)
+                                         { return Wanted.count(GV) != 0; });
+            });
+        if (llvm::Error Err = JIT->addModule(llvm::orc::ThreadSafeModule(std::move(Part), Units[U].getContext())))
+        {
+            return Err;
+        }
+    }
+
+    if (llvm::Error Err = JIT->addModule(makeEntries(BC, Closure, "tier." + BC.getFunction(Root).Name)))
+    {
+        return Err;
+    }
+    for (uint32_t Fn : Closure)
+    {
+        bc::Function &F = BC.getFunction(Fn);
+        auto Sym = JIT->getLLJIT().lookup(entryName(F.Name));
+        if (!Sym)
+        {
+            return Sym.takeError();
+        }
+        F.Native.store(llvm::jitTargetAddressToFunction<bc::NativeEntry>(Sym->getAddress()),
+                       std::memory_order_release);
+    }
+    NumCompiled.fetch_add(static_cast<unsigned>(Closure.size()));
+    return llvm::Error::success();
+}
+
+bc::NativeEntry TieredEngine::resolve(uint32_t Fn)
+{
+    // Each extern gets its own stub module, so one that the process lacks
+    // only fails if it is actually called.
+    bc::Function &F = BC.getFunction(Fn);
+    if (llvm::Error Err = JIT->addModule(makeEntries(BC, {Fn}, "tier.extern." + F.Name)))
+    {
+        fprintf(stderr, "Error: %s\n", llvm::toString(std::move(Err)).c_str());
+        return nullptr;
+    }
+    auto Sym = JIT->getLLJIT().lookup(entryName(F.Name));
+    if (!Sym)
+    {
+        fprintf(stderr, "Error: cannot resolve extern '%s': %s\n", F.Name.c_str(),
+                llvm::toString(Sym.takeError()).c_str());
+        return nullptr;
+    }
+    bc::NativeEntry Native = llvm::jitTargetAddressToFunction<bc::NativeEntry>(Sym->getAddress());
+    F.Native.store(Native, std::memory_order_release);
+    return Native;
+}
@@ -0,0 +1,87 @@
+#ifndef KALEIDOSCOPE_UTILS_TIERED_H
+#define KALEIDOSCOPE_UTILS_TIERED_H
+
+#include "bytecode.h"
+#include "interpreter.h"
+#include "jit.h"
+
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/Error.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//===-------------------------------------------------------------===//
+// Tiered execution
+//===-------------------------------------------------------------===//
+// TieredEngine - Starts every program in the bytecode interpreter, which
+// needs no LLVM compilation, and moves hot functions to the JIT behind its
+// back. When a function has been called Threshold times the interpreter asks
+// for it; a single compile thread extracts the function, and every function
+// it can reach that isn't compiled yet, from the units' IR modules, adds them
+// to the JIT together with an entry stub per function, and publishes the
+// stubs. Call sites in the bytecode switch over the next time they run.
+//
+// Externs are always native: their entry stubs are compiled on the
+// interpreter's thread the first time one of them is called.
+class TieredEngine : public TierListener
+{
+private:
+    BytecodeModule BC;
+    std::unique_ptr<KaleidoscopeJIT> JIT;
+    std::unique_ptr<Interpreter> Interp;
+
+    // The IR of each unit, only touched by the compile thread once running.
+    std::vector<llvm::orc::ThreadSafeModule> Units;
+    std::vector<char> InJIT; // by bytecode function, compile thread only
+
+    std::thread Compiler;
+    std::mutex QueueLock;
+    std::condition_variable QueueReady;
+    std::deque<uint32_t> Queue;
+    bool Stopping = false;
+    std::atomic<unsigned> NumPromoted{0};
+    std::atomic<unsigned> NumCompiled{0};
+
+    explicit TieredEngine(std::unique_ptr<KaleidoscopeJIT> JIT);
+    void compileLoop();
+    llvm::Error compileClosure(uint32_t Root);
+
+public:
+    // create - Threshold is the number of calls after which a function is
+    // compiled; 0 keeps everything in the interpreter.
+    static llvm::Expected<std::unique_ptr<TieredEngine>> create(uint32_t Threshold);
+    ~TieredEngine() override;
+
+    // addUnit - Compile M to bytecode and keep its IR for the JIT. Function
+    // names must be unique across units, as the driver's link step checks.
+    // Returns the number of errors printed.
+    unsigned addUnit(const ModuleAST &M, const SymbolTable &Symbols, const std::string &FileName,
+                     llvm::orc::ThreadSafeModule TSM);
+
+    const std::vector<uint32_t> &getTopLevelExprs() const { return BC.getTopLevelExprs(); }
+
+    // precompile - Queue the function Name for the JIT before any call,
+    // e.g. because a profile says it gets hot; false if no unit defines it.
+    // Needs a non-zero threshold.
+    bool precompile(const std::string &Name);
+
+    // run - Evaluate the top-level expression Fn; false after an error.
+    bool run(uint32_t Fn, double &Result) { return Interp->run(Fn, Result); }
+
+    // Functions promoted because they got hot, and functions compiled in
+    // all (a promotion also compiles what the hot function calls).
+    unsigned getNumPromoted() const { return NumPromoted.load(); }
+    unsigned getNumCompiled() const { return NumCompiled.load(); }
+
+    void promote(uint32_t Fn) override;
+    bc::NativeEntry resolve(uint32_t Fn) override;
+};
+
+#endif // KALEIDOSCOPE_UTILS_TIERED_H
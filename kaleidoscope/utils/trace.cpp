@@ -0,0 +1,213 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if KALEIDOSCOPE_TRACING
+bool TracingEnabled = false;
+#endif
+
+namespace
+{
+    struct Event
+    {
+        const char *Name;
+        int64_t Start;
+        int64_t End;
+        std::string Detail;
+    };
+
+    // ThreadBuffer - The events of one thread, in the order they ended. The
+    // buffers outlive their threads, so pool workers that have exited still
+    // show up in the trace.
+    struct ThreadBuffer
+    {
+        unsigned TID;
+        std::vector<Event> Events;
+    };
+
+    std::atomic<uint64_t> Counters[NumTraceCounters];
+    std::mutex BuffersMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> Buffers;
+    int64_t Epoch = 0; // traceNow() at enableTracing(); trace timestamps start there
+    thread_local ThreadBuffer *Local = nullptr;
+
+    const char *const CounterNames[NumTraceCounters] = {
+        "tokens lexed",
+        "number nodes",
+        "variable nodes",
+        "binary nodes",
+        "call nodes",
+        "if nodes",
+        "AST arena bytes",
+        "IR functions",
+        "IR instructions",
+        "modules materialized",
+        "functions materialized",
+    };
+
+    ThreadBuffer &localBuffer()
+    {
+        if (!Local)
+        {
+            std::lock_guard<std::mutex> Lock(BuffersMutex);
+            Buffers.push_back(std::make_unique<ThreadBuffer>());
+            Local = Buffers.back().get();
+            Local->TID = static_cast<unsigned>(Buffers.size());
+        }
+        return *Local;
+    }
+
+    // writeJSONString - S as a JSON string literal.
+    void writeJSONString(FILE *Out, std::string_view S)
+    {
+        fputc('"', Out);
+        for (char C : S)
+        {
+            unsigned char U = static_cast<unsigned char>(C);
+            if (C == '"' || C == '\\')
+            {
+                fputc('\\', Out);
+                fputc(C, Out);
+            }
+            else if (U < 0x20)
+            {
+                fprintf(Out, "\\u%04x", U);
+            }
+            else
+            {
+                fputc(C, Out);
+            }
+        }
+        fputc('"', Out);
+    }
+}
+
+void enableTracing()
+{
+#if KALEIDOSCOPE_TRACING
+    Epoch = traceNow();
+    TracingEnabled = true;
+    localBuffer(); // the calling thread is thread 1, "main"
+#endif
+}
+
+int64_t traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void traceCount(TraceCounter C, uint64_t N) { Counters[C].fetch_add(N, std::memory_order_relaxed); }
+
+void traceEvent(const char *Name, int64_t Start, int64_t End, std::string_view Detail)
+{
+    localBuffer().Events.push_back({Name, Start, End, std::string(Detail)});
+}
+
+void printTraceSummary(FILE *Out, const char *Slowest)
+{
+    fprintf(Out, "===-------------------------------------------------------------===\n");
+    fprintf(Out, "  Statistics\n");
+    fprintf(Out, "===-------------------------------------------------------------===\n");
+    for (unsigned C = 0; C < NumTraceCounters; ++C)
+    {
+        fprintf(Out, "  %-24s %14llu\n", CounterNames[C],
+                static_cast<unsigned long long>(Counters[C].load(std::memory_order_relaxed)));
+    }
+
+    struct Totals
+    {
+        uint64_t Count = 0;
+        int64_t Total = 0;
+        int64_t Max = 0;
+    };
+    std::map<std::string_view, Totals> ByName;
+    std::vector<const Event *> Slow;
+    for (const auto &B : Buffers)
+    {
+        for (const Event &E : B->Events)
+        {
+            Totals &T = ByName[E.Name];
+            ++T.Count;
+            T.Total += E.End - E.Start;
+            T.Max = std::max(T.Max, E.End - E.Start);
+            if (strcmp(E.Name, Slowest) == 0)
+            {
+                Slow.push_back(&E);
+            }
+        }
+    }
+    fprintf(Out, "\n  %-16s %10s %12s %12s\n", "Event", "Count", "Total (ms)", "Max (ms)");
+    for (const auto &[Name, T] : ByName)
+    {
+        fprintf(Out, "  %-16.*s %10llu %12.3f %12.3f\n", static_cast<int>(Name.size()), Name.data(),
+                static_cast<unsigned long long>(T.Count), T.Total * 1e-6, T.Max * 1e-6);
+    }
+
+    const size_t NumSlow = std::min<size_t>(Slow.size(), 10);
+    std::partial_sort(Slow.begin(), Slow.begin() + NumSlow, Slow.end(), [](const Event *A, const Event *B)
+                      { return A->End - A->Start > B->End - B->Start; });
+    if (NumSlow != 0)
+    {
+        fprintf(Out, "\n  Slowest %s events:\n", Slowest);
+    }
+    for (size_t I = 0; I < NumSlow; ++I)
+    {
+        fprintf(Out, "  %12.3f ms  %s\n", (Slow[I]->End - Slow[I]->Start) * 1e-6, Slow[I]->Detail.c_str());
+    }
+}
+
+bool writeChromeTrace(const std::string &Path)
+{
+    FILE *Out = fopen(Path.c_str(), "w");
+    if (!Out)
+    {
+        fprintf(stderr, "Error: cannot write '%s': %s\n", Path.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(Out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool First = true;
+    for (const auto &B : Buffers)
+    {
+        std::string Thread = B->TID == 1 ? "main" : "thread " + std::to_string(B->TID);
+        fprintf(Out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                First ? "" : ",\n", B->TID, Thread.c_str());
+        First = false;
+        for (const Event &E : B->Events)
+        {
+            // Timestamps and durations are in microseconds.
+            fprintf(Out, ",\n{\"name\":\"%s\",\"cat\":\"kaleidoscope\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                         "\"ts\":%.3f,\"dur\":%.3f",
+                    E.Name, B->TID, (E.Start - Epoch) * 1e-3, (E.End - E.Start) * 1e-3);
+            if (!E.Detail.empty())
+            {
+                fprintf(Out, ",\"args\":{\"detail\":");
+                writeJSONString(Out, E.Detail);
+                fputc('}', Out);
+            }
+            fputc('}', Out);
+        }
+    }
+    fprintf(Out, "\n],\"otherData\":{");
+    for (unsigned C = 0; C < NumTraceCounters; ++C)
+    {
+        fprintf(Out, "%s\"%s\":%llu", C ? "," : "", CounterNames[C],
+                static_cast<unsigned long long>(Counters[C].load(std::memory_order_relaxed)));
+    }
+    fprintf(Out, "}}\n");
+    if (fclose(Out) != 0)
+    {
+        fprintf(stderr, "Error: cannot write '%s': %s\n", Path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+#ifndef KALEIDOSCOPE_UTILS_TRACE_H
+#define KALEIDOSCOPE_UTILS_TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+// KALEIDOSCOPE_TRACING - 0 compiles the instrumentation out: isTracing() is
+// a constant false and every scope and counter below folds away. CMake sets
+// it from the option of the same name.
+#ifndef KALEIDOSCOPE_TRACING
+#define KALEIDOSCOPE_TRACING 1
+#endif
+
+//===-------------------------------------------------------------===//
+// Tracing
+//===-------------------------------------------------------------===//
+// Process-wide counters and a timeline of events, for -stats and -trace.
+// Both are off until enableTracing(); until then an instrumented phase pays
+// one load and branch on a global flag. Phases count in bulk (a module's
+// tokens once it is parsed, a function's instructions once it is lowered),
+// never per token or per node, and each thread appends its events to a
+// buffer of its own.
+
+// TraceCounter - What the phases count.
+enum TraceCounter
+{
+    TokensLexed,
+    NumberNodes,
+    VariableNodes,
+    BinaryNodes,
+    CallNodes,
+    IfNodes,
+    ArenaBytes,           // AST arena bytes, nodes and arrays
+    IRFunctions,          // functions lowered to IR
+    IRInstructions,       // ... and their instructions, after optimization
+    ModulesMaterialized,  // modules the JIT compiled to machine code
+    FunctionsMaterialized,
+    NumTraceCounters,
+};
+
+#if KALEIDOSCOPE_TRACING
+extern bool TracingEnabled;
+inline bool isTracing() { return TracingEnabled; }
+#else
+constexpr bool isTracing() { return false; }
+#endif
+
+// enableTracing - Start collecting. Call before any thread that is traced
+// starts; tracing can't be turned off again.
+void enableTracing();
+
+// traceNow - The clock events are measured in, in nanoseconds.
+int64_t traceNow();
+
+// traceCount - Add N to counter C. Only call it while tracing.
+void traceCount(TraceCounter C, uint64_t N);
+
+// traceEvent - Record a complete event Name (a string literal) over [Start,
+// End) on the calling thread, with Detail, e.g. a file or function name, as
+// its argument. Only call it while tracing.
+void traceEvent(const char *Name, int64_t Start, int64_t End, std::string_view Detail);
+
+// TraceScope - A traceEvent() from construction to destruction, if tracing.
+class TraceScope
+{
+private:
+    const char *Name;
+    int64_t Start = 0;
+    std::string Detail;
+
+public:
+    TraceScope(const char *Name, std::string_view Detail = {}) : Name(Name)
+    {
+        if (isTracing())
+        {
+            Start = traceNow();
+            this->Detail = Detail;
+        }
+    }
+    ~TraceScope()
+    {
+        if (isTracing())
+        {
+            traceEvent(Name, Start, traceNow(), Detail);
+        }
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+// printTraceSummary - -stats: the counters, then per event name the count,
+// total and longest duration, then the slowest events named Slowest.
+void printTraceSummary(FILE *Out, const char *Slowest = "materialize");
+
+// writeChromeTrace - -trace=Path: every event so far in Chrome's trace_event
+// JSON format, for chrome://tracing or Perfetto, with the counters under
+// "otherData". Reports its own error; false if Path can't be written.
+bool writeChromeTrace(const std::string &Path);
+
+#endif // KALEIDOSCOPE_UTILS_TRACE_H